@@ -0,0 +1,225 @@
+/** \file
+    \brief TimeSync: Lock-Free Synchronizer Event Queue
+    \copyright Copyright (c) 2017-2018 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of TimeSync nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <stdint.h>
+
+/**
+    Synchronizer Events
+
+    Rather than polling IsSynchronized(), GetMinimumOneWayDelayUsec() and
+    GetSignedRemoteTimeDeltaUsec() on every peer to notice changes, a
+    management thread can give each TimeSynchronizer the same event queue
+    with TimeSynchronizer::SetEventQueue().  The synchronizers push events
+    from their network threads as state changes, and the management thread
+    drains the queue, doing work proportional to the number of events
+    rather than the number of peers:
+
+        TimeSyncEventQueue events;
+        sync.SetEventQueue(&events, peerId);
+        ...
+        TimeSyncEvent event;
+        while (events.Pop(event)) {
+            ...
+        }
+
+    The queue is bounded, and events that do not fit are dropped and
+    counted.  When GetDroppedCount() changes, poll all peers once to catch up.
+*/
+
+
+//------------------------------------------------------------------------------
+// Constants
+
+/// Default number of events the queue holds
+static const unsigned kDefaultEventQueueCapacity = 1024;
+
+/// Default change in remote time delta since the last reported offset that
+/// is reported as kEventOffsetChanged
+static const uint32_t kEventOffsetChangeUsec = 100;
+
+/// Default change in remote time delta from one estimate to the next that
+/// is reported as kEventStep instead
+static const uint32_t kEventStepUsec = 1000; ///< 1 ms
+
+/// Default OWD above the minimum OWD that is reported as kEventOWDSpike
+static const uint32_t kEventOWDSpikeUsec = 20000; ///< 20 ms
+
+
+//------------------------------------------------------------------------------
+// TimeSyncEvent
+
+enum TimeSyncEventType
+{
+    /// Offset became valid.  Value: Remote time delta in nsec
+    kEventSynchronized,
+
+    /// Synchronizer was reset and the offset is no longer valid.  Value: 0
+    kEventSyncLost,
+
+    /// Remote time delta drifted since it was last reported.
+    /// Value: Change in nsec since the last reported delta
+    kEventOffsetChanged,
+
+    /// Remote time delta jumped between consecutive estimates, for example
+    /// after the peer's clock was stepped.  Value: Jump in nsec
+    kEventStep,
+
+    /// A datagram's OWD exceeded the minimum by the spike threshold.
+    /// Reported once until the OWD falls back under half the threshold.
+    /// Value: OWD in usec
+    kEventOWDSpike,
+
+    /// Route change reset the minimum delta window, as reported to the
+    /// RouteChangeCallback.  Value: Increase in base delay in usec
+    kEventWindowReset
+};
+
+struct TimeSyncEvent
+{
+    /// Peer id given to SetEventQueue()
+    uint32_t PeerId;
+
+    /// Event type
+    TimeSyncEventType Type;
+
+    /// Local time of the latest datagram from the peer, in usec
+    uint64_t LocalUsec;
+
+    /// Meaning depends on Type
+    int64_t Value;
+};
+
+/// Event thresholds for TimeSynchronizer::SetEventQueue()
+struct TimeSyncEventParams
+{
+    uint32_t OffsetChangeUsec = kEventOffsetChangeUsec;
+    uint32_t StepUsec = kEventStepUsec;
+    uint32_t OWDSpikeUsec = kEventOWDSpikeUsec;
+};
+
+
+//------------------------------------------------------------------------------
+// TimeSyncEventQueue
+
+/**
+    Bounded multiple-producer single-consumer queue of TimeSyncEvents.
+
+    This is Dmitry Vyukov's bounded queue: Each cell carries a sequence
+    number that tells producers when it is free and the consumer when it is
+    full, so producers only contend on one compare-and-swap of the enqueue
+    position and never wait for each other.  Push() is lock-free and may be
+    called from any thread.  Pop() must only be called from one thread.
+*/
+class TimeSyncEventQueue
+{
+public:
+    /// The capacity is rounded up to a power of two
+    explicit TimeSyncEventQueue(unsigned capacity = kDefaultEventQueueCapacity);
+
+    /// Push an event.  Returns false if the queue is full.
+    /// Inline so that TimeSync.cpp links without EventQueue.cpp
+    inline bool Push(const TimeSyncEvent& event);
+
+    /// Pop the oldest event.  Returns false if the queue is empty
+    bool Pop(TimeSyncEvent& event);
+
+    /// Pop up to maxCount events.  Returns the number popped
+    unsigned PopBatch(TimeSyncEvent* events, unsigned maxCount);
+
+    /// Number of events dropped because the queue was full
+    inline uint64_t GetDroppedCount() const
+    {
+        return DroppedCount.load(std::memory_order_relaxed);
+    }
+
+    /// Number of events the queue holds
+    inline unsigned GetCapacity() const
+    {
+        return (unsigned)Mask + 1;
+    }
+
+protected:
+    struct Cell
+    {
+        std::atomic<uint64_t> Sequence;
+        TimeSyncEvent Event;
+    };
+
+    std::unique_ptr<Cell[]> Cells;
+    uint64_t Mask = 0;
+
+    /// Producers and the consumer write these, so keep them on separate
+    /// cache lines
+    uint8_t Padding0[64];
+    std::atomic<uint64_t> EnqueuePosition = ATOMIC_VAR_INIT(0);
+    uint8_t Padding1[64];
+    uint64_t DequeuePosition = 0;
+    uint8_t Padding2[64];
+
+    std::atomic<uint64_t> DroppedCount = ATOMIC_VAR_INIT(0);
+};
+
+inline bool TimeSyncEventQueue::Push(const TimeSyncEvent& event)
+{
+    uint64_t position = EnqueuePosition.load(std::memory_order_relaxed);
+    Cell* cell;
+
+    for (;;)
+    {
+        cell = &Cells[(size_t)(position & Mask)];
+        const uint64_t sequence = cell->Sequence.load(std::memory_order_acquire);
+        const int64_t diff = (int64_t)(sequence - position);
+
+        if (diff == 0)
+        {
+            // Cell is free: Claim the position
+            if (EnqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            // Cell still holds the event from one lap ago: Queue is full
+            DroppedCount.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        else {
+            // Another producer claimed this position
+            position = EnqueuePosition.load(std::memory_order_relaxed);
+        }
+    }
+
+    cell->Event = event;
+    cell->Sequence.store(position + 1, std::memory_order_release);
+    return true;
+}
@@ -0,0 +1,221 @@
+/** \file
+    \brief TimeSync: Delta-Encoded MinDelta Updates
+    \copyright Copyright (c) 2017-2018 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of TimeSync nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "TimeSync.h"
+
+/**
+    Delta-Encoded MinDelta Updates
+
+    After convergence GetMinDeltaTS24() moves by a few units at a time, so
+    most updates can be sent as a 1 byte signed delta from a base value the
+    peer has acknowledged, instead of the full 3 bytes:
+
+        Delta (1 byte):     0 b b d d d d d
+                            bb = base id, ddddd = signed delta (-16..15)
+
+        Full (4 bytes):     1 0 0 0 0 0 b b  + 3 byte value (little-endian)
+                            Sets base bb to the value
+
+        Absolute (4 bytes): 1 0 1 0 0 0 0 0  + 3 byte value (little-endian)
+                            Value without setting a base
+
+        Ack (1 byte):       1 1 0 0 0 0 b b
+                            Receiver to sender: Base bb was received
+
+    Every delta is relative to an acknowledged base rather than to the
+    previous update, so updates can be lost, duplicated or reordered without
+    corrupting later ones.  The sender starts a new base with a full update
+    when the value drifts out of delta range, and periodically so a peer
+    that lost its state recovers.  A base id always carries the same value
+    while it is in use and is only reused for another value after
+    kMinDeltaIdReuseUsec, so a late full update cannot overwrite a newer
+    base; when no id is free the value is sent as an absolute update.
+    Reordering by more than kMinDeltaIdReuseUsec is assumed not to happen.
+
+    Sender:
+
+        bytes = encoder.Encode(sync.GetMinDeltaTS24(), localUsec, message);
+        ...
+        encoder.OnAck(ackByte);
+
+    Receiver:
+
+        decoder.Decode(sync, message, bytes);   // Calls OnPeerMinDeltaTS24()
+        if (decoder.HasAck()) {
+            ackByte = decoder.WriteAck();
+        }
+*/
+
+
+//------------------------------------------------------------------------------
+// Constants
+
+/// Largest encoded update in bytes
+static const unsigned kMinDeltaUpdateMaxBytes = 4;
+
+/// Size of a delta update and of an ack in bytes
+static const unsigned kMinDeltaDeltaBytes = 1;
+static const unsigned kMinDeltaAckBytes = 1;
+
+/// Size of a full update in bytes
+static const unsigned kMinDeltaFullBytes = 4;
+
+/// Default interval between full refreshes
+static const uint32_t kMinDeltaFullRefreshUsec = 30 * 1000 * 1000;
+
+/// Default time before a base id may be reused for a different value
+static const uint32_t kMinDeltaIdReuseUsec = 4 * 1000 * 1000;
+
+
+//------------------------------------------------------------------------------
+// MinDeltaEncoder
+
+/// Sender side: Encode MinDeltaTS24 updates
+class MinDeltaEncoder
+{
+public:
+    /// Set the interval between full refreshes
+    inline void SetFullRefreshUsec(uint32_t refreshUsec)
+    {
+        FullRefreshUsec = refreshUsec;
+    }
+
+    /// Set the time before a base id may be reused for a different value.
+    /// This should exceed the longest reordering delay of the transport
+    inline void SetIdReuseUsec(uint32_t reuseUsec)
+    {
+        IdReuseUsec = reuseUsec;
+    }
+
+    /**
+        Encode()
+
+        Encode an update for the given value.
+
+        data: Buffer of at least kMinDeltaUpdateMaxBytes.
+
+        Returns the number of bytes written: kMinDeltaDeltaBytes or
+        kMinDeltaFullBytes (for full and absolute updates).
+    */
+    unsigned Encode(Counter24 minDeltaTS24, uint64_t localUsec, uint8_t* data);
+
+    /// Handle an ack from the peer.
+    /// Returns false if the byte is not an ack for a pending base
+    bool OnAck(uint8_t ack);
+
+    /// Number of full (including absolute) and delta updates written
+    inline uint64_t GetFullCount() const
+    {
+        return FullCount;
+    }
+    inline uint64_t GetDeltaCount() const
+    {
+        return DeltaCount;
+    }
+
+protected:
+    static const unsigned kIdCount = 4;
+
+    uint32_t FullRefreshUsec = kMinDeltaFullRefreshUsec;
+    uint32_t IdReuseUsec = kMinDeltaIdReuseUsec;
+
+    /// When each base id was last sent in a full update
+    bool IdUsed[kIdCount] = { false, false, false, false };
+    uint64_t IdSentUsec[kIdCount] = { 0, 0, 0, 0 };
+
+    /// Base acknowledged by the peer
+    bool AckedValid = false;
+    uint8_t AckedId = 0;
+    Counter24 AckedValue = 0;
+    uint64_t AckedSentUsec = 0;
+
+    /// Base sent in a full update but not acknowledged yet
+    bool PendingValid = false;
+    uint8_t PendingId = 0;
+    Counter24 PendingValue = 0;
+    uint64_t PendingSentUsec = 0;
+
+    /// Next base id to try
+    uint8_t NextId = 0;
+
+    /// Write a full update for the pending base
+    unsigned WritePendingFull(uint64_t localUsec, uint8_t* data);
+
+    uint64_t FullCount = 0;
+    uint64_t DeltaCount = 0;
+};
+
+
+//------------------------------------------------------------------------------
+// MinDeltaDecoder
+
+/// Receiver side: Decode updates and feed them to the synchronizer
+class MinDeltaDecoder
+{
+public:
+    /**
+        Decode()
+
+        Decode one update and pass its value to sync.OnPeerMinDeltaTS24().
+
+        Returns the number of bytes consumed, or 0 if the update is
+        truncated, malformed, or refers to a base that was never received.
+    */
+    unsigned Decode(TimeSynchronizer& sync, const uint8_t* data, unsigned bytes);
+
+    /// Is an ack waiting to be sent?
+    inline bool HasAck() const
+    {
+        return AckPending;
+    }
+
+    /// Get the ack byte to send to the peer
+    uint8_t WriteAck();
+
+    /// Number of updates passed to the synchronizer
+    inline uint64_t GetUpdateCount() const
+    {
+        return UpdateCount;
+    }
+
+protected:
+    static const unsigned kBaseCount = 4;
+
+    /// Received base values by id
+    Counter24 Bases[kBaseCount];
+    bool BaseValid[kBaseCount] = { false, false, false, false };
+
+    /// Ack to send
+    bool AckPending = false;
+    uint8_t AckId = 0;
+
+    uint64_t UpdateCount = 0;
+};
@@ -0,0 +1,206 @@
+/** \file
+    \brief TimeSync: MinDelta Piggybacking
+    \copyright Copyright (c) 2017-2018 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of TimeSync nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "TimeSync.h"
+
+/**
+    MinDelta Piggybacking
+
+    Each peer has to deliver its GetMinDeltaTS24() value to the other side
+    every few seconds.  Sending it as a separate message costs a radio
+    wakeup on mobile uplinks whenever no data happened to be in flight.
+
+    MinDeltaPiggybacker decides for each outgoing data packet whether to
+    attach the 3 byte value:  It attaches when the value changed since it
+    was last sent or a periodic refresh is due, as long as attachments stay
+    within a byte budget.  Only when no data packet carried a pending value
+    within the staleness deadline does it ask for a standalone message.
+
+    Sender:
+
+        // For each outgoing data packet with spare room:
+        packetBytes += piggybacker.OnDataPacket(localUsec, packet + packetBytes, spare);
+
+        // From a timer set to GetStandaloneDeadlineUsec():
+        if (piggybacker.NeedsStandaloneUpdate(localUsec)) {
+            piggybacker.WriteStandaloneUpdate(localUsec, message);
+            ...send message...
+        }
+
+    Receiver:
+
+        parser.OnAttachment(sync, attachment, attachmentBytes);
+
+    The value is an absolute minimum, so it is fine if attachments are lost
+    or reordered: The periodic refresh repairs losses.
+*/
+
+
+//------------------------------------------------------------------------------
+// Constants
+
+/// Size of a MinDeltaTS24 attachment in bytes
+static const unsigned kMinDeltaAttachmentBytes = 3;
+
+
+//------------------------------------------------------------------------------
+// PiggybackParams
+
+struct PiggybackParams
+{
+    /// Bytes per second that attachments may add to data packets
+    uint32_t BudgetBytesPerSecond = 30;
+
+    /// Attachments that may be sent back to back after an idle period
+    uint32_t BurstAttachments = 4;
+
+    /// A pending value is sent standalone after waiting this long for a
+    /// data packet to carry it
+    uint32_t StalenessDeadlineUsec = 1500000;
+
+    /// Interval for resending an unchanged value
+    uint32_t RefreshIntervalUsec = 2000000;
+
+    /// Faster refresh interval for the first StartupDurationUsec, so that
+    /// the peer synchronizes quickly
+    uint32_t StartupRefreshIntervalUsec = 500000;
+    uint32_t StartupDurationUsec = 20000000;
+};
+
+
+//------------------------------------------------------------------------------
+// MinDeltaPiggybacker
+
+/// Sender side: Attach MinDeltaTS24 to outgoing data packets
+class MinDeltaPiggybacker
+{
+public:
+    explicit MinDeltaPiggybacker(
+        const TimeSynchronizer& sync,
+        const PiggybackParams& params = PiggybackParams());
+
+    /**
+        OnDataPacket()
+
+        Call this for each outgoing data packet.
+
+        attachment: Spare room at the end of the packet.
+        availableBytes: Bytes available at attachment.
+
+        Returns the number of bytes written: kMinDeltaAttachmentBytes if the
+        value was attached, or 0.
+    */
+    unsigned OnDataPacket(uint64_t localUsec, uint8_t* attachment, unsigned availableBytes);
+
+    /// Returns true if a pending value has waited past the staleness
+    /// deadline, so it should be sent in a standalone message
+    bool NeedsStandaloneUpdate(uint64_t localUsec);
+
+    /// Write kMinDeltaAttachmentBytes for a standalone message.
+    /// Returns the number of bytes written
+    unsigned WriteStandaloneUpdate(uint64_t localUsec, uint8_t* data);
+
+    /// Get the local time at which NeedsStandaloneUpdate() will return true
+    /// if no data packet carries the value first, for scheduling a timer.
+    /// Returns 0 if there is nothing to send yet
+    uint64_t GetStandaloneDeadlineUsec(uint64_t localUsec);
+
+    /// Number of attachments written
+    inline uint64_t GetAttachmentCount() const
+    {
+        return AttachmentCount;
+    }
+
+    /// Number of standalone messages written
+    inline uint64_t GetStandaloneCount() const
+    {
+        return StandaloneCount;
+    }
+
+protected:
+    const TimeSynchronizer& Sync;
+    const PiggybackParams Params;
+
+    /// Has a value been sent yet?
+    bool SentAny = false;
+
+    /// Last value sent and when
+    Counter24 LastSentTS24 = 0;
+    uint64_t LastSentUsec = 0;
+
+    /// Local time of the first value sent, for the startup refresh rate
+    uint64_t FirstSentUsec = 0;
+
+    /// Is a value due to be sent, and since when?
+    bool Due = false;
+    uint64_t DueUsec = 0;
+
+    /// Attachment byte budget: Token bucket in millionths of a byte
+    uint64_t BudgetMicroBytes = 0;
+    uint64_t BudgetUpdateUsec = 0;
+
+    uint64_t AttachmentCount = 0;
+    uint64_t StandaloneCount = 0;
+
+    /// Update DueUsec.  Returns true if a value is due
+    bool UpdateDue(uint64_t localUsec);
+
+    /// Record that the current value was sent
+    void OnSent(uint64_t localUsec, uint8_t* data);
+};
+
+
+//------------------------------------------------------------------------------
+// MinDeltaPiggybackParser
+
+/// Receiver side: Feed attachments to the synchronizer
+class MinDeltaPiggybackParser
+{
+public:
+    /**
+        OnAttachment()
+
+        Call with an attachment from a data packet, or the body of a
+        standalone message.
+
+        Returns false if the attachment is truncated.
+    */
+    bool OnAttachment(TimeSynchronizer& sync, const uint8_t* data, unsigned bytes);
+
+    /// Number of values delivered to the synchronizer
+    inline uint64_t GetUpdateCount() const
+    {
+        return UpdateCount;
+    }
+
+protected:
+    uint64_t UpdateCount = 0;
+};
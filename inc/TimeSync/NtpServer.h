@@ -0,0 +1,274 @@
+/** \file
+    \brief TimeSync: NTPv4 Responder
+    \copyright Copyright (c) 2017-2018 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of TimeSync nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "TimeSync.h"
+
+/**
+    NTPv4 Responder
+
+    Serves the synchronized cluster time to legacy hosts over NTP (RFC 5905).
+    An edge node keeps a TimeSynchronizer with a core node, and answers NTP
+    client requests with the core's time:
+
+        Cluster Time = Local CLOCK_REALTIME + Remote Time Delta
+
+    The receive timestamp comes from the kernel (SO_TIMESTAMPNS), and the
+    remote time delta from TimeSynchronizer::GetSignedRemoteTimeDeltaNsec().
+    So the TimeSynchronizer must be fed local times from CLOCK_REALTIME, and
+    the cluster time must be within about 33 seconds of the local clock.
+
+    Requests are processed in batches with recvmmsg() and sendmmsg().
+    Building a response only touches the request and a few atomics (about
+    20 nsec), so the cost is dominated by the kernel: One socket served
+    about 250k requests per second over loopback in `benchmarks`, with the
+    client on the same core.  To scale past one core, open one NtpServer
+    per core on the same port with reusePort set, and poll each from its
+    own thread.
+
+    Until the synchronizer is synchronized, responses are sent with the
+    leap indicator set to 3 (unsynchronized) and stratum 16, so that clients
+    will not use them.
+*/
+
+
+//------------------------------------------------------------------------------
+// Constants
+
+/// Size of an NTP packet without extensions
+static const unsigned kNtpPacketBytes = 48;
+
+/// Default NTP server port
+static const uint16_t kNtpPort = 123;
+
+/// Seconds between the NTP epoch (1900) and the Unix epoch (1970)
+static const uint64_t kNtpUnixEpochDeltaSec = 2208988800ULL;
+
+
+//------------------------------------------------------------------------------
+// NTP Timestamps
+
+/// Convert Unix time in nanoseconds to a 64-bit NTP timestamp
+inline uint64_t UnixNsecToNtpTimestamp(uint64_t unixNsec)
+{
+    const uint64_t sec = unixNsec / 1000000000 + kNtpUnixEpochDeltaSec;
+    const uint64_t frac = ((unixNsec % 1000000000) << 32) / 1000000000;
+    return (sec << 32) | frac;
+}
+
+/// Convert a 64-bit NTP timestamp to Unix time in nanoseconds.
+/// Assumes the timestamp is in NTP era 0 (before 2036)
+inline uint64_t NtpTimestampToUnixNsec(uint64_t ntpTimestamp)
+{
+    const uint64_t sec = (ntpTimestamp >> 32) - kNtpUnixEpochDeltaSec;
+    const uint64_t nsec = ((ntpTimestamp & 0xffffffff) * 1000000000) >> 32;
+    return sec * 1000000000 + nsec;
+}
+
+/// Read a big-endian 64-bit NTP timestamp
+inline uint64_t ReadNtpTimestamp(const uint8_t* data)
+{
+    uint64_t x = 0;
+    for (unsigned i = 0; i < 8; ++i) {
+        x = (x << 8) | data[i];
+    }
+    return x;
+}
+
+/// Write a big-endian 64-bit NTP timestamp
+inline void WriteNtpTimestamp(uint8_t* data, uint64_t x)
+{
+    for (int i = 7; i >= 0; --i, x >>= 8) {
+        data[i] = (uint8_t)x;
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// NtpServerParams
+
+struct NtpServerParams
+{
+    /// Stratum to report when synchronized
+    uint8_t Stratum = 2;
+
+    /// Reported clock precision as a power of two in seconds (-20 ~ 1 usec)
+    int8_t Precision = -20;
+
+    /// Reference identifier, e.g. the IPv4 address of the core node
+    uint32_t ReferenceId = 0;
+};
+
+
+//------------------------------------------------------------------------------
+// NtpResponder
+
+class NtpResponder
+{
+public:
+    explicit NtpResponder(
+        const TimeSynchronizer& sync,
+        const NtpServerParams& params = NtpServerParams())
+        : Sync(sync)
+        , Params(params)
+    {
+    }
+
+    /**
+        BuildResponse()
+
+        Build a server response for a client request.
+
+        request: The received datagram.
+        requestBytes: Size of the received datagram.
+        recvUnixNsec: Kernel receive time (CLOCK_REALTIME) in nanoseconds.
+        sendUnixNsec: CLOCK_REALTIME time just before sending in nanoseconds.
+        response: Output buffer of kNtpPacketBytes bytes.
+
+        Returns false if the datagram is not a valid NTP client request.
+    */
+    bool BuildResponse(
+        const uint8_t* request,
+        unsigned requestBytes,
+        uint64_t recvUnixNsec,
+        uint64_t sendUnixNsec,
+        uint8_t* response) const;
+
+protected:
+    const TimeSynchronizer& Sync;
+    NtpServerParams Params;
+};
+
+
+//------------------------------------------------------------------------------
+// NtpServer
+
+#ifdef __linux__
+
+/// UDP NTP server socket using recvmmsg/sendmmsg batches
+class NtpServer
+{
+public:
+    /// Maximum number of requests processed per batch
+    static const unsigned kBatchSize = 64;
+
+    explicit NtpServer(
+        const TimeSynchronizer& sync,
+        const NtpServerParams& params = NtpServerParams())
+        : Responder(sync, params)
+    {
+    }
+    ~NtpServer()
+    {
+        Close();
+    }
+
+    /**
+        Open()
+
+        Bind a UDP socket to the given IPv4 address and port in host byte
+        order.  Use port 0 to pick an ephemeral port (see GetPort()).
+
+        reusePort: Set SO_REUSEPORT, so that several servers can bind the
+        same port and the kernel spreads clients across them.
+
+        Returns false on failure.
+    */
+    bool Open(uint16_t port = kNtpPort, uint32_t bindAddress = 0, bool reusePort = false);
+
+    /**
+        OpenIPv6()
+
+        Bind a UDP socket to the given IPv6 address and port in host byte
+        order.  The address is 16 bytes in network byte order, or nullptr
+        for any address.  Unless v6Only is set, IPv4 clients are served on
+        the same socket through IPv4-mapped addresses.
+
+        reusePort: See Open().
+
+        Returns false on failure.
+    */
+    bool OpenIPv6(
+        uint16_t port = kNtpPort,
+        const uint8_t* bindAddress = nullptr,
+        bool v6Only = false,
+        bool reusePort = false);
+
+    /// Close the socket
+    void Close();
+
+    /// Get the bound port in host byte order
+    inline uint16_t GetPort() const
+    {
+        return Port;
+    }
+
+    /**
+        Poll()
+
+        Wait up to timeoutMsec for requests, then receive and answer up to
+        kBatchSize of them.  Replies that fail to send are skipped and
+        counted by GetDroppedCount(), without holding up the rest.
+
+        Returns the number of responses sent, or -1 on receive error.
+    */
+    int Poll(int timeoutMsec);
+
+    /// Number of responses sent so far
+    inline uint64_t GetResponseCount() const
+    {
+        return ResponseCount;
+    }
+
+    /// Number of invalid datagrams ignored so far
+    inline uint64_t GetInvalidCount() const
+    {
+        return InvalidCount;
+    }
+
+    /// Number of replies that failed to send so far
+    inline uint64_t GetDroppedCount() const
+    {
+        return DroppedCount;
+    }
+
+protected:
+    NtpResponder Responder;
+    int Socket = -1;
+    uint16_t Port = 0;
+    uint64_t ResponseCount = 0;
+    uint64_t InvalidCount = 0;
+    uint64_t DroppedCount = 0;
+
+    /// Create, configure and bind the socket for Open() and OpenIPv6()
+    bool OpenSocket(int family, const void* addr, unsigned addrBytes, bool v6Only, bool reusePort);
+};
+
+#endif // __linux__
@@ -0,0 +1,177 @@
+/** \file
+    \brief TimeSync: One-Way Delay Feedback to the Sender
+    \copyright Copyright (c) 2017-2018 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of TimeSync nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "TimeSync.h"
+
+/**
+    OWD Feedback
+
+    OnAuthenticatedDatagramTimestamp() gives the one-way delay (OWD) of each
+    datagram only to the receiver, but the sender's congestion controller
+    needs it to react to queuing on the forward path.
+
+    The receiver feeds the OWD of each datagram into an OWDFeedbackCollector
+    and periodically sends a compact 10 byte summary to the sender:
+
+        Offset  Field
+        ------  -----
+        0       Sequence number (Counter8)
+        1       Sample count since the last summary (saturating)
+        2-3     Minimum OWD in TS24 units (8 usec, saturating)
+        4-5     Maximum OWD - Minimum OWD in TS24 units (saturating)
+        6-7     Queuing delay of the last datagram in TS24 units (saturating)
+        8-9     OWD trend in TS24 units per summary (signed, saturating)
+
+    The sender decodes it with OWDFeedbackDecoder, which expands the
+    sequence number with Counter64 so that reordered or duplicated summaries
+    are ignored.
+
+    The delay fields saturate instead of wrapping like Counter16: They are
+    magnitudes with no nearby reference value on the sender to expand them
+    against, and a wrapped delay would read as a small one, which is the
+    wrong signal for congestion control.  A saturated field means "at
+    least 524 ms".  This provides a forward-path delay signal without
+    acknowledging every datagram.
+*/
+
+
+//------------------------------------------------------------------------------
+// Constants
+
+/// Size of an encoded OWD feedback message in bytes
+static const unsigned kOWDFeedbackBytes = 10;
+
+
+//------------------------------------------------------------------------------
+// OWDFeedback
+
+/// Decoded OWD feedback summary
+struct OWDFeedback
+{
+    /// Expanded sequence number, counting from the 8-bit sequence number
+    /// of the first summary received
+    uint64_t Sequence = 0;
+
+    /// Number of datagrams summarized (saturates at 255)
+    unsigned SampleCount = 0;
+
+    /// Smallest OWD in the summary interval
+    uint32_t MinOWDUsec = 0;
+
+    /// Largest OWD in the summary interval
+    uint32_t MaxOWDUsec = 0;
+
+    /// Queuing delay of the most recent datagram: OWD - minimum OWD
+    uint32_t QueuingDelayUsec = 0;
+
+    /// Change in the average OWD since the previous summary
+    int32_t TrendUsec = 0;
+};
+
+
+//------------------------------------------------------------------------------
+// OWDFeedbackCollector
+
+/// Receiver side: Summarize OWD of recently received datagrams
+class OWDFeedbackCollector
+{
+public:
+    /**
+        OnDatagramOWD()
+
+        Call this with the result of OnAuthenticatedDatagramTimestamp().
+
+        owdUsec: OWD of the datagram in microseconds.  Ignored if 0.
+        minimumOWDUsec: TimeSynchronizer::GetMinimumOneWayDelayUsec().
+    */
+    void OnDatagramOWD(unsigned owdUsec, uint32_t minimumOWDUsec);
+
+    /// Are there any samples to report?
+    inline bool HasSamples() const
+    {
+        return SampleCount > 0;
+    }
+
+    /**
+        Encode()
+
+        Write a kOWDFeedbackBytes summary of the samples since the last
+        call, and start a new interval.
+    */
+    void Encode(uint8_t* data);
+
+protected:
+    /// Next sequence number to send
+    Counter8 NextSequence = 0;
+
+    /// Samples in the current interval
+    unsigned SampleCount = 0;
+
+    /// Min/max OWD in the current interval
+    uint32_t MinOWDUsec = 0;
+    uint32_t MaxOWDUsec = 0;
+
+    /// Sum of OWD in the current interval for the average
+    uint64_t SumOWDUsec = 0;
+
+    /// Queuing delay of the last datagram
+    uint32_t LastQueuingDelayUsec = 0;
+
+    /// Average OWD of the previous interval
+    uint32_t LastAverageOWDUsec = 0;
+
+    /// Is LastAverageOWDUsec valid?
+    bool HasLastAverage = false;
+};
+
+
+//------------------------------------------------------------------------------
+// OWDFeedbackDecoder
+
+/// Sender side: Decode summaries from the receiver
+class OWDFeedbackDecoder
+{
+public:
+    /**
+        Decode()
+
+        Returns false if the message is older than, or a duplicate of, the
+        latest summary.  Returns true if feedback was filled in.
+    */
+    bool Decode(const uint8_t* data, OWDFeedback& feedback);
+
+protected:
+    /// Largest sequence number seen so far
+    uint64_t LargestSequence = 0;
+
+    /// Has a summary been decoded yet?
+    bool GotFeedback = false;
+};
@@ -0,0 +1,143 @@
+/** \file
+    \brief TimeSync: Offset Timeline for Cross-Host Log Merging
+    \copyright Copyright (c) 2017-2018 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of TimeSync nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+    Offset Timeline
+
+    Distributed logs from many hosts cannot be ordered when each host stamps
+    its lines with its own clock.  Each host can periodically record its
+    offset to a common reference clock, for example the server it is
+    synchronized to:
+
+        offsetUsec = TimeSynchronizer::GetSignedRemoteTimeDeltaUsec()
+
+    The OffsetTimeline for a host holds these records and maps local times
+    to the reference timeline, linearly interpolating the offset between
+    records so that clock drift between records is smoothed out.
+
+    The synchronizer only knows the offset modulo 2^26 microseconds, so the
+    host clocks must be within about 33 seconds of the reference, e.g. by
+    keeping them roughly set with NTP.  If an offset drifts across the
+    edge of that range, its sign flips, so a record whose offset is more
+    than half the range from its neighbors is rejected rather than
+    interpolated across.
+
+    The TimeSync log format understood by tools/LogMerge.cpp is one record
+    per line, with local times in decimal microseconds:
+
+        <localUsec> <message>
+        #TIMESYNC <localUsec> <offsetUsec>
+*/
+
+
+//------------------------------------------------------------------------------
+// Constants
+
+/// Prefix for offset records in TimeSync log files
+#define TIMESYNC_OFFSET_RECORD_PREFIX "#TIMESYNC "
+
+/// Largest offset change between neighboring records, which is half of the
+/// 2^26 microsecond range of TimeSynchronizer::GetSignedRemoteTimeDeltaUsec()
+static const int64_t kOffsetRecordMaxStepUsec = (int64_t)1 << 25;
+
+
+//------------------------------------------------------------------------------
+// OffsetTimeline
+
+class OffsetTimeline
+{
+public:
+    /// Add an offset record.  Records should be added in local time order,
+    /// but out-of-order records are also accepted.
+    /// Returns false if the offset differs from a neighboring record by more
+    /// than kOffsetRecordMaxStepUsec, which means it wrapped around
+    bool AddRecord(uint64_t localUsec, int64_t offsetUsec);
+
+    /// Number of records
+    inline size_t GetRecordCount() const
+    {
+        return Records.size();
+    }
+
+    /// Offset at the given local time, interpolated between records and
+    /// held constant before the first and after the last record.
+    /// Returns 0 if there are no records
+    int64_t GetOffsetUsec(uint64_t localUsec) const;
+
+    /// Map a local time to the reference timeline
+    inline uint64_t ToReferenceUsec(uint64_t localUsec) const
+    {
+        return localUsec + GetOffsetUsec(localUsec);
+    }
+
+    /**
+        ParseOffsetRecord()
+
+        Parse a "#TIMESYNC <localUsec> <offsetUsec>" line from a log.
+        The line does not need to be null-terminated.
+
+        Returns true if the line is an offset record.
+        Returns false if either number does not fit its type.
+    */
+    static bool ParseOffsetRecord(
+        const char* line,
+        size_t length,
+        uint64_t& localUsec,
+        int64_t& offsetUsec);
+
+    /**
+        FormatOffsetRecord()
+
+        Format an offset record line including the trailing newline.
+
+        Returns the number of characters written, excluding the null
+        terminator, or 0 if the buffer is too small.
+    */
+    static size_t FormatOffsetRecord(
+        char* buffer,
+        size_t bufferBytes,
+        uint64_t localUsec,
+        int64_t offsetUsec);
+
+protected:
+    struct Record
+    {
+        uint64_t LocalUsec;
+        int64_t OffsetUsec;
+    };
+
+    /// Records sorted by local time
+    std::vector<Record> Records;
+};
@@ -0,0 +1,138 @@
+/** \file
+    \brief TimeSync: Peer Table with Idle Hibernation
+    \copyright Copyright (c) 2017-2018 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of TimeSync nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "TimeSync.h"
+
+#include <memory>
+#include <unordered_map>
+
+/**
+    Peer Table
+
+    Servers with many sessions keep one TimeSynchronizer per peer, but most
+    of the peers are idle at any given moment.  This table keeps active peers
+    as full TimeSynchronizer objects, and moves idle peers to a cold tier of
+    16 byte HibernatedTimeSync summaries.  A hibernated peer is rehydrated
+    on its next datagram, so resident memory scales with the active peers
+    rather than the total number of peers.
+
+    The summaries do not keep per-peer configuration such as the drift
+    window, route change callback or event queue.  Set a create callback
+    with SetCreateCallback() to configure each synchronizer, which runs for
+    new peers and again each time a hibernated peer is rehydrated.
+
+    This class is not thread-safe.
+*/
+
+
+//------------------------------------------------------------------------------
+// TimeSyncPeerTable
+
+class TimeSyncPeerTable
+{
+public:
+    /// Create and configure the synchronizer for a peer.  This can also
+    /// return a class derived from TimeSynchronizer
+    typedef TimeSynchronizer* (*CreateCallback)(void* context, uint64_t peerId);
+
+    /// Set the callback that creates synchronizers, or nullptr to create
+    /// default TimeSynchronizer objects
+    void SetCreateCallback(CreateCallback callback, void* context);
+
+    /**
+        OnDatagram()
+
+        Call this when a datagram arrives from a peer, before passing its
+        timestamp to the returned synchronizer.  Hibernated peers are
+        rehydrated, and unknown peers get a new synchronizer.
+
+        peerId: Application-defined identifier for the peer.
+        localUsec: A recent timestamp in microsecond units.
+
+        Returns the active synchronizer for the peer.
+    */
+    TimeSynchronizer* OnDatagram(uint64_t peerId, uint64_t localUsec);
+
+    /// Returns the active synchronizer for the peer, or nullptr if it is
+    /// hibernated or unknown
+    TimeSynchronizer* FindActive(uint64_t peerId) const;
+
+    /// Returns the summary for a hibernated peer, or nullptr if it is
+    /// active or unknown
+    const HibernatedTimeSync* FindHibernated(uint64_t peerId) const;
+
+    /**
+        HibernateIdle()
+
+        Move peers that have not received a datagram in the past idleUsec
+        microseconds to the cold tier.
+
+        localUsec: A recent timestamp in microsecond units.
+
+        Returns the number of peers that were hibernated.
+    */
+    unsigned HibernateIdle(uint64_t localUsec, uint64_t idleUsec);
+
+    /// Forget about a peer
+    void Remove(uint64_t peerId);
+
+    /// Number of peers with a full TimeSynchronizer
+    inline size_t GetActiveCount() const
+    {
+        return Active.size();
+    }
+
+    /// Number of peers in the cold tier
+    inline size_t GetHibernatedCount() const
+    {
+        return Hibernated.size();
+    }
+
+protected:
+    struct ActivePeer
+    {
+        /// Synchronizer for this peer
+        std::unique_ptr<TimeSynchronizer> Sync;
+
+        /// Local time of the last datagram received from the peer
+        uint64_t LastActivityUsec = 0;
+    };
+
+    /// Active peers
+    std::unordered_map<uint64_t, ActivePeer> Active;
+
+    /// Hibernated peers
+    std::unordered_map<uint64_t, HibernatedTimeSync> Hibernated;
+
+    /// Callback that creates synchronizers
+    CreateCallback OnCreate = nullptr;
+    void* CreateContext = nullptr;
+};
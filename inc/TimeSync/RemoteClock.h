@@ -0,0 +1,237 @@
+/** \file
+    \brief TimeSync: Slewed Remote Clock
+    \copyright Copyright (c) 2017-2018 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of TimeSync nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "TimeSync.h"
+
+/**
+    Remote Clock
+
+    TimeSynchronizer::Recalculate() applies each new clock offset estimate
+    immediately, so ToRemoteTime23() can step forwards or backwards by tens
+    of microseconds when the minimum delay windows change.  Consumers that
+    stamp event streams with remote time then see time reversals.
+
+    RemoteClock is a view of the remote clock that slews towards each new
+    offset at a bounded rate instead of stepping, like adjtime() does for
+    the system clock.  The remote clock rate stays within MaxSlewPPM of the
+    local clock rate, so as long as local time does not go backwards the
+    remote time it returns does not go backwards either.
+
+    Slewing a large correction at 500 ppm takes a long time, e.g. 20
+    minutes for 0.6 seconds.  So like ntpd, the first offset and any
+    correction larger than the step threshold (128 ms by default, see
+    SetStepThresholdNsec()) are stepped to instead, which can move remote
+    time backwards.  Updates must be made with the current
+    local time: Queries for local times before the latest update are
+    answered with the offset at that update.
+
+    Usage:
+
+        Writer (the thread that feeds the TimeSynchronizer):
+
+            sync.OnAuthenticatedDatagramTimestampNs(ts, localNsec);
+            remoteClock.Update(sync, localNsec);
+
+        Readers (any thread):
+
+            uint64_t remoteNsec = remoteClock.ToRemoteNsec(GetTimeNsec());
+
+    Reads are lock-free but not wait-free: The writer publishes each slew
+    segment into a ring of snapshots and readers copy the latest one
+    without locks.  A reader repeats its copy if the writer published a
+    whole ring of segments during it, which takes 8 offset changes while
+    one reader is preempted.
+*/
+
+
+//------------------------------------------------------------------------------
+// Constants
+
+/// Default maximum slew rate, matching the ntpd kernel discipline
+static const uint32_t kDefaultMaxSlewPPM = 500;
+
+/// Largest accepted maximum slew rate
+static const uint32_t kMaxSlewPPMLimit = 100000;
+
+/// Default step threshold, matching ntpd
+static const uint64_t kDefaultStepThresholdNsec = 128 * 1000 * 1000; ///< 128 ms
+
+
+//------------------------------------------------------------------------------
+// RemoteClock
+
+class RemoteClock
+{
+public:
+    RemoteClock();
+
+    /// Set the maximum slew rate in parts per million (1..kMaxSlewPPMLimit).
+    /// Takes effect at the next offset change
+    void SetMaxSlewPPM(uint32_t ppm);
+
+    /// Get the maximum slew rate in parts per million
+    inline uint32_t GetMaxSlewPPM() const
+    {
+        return MaxSlewPPM;
+    }
+
+    /// Set the correction above which the offset is stepped to rather than
+    /// slewed.  Use 0 to always slew, so remote time never goes backwards.
+    /// Takes effect at the next offset change
+    inline void SetStepThresholdNsec(uint64_t thresholdNsec)
+    {
+        StepThresholdNsec = thresholdNsec;
+    }
+
+    /// Get the step threshold in nanoseconds
+    inline uint64_t GetStepThresholdNsec() const
+    {
+        return StepThresholdNsec;
+    }
+
+    /// Number of corrections stepped to since the first offset
+    inline unsigned GetStepCount() const
+    {
+        return StepCount;
+    }
+
+    /**
+        Update()
+
+        Slew towards the synchronizer's current offset.
+        Call this from the thread that feeds the synchronizer, for example
+        after each datagram.  Does nothing if the offset has not changed or
+        the synchronizer is not synchronized yet.
+
+        localNsec: Current local time in nanoseconds.
+    */
+    void Update(const TimeSynchronizer& sync, uint64_t localNsec);
+
+    /**
+        SetTargetOffsetNsec()
+
+        Slew towards the given remote - local offset in nanoseconds.
+        The first offset, and corrections larger than the step threshold,
+        are applied immediately.  Single writer only.
+
+        localNsec: Current local time in nanoseconds.
+    */
+    void SetTargetOffsetNsec(int64_t offsetNsec, uint64_t localNsec);
+
+    /// Returns true once the first offset has been set
+    inline bool IsInitialized() const
+    {
+        return Latest.load(std::memory_order_acquire) != 0;
+    }
+
+    /// Convert local time to remote time in nanoseconds
+    uint64_t ToRemoteNsec(uint64_t localNsec) const;
+
+    /// Convert local time to remote time in microseconds
+    inline uint64_t ToRemoteUsec(uint64_t localUsec) const
+    {
+        return ToRemoteNsec(localUsec * 1000) / 1000;
+    }
+
+    /// Get the offset (remote - local) applied at the given local time
+    int64_t GetOffsetNsec(uint64_t localNsec) const;
+
+    /**
+        GetSlewErrorNsec()
+
+        Returns the remaining correction at the given local time:
+        The target offset minus the currently applied offset.
+        Returns 0 once the slew has completed.
+    */
+    int64_t GetSlewErrorNsec(uint64_t localNsec) const;
+
+    /// Returns true if still slewing at the given local time
+    inline bool IsSlewing(uint64_t localNsec) const
+    {
+        return GetSlewErrorNsec(localNsec) != 0;
+    }
+
+protected:
+    /// One slew segment
+    struct Segment
+    {
+        /// Local time where the segment starts
+        uint64_t AnchorLocalNsec;
+
+        /// Offset applied at the anchor
+        int64_t AnchorOffsetNsec;
+
+        /// Offset being slewed towards
+        int64_t TargetOffsetNsec;
+
+        /// Local time where the target is reached
+        uint64_t SlewEndNsec;
+
+        /// Slew rate in parts per billion (signed)
+        int64_t SlewRatePPB;
+    };
+
+    /// Published copy of a Segment
+    struct Snapshot
+    {
+        /// Sequence number of the segment in this slot, or 0 while writing
+        std::atomic<uint64_t> Seq = ATOMIC_VAR_INIT(0);
+
+        std::atomic<uint64_t> AnchorLocalNsec = ATOMIC_VAR_INIT(0);
+        std::atomic<int64_t> AnchorOffsetNsec = ATOMIC_VAR_INIT(0);
+        std::atomic<int64_t> TargetOffsetNsec = ATOMIC_VAR_INIT(0);
+        std::atomic<uint64_t> SlewEndNsec = ATOMIC_VAR_INIT(0);
+        std::atomic<int64_t> SlewRatePPB = ATOMIC_VAR_INIT(0);
+    };
+
+    static const unsigned kSnapshotCount = 8;
+
+    /// Snapshot ring indexed by sequence number
+    Snapshot Snapshots[kSnapshotCount];
+
+    /// Sequence number of the latest segment, or 0 before the first offset
+    std::atomic<uint64_t> Latest = ATOMIC_VAR_INIT(0);
+
+    /// Writer state
+    Segment Current;
+    uint32_t MaxSlewPPM = kDefaultMaxSlewPPM;
+    uint64_t StepThresholdNsec = kDefaultStepThresholdNsec;
+    unsigned StepCount = 0;
+
+    /// Copy the latest segment
+    void ReadSegment(Segment& segment) const;
+
+    /// Publish Current as the latest segment
+    void PublishSegment();
+
+    /// Offset applied at the given local time within a segment
+    static int64_t SegmentOffsetNsec(const Segment& segment, uint64_t localNsec);
+};
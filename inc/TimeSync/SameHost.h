@@ -0,0 +1,204 @@
+/** \file
+    \brief TimeSync: Same-Host Clock Domain Detection
+    \copyright Copyright (c) 2017-2018 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of TimeSync nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "TimeSync.h"
+
+#include <string.h>
+
+/**
+    Same-Host Clock Domain Detection
+
+    Peers that run on the same host, such as sidecar processes, read the
+    same monotonic clock, so the full TimeSynchronizer exchange only adds
+    estimation error to an offset that is exactly 0.  This detects that
+    case during the handshake:
+
+    (1) Each peer opens a ClockDomainBeacon, which publishes a small POSIX
+        shared memory object named after a random nonce, and sends the
+        24-byte ClockDomainToken to its peer.
+    (2) On receiving the peer's token, CheckSameClockDomain() verifies that
+        the kernel boot ids match, that the peer's beacon is visible in
+        this /dev/shm, and that the peer's CLOCK_MONOTONIC agrees with ours
+        relative to CLOCK_REALTIME, which catches time namespaces.
+    (3) If so, call TimeSynchronizer::SetSameClockDomain(true).
+
+        ClockDomainBeacon beacon;
+        beacon.Open();
+        beacon.GetToken().Write(handshake + offset);
+        ...
+        ClockDomainToken peerToken;
+        if (peerToken.Read(peerHandshake + offset) &&
+            CheckSameClockDomain(peerToken))
+        {
+            sync.SetSameClockDomain(true);
+        }
+
+    Both peers must timestamp with CLOCK_MONOTONIC.  Each side checks
+    independently, and the results can differ, e.g. if the beacon is
+    closed before the peer checks it.  So both sides must keep sending
+    GetMinDeltaTS24() as usual: A synchronizer in same clock domain mode
+    still tracks it, so a peer that did not switch synchronizes through the
+    normal exchange.
+*/
+
+
+//------------------------------------------------------------------------------
+// Constants
+
+/// Bytes in a serialized ClockDomainToken
+static const unsigned kClockDomainTokenBytes = 24;
+
+/// Identifies an initialized clock domain beacon ("TSCD")
+static const uint32_t kClockDomainMagic = 0x54534344;
+
+/// Allowed disagreement between the peers' realtime - monotonic offsets
+static const uint64_t kClockDomainToleranceNsec = 1000 * 1000;
+
+/// Allowed divergence of CLOCK_REALTIME from CLOCK_MONOTONIC while NTP is
+/// slewing, in parts per million of the beacon age
+static const uint64_t kClockDomainSlewPPM = 500;
+
+
+//------------------------------------------------------------------------------
+// ClockDomainToken
+
+/// Token exchanged in the handshake
+struct ClockDomainToken
+{
+    /// Kernel boot id from /proc/sys/kernel/random/boot_id
+    uint8_t BootId[16];
+
+    /// Random nonce naming the peer's beacon
+    uint8_t Nonce[8];
+
+    /// Write kClockDomainTokenBytes bytes to the buffer
+    inline void Write(uint8_t* buffer) const
+    {
+        memcpy(buffer, BootId, sizeof(BootId));
+        memcpy(buffer + sizeof(BootId), Nonce, sizeof(Nonce));
+    }
+
+    /// Read kClockDomainTokenBytes bytes from the buffer.
+    /// Returns false if the token is all zeros
+    inline bool Read(const uint8_t* buffer)
+    {
+        memcpy(BootId, buffer, sizeof(BootId));
+        memcpy(Nonce, buffer + sizeof(BootId), sizeof(Nonce));
+
+        uint8_t any = 0;
+        for (unsigned i = 0; i < kClockDomainTokenBytes; ++i) {
+            any |= buffer[i];
+        }
+        return any != 0;
+    }
+};
+
+
+//------------------------------------------------------------------------------
+// ClockDomainBeaconPage
+
+/// Layout of the beacon shared memory object.
+/// Written once before the token is sent, so no locking is needed
+struct ClockDomainBeaconPage
+{
+    uint32_t Magic;
+    uint8_t Nonce[8];
+
+    /// CLOCK_MONOTONIC and CLOCK_REALTIME at publication in nanoseconds
+    uint64_t MonotonicNsec;
+    uint64_t RealtimeNsec;
+};
+
+
+#ifdef __linux__
+
+//------------------------------------------------------------------------------
+// ClockDomainBeacon
+
+class ClockDomainBeacon
+{
+public:
+    ~ClockDomainBeacon()
+    {
+        Close();
+    }
+
+    /**
+        Open()
+
+        Generate a new token and publish its beacon.  The beacon is removed
+        by Close(), so keep this open until the peer has checked it.
+
+        Returns false on failure.
+    */
+    bool Open();
+
+    /// Remove the beacon
+    void Close();
+
+    /// Is the beacon published?
+    inline bool IsOpen() const
+    {
+        return Page != nullptr;
+    }
+
+    /// Get the token to send to the peer
+    inline const ClockDomainToken& GetToken() const
+    {
+        return Token;
+    }
+
+    /// Get the name of the shared memory object for a token,
+    /// e.g. "/timesync_cd_0123456789abcdef"
+    static void GetBeaconName(const ClockDomainToken& token, char name[32]);
+
+protected:
+    ClockDomainToken Token;
+    ClockDomainBeaconPage* Page = nullptr;
+};
+
+
+//------------------------------------------------------------------------------
+// Clock Domain Checks
+
+/// Read the 16-byte kernel boot id.  Returns false on failure
+bool ReadKernelBootId(uint8_t bootId[16]);
+
+/**
+    CheckSameClockDomain()
+
+    Returns true if the peer that sent the token shares this process's
+    CLOCK_MONOTONIC: Same boot, same shared memory namespace, and no time
+    namespace offset between the two.
+*/
+bool CheckSameClockDomain(const ClockDomainToken& peerToken);
+
+#endif // __linux__
@@ -0,0 +1,289 @@
+/** \file
+    \brief TimeSync: Cross-Process Shared Sync State
+    \copyright Copyright (c) 2017-2018 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of TimeSync nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "TimeSync.h"
+
+/**
+    Shared Sync State
+
+    On a host where one network daemon owns the TimeSynchronizer, other
+    processes can convert timestamps without IPC round trips: The daemon
+    publishes a snapshot of the synchronizer state into a POSIX shared
+    memory page, and readers map the page read-only and copy the snapshot
+    under a sequence lock, much like the kernel vDSO publishes its clock
+    data.  Reading is a handful of loads with no syscalls.
+
+    Daemon:
+
+        SyncStatePublisher publisher;
+        publisher.Open("/timesync");
+        ...
+        sync.OnAuthenticatedDatagramTimestamp(ts, localUsec);
+        publisher.Publish(sync, localUsec);
+
+    Other processes:
+
+        SyncStateReader reader;
+        reader.Open("/timesync");
+        ...
+        uint32_t remoteTS23 = reader.ToRemoteTime23(localUsec);
+
+    All processes must use the same local clock, e.g. CLOCK_MONOTONIC.
+    Only one publisher may write a page at a time.
+*/
+
+
+//------------------------------------------------------------------------------
+// Constants
+
+/// Identifies an initialized shared sync state page ("TSYN")
+static const uint32_t kSharedSyncMagic = 0x5453594e;
+
+/// Layout version of the shared sync state page
+static const uint32_t kSharedSyncVersion = 1;
+
+/// Reads give up after this many attempts to get a consistent copy, which
+/// only happens if the publisher died in the middle of a write
+static const unsigned kSharedSyncReadAttempts = 100000;
+
+
+//------------------------------------------------------------------------------
+// SyncStateSnapshot
+
+/// Copy of the published synchronizer state
+struct SyncStateSnapshot
+{
+    /// Is the offset valid?
+    bool Synchronized = false;
+
+    /// Calculated delta = (Remote time - Local time) in microseconds
+    uint32_t RemoteTimeDeltaUsec = 0;
+
+    /// Signed remote time delta in nanoseconds
+    int64_t RemoteTimeDeltaNsec = 0;
+
+    /// Minimum one-way delay in microseconds
+    uint32_t MinimumOneWayDelayUsec = 0;
+
+    /// Local time of the publication in microseconds
+    uint64_t PublishLocalUsec = 0;
+
+    /// Number of publications so far
+    uint64_t PublishCount = 0;
+
+    /// Returns 23-bit remote time field to send in a packet,
+    /// as in TimeSynchronizer::ToRemoteTime23()
+    inline uint32_t ToRemoteTime23(uint64_t localUsec) const
+    {
+        if (!Synchronized) {
+            return 0;
+        }
+
+        const Counter23 localTS23 = (uint32_t)(localUsec >> kTime23LostBits);
+        const Counter23 deltaTS23 = RemoteTimeDeltaUsec >> kTime23LostBits;
+
+        return (localTS23 + deltaTS23).ToUnsigned();
+    }
+
+    /// Returns local time given a 23-bit remote timestamp,
+    /// as in TimeSynchronizer::FromRemoteTime23()
+    inline uint64_t FromRemoteTime23(uint64_t localUsec, Counter23 remoteTS23) const
+    {
+        const Counter23 deltaTS23 = RemoteTimeDeltaUsec >> kTime23LostBits;
+
+        return Counter64::ExpandFromTruncated(
+            localUsec >> kTime23LostBits,
+            remoteTS23 - deltaTS23).ToUnsigned() << kTime23LostBits;
+    }
+
+    /// Returns remote time in nanoseconds given local time in nanoseconds
+    inline uint64_t ToRemoteNsec(uint64_t localNsec) const
+    {
+        return localNsec + RemoteTimeDeltaNsec;
+    }
+};
+
+
+//------------------------------------------------------------------------------
+// SharedSyncPage
+
+/**
+    Layout of the shared memory page.
+
+    The publisher increments Sequence to an odd value before writing the
+    fields and to the next even value afterwards.  A reader that sees the
+    same even value before and after copying the fields has a consistent
+    copy.  The fields are lock-free atomics so that they are address-free
+    and can be shared between processes.
+*/
+struct SharedSyncPage
+{
+    uint32_t Magic;
+    uint32_t Version;
+
+    std::atomic<uint32_t> Sequence;
+    std::atomic<uint32_t> Synchronized;
+    std::atomic<uint32_t> RemoteTimeDeltaUsec;
+    std::atomic<uint32_t> MinimumOneWayDelayUsec;
+    std::atomic<int64_t> RemoteTimeDeltaNsec;
+    std::atomic<uint64_t> PublishLocalUsec;
+    std::atomic<uint64_t> PublishCount;
+};
+
+static_assert(ATOMIC_INT_LOCK_FREE == 2 && ATOMIC_LLONG_LOCK_FREE == 2,
+    "Shared sync state requires lock-free atomics");
+
+
+//------------------------------------------------------------------------------
+// SyncStatePublisher
+
+#ifdef __linux__
+
+class SyncStatePublisher
+{
+public:
+    ~SyncStatePublisher()
+    {
+        Close();
+    }
+
+    /**
+        Open()
+
+        Create (or reuse) the named POSIX shared memory object, e.g.
+        "/timesync", and map it for writing.  The object stays available to
+        readers after Close() until Unlink() is called.
+
+        Returns false on failure.
+    */
+    bool Open(const char* name);
+
+    /// Unmap the page
+    void Close();
+
+    /// Remove the named shared memory object
+    static void Unlink(const char* name);
+
+    /**
+        Publish()
+
+        Publish the synchronizer's current state.
+
+        localUsec: Current local time in microseconds.
+    */
+    void Publish(const TimeSynchronizer& sync, uint64_t localUsec);
+
+    /// Publish a snapshot directly
+    void Publish(const SyncStateSnapshot& snapshot);
+
+protected:
+    SharedSyncPage* Page = nullptr;
+};
+
+
+//------------------------------------------------------------------------------
+// SyncStateReader
+
+class SyncStateReader
+{
+public:
+    ~SyncStateReader()
+    {
+        Close();
+    }
+
+    /**
+        Open()
+
+        Map the named shared memory object read-only.
+
+        Returns false if it does not exist or was not created by a
+        compatible publisher.
+    */
+    bool Open(const char* name);
+
+    /// Unmap the page
+    void Close();
+
+    /**
+        Read()
+
+        Copy the latest published state.
+
+        If the publisher dies in the middle of a write, the page is left
+        marked as being written.  Read() then gives up after
+        kSharedSyncReadAttempts and returns an unsynchronized snapshot until
+        the next SyncStatePublisher::Open() on the page recovers it.
+
+        Returns false if the reader is not open or no consistent copy was
+        read.
+    */
+    bool Read(SyncStateSnapshot& snapshot) const;
+
+    /// Returns true if the publisher is synchronized
+    inline bool IsSynchronized() const
+    {
+        SyncStateSnapshot snapshot;
+        return Read(snapshot) && snapshot.Synchronized;
+    }
+
+    /// Returns 23-bit remote time field to send in a packet,
+    /// or 0 if the publisher is not synchronized
+    inline uint32_t ToRemoteTime23(uint64_t localUsec) const
+    {
+        SyncStateSnapshot snapshot;
+        Read(snapshot);
+        return snapshot.ToRemoteTime23(localUsec);
+    }
+
+    /// Returns local time given a 23-bit remote timestamp
+    inline uint64_t FromRemoteTime23(uint64_t localUsec, Counter23 remoteTS23) const
+    {
+        SyncStateSnapshot snapshot;
+        Read(snapshot);
+        return snapshot.FromRemoteTime23(localUsec, remoteTS23);
+    }
+
+    /// Returns local time given local time from packet.
+    /// This does not depend on the shared state
+    static inline uint64_t FromLocalTime23(uint64_t localUsec, Counter23 timestamp23)
+    {
+        return Counter64::ExpandFromTruncatedWithBias(
+            localUsec >> kTime23LostBits,
+            timestamp23,
+            kTime23Bias).ToUnsigned() << kTime23LostBits;
+    }
+
+protected:
+    const SharedSyncPage* Page = nullptr;
+};
+
+#endif // __linux__
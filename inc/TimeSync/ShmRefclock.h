@@ -0,0 +1,153 @@
+/** \file
+    \brief TimeSync: NTP SHM Refclock Exporter
+    \copyright Copyright (c) 2017-2018 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of TimeSync nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "TimeSync.h"
+
+#include <time.h>
+
+/**
+    NTP SHM Refclock Exporter
+
+    Publishes the synchronized cluster time to chronyd or ntpd through the
+    NTP shared memory reference clock driver, so that the system clock is
+    disciplined to the cluster time and every process on the host gets it
+    through CLOCK_REALTIME without speaking any protocol.
+
+    chrony.conf:
+
+        refclock SHM 2 refid TSYN
+
+    Each sample pairs a local CLOCK_REALTIME timestamp with the cluster time
+    at the same instant (local time + remote time delta).  Samples are
+    written with the mode 1 count/valid protocol: valid is cleared and count
+    incremented before the fields are written, and count is incremented
+    again and valid set afterwards, so readers can detect torn reads.
+
+    As with NtpServer, the TimeSynchronizer must be fed local times from
+    CLOCK_REALTIME.
+*/
+
+
+//------------------------------------------------------------------------------
+// Constants
+
+/// SysV shared memory key for unit 0 ("NTP0")
+static const int kNtpShmKeyBase = 0x4e545030;
+
+
+//------------------------------------------------------------------------------
+// NtpShmTime
+
+/// Layout of the NTP SHM segment (see ntpd refclock_shm.c)
+struct NtpShmTime
+{
+    int Mode;
+    volatile int Count;
+    time_t ClockTimeStampSec;
+    int ClockTimeStampUSec;
+    time_t ReceiveTimeStampSec;
+    int ReceiveTimeStampUSec;
+    int Leap;
+    int Precision;
+    int NSamples;
+    volatile int Valid;
+    unsigned ClockTimeStampNSec;
+    unsigned ReceiveTimeStampNSec;
+    int Dummy[8];
+};
+
+
+//------------------------------------------------------------------------------
+// ShmRefclockExporter
+
+#ifdef __linux__
+
+class ShmRefclockExporter
+{
+public:
+    ~ShmRefclockExporter()
+    {
+        Close();
+    }
+
+    /**
+        Open()
+
+        Attach to (creating if needed) the SHM segment for the given unit.
+        As in ntpd, units 0 and 1 are only accessible by root and higher
+        units are world-writable.
+
+        Returns false on failure.
+    */
+    bool Open(int unit);
+
+    /// Detach from the segment
+    void Close();
+
+    /// Get the attached segment, or nullptr if not open
+    inline const NtpShmTime* GetSegment() const
+    {
+        return Segment;
+    }
+
+    /**
+        Publish()
+
+        Write one sample: The cluster time was clockUnixNsec when the local
+        CLOCK_REALTIME was localUnixNsec.
+
+        precision: Clock precision as a power of two in seconds.
+    */
+    void Publish(uint64_t localUnixNsec, uint64_t clockUnixNsec, int precision = -20);
+
+    /**
+        PublishFromSynchronizer()
+
+        Write a sample from the synchronizer's current offset.
+
+        localUnixNsec: Current CLOCK_REALTIME time in nanoseconds.
+
+        Returns false if the synchronizer is not synchronized yet.
+    */
+    bool PublishFromSynchronizer(const TimeSynchronizer& sync, uint64_t localUnixNsec);
+
+    /// Number of samples published so far
+    inline uint64_t GetPublishCount() const
+    {
+        return PublishCount;
+    }
+
+protected:
+    NtpShmTime* Segment = nullptr;
+    uint64_t PublishCount = 0;
+};
+
+#endif // __linux__
@@ -0,0 +1,165 @@
+/** \file
+    \brief TimeSync: Distributed Start Barrier
+    \copyright Copyright (c) 2017-2018 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of TimeSync nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "TimeSync.h"
+
+/**
+    Distributed Start Barrier
+
+    For synchronized match starts or distributed load tests, N hosts should
+    begin at the same instant.  A coordinator keeps a TimeSynchronizer with
+    each participant and picks a start time far enough in the future that
+    the broadcast reaches every participant before it:
+
+        Lead = Worst Min OWD * OWDMultiplier + Worst Error Bound + Margin
+
+    The start time is broadcast as a 23-bit timestamp in the coordinator's
+    clock (TS23), and every participant converts it to local time with its
+    own synchronizer, e.g. to wait on it with SyncTimer.
+
+    Because TS23 wraps every 67 seconds, the lead time is capped at
+    kMaxLeadUsec so that participants can expand it unambiguously.
+*/
+
+
+//------------------------------------------------------------------------------
+// StartBarrierParams
+
+struct StartBarrierParams
+{
+    /// Multiplier applied to the worst minimum OWD to cover jitter
+    unsigned OWDMultiplier = 3;
+
+    /// Extra safety margin in microseconds
+    uint32_t MarginUsec = 50 * 1000; ///< 50 ms
+
+    /// Shortest lead time in microseconds
+    uint32_t MinLeadUsec = 100 * 1000; ///< 100 ms
+};
+
+
+//------------------------------------------------------------------------------
+// StartBarrierCoordinator
+
+class StartBarrierCoordinator
+{
+public:
+    /// Longest lead time that participants can expand from TS23
+    static const uint32_t kMaxLeadUsec = 30 * 1000 * 1000; ///< 30 seconds
+
+    explicit StartBarrierCoordinator(const StartBarrierParams& params = StartBarrierParams())
+        : Params(params)
+    {
+    }
+
+    /// Forget all participants
+    void Reset();
+
+    /**
+        AddParticipant()
+
+        Add a participant using the coordinator's synchronizer for that peer.
+
+        Returns false if the synchronizer is not synchronized yet.
+    */
+    bool AddParticipant(const TimeSynchronizer& sync);
+
+    /// Number of participants added
+    inline unsigned GetParticipantCount() const
+    {
+        return ParticipantCount;
+    }
+
+    /// Worst-case error bound between the coordinator and any participant.
+    /// The skew between two participants is at most twice this
+    inline uint32_t GetWorstErrorBoundUsec() const
+    {
+        return WorstMinOWDUsec + kTime23ErrorBound * 2;
+    }
+
+    /// Lead time between picking the start and the start itself
+    uint32_t GetLeadUsec() const;
+
+    /**
+        PickStartTS23()
+
+        localUsec: Current local time at the coordinator.
+
+        Returns the start time to broadcast, in the coordinator's clock.
+    */
+    Counter23 PickStartTS23(uint64_t localUsec) const;
+
+    /// Returns the start time in the coordinator's local clock
+    inline uint64_t GetLocalStartUsec(uint64_t localUsec) const
+    {
+        return FromStartTS23(localUsec, PickStartTS23(localUsec));
+    }
+
+    /// Expand a start time in the coordinator's clock to 64 bits
+    static inline uint64_t FromStartTS23(uint64_t localUsec, Counter23 startTS23)
+    {
+        return Counter64::ExpandFromTruncated(
+            localUsec >> kTime23LostBits,
+            startTS23).ToUnsigned() << kTime23LostBits;
+    }
+
+protected:
+    /// Parameters
+    StartBarrierParams Params;
+
+    /// Number of participants added
+    unsigned ParticipantCount = 0;
+
+    /// Largest minimum OWD of any participant
+    uint32_t WorstMinOWDUsec = 0;
+};
+
+
+//------------------------------------------------------------------------------
+// Participant
+
+/**
+    GetBarrierStartLocalUsec()
+
+    Call this on a participant when the start TS23 broadcast arrives from
+    the coordinator.
+
+    sync: The participant's synchronizer with the coordinator.
+    localUsec: Current local time at the participant.
+    startTS23: Start time in the coordinator's clock.
+
+    Returns the start time in the participant's local clock.
+    Returns 0 if the synchronizer is not synchronized.
+*/
+uint64_t GetBarrierStartLocalUsec(
+    TimeSynchronizer& sync,
+    uint64_t localUsec,
+    Counter23 startTS23);
@@ -0,0 +1,161 @@
+/** \file
+    \brief TimeSync: High-Precision Synchronized Timer
+    \copyright Copyright (c) 2017-2018 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of TimeSync nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "TimeSync.h"
+
+#include <condition_variable>
+#include <mutex>
+
+/**
+    Synchronized Timer
+
+    Triggers an action at a specific remote-clock instant, for example a
+    shared round start.  The target TS23 remote time is converted to local
+    time with TimeSynchronizer::FromRemoteTime23(), the inverse of
+    ToRemoteTime23().
+
+    The wait sleeps on a timerfd on Linux (a condition variable elsewhere),
+    and optionally busy-spins for a short tail before the deadline to reach
+    sub-50 microsecond precision.
+
+    The timer does not poll the offset.  After Attach(), the synchronizer
+    wakes the sleep whenever its conversion parameters change, so the timer
+    is re-armed for the new local target time, or the wait ends early if
+    synchronization is lost.  Without Attach() the target is only re-read
+    when the sleep ends, so an offset change that moves it earlier makes
+    the timer fire late.
+
+    Local times passed to the TimeSynchronizer should come from the same
+    clock as the timer, which defaults to SyncTimer::GetMonotonicUsec().
+*/
+
+
+//------------------------------------------------------------------------------
+// SyncTimerResult
+
+struct SyncTimerResult
+{
+    /// Local time the timer was last armed for
+    uint64_t TargetLocalUsec = 0;
+
+    /// Local time the timer fired
+    uint64_t FiredLocalUsec = 0;
+
+    /// Achieved firing error: Fired - Target (positive = late)
+    int64_t ErrorUsec = 0;
+
+    /// Number of times the target moved because the offset changed
+    unsigned RearmCount = 0;
+};
+
+
+//------------------------------------------------------------------------------
+// SyncTimer
+
+class SyncTimer
+{
+public:
+    /// Default duration of the busy-spin tail
+    static const unsigned kDefaultSpinUsec = 100;
+
+    /// Clock used to read local time in microseconds
+    typedef uint64_t (*LocalClock)();
+
+    /// Returns a monotonic timestamp in microseconds (CLOCK_MONOTONIC on Linux)
+    static uint64_t GetMonotonicUsec();
+
+    SyncTimer();
+    virtual ~SyncTimer();
+
+    /// Set how long to busy-spin before the deadline.  0 disables spinning
+    inline void SetSpinUsec(unsigned spinUsec)
+    {
+        SpinUsec = spinUsec;
+    }
+
+    /// Set the clock used for local time, defaulting to GetMonotonicUsec()
+    inline void SetLocalClock(LocalClock clock)
+    {
+        Clock = clock;
+    }
+
+    /**
+        Attach()
+
+        Wake this timer when the offset of the synchronizer changes or
+        synchronization is lost.  This takes the conversion change callback
+        of the synchronizer, so call it before other threads feed it.
+    */
+    void Attach(TimeSynchronizer& sync);
+
+    /// Wake a waiting thread to re-read the offset.  Safe from any thread
+    void Notify();
+
+    /**
+        WaitForRemoteTime23()
+
+        Block the calling thread until the remote clock reaches remoteTS23,
+        which must be within about 33 seconds of the current remote time.
+
+        Returns false if the synchronizer is not synchronized, or stops being
+        synchronized while waiting.
+        Returns true after the timer fires, filling in the result.
+    */
+    bool WaitForRemoteTime23(
+        TimeSynchronizer& sync,
+        Counter23 remoteTS23,
+        SyncTimerResult& result);
+
+protected:
+    /// Duration of the busy-spin tail
+    unsigned SpinUsec = kDefaultSpinUsec;
+
+    /// Local clock
+    LocalClock Clock = &GetMonotonicUsec;
+
+    /// timerfd and eventfd handles, or -1 if unavailable
+    int TimerFd = -1;
+    int WakeFd = -1;
+
+    /// Fallback wake-up when the handles are unavailable
+    std::mutex WakeLock;
+    std::condition_variable WakeCondition;
+    bool WakePending = false;
+
+
+    /// Sleep for roughly the given number of microseconds, returning early
+    /// if Notify() is called.  A notification that arrives before the sleep
+    /// starts also ends it
+    virtual void SleepUsec(uint64_t usec);
+
+    /// ConversionChangeCallback for Attach()
+    static void OnConversionChange(void* context);
+};
@@ -30,6 +30,7 @@
 #pragma once
 
 #include "Counter.h"
+#include "EventQueue.h"
 
 #include <atomic>
 
@@ -171,6 +172,9 @@ static const unsigned kTime23Bias = 0x200000;
 /// Error bound for 23-bit timestamps <= 8*2-1 = 15 microseconds
 static const unsigned kTime23ErrorBound = (1 << kTime23LostBits) * 2 - 1;
 
+/// Error bound for 32-bit timestamps <= 1*2-1 = 1 microsecond
+static const unsigned kTime32ErrorBound = 1;
+
 /// Number of bits removed from the low end of the microsecond timestamp
 static const unsigned kTime16LostBits = 9;
 
@@ -180,12 +184,35 @@ static const unsigned kTime16Bias = 0x4000;
 /// Error bound for 16-bit timestamps <= 512*2-1 = 1.023 milliseconds
 static const unsigned kTime16ErrorBound = (1 << kTime16LostBits) * 2 - 1;
 
-/// Window size for WindowedMinTS24Deltas.
+/// Number of fractional bits kept below TS24 units in the internal
+/// (receipt - send) delta representation, called TS37.
+/// Each TS37 unit is 8 usec / 8192 = 1/1024 usec, just under 1 nsec
+static const unsigned kDeltaFracBits = 13;
+
+/// Number of TS37 units per microsecond
+static const unsigned kTS37UnitsPerUsec = 1 << (kDeltaFracBits - kTime23LostBits);
+
+/// Window size for WindowedMinDeltas.
 /// Since clocks drift over time, eventually old measurements must be ignored.
 /// This is also the longest that a timing measurement will affect time synch.
-/// Assumes that clocks drift 1 millisecond every 10 seconds
+/// Assumes that clocks drift 1 millisecond every 10 seconds.
+/// This is the default, see TimeSynchronizer::SetDriftWindowUsec()
 static const uint64_t kDriftWindowUsec = 10 * 1000 * 1000; ///< 10 seconds
 
+/// Base added to the first expanded 64-bit delta so that expanded deltas are
+/// never zero.  It is a multiple of 2^37 so that the low 37 bits are unchanged
+static const uint64_t kExpandedDeltaBase = (uint64_t)1 << 40;
+
+/// Default window for the recent minimum used to detect route changes.
+/// The base delay must stay elevated for this long to count as a route change
+static const uint64_t kRouteChangeWindowUsec = 2 * 1000 * 1000; ///< 2 seconds
+
+/// Default increase in base delay that counts as a route change
+static const uint32_t kRouteChangeThresholdUsec = 2000; ///< 2 ms
+
+/// Largest clock drift rate allowed for when detecting route changes
+static const uint32_t kRouteChangeMaxDriftPPM = 100;
+
 
 //------------------------------------------------------------------------------
 // Types
@@ -193,27 +220,31 @@ static const uint64_t kDriftWindowUsec = 10 * 1000 * 1000; ///< 10 seconds
 /// Use Counter23::Decompress to expand back to 64-bit counters
 typedef Counter<uint32_t, 23> Counter23;
 
+/// TS24 deltas with kDeltaFracBits fractional bits
+typedef Counter<uint64_t, 37> Counter37;
+
 
 //------------------------------------------------------------------------------
-// WindowedMinTS24
+// WindowedMinT
 
-/// Windowed minimum in TS24 units
-class WindowedMinTS24
+/// Windowed minimum of wrap-around counter values
+template<class CounterT>
+class WindowedMinT
 {
 public:
-    WindowedMinTS24() {}
+    WindowedMinT() {}
 
     struct Sample
     {
         /// Sample value
-        Counter24 Value;
+        CounterT Value;
 
         /// Timestamp of data collection
         uint64_t Timestamp;
 
 
         /// Default values and initializing constructor
-        explicit Sample(Counter24 value = 0, uint64_t timestamp = 0)
+        explicit Sample(CounterT value = 0, uint64_t timestamp = 0)
             : Value(value)
             , Timestamp(timestamp)
         {
@@ -241,7 +272,7 @@ public:
     }
 
     /// Get smallest sample
-    inline Counter24 GetBest() const
+    inline CounterT GetBest() const
     {
         return Samples[0].Value;
     }
@@ -254,11 +285,179 @@ public:
 
     /// Update minimum with new value
     void Update(
-        Counter24 value,
+        CounterT value,
         uint64_t timestamp,
         const uint64_t windowLengthTime);
 };
 
+/// Windowed minimum in TS24 units
+typedef WindowedMinT<Counter24> WindowedMinTS24;
+
+/// Windowed minimum of TS37 deltas expanded to 64 bits
+typedef WindowedMinT<Counter64> WindowedMinX64;
+
+
+//------------------------------------------------------------------------------
+// HibernatedTimeSync
+
+/**
+    Compressed state of an idle TimeSynchronizer.
+
+    Most peers are idle at any given moment, so their synchronizers can be
+    reduced to this 16 byte summary and moved to a cold tier.  The summary
+    keeps enough to convert timestamps while hibernated, and to restore a
+    valid estimate on the next datagram if the best sample is still within
+    the drift window.
+*/
+struct HibernatedTimeSync
+{
+    /// Local time of hibernation in milliseconds, truncated to 32 bits
+    Counter32 HibernateMsec;
+
+    /// Age of the best sample at hibernation in milliseconds (saturating)
+    uint16_t BestAgeMsec;
+
+    /// Combination of kFlag* bits
+    uint8_t Flags;
+
+    /// Best (receipt - send) delta in TS24 units
+    uint8_t BestDeltaTS24[3];
+
+    /// Last MinDeltaTS24 value provided by the peer
+    uint8_t PeerMinDeltaTS24[3];
+
+    /// Remote time delta in TS23 units (offset)
+    uint8_t RemoteTimeDeltaTS23[3];
+
+
+    static const uint8_t kFlagSynchronized = 1;
+    static const uint8_t kFlagGotPeerUpdate = 2;
+    static const uint8_t kFlagSameClockDomain = 4;
+
+    /// Is the offset valid?
+    inline bool IsSynchronized() const
+    {
+        return (Flags & kFlagSynchronized) != 0;
+    }
+
+    /// Calculated delta = (Remote time - Local time) in microseconds
+    inline uint32_t GetRemoteTimeDeltaUsec() const
+    {
+        return Read24(RemoteTimeDeltaTS23) << kTime23LostBits;
+    }
+
+    /// Returns 23-bit remote time field to send in a packet, as in
+    /// TimeSynchronizer::ToRemoteTime23() without rehydrating the peer
+    inline uint32_t ToRemoteTime23(uint64_t localUsec) const
+    {
+        if (!IsSynchronized()) {
+            return 0;
+        }
+
+        const Counter23 localTS23 = (uint32_t)(localUsec >> kTime23LostBits);
+        const Counter23 deltaTS23 = Read24(RemoteTimeDeltaTS23);
+
+        return (localTS23 + deltaTS23).ToUnsigned();
+    }
+
+    static inline uint32_t Read24(const uint8_t* data)
+    {
+        return data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16);
+    }
+    static inline void Write24(uint8_t* data, uint32_t value)
+    {
+        data[0] = (uint8_t)value;
+        data[1] = (uint8_t)(value >> 8);
+        data[2] = (uint8_t)(value >> 16);
+    }
+};
+
+static_assert(sizeof(HibernatedTimeSync) == 16, "Unexpected padding");
+
+
+//------------------------------------------------------------------------------
+// TimeConversionParams
+
+/**
+    Parameters needed to convert timestamps to and from the remote clock.
+
+    The TimeSynchronizer packs these into a single atomic 64-bit word, so a
+    converting thread reads a consistent copy with one acquire load, and
+    stable offsets can be cached by TimeConversionCache.
+
+    Packed layout:
+        Bits  0..31: RemoteTimeDeltaUsec
+        Bit      32: Synchronized
+        Bits 33..63: Generation, incremented when the other fields change
+*/
+struct TimeConversionParams
+{
+    /// Incremented each time the offset changes
+    uint32_t Generation = 0;
+
+    /// Is the offset valid?
+    bool Synchronized = false;
+
+    /// Calculated delta = (Remote time - Local time) in microseconds
+    uint32_t RemoteTimeDeltaUsec = 0;
+
+
+    static const unsigned kSynchronizedShift = 32;
+    static const unsigned kGenerationShift = 33;
+
+    static inline TimeConversionParams Unpack(uint64_t packed)
+    {
+        TimeConversionParams params;
+        params.RemoteTimeDeltaUsec = (uint32_t)packed;
+        params.Synchronized = ((packed >> kSynchronizedShift) & 1) != 0;
+        params.Generation = (uint32_t)(packed >> kGenerationShift);
+        return params;
+    }
+
+    static inline uint64_t Pack(uint32_t generation, bool synchronized, uint32_t deltaUsec)
+    {
+        return ((uint64_t)generation << kGenerationShift) |
+            ((uint64_t)(synchronized ? 1 : 0) << kSynchronizedShift) |
+            deltaUsec;
+    }
+
+    /// Returns 16-bit remote time field to send in a packet
+    inline uint16_t ToRemoteTime16(uint64_t localUsec) const
+    {
+        if (!Synchronized) {
+            return 0;
+        }
+
+        const uint16_t localTS16 = (uint16_t)(localUsec >> kTime16LostBits);
+        const uint16_t deltaTS16 = (uint16_t)(RemoteTimeDeltaUsec >> kTime16LostBits);
+
+        return localTS16 + deltaTS16;
+    }
+
+    /// Returns 23-bit remote time field to send in a packet
+    inline uint32_t ToRemoteTime23(uint64_t localUsec) const
+    {
+        if (!Synchronized) {
+            return 0;
+        }
+
+        const Counter23 localTS23 = (uint32_t)(localUsec >> kTime23LostBits);
+        const Counter23 deltaTS23 = RemoteTimeDeltaUsec >> kTime23LostBits;
+
+        return (localTS23 + deltaTS23).ToUnsigned();
+    }
+
+    /// Returns local time given a 23-bit timestamp in the remote clock
+    inline uint64_t FromRemoteTime23(uint64_t localUsec, Counter23 remoteTS23) const
+    {
+        const Counter23 deltaTS23 = RemoteTimeDeltaUsec >> kTime23LostBits;
+
+        return Counter64::ExpandFromTruncated(
+            localUsec >> kTime23LostBits,
+            remoteTS23 - deltaTS23).ToUnsigned() << kTime23LostBits;
+    }
+};
+
 
 //------------------------------------------------------------------------------
 // TimeSynchronizer
@@ -266,6 +465,8 @@ public:
 class TimeSynchronizer
 {
 public:
+    virtual ~TimeSynchronizer() {}
+
     /**
         OnPeerMinDeltaTS24()
 
@@ -302,13 +503,163 @@ public:
         Counter24 remoteSendTS24,
         uint64_t localRecvUsec);
 
+    /**
+        OnAuthenticatedDatagramTimestampNs()
+
+        Same as OnAuthenticatedDatagramTimestamp(), with the receive time in
+        nanoseconds, e.g. from SO_TIMESTAMPNS kernel timestamps.
+
+        Deltas are kept in TS37 units (about 1 nsec) rather than truncated to
+        the 8 usec datagram timestamp resolution.  Since datagrams are sent at
+        different phases of the 8 usec send timestamp period, the windowed
+        minimum converges on the sub-microsecond delta.
+
+        Returns estimated one way delay (OWD) in nanoseconds for this datagram.
+        Returns 0 if OWD is unavailable.
+    */
+    uint64_t OnAuthenticatedDatagramTimestampNs(
+        Counter24 remoteSendTS24,
+        uint64_t localRecvNsec);
+
+    /**
+        1 Microsecond Precision Profile
+
+        Inside a datacenter the OWD is 20-50 microseconds, and the 8
+        microsecond TS24 quantization dominates the error.  Peers can send
+        32-bit datagram timestamps (TS32) and MinDelta values with 1
+        microsecond resolution instead.  These feed the same TS37 deltas as
+        TS24 timestamps, so every other feature applies unchanged, and the
+        remote time delta is still known modulo 2^26 microseconds (about
+        +/- 33 seconds).
+
+        Both peers must use the same profile, since the field sizes differ.
+    */
+
+    /// Convert local time in microseconds to a 32-bit datagram timestamp
+    static inline uint32_t LocalTimeToDatagramTS32(uint64_t localUsec)
+    {
+        return (uint32_t)localUsec;
+    }
+
+    /// Same as OnAuthenticatedDatagramTimestamp() with a TS32 timestamp
+    unsigned OnAuthenticatedDatagramTimestamp32(
+        Counter32 remoteSendTS32,
+        uint64_t localRecvUsec);
+
+    /// Get the minimum (receipt - send) delta in TS32 units
+    inline Counter32 GetMinDeltaTS32() const
+    {
+        return (uint32_t)(GetMinDeltaTS37().ToUnsigned() / kTS37UnitsPerUsec);
+    }
+
+    /// Call this when the peer provides its latest MinDeltaTS32 value.
+    /// See OnPeerMinDeltaTS24()
+    void OnPeerMinDeltaTS32(Counter32 minDeltaTS32);
+
+    /// Returns remote time in microseconds given local time
+    inline uint64_t ToRemoteUsec(uint64_t localUsec) const
+    {
+        return localUsec + (int64_t)GetSignedRemoteTimeDeltaUsec();
+    }
+
+    /// Returns local time in microseconds given remote time
+    inline uint64_t FromRemoteUsec(uint64_t remoteUsec) const
+    {
+        return remoteUsec - (int64_t)GetSignedRemoteTimeDeltaUsec();
+    }
+
+    /// Returns 32-bit remote time field to send in a packet
+    inline uint32_t ToRemoteTime32(uint64_t localUsec) const
+    {
+        if (!IsSynchronized()) {
+            return 0;
+        }
+        return (uint32_t)ToRemoteUsec(localUsec);
+    }
+
+    /// Returns local time given local time from packet
+    static inline uint64_t FromLocalTime32(
+        uint64_t localUsec,
+        Counter32 timestamp32)
+    {
+        return Counter64::ExpandFromTruncated(localUsec, timestamp32).ToUnsigned();
+    }
+
+    /// Returns local time given a 32-bit timestamp in the remote clock.
+    /// This is the inverse of ToRemoteTime32().
+    /// Only valid when IsSynchronized() returns true
+    inline uint64_t FromRemoteTime32(
+        uint64_t localUsec,
+        Counter32 remoteTS32) const
+    {
+        const Counter32 localTS32 = remoteTS32 - (uint32_t)GetSignedRemoteTimeDeltaUsec();
+        return FromLocalTime32(localUsec, localTS32);
+    }
+
+    /// Convert local time in microseconds to TS37 units
+    static inline uint64_t LocalUsecToTS37(uint64_t localUsec)
+    {
+        return localUsec * kTS37UnitsPerUsec;
+    }
+
+    /// Convert local time in nanoseconds to TS37 units
+    static inline uint64_t LocalNsecToTS37(uint64_t localNsec)
+    {
+        return LocalUsecToTS37(localNsec / 1000) + (localNsec % 1000) * kTS37UnitsPerUsec / 1000;
+    }
+
+    /// Returns true once a datagram has been received, so that
+    /// GetMinDeltaTS24() has a value worth sending to the peer
+    inline bool HasMinDelta() const
+    {
+        return WindowedMinDeltas.IsValid();
+    }
 
     /// Get the minimum TS24 (receipt - send) delta seen in the past interval
     inline Counter24 GetMinDeltaTS24() const
     {
-        return WindowedMinTS24Deltas.GetBest();
+        return (uint32_t)(WindowedMinDeltas.GetBest().ToUnsigned() >> kDeltaFracBits);
+    }
+
+    /// Get the minimum (receipt - send) delta in TS37 units.
+    /// Sending this 5 byte value instead of GetMinDeltaTS24() lets the peer
+    /// keep sub-microsecond precision
+    inline Counter37 GetMinDeltaTS37() const
+    {
+        return WindowedMinDeltas.GetBest().ToUnsigned();
     }
 
+    /// Call this when the peer provides its latest MinDeltaTS37 value.
+    /// See OnPeerMinDeltaTS24()
+    void OnPeerMinDeltaTS37(Counter37 minDeltaTS37);
+
+    /**
+        OnFourTimestampExchange()
+
+        Call this with a PTP/NTP-style request/response probe, for peers that
+        cannot timestamp every datagram, e.g. over TCP or via legacy agents:
+
+            t1: Local time when the request was sent
+            t2: Remote time when the request was received
+            t3: Remote time when the response was sent
+            t4: Local time when the response was received
+
+        All times are in microseconds on the clock of the host that took them.
+        The response (t4 - t3) feeds the same windowed minimum as datagram
+        timestamps.  The request (t2 - t1) feeds a minimum of outgoing deltas,
+        which stands in for the peer's MinDelta reports: If both are
+        available, the smaller one is used.  So probes and per-datagram
+        timestamps can be mixed and produce one offset estimate.
+
+        Returns the round trip time excluding the remote processing time in
+        microseconds: (t4 - t1) - (t3 - t2).
+    */
+    uint32_t OnFourTimestampExchange(
+        uint64_t t1,
+        uint64_t t2,
+        uint64_t t3,
+        uint64_t t4);
+
     /// Is time synchronized?
     inline bool IsSynchronized() const
     {
@@ -323,17 +674,145 @@ public:
         return MinimumOneWayDelayUsec;
     }
 
-    /// Returns 16-bit remote time field to send in a packet
-    inline uint16_t ToRemoteTime16(uint64_t localUsec)
+    /// Get the minimum one-way delay in nanoseconds
+    inline uint64_t GetMinimumOneWayDelayNsec() const
     {
-        if (!Synchronized) {
+        return MinimumOneWayDelayNsec;
+    }
+
+    /// Get the calculated delta = (Remote time - Local time) in microseconds.
+    /// The delta is only known modulo 2^26 microseconds (about 67 seconds),
+    /// so it is sign-extended into the range of about +/- 33 seconds
+    inline int32_t GetSignedRemoteTimeDeltaUsec() const
+    {
+        static const unsigned kDeltaBits = 23 + kTime23LostBits;
+        const uint32_t delta = RemoteTimeDeltaUsec;
+        return (int32_t)(delta << (32 - kDeltaBits)) >> (32 - kDeltaBits);
+    }
+
+    /// Get the calculated delta = (Remote time - Local time) in nanoseconds,
+    /// sign-extended into the range of about +/- 33 seconds
+    inline int64_t GetSignedRemoteTimeDeltaNsec() const
+    {
+        return RemoteTimeDeltaNsec;
+    }
+
+    /**
+        Per-direction queuing delay
+
+        GetMinimumOneWayDelayUsec() merges both directions into RTT/2.
+        The queuing delay above the base delay can be measured separately
+        for each direction, which tells whether congestion is on the path
+        from the peer (incoming) or the path to the peer (outgoing).
+
+        The incoming queuing delay is measured locally from the most recent
+        datagram, and does not require synchronization.  The outgoing
+        queuing delay is the peer's incoming queuing delay, which it must
+        report, for example in OWDFeedback::QueuingDelayUsec.
+    */
+
+    /// Queuing delay of the most recent datagram from the peer:
+    /// (Current delta) - (Minimum delta)
+    inline uint32_t GetIncomingQueuingDelayUsec() const
+    {
+        if (!WindowedMinDeltas.IsValid()) {
             return 0;
         }
 
-        const uint16_t localTS16 = (uint16_t)(localUsec >> kTime16LostBits);
-        const uint16_t deltaTS16 = (uint16_t)(RemoteTimeDeltaUsec >> kTime16LostBits);
+        const Counter64 minDeltaX64 = WindowedMinDeltas.GetBest();
+        if (LastDeltaX64 <= minDeltaX64) {
+            return 0;
+        }
+        return (uint32_t)((LastDeltaX64 - minDeltaX64).ToUnsigned() / kTS37UnitsPerUsec);
+    }
 
-        return localTS16 + deltaTS16;
+    /// Call this when the peer reports the queuing delay of its most
+    /// recently received datagram from us
+    inline void OnPeerIncomingQueuingDelayUsec(uint32_t queuingDelayUsec)
+    {
+        PeerQueuingDelayUsec = queuingDelayUsec;
+    }
+
+    /// Queuing delay on the path to the peer, as last reported by the peer
+    inline uint32_t GetOutgoingQueuingDelayUsec() const
+    {
+        return PeerQueuingDelayUsec;
+    }
+
+    /// Base (minimum) delay on the path from the peer.
+    /// Only the sum of the two base delays can be measured, so the link is
+    /// assumed to be symmetric as in the clock delta calculation, and this
+    /// is equal to GetOutgoingBaseDelayUsec()
+    inline uint32_t GetIncomingBaseDelayUsec() const
+    {
+        return MinimumOneWayDelayUsec;
+    }
+
+    /// Base (minimum) delay on the path to the peer.
+    /// See GetIncomingBaseDelayUsec()
+    inline uint32_t GetOutgoingBaseDelayUsec() const
+    {
+        return MinimumOneWayDelayUsec;
+    }
+
+    /**
+        Smoothed RTT
+
+        Once synchronized, each datagram provides an RTT sample without any
+        echo packets:
+
+            RTT = (Incoming base + queuing) + (Outgoing base + queuing)
+
+        These are smoothed TCP-style (RFC 6298) into SRTT and RTTVAR, so
+        that retransmission timers can use them without dedicated probes.
+        The RFC 6298 gains are meant for one sample per round trip, so only
+        the first datagram after each SRTT interval is sampled.  The
+        outgoing queuing delay is only as fresh as the last report from the
+        peer.
+    */
+
+    /// Smoothed RTT in microseconds, or 0 if no samples yet
+    inline uint32_t GetSmoothedRTTUsec() const
+    {
+        return SmoothedRTTUsec;
+    }
+
+    /// RTT variation in microseconds
+    inline uint32_t GetRTTVarianceUsec() const
+    {
+        return RTTVarianceUsec;
+    }
+
+    /// Retransmission timeout: SRTT + 4 * RTTVAR, at least minimumUsec.
+    /// Returns 2 * kDefaultOWDUsec if no samples yet
+    inline uint32_t GetRetransmitTimeoutUsec(uint32_t minimumUsec = 0) const
+    {
+        const uint32_t srtt = SmoothedRTTUsec;
+        if (srtt == 0) {
+            return kDefaultOWDUsec * 2;
+        }
+        const uint32_t rto = srtt + 4 * RTTVarianceUsec;
+        return rto > minimumUsec ? rto : minimumUsec;
+    }
+
+    /// Get a consistent copy of the conversion parameters with one
+    /// acquire load.  Safe to call from any thread
+    inline TimeConversionParams GetConversionParams() const
+    {
+        return TimeConversionParams::Unpack(ConversionState.load(std::memory_order_acquire));
+    }
+
+    /// Get the generation of the conversion parameters, which changes each
+    /// time the offset or synchronized state changes
+    inline uint32_t GetConversionGeneration() const
+    {
+        return GetConversionParams().Generation;
+    }
+
+    /// Returns 16-bit remote time field to send in a packet
+    inline uint16_t ToRemoteTime16(uint64_t localUsec) const
+    {
+        return GetConversionParams().ToRemoteTime16(localUsec);
     }
 
     /// Returns local time given local time from packet
@@ -348,16 +827,9 @@ public:
     }
 
     /// Returns 23-bit remote time field to send in a packet
-    inline uint32_t ToRemoteTime23(uint64_t localUsec)
+    inline uint32_t ToRemoteTime23(uint64_t localUsec) const
     {
-        if (!Synchronized) {
-            return 0;
-        }
-
-        const Counter23 localTS23 = (uint32_t)(localUsec >> kTime23LostBits);
-        const Counter23 deltaTS23 = RemoteTimeDeltaUsec >> kTime23LostBits;
-
-        return (localTS23 + deltaTS23).ToUnsigned();
+        return GetConversionParams().ToRemoteTime23(localUsec);
     }
 
     /// Returns local time given remote time from packet
@@ -371,6 +843,164 @@ public:
             kTime23Bias).ToUnsigned() << kTime23LostBits;
     }
 
+    /// Returns local time given a 23-bit timestamp in the remote clock.
+    /// This is the inverse of ToRemoteTime23(), and accepts timestamps up to
+    /// about 33 seconds in the past or future, e.g. for scheduling.
+    /// Only valid when IsSynchronized() returns true
+    inline uint64_t FromRemoteTime23(
+        uint64_t localUsec,
+        Counter23 remoteTS23) const
+    {
+        return GetConversionParams().FromRemoteTime23(localUsec, remoteTS23);
+    }
+
+    /**
+        Hibernate()
+
+        Compress the synchronizer state into a HibernatedTimeSync summary.
+        The synchronizer object can then be released until the peer becomes
+        active again.
+
+        localUsec: A recent timestamp in microsecond units.
+    */
+    void Hibernate(uint64_t localUsec, HibernatedTimeSync& state) const;
+
+    /**
+        Rehydrate()
+
+        Restore the state from a HibernatedTimeSync summary, typically when
+        the next datagram arrives from a hibernated peer.  If the best sample
+        has aged out of the drift window, then the synchronizer starts over.
+
+        localUsec: A recent timestamp in microsecond units.
+
+        Returns true if a valid estimate was restored.
+    */
+    bool Rehydrate(const HibernatedTimeSync& state, uint64_t localUsec);
+
+    /**
+        Route change detection
+
+        When a route change raises the base delay, the old smaller minimum
+        would stay in the window for up to kDriftWindowUsec and OWD would be
+        underreported until then.  So a second, short window tracks the
+        recent minimum delta.  If it stays above the long-term minimum by
+        more than the threshold for the whole short window, and the peer's
+        reported minimum has not fallen by the same amount (which is what
+        clock drift looks like), then the round trip base delay has risen.
+        The window is then reset to the recent samples and the callback runs.
+
+        The peer's minimum comes from its reports or from four-timestamp
+        exchanges, whichever is smaller, so probe-only peers are covered.
+        Only a rise on the path from the peer is detected here.  A rise on
+        the path to the peer is detected by the peer itself.  For a
+        probe-only peer, that rise shows up once the old minimum ages out
+        of the drift window.
+    */
+
+    /// Called on route change with the increase in base delay in usec
+    typedef void (*RouteChangeCallback)(void* context, uint32_t increaseUsec);
+
+    /// Set the callback for route changes, or nullptr to disable it
+    void SetRouteChangeCallback(RouteChangeCallback callback, void* context);
+
+    /// Set the route change detection parameters
+    void SetRouteChangeParams(
+        uint64_t windowUsec = kRouteChangeWindowUsec,
+        uint32_t thresholdUsec = kRouteChangeThresholdUsec);
+
+    /// Called when time becomes synchronized, from whichever entry point
+    /// fed the synchronizer
+    typedef void (*SynchronizedCallback)(void* context);
+
+    /// Set the callback for becoming synchronized, or nullptr to disable it.
+    /// See AwaitableTimeSynchronizer in TimeSyncAwait.h
+    void SetSynchronizedCallback(SynchronizedCallback callback, void* context);
+
+    /// Called when the conversion parameters change: the offset moves, or
+    /// synchronization is gained or lost.  Called from whichever entry point
+    /// fed the synchronizer
+    typedef void (*ConversionChangeCallback)(void* context);
+
+    /// Set the callback for conversion changes, or nullptr to disable it.
+    /// See SyncTimer in SyncTimer.h
+    void SetConversionChangeCallback(ConversionChangeCallback callback, void* context);
+
+    /// Set the window length for the minimum delta, which defaults to
+    /// kDriftWindowUsec.  Deltas are expanded to 64 bits, so the window can
+    /// be minutes long for stable links between clocks with little drift
+    inline void SetDriftWindowUsec(uint64_t windowUsec)
+    {
+        DriftWindowUsec = windowUsec;
+    }
+
+    /// Get the window length for the minimum delta
+    inline uint64_t GetDriftWindowUsec() const
+    {
+        return DriftWindowUsec;
+    }
+
+    /// Number of route changes detected so far
+    inline unsigned GetRouteChangeCount() const
+    {
+        return RouteChangeCount;
+    }
+
+    /**
+        SetEventQueue()
+
+        Push state change events for this peer to the queue, or pass nullptr
+        to stop.  Many synchronizers can share one queue.  See EventQueue.h.
+
+        Events are pushed from the thread that feeds this synchronizer.
+        The queue must outlive the synchronizer, or be removed first.
+    */
+    void SetEventQueue(
+        TimeSyncEventQueue* queue,
+        uint32_t peerId,
+        const TimeSyncEventParams& params = TimeSyncEventParams());
+
+    /**
+        SetSameClockDomain()
+
+        Switch to exact zero-offset mode for a peer that reads the same
+        monotonic clock as this one, for example a sidecar on the same host.
+        See SameHost.h for the handshake that establishes this.
+
+        While enabled the synchronizer is synchronized with a remote time
+        delta of exactly 0, so conversions carry no estimation error.
+        The offset is not estimated: the (receipt - send) delta of each
+        datagram is its actual loopback latency, and is returned directly as
+        the OWD.  GetMinimumOneWayDelayUsec() reports the smallest one seen.
+
+        The minimum delta window is still updated, so GetMinDeltaTS24()
+        should still be sent to the peer.  Each side decides on its own
+        whether to switch, and a peer that did not switch needs it to
+        synchronize through the usual exchange.
+
+        Switching in either direction starts over from the initial state, so
+        after disabling the usual exchange must run again before conversions
+        are available.  Hibernate() records the mode and Rehydrate() restores
+        it.
+    */
+    void SetSameClockDomain(bool sameDomain);
+
+    /// Is exact zero-offset mode enabled?
+    inline bool IsSameClockDomain() const
+    {
+        return SameClockDomain;
+    }
+
+    /**
+        OnSameHostDatagramNs()
+
+        In same clock domain mode, process a datagram that carries the full
+        local send time in nanoseconds rather than a 24-bit timestamp.
+
+        Returns the exact OWD in nanoseconds, or 0 if the mode is not enabled.
+    */
+    uint64_t OnSameHostDatagramNs(uint64_t sendNsec, uint64_t localRecvNsec);
+
 protected:
     /// Synchronized?
     std::atomic<bool> Synchronized = ATOMIC_VAR_INIT(false);
@@ -378,20 +1008,291 @@ protected:
     /// Calculated delta = (Remote time - Local time)
     std::atomic<uint32_t> RemoteTimeDeltaUsec = ATOMIC_VAR_INIT(0); ///< usec
 
+    /// Synchronized and RemoteTimeDeltaUsec packed with a generation counter
+    /// for converting threads.  See TimeConversionParams
+    std::atomic<uint64_t> ConversionState = ATOMIC_VAR_INIT(0);
+
     /// Calculated minimum OWD
     std::atomic<uint32_t> MinimumOneWayDelayUsec = ATOMIC_VAR_INIT(kDefaultOWDUsec); ///< in usec
 
+    /// Calculated delta and minimum OWD with sub-microsecond precision
+    std::atomic<int64_t> RemoteTimeDeltaNsec = ATOMIC_VAR_INIT(0); ///< nsec
+    std::atomic<uint64_t> MinimumOneWayDelayNsec = ATOMIC_VAR_INIT(kDefaultOWDUsec * 1000ULL); ///< nsec
+
     /// Windowed minimum value for received packet timestamp deltas
     /// Keep track of the smallest (receipt - send) time delta seen so far
-    WindowedMinTS24 WindowedMinTS24Deltas; ///< in Timestamp24 units
+    WindowedMinX64 WindowedMinDeltas; ///< in expanded TS37 units
 
-    /// Keep a copy of the last MinDeltaUsec from the flow control data from peer
-    Counter24 LastFC_MinDeltaTS24 = 0;
+    /// Keep a copy of the last MinDelta from the flow control data from peer
+    Counter37 LastFC_MinDeltaTS37 = 0;
 
     /// Is peer update received yet?
     bool GotPeerUpdate = false;
 
+    /// Window length for WindowedMinDeltas
+    uint64_t DriftWindowUsec = kDriftWindowUsec;
+
+    /// Windowed minimum of (remote receipt - local send) deltas from
+    /// four-timestamp exchanges
+    WindowedMinX64 OutgoingMinDeltas; ///< in expanded TS37 units
+
+    /// Outgoing delta of the most recent four-timestamp exchange
+    Counter64 LastOutgoingDeltaX64 = 0;
+
+    /// (Receipt - send) delta of the most recent datagram
+    Counter64 LastDeltaX64 = 0;
+
+    /// Queuing delay on the path to the peer, as reported by the peer
+    uint32_t PeerQueuingDelayUsec = 0;
+
+    /// Smoothed RTT and its variation in microseconds
+    std::atomic<uint32_t> SmoothedRTTUsec = ATOMIC_VAR_INIT(0);
+    std::atomic<uint32_t> RTTVarianceUsec = ATOMIC_VAR_INIT(0);
+
+    /// Local receive time of the last RTT sample taken
+    uint64_t LastRTTSampleUsec = 0;
+
+    /// Windowed minimum over the last RouteChangeWindowUsec
+    WindowedMinX64 RecentMinDeltas; ///< in expanded TS37 units
+
+    /// Time when RecentMinDeltas started collecting samples
+    uint64_t RecentStartUsec = 0;
+
+    /// Long-term minimum and peer minimum when the long-term minimum was set
+    Counter64 BaselineMinDeltaX64 = 0;
+    Counter37 BaselinePeerMinDeltaTS37 = 0;
+
+    /// Route change detection parameters
+    uint64_t RouteChangeWindowUsec = kRouteChangeWindowUsec;
+    uint32_t RouteChangeThresholdUsec = kRouteChangeThresholdUsec;
+
+    /// Route change callback
+    RouteChangeCallback OnRouteChange = nullptr;
+    void* RouteChangeContext = nullptr;
+
+    /// Number of route changes detected
+    unsigned RouteChangeCount = 0;
+
+    /// Synchronized callback
+    SynchronizedCallback OnSynchronized = nullptr;
+    void* SynchronizedContext = nullptr;
+
+    /// Conversion change callback
+    ConversionChangeCallback OnConversionChange = nullptr;
+    void* ConversionChangeContext = nullptr;
+
+    /// Peer shares this clock, so the remote time delta is exactly 0
+    bool SameClockDomain = false;
+
+    /// Has a loopback OWD been measured in same clock domain mode?
+    bool GotSameHostOWD = false;
+
+    /// Event queue and thresholds
+    TimeSyncEventQueue* EventQueue = nullptr;
+    uint32_t EventPeerId = 0;
+    TimeSyncEventParams EventParams;
+
+    /// Remote time delta when kEventSynchronized/kEventOffsetChanged/
+    /// kEventStep was last pushed
+    int64_t ReportedDeltaNsec = 0;
+
+    /// Was kEventOWDSpike pushed without the OWD falling back yet?
+    bool InOWDSpike = false;
+
+    /// Local receive time of the latest datagram, for event timestamps
+    uint64_t LastRecvUsec = 0;
+
 
     /// Recalculate MinimumOneWayDelayUsec and RemoteTimeDeltaUsec
     void Recalculate();
+
+    /// Start over from the initial state.
+    /// Virtual so that derived classes can reset their own state too
+    virtual void ResetState();
+
+    /// Update ConversionState, bumping the generation if it changed
+    void PublishConversionState();
+
+    /// Record an exact loopback OWD in same clock domain mode
+    void OnSameHostOWD(uint64_t owdNsec);
+
+    /// Push an event if a queue is set
+    void PushEvent(TimeSyncEventType type, int64_t value);
+
+    /// Push offset events after Recalculate() updated the delta
+    void CheckOffsetEvents(bool wasSynchronized, int64_t prevDeltaNsec);
+
+    /// Push kEventOWDSpike if the OWD of a datagram is a spike
+    void CheckOWDSpike(uint64_t owdNsec);
+
+    /// Get the minimum (remote receipt - local send) delta, from the peer's
+    /// reports or from four-timestamp exchanges.  Returns false if unknown
+    bool GetPeerMinDeltaTS37(Counter37& minDeltaTS37) const;
+
+    /// Expand the (receipt - send) delta of a datagram and add it to
+    /// WindowedMinDeltas.  Returns the expanded delta
+    Counter64 UpdateMinDeltas(Counter37 deltaTS37, uint64_t localRecvUsec);
+
+    /// Process the (receipt - send) delta of a datagram.  All datagram
+    /// entry points end up here, so derived classes can override it.
+    /// Returns OWD in nanoseconds, or 0 if unavailable
+    virtual uint64_t OnDatagramDeltaTS37(
+        Counter37 deltaTS37,
+        uint64_t localRecvUsec,
+        bool checkRouteChange = true);
+
+    /// Incorporate an RTT sample into SmoothedRTTUsec and RTTVarianceUsec,
+    /// at most once per SRTT interval of LastRecvUsec
+    void UpdateRTT(uint32_t rttUsec);
+
+    /// Update the recent minimum and reset the window on route change
+    void CheckRouteChange(Counter64 deltaX64, uint64_t localRecvUsec);
+};
+
+
+//------------------------------------------------------------------------------
+// TimeConversionCache
+
+/**
+    Per-thread cache of a synchronizer's TimeConversionParams.
+
+    Threads that convert many timestamps, for example a batch of packets per
+    event loop iteration, can keep one of these per synchronizer (e.g. as a
+    thread_local) and call Refresh() once per batch.  Conversions in between
+    are plain arithmetic on the cached copy with no atomic loads.  Refresh()
+    only unpacks new parameters when the generation has changed, which
+    happens only when the offset moves.
+*/
+class TimeConversionCache
+{
+public:
+    /// Refresh from the synchronizer.
+    /// Returns true if the cached parameters changed
+    inline bool Refresh(const TimeSynchronizer& sync)
+    {
+        const TimeConversionParams params = sync.GetConversionParams();
+        if (params.Generation == Params.Generation) {
+            return false;
+        }
+        Params = params;
+        return true;
+    }
+
+    /// Get the cached parameters
+    inline const TimeConversionParams& GetParams() const
+    {
+        return Params;
+    }
+
+    /// Returns 16-bit remote time field to send in a packet
+    inline uint16_t ToRemoteTime16(uint64_t localUsec) const
+    {
+        return Params.ToRemoteTime16(localUsec);
+    }
+
+    /// Returns 23-bit remote time field to send in a packet
+    inline uint32_t ToRemoteTime23(uint64_t localUsec) const
+    {
+        return Params.ToRemoteTime23(localUsec);
+    }
+
+    /// Returns local time given a 23-bit timestamp in the remote clock
+    inline uint64_t FromRemoteTime23(uint64_t localUsec, Counter23 remoteTS23) const
+    {
+        return Params.FromRemoteTime23(localUsec, remoteTS23);
+    }
+
+protected:
+    TimeConversionParams Params;
+};
+
+
+//------------------------------------------------------------------------------
+// MultipathTimeSynchronizer
+
+/**
+    TimeSynchronizer for peers that send over several paths at once, for
+    example Wi-Fi and LTE, where each path has a very different base OWD.
+
+    All paths share one clock offset estimate, which comes from the fastest
+    path as before.  Each path also keeps its own windowed minimum, so that
+    the base delay and queuing delay can be reported per path rather than
+    reporting the slow path's extra base delay as queuing.
+*/
+class MultipathTimeSynchronizer : public TimeSynchronizer
+{
+public:
+    /// Maximum number of paths
+    static const unsigned kMaxPaths = 4;
+
+    /**
+        OnAuthenticatedDatagramTimestamp()
+
+        Same as TimeSynchronizer::OnAuthenticatedDatagramTimestamp() with a
+        path identifier in [0, kMaxPaths).  Datagrams with an invalid path
+        identifier are ignored and return 0.
+
+        Datagrams that arrive through the inherited entry points without a
+        path identifier, e.g. OnAuthenticatedDatagramTimestampNs() or
+        OnFourTimestampExchange(), or through a TimeSynchronizer reference,
+        are counted as path 0.
+
+        Route changes are only checked on the path with the lowest base
+        delay, since a slower path is expected to have larger deltas.  A
+        route change on another path shows up in its base delay once the old
+        minimum ages out of the drift window.
+
+        Returns estimated one way delay (OWD) in microseconds for this datagram.
+        Returns 0 if OWD is unavailable.
+    */
+    unsigned OnAuthenticatedDatagramTimestamp(
+        Counter24 remoteSendTS24,
+        uint64_t localRecvUsec,
+        unsigned pathId);
+
+    /// Has a datagram been received on this path?
+    inline bool IsPathValid(unsigned pathId) const
+    {
+        return pathId < kMaxPaths && PathMinDeltas[pathId].IsValid();
+    }
+
+    /// Base (minimum) OWD of the path from the peer.
+    /// Returns 0 if unavailable
+    uint32_t GetPathBaseDelayUsec(unsigned pathId) const;
+
+    /// Queuing delay of the most recent datagram on the path from the peer
+    uint32_t GetPathQueuingDelayUsec(unsigned pathId) const;
+
+    /// Current OWD of the path: Base delay + queuing delay.
+    /// Returns 0 if unavailable
+    uint32_t GetPathOneWayDelayUsec(unsigned pathId) const;
+
+    /// Returns the path with the lowest current OWD, or kMaxPaths if none
+    unsigned GetLowestDelayPath() const;
+
+protected:
+    /// Windowed minimum of (receipt - send) deltas for each path
+    WindowedMinX64 PathMinDeltas[kMaxPaths]; ///< in expanded TS37 units
+
+    /// Delta of the most recent datagram on each path
+    Counter64 PathLastDeltas[kMaxPaths]; ///< in expanded TS37 units
+
+
+    /// Also clears the per-path windows
+    void ResetState() override;
+
+    /// Datagrams without a path identifier are counted as path 0
+    uint64_t OnDatagramDeltaTS37(
+        Counter37 deltaTS37,
+        uint64_t localRecvUsec,
+        bool checkRouteChange) override;
+
+    /// Process the delta of a datagram received on the given path
+    uint64_t OnPathDeltaTS37(
+        Counter37 deltaTS37,
+        uint64_t localRecvUsec,
+        unsigned pathId);
+
+    /// Returns the valid path with the smallest minimum delta, or kMaxPaths
+    unsigned GetLowestBasePath() const;
 };
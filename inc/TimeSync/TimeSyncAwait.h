@@ -0,0 +1,271 @@
+/** \file
+    \brief TimeSync: Awaiting Synchronization and Synchronized Instants
+    \copyright Copyright (c) 2017-2018 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of TimeSync nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "TimeSync.h"
+#include "TimerWheel.h"
+
+#include <vector>
+
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+    #if __has_include(<coroutine>)
+        #include <coroutine>
+        #define TIMESYNC_COROUTINES
+    #endif
+#endif
+
+/**
+    Awaitable TimeSync
+
+    Application code often needs to wait until IsSynchronized() becomes true,
+    or until a given remote time arrives.  AwaitableTimeSynchronizer wraps a
+    TimeSynchronizer and runs waiters on a pluggable TimeSyncEventLoop, so
+    that thousands of waiting tasks cost no threads and no polling.
+
+    The core API is callback based.  When compiled as C++20 with coroutine
+    support, these are also available as awaitables:
+
+        co_await awaitable.Synchronized();
+        co_await awaitable.UntilRemoteTime(ts23);
+
+    Waiters are released from a TimeSynchronizer::SetSynchronizedCallback()
+    hook, so the synchronizer can be fed through any of its entry points or
+    helpers (MinDeltaCodec.h, MinDeltaPiggyback.h, etc).
+
+    A pending wait can be withdrawn with Cancel(), and a suspended coroutine
+    that is destroyed withdraws its own wait.  The event loop only holds a
+    pointer to the AwaitableTimeSynchronizer, which must outlive any
+    callbacks it has posted or scheduled.
+
+    This class is not thread-safe: The synchronizer should be fed and
+    waited on from the event loop thread.
+*/
+
+
+//------------------------------------------------------------------------------
+// TimeSyncWait
+
+class AwaitableTimeSynchronizer;
+
+/// Storage for one waiter, owned by the caller until its callback runs or
+/// it is cancelled
+struct TimeSyncWait
+{
+    /// Callback to invoke
+    TimerWheel::Callback Func = nullptr;
+
+    /// Context passed to the callback
+    void* Context = nullptr;
+
+    /// If true: Wait until RemoteTS23 arrives.  Otherwise just wait for sync
+    bool HasRemoteTime = false;
+
+    /// Remote time to wait for
+    Counter23 RemoteTS23 = 0;
+
+    /// Set by AwaitableTimeSynchronizer while the wait is pending
+    bool Pending = false;
+};
+
+
+//------------------------------------------------------------------------------
+// AwaitableTimeSynchronizer
+
+class AwaitableTimeSynchronizer
+{
+public:
+    /// Takes over the synchronized callback of the synchronizer
+    AwaitableTimeSynchronizer(TimeSynchronizer& sync, TimeSyncEventLoop& loop);
+    ~AwaitableTimeSynchronizer();
+
+    /// Forwards to TimeSynchronizer::OnAuthenticatedDatagramTimestamp()
+    inline unsigned OnAuthenticatedDatagramTimestamp(
+        Counter24 remoteSendTS24,
+        uint64_t localRecvUsec)
+    {
+        return Sync.OnAuthenticatedDatagramTimestamp(remoteSendTS24, localRecvUsec);
+    }
+
+    /// Forwards to TimeSynchronizer::OnPeerMinDeltaTS24()
+    inline void OnPeerMinDeltaTS24(Counter24 minDeltaTS24)
+    {
+        Sync.OnPeerMinDeltaTS24(minDeltaTS24);
+    }
+
+    /// Is time synchronized?
+    inline bool IsSynchronized() const
+    {
+        return Sync.IsSynchronized();
+    }
+
+    /**
+        Wait()
+
+        Run wait->Func on the event loop once time is synchronized, or once
+        the remote time wait->RemoteTS23 arrives if wait->HasRemoteTime is
+        set.  The wait object must stay alive until the callback runs or
+        Cancel() removes it.
+
+        The local time of a remote time wait is computed from the offset
+        estimate when the wait is scheduled.  If the offset moves before the
+        timer expires, the remote time is checked again and the timer is set
+        again if it has not arrived yet, so the callback never runs early.
+        If the offset moves the remote time earlier instead, the callback
+        runs late by that amount.
+    */
+    void Wait(TimeSyncWait* wait);
+
+    /// Withdraw a wait so that its callback never runs.
+    /// Returns false if it is not pending, e.g. because it already ran
+    bool Cancel(TimeSyncWait* wait);
+
+    /// Number of waiters blocked on synchronization
+    inline size_t GetWaiterCount() const
+    {
+        return Waiters.size();
+    }
+
+#ifdef TIMESYNC_COROUTINES
+
+    /// Awaiter returned by Synchronized() and UntilRemoteTime()
+    class Awaiter
+    {
+    public:
+        Awaiter(AwaitableTimeSynchronizer& owner, bool hasRemoteTime, Counter23 remoteTS23)
+            : Owner(owner)
+        {
+            State.HasRemoteTime = hasRemoteTime;
+            State.RemoteTS23 = remoteTS23;
+        }
+
+        /// Runs when the coroutine frame is destroyed, possibly while the
+        /// coroutine is still suspended
+        ~Awaiter()
+        {
+            Owner.Cancel(&State);
+        }
+
+        Awaiter(const Awaiter&) = delete;
+        Awaiter& operator=(const Awaiter&) = delete;
+
+        bool await_ready()
+        {
+            if (!Owner.IsSynchronized()) {
+                return false;
+            }
+            if (!State.HasRemoteTime) {
+                return true;
+            }
+            const uint64_t nowUsec = Owner.Loop.GetLocalUsec();
+            return Owner.Sync.FromRemoteTime23(nowUsec, State.RemoteTS23) <= nowUsec;
+        }
+
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            State.Func = &Awaiter::ResumeCoroutine;
+            State.Context = handle.address();
+            Owner.Wait(&State);
+        }
+
+        void await_resume()
+        {
+        }
+
+    protected:
+        AwaitableTimeSynchronizer& Owner;
+        TimeSyncWait State;
+
+        static void ResumeCoroutine(void* context)
+        {
+            std::coroutine_handle<>::from_address(context).resume();
+        }
+    };
+
+    /// co_await this to wait until time is synchronized
+    inline Awaiter Synchronized()
+    {
+        return Awaiter(*this, false, 0);
+    }
+
+    /// co_await this to wait until the given remote time arrives
+    inline Awaiter UntilRemoteTime(Counter23 remoteTS23)
+    {
+        return Awaiter(*this, true, remoteTS23);
+    }
+
+#endif // TIMESYNC_COROUTINES
+
+protected:
+    /// Synchronizer being wrapped
+    TimeSynchronizer& Sync;
+
+    /// Event loop that runs the callbacks
+    TimeSyncEventLoop& Loop;
+
+    /// Waiters blocked on synchronization
+    std::vector<TimeSyncWait*> Waiters;
+
+    /// Waiters to run on the next posted callback.
+    /// Cancelled entries are set to nullptr until the list is run
+    std::vector<TimeSyncWait*> Ready;
+
+    /// Waiters for a remote time
+    std::vector<TimeSyncWait*> Timed;
+
+    /// Is a callback posted to run the Ready list?
+    bool ReadyPosted = false;
+
+    /// Is a timer scheduled for the Timed list, and when?
+    bool TimerScheduled = false;
+    uint64_t TimerUsec = 0;
+
+
+    /// Synchronized callback: Release all waiters
+    static void OnSynchronized(void* context);
+
+    /// Hand a waiter to the event loop
+    void Release(TimeSyncWait* wait);
+
+    /// Post a callback to run the Ready list if not already posted
+    void PostReady();
+
+    /// Posted callback: Runs the Ready list
+    static void OnReadyPosted(void* context);
+
+    /// Run the waiters that are in the Ready list now
+    void RunReady();
+
+    /// Schedule a timer for the Timed list if localUsec is sooner than the
+    /// pending one
+    void ScheduleTimer(uint64_t localUsec);
+
+    /// Timer callback: Runs the waiters whose remote time has arrived
+    static void OnTimer(void* context);
+};
@@ -0,0 +1,186 @@
+/** \file
+    \brief TimeSync: Timer Wheel and Event Loop Interface
+    \copyright Copyright (c) 2017-2018 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of TimeSync nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+    Timer Wheel
+
+    A hashed timer wheel for scheduling many callbacks at local microsecond
+    times without a thread or a polling loop per timer.  Each slot covers one
+    tick of time, and timers that are more than one revolution in the future
+    stay in their slot until their expiration time is reached.
+
+    Schedule() and Cancel() are O(1) and O(timers in slot) respectively.
+    Advance() is O(ticks elapsed + timers expired).
+
+    This class is not thread-safe.
+*/
+
+
+//------------------------------------------------------------------------------
+// TimerWheel
+
+class TimerWheel
+{
+public:
+    /// Callback invoked when a timer expires
+    typedef void (*Callback)(void* context);
+
+    /**
+        tickUsec: Resolution of each slot in microseconds.
+        slotCount: Number of slots in the wheel, between 1 and 65536.
+    */
+    explicit TimerWheel(uint64_t tickUsec = 1000, unsigned slotCount = 256);
+
+    /// Schedule a callback at the given local time.
+    /// Returns an identifier that can be passed to Cancel()
+    uint64_t Schedule(uint64_t expireUsec, Callback callback, void* context);
+
+    /// Cancel a scheduled timer.  Returns false if it is no longer pending
+    bool Cancel(uint64_t timerId);
+
+    /// Invoke all callbacks with expiration times at or before nowUsec.
+    /// Callbacks may schedule new timers.  Returns the number invoked
+    unsigned Advance(uint64_t nowUsec);
+
+    /// Returns a lower bound on the next expiration time, suitable for
+    /// sleeping until the next Advance().  Returns 0 if nothing is pending
+    uint64_t GetNextExpireUsec() const;
+
+    /// Number of timers pending
+    inline size_t GetPendingCount() const
+    {
+        return PendingCount;
+    }
+
+protected:
+    struct Entry
+    {
+        uint64_t ExpireUsec;
+        uint64_t TimerId;
+        Callback Func;
+        void* Context;
+    };
+
+    /// Resolution of each slot
+    uint64_t TickUsec;
+
+    /// Slots indexed by (expire tick % slot count)
+    std::vector< std::vector<Entry> > Slots;
+
+    /// Last tick that was processed by Advance()
+    uint64_t LastTick = 0;
+
+    /// Has Advance() been called yet?
+    bool Started = false;
+
+    /// Number of timers pending
+    size_t PendingCount = 0;
+
+    /// Next timer identifier, shifted up above the slot index bits
+    uint64_t NextTimerId = 1;
+
+    /// Scratch space for expired entries, kept to avoid reallocation
+    std::vector<Entry> Expired;
+};
+
+
+//------------------------------------------------------------------------------
+// TimeSyncEventLoop
+
+/**
+    Pluggable event loop interface.
+
+    Applications that already have an event loop can implement this to run
+    TimeSync wait callbacks on their loop thread.  TimerWheelEventLoop is a
+    simple implementation driven by the application calling Poll().
+*/
+class TimeSyncEventLoop
+{
+public:
+    virtual ~TimeSyncEventLoop() {}
+
+    /// Returns the current local time in microseconds
+    virtual uint64_t GetLocalUsec() = 0;
+
+    /// Run the callback soon on the loop thread
+    virtual void Post(TimerWheel::Callback callback, void* context) = 0;
+
+    /// Run the callback on the loop thread at or after the given local time
+    virtual void ScheduleAt(uint64_t localUsec, TimerWheel::Callback callback, void* context) = 0;
+};
+
+
+//------------------------------------------------------------------------------
+// TimerWheelEventLoop
+
+/// Event loop backed by a TimerWheel and driven by Poll()
+class TimerWheelEventLoop : public TimeSyncEventLoop
+{
+public:
+    explicit TimerWheelEventLoop(uint64_t tickUsec = 1000, unsigned slotCount = 256)
+        : Wheel(tickUsec, slotCount)
+    {
+    }
+
+    uint64_t GetLocalUsec() override
+    {
+        return NowUsec;
+    }
+    void Post(TimerWheel::Callback callback, void* context) override;
+    void ScheduleAt(uint64_t localUsec, TimerWheel::Callback callback, void* context) override;
+
+    /// Run posted callbacks and expired timers.  Returns the number run
+    unsigned Poll(uint64_t nowUsec);
+
+    /// Returns a lower bound on the next time Poll() has work to do.
+    /// Returns 0 if nothing is pending
+    uint64_t GetNextWakeUsec() const;
+
+protected:
+    struct Posted
+    {
+        TimerWheel::Callback Func;
+        void* Context;
+    };
+
+    /// Timers
+    TimerWheel Wheel;
+
+    /// Callbacks waiting to run on the next Poll()
+    std::vector<Posted> PostedCallbacks;
+
+    /// Time provided to the last Poll()
+    uint64_t NowUsec = 0;
+};
@@ -0,0 +1,204 @@
+/** \file
+    \brief TimeSync: C API for FFI Consumers
+    \copyright Copyright (c) 2017-2018 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of TimeSync nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+    TimeSync C API
+
+    Plain C interface to TimeSynchronizer for callers in other languages
+    (Python ctypes/cffi, Rust, Go, Java FFM, ...).  Synchronizers are opaque
+    handles, and the hot paths take arrays so that a caller pays the
+    foreign function call once per batch of timestamps rather than once per
+    timestamp:
+
+        timesync_sync_t* sync = timesync_create();
+        ...
+        timesync_ingest_ts24(sync, sendTS24, recvUsec, owdUsec, count);
+        timesync_to_remote_ts23(sync, localUsec, remoteTS23, count);
+        ...
+        timesync_destroy(sync);
+
+    Functions that write arrays never read the outputs first, and outputs
+    that are marked optional may be NULL.  Input and output arrays must not
+    overlap.  The same threading rules apply as for TimeSynchronizer: calls
+    that ingest must be serialized, while conversions are safe from any
+    thread.
+
+    Functions and types are only ever added, so code built against an older
+    version of this header keeps working.  TIMESYNC_C_VERSION is bumped on
+    additions.
+*/
+
+#define TIMESYNC_C_VERSION 1
+
+#if defined(_WIN32)
+    #define TIMESYNC_C_API
+#else
+    #define TIMESYNC_C_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/*------------------------------------------------------------------------------
+    Handles
+*/
+
+/** Opaque handle to a TimeSynchronizer */
+typedef struct timesync_sync_t timesync_sync_t;
+
+/** Returns TIMESYNC_C_VERSION of the library, which may be newer */
+TIMESYNC_C_API uint32_t timesync_c_version(void);
+
+/** Create a synchronizer.  Returns NULL on allocation failure */
+TIMESYNC_C_API timesync_sync_t* timesync_create(void);
+
+/** Destroy a synchronizer.  NULL is ignored */
+TIMESYNC_C_API void timesync_destroy(timesync_sync_t* sync);
+
+
+/*------------------------------------------------------------------------------
+    State
+*/
+
+/** Returns 1 if the offset is valid, 0 otherwise */
+TIMESYNC_C_API int timesync_is_synchronized(const timesync_sync_t* sync);
+
+/** Returns the signed (remote - local) clock delta in microseconds */
+TIMESYNC_C_API int32_t timesync_get_remote_delta_usec(const timesync_sync_t* sync);
+
+/** Returns the minimum one-way delay in microseconds */
+TIMESYNC_C_API uint32_t timesync_get_min_owd_usec(const timesync_sync_t* sync);
+
+/** Returns the 24-bit MinDeltaTS24 value to send to the peer */
+TIMESYNC_C_API uint32_t timesync_get_min_delta_ts24(const timesync_sync_t* sync);
+
+/** Provide the peer's latest 24-bit MinDeltaTS24 value */
+TIMESYNC_C_API void timesync_on_peer_min_delta_ts24(
+    timesync_sync_t* sync,
+    uint32_t minDeltaTS24);
+
+
+/*------------------------------------------------------------------------------
+    Batch Ingest
+
+    Feed authenticated datagram timestamps in arrival order, as for
+    TimeSynchronizer::OnAuthenticatedDatagramTimestamp().
+*/
+
+/**
+    timesync_ingest_ts24()
+
+    remoteSendTS24: 24-bit send timestamps from the datagrams.
+    localRecvUsec: Local receive times in microseconds.
+    owdUsecOut: Optional estimated OWD per datagram, 0 if unavailable.
+    count: Number of datagrams.
+*/
+TIMESYNC_C_API void timesync_ingest_ts24(
+    timesync_sync_t* sync,
+    const uint32_t* remoteSendTS24,
+    const uint64_t* localRecvUsec,
+    uint32_t* owdUsecOut,
+    size_t count);
+
+/** Same as timesync_ingest_ts24() with receive times and OWD in nanoseconds */
+TIMESYNC_C_API void timesync_ingest_ts24_ns(
+    timesync_sync_t* sync,
+    const uint32_t* remoteSendTS24,
+    const uint64_t* localRecvNsec,
+    uint64_t* owdNsecOut,
+    size_t count);
+
+
+/*------------------------------------------------------------------------------
+    Batch Conversions
+
+    Each call reads the synchronizer state once, so a batch is converted
+    with one consistent offset.
+*/
+
+/** Convert local times in microseconds to 24-bit datagram timestamps */
+TIMESYNC_C_API void timesync_to_datagram_ts24(
+    const uint64_t* localUsec,
+    uint32_t* ts24Out,
+    size_t count);
+
+/** Convert local times in microseconds to 23-bit remote timestamps.
+    Writes zeros if not synchronized */
+TIMESYNC_C_API void timesync_to_remote_ts23(
+    const timesync_sync_t* sync,
+    const uint64_t* localUsec,
+    uint32_t* remoteTS23Out,
+    size_t count);
+
+/** Convert 23-bit remote timestamps to local times in microseconds.
+    localUsec holds a local time near each timestamp, e.g. its receive time */
+TIMESYNC_C_API void timesync_from_remote_ts23(
+    const timesync_sync_t* sync,
+    const uint64_t* localUsec,
+    const uint32_t* remoteTS23,
+    uint64_t* localUsecOut,
+    size_t count);
+
+/** Convert 23-bit timestamps in the local clock, as received from the peer,
+    to local times in microseconds.  localUsec holds each receive time */
+TIMESYNC_C_API void timesync_from_local_ts23(
+    const uint64_t* localUsec,
+    const uint32_t* localTS23,
+    uint64_t* localUsecOut,
+    size_t count);
+
+/**
+    timesync_expand_counters()
+
+    Expand truncated counters of 1 to 32 bits to 64 bits, e.g. sequence
+    numbers or timestamps read from a log.  Each value is expanded next to
+    the previous result, starting from recent, so long runs that wrap many
+    times expand correctly as long as neighbours are within half the
+    counter range of each other.
+
+    Returns the number of values expanded: count, or 0 if bits is invalid.
+*/
+TIMESYNC_C_API size_t timesync_expand_counters(
+    unsigned bits,
+    uint64_t recent,
+    const uint32_t* truncated,
+    uint64_t* expandedOut,
+    size_t count);
+
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,77 @@
+/** \file
+    \brief TimeSync: Lock-Free Synchronizer Event Queue
+    \copyright Copyright (c) 2017-2018 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of TimeSync nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <TimeSync/EventQueue.h>
+
+
+//------------------------------------------------------------------------------
+// TimeSyncEventQueue
+
+TimeSyncEventQueue::TimeSyncEventQueue(unsigned capacity)
+{
+    uint64_t size = 2;
+    while (size < capacity) {
+        size <<= 1;
+    }
+
+    Cells.reset(new Cell[(size_t)size]);
+    Mask = size - 1;
+
+    // Cell i is free for the producer at position i
+    for (uint64_t i = 0; i < size; ++i) {
+        Cells[(size_t)i].Sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+bool TimeSyncEventQueue::Pop(TimeSyncEvent& event)
+{
+    Cell* cell = &Cells[(size_t)(DequeuePosition & Mask)];
+    const uint64_t sequence = cell->Sequence.load(std::memory_order_acquire);
+
+    // Not yet written by the producer that claimed it
+    if (sequence != DequeuePosition + 1) {
+        return false;
+    }
+
+    event = cell->Event;
+
+    // Free the cell for the producer one lap ahead
+    cell->Sequence.store(DequeuePosition + Mask + 1, std::memory_order_release);
+    ++DequeuePosition;
+    return true;
+}
+
+unsigned TimeSyncEventQueue::PopBatch(TimeSyncEvent* events, unsigned maxCount)
+{
+    unsigned count = 0;
+    while (count < maxCount && Pop(events[count])) {
+        ++count;
+    }
+    return count;
+}
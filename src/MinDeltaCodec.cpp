@@ -0,0 +1,187 @@
+/** \file
+    \brief TimeSync: Delta-Encoded MinDelta Updates
+    \copyright Copyright (c) 2017-2018 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of TimeSync nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <TimeSync/MinDeltaCodec.h>
+
+
+//------------------------------------------------------------------------------
+// Constants
+
+static const uint8_t kFullFlag = 0x80;
+static const uint8_t kAbsoluteHeader = 0xa0;
+static const uint8_t kAckFlag = 0xc0;
+static const uint8_t kTypeMask = 0xc0;
+static const uint8_t kIdMask = 3;
+
+static const unsigned kDeltaIdShift = 5;
+static const uint8_t kDeltaMask = 0x1f;
+static const int32_t kDeltaMin = -16;
+static const int32_t kDeltaMax = 15;
+
+
+//------------------------------------------------------------------------------
+// MinDeltaEncoder
+
+unsigned MinDeltaEncoder::Encode(Counter24 minDeltaTS24, uint64_t localUsec, uint8_t* data)
+{
+    // Delta from the acknowledged base, sign-extended from 24 bits
+    const uint32_t diff = (minDeltaTS24 - AckedValue).ToUnsigned();
+    const int32_t delta = (int32_t)(diff << 8) >> 8;
+
+    const bool refreshDue = (uint64_t)(localUsec - AckedSentUsec) >= FullRefreshUsec;
+
+    if (AckedValid && !refreshDue && delta >= kDeltaMin && delta <= kDeltaMax)
+    {
+        data[0] = (uint8_t)((AckedId << kDeltaIdShift) | ((uint32_t)delta & kDeltaMask));
+        ++DeltaCount;
+        return kMinDeltaDeltaBytes;
+    }
+
+    // Resend the pending base if the value is the same
+    if (PendingValid && PendingValue == minDeltaTS24) {
+        return WritePendingFull(localUsec, data);
+    }
+
+    // Start a new base with an id that is not in use
+    for (unsigned i = 0; i < kIdCount; ++i)
+    {
+        const uint8_t id = (NextId + i) & kIdMask;
+        if ((AckedValid && id == AckedId) ||
+            (IdUsed[id] && (uint64_t)(localUsec - IdSentUsec[id]) < IdReuseUsec))
+        {
+            continue;
+        }
+
+        PendingValid = true;
+        PendingId = id;
+        PendingValue = minDeltaTS24;
+        NextId = (id + 1) & kIdMask;
+        return WritePendingFull(localUsec, data);
+    }
+
+    // All ids are in use: Send the value without a base
+    data[0] = kAbsoluteHeader;
+    HibernatedTimeSync::Write24(data + 1, minDeltaTS24.ToUnsigned());
+    ++FullCount;
+    return kMinDeltaFullBytes;
+}
+
+unsigned MinDeltaEncoder::WritePendingFull(uint64_t localUsec, uint8_t* data)
+{
+    PendingSentUsec = localUsec;
+    IdUsed[PendingId] = true;
+    IdSentUsec[PendingId] = localUsec;
+
+    data[0] = kFullFlag | PendingId;
+    HibernatedTimeSync::Write24(data + 1, PendingValue.ToUnsigned());
+    ++FullCount;
+    return kMinDeltaFullBytes;
+}
+
+bool MinDeltaEncoder::OnAck(uint8_t ack)
+{
+    if ((ack & kTypeMask) != kAckFlag || (ack & ~(kTypeMask | kIdMask)) != 0) {
+        return false;
+    }
+
+    const uint8_t id = ack & kIdMask;
+    if (!PendingValid || id != PendingId) {
+        return false; // Duplicate or stale ack
+    }
+
+    AckedValid = true;
+    AckedId = PendingId;
+    AckedValue = PendingValue;
+    AckedSentUsec = PendingSentUsec;
+    PendingValid = false;
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+// MinDeltaDecoder
+
+unsigned MinDeltaDecoder::Decode(TimeSynchronizer& sync, const uint8_t* data, unsigned bytes)
+{
+    if (bytes < 1) {
+        return 0;
+    }
+
+    const uint8_t header = data[0];
+
+    // Delta update
+    if ((header & kFullFlag) == 0)
+    {
+        const unsigned id = (header >> kDeltaIdShift) & kIdMask;
+        if (!BaseValid[id]) {
+            return 0;
+        }
+
+        // Sign-extend from 5 bits
+        const int32_t delta = (int32_t)((uint32_t)(header & kDeltaMask) << 27) >> 27;
+        sync.OnPeerMinDeltaTS24(Bases[id] + (uint32_t)delta);
+        ++UpdateCount;
+        return kMinDeltaDeltaBytes;
+    }
+
+    // Absolute update
+    if (header == kAbsoluteHeader)
+    {
+        if (bytes < kMinDeltaFullBytes) {
+            return 0;
+        }
+        sync.OnPeerMinDeltaTS24(HibernatedTimeSync::Read24(data + 1));
+        ++UpdateCount;
+        return kMinDeltaFullBytes;
+    }
+
+    // Full update
+    if ((header & kTypeMask) != kFullFlag ||
+        (header & ~(kTypeMask | kIdMask)) != 0 ||
+        bytes < kMinDeltaFullBytes)
+    {
+        return 0;
+    }
+
+    const unsigned id = header & kIdMask;
+    Bases[id] = HibernatedTimeSync::Read24(data + 1);
+    BaseValid[id] = true;
+    AckPending = true;
+    AckId = (uint8_t)id;
+
+    sync.OnPeerMinDeltaTS24(Bases[id]);
+    ++UpdateCount;
+    return kMinDeltaFullBytes;
+}
+
+uint8_t MinDeltaDecoder::WriteAck()
+{
+    AckPending = false;
+    return kAckFlag | AckId;
+}
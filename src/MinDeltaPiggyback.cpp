@@ -0,0 +1,162 @@
+/** \file
+    \brief TimeSync: MinDelta Piggybacking
+    \copyright Copyright (c) 2017-2018 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of TimeSync nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <TimeSync/MinDeltaPiggyback.h>
+
+
+//------------------------------------------------------------------------------
+// MinDeltaPiggybacker
+
+MinDeltaPiggybacker::MinDeltaPiggybacker(
+    const TimeSynchronizer& sync,
+    const PiggybackParams& params)
+    : Sync(sync)
+    , Params(params)
+{
+    BudgetMicroBytes = (uint64_t)Params.BurstAttachments * kMinDeltaAttachmentBytes * 1000000;
+}
+
+bool MinDeltaPiggybacker::UpdateDue(uint64_t localUsec)
+{
+    if (!Sync.HasMinDelta()) {
+        return false;
+    }
+
+    if (Due) {
+        return true;
+    }
+
+    if (!SentAny || Sync.GetMinDeltaTS24() != LastSentTS24)
+    {
+        Due = true;
+        DueUsec = localUsec;
+        return true;
+    }
+
+    const bool startup = (uint64_t)(localUsec - FirstSentUsec) < Params.StartupDurationUsec;
+    const uint64_t refreshUsec = startup ? Params.StartupRefreshIntervalUsec : Params.RefreshIntervalUsec;
+    if ((uint64_t)(localUsec - LastSentUsec) >= refreshUsec)
+    {
+        Due = true;
+        DueUsec = LastSentUsec + refreshUsec;
+        return true;
+    }
+
+    return false;
+}
+
+void MinDeltaPiggybacker::OnSent(uint64_t localUsec, uint8_t* data)
+{
+    LastSentTS24 = Sync.GetMinDeltaTS24();
+    HibernatedTimeSync::Write24(data, LastSentTS24.ToUnsigned());
+
+    if (!SentAny)
+    {
+        SentAny = true;
+        FirstSentUsec = localUsec;
+    }
+    LastSentUsec = localUsec;
+    Due = false;
+}
+
+unsigned MinDeltaPiggybacker::OnDataPacket(uint64_t localUsec, uint8_t* attachment, unsigned availableBytes)
+{
+    // Refill the byte budget
+    const uint64_t capacity = (uint64_t)Params.BurstAttachments * kMinDeltaAttachmentBytes * 1000000;
+    const uint64_t elapsedUsec = localUsec - BudgetUpdateUsec;
+    BudgetUpdateUsec = localUsec;
+    if (Params.BudgetBytesPerSecond == 0) {
+        BudgetMicroBytes = 0;
+    }
+    else if (elapsedUsec >= capacity / Params.BudgetBytesPerSecond) {
+        BudgetMicroBytes = capacity;
+    }
+    else
+    {
+        BudgetMicroBytes += elapsedUsec * Params.BudgetBytesPerSecond;
+        if (BudgetMicroBytes > capacity) {
+            BudgetMicroBytes = capacity;
+        }
+    }
+
+    if (availableBytes < kMinDeltaAttachmentBytes ||
+        BudgetMicroBytes < kMinDeltaAttachmentBytes * 1000000 ||
+        !UpdateDue(localUsec))
+    {
+        return 0;
+    }
+
+    BudgetMicroBytes -= kMinDeltaAttachmentBytes * 1000000;
+    OnSent(localUsec, attachment);
+    ++AttachmentCount;
+    return kMinDeltaAttachmentBytes;
+}
+
+bool MinDeltaPiggybacker::NeedsStandaloneUpdate(uint64_t localUsec)
+{
+    return UpdateDue(localUsec) &&
+        (uint64_t)(localUsec - DueUsec) >= Params.StalenessDeadlineUsec;
+}
+
+unsigned MinDeltaPiggybacker::WriteStandaloneUpdate(uint64_t localUsec, uint8_t* data)
+{
+    OnSent(localUsec, data);
+    ++StandaloneCount;
+    return kMinDeltaAttachmentBytes;
+}
+
+uint64_t MinDeltaPiggybacker::GetStandaloneDeadlineUsec(uint64_t localUsec)
+{
+    if (UpdateDue(localUsec)) {
+        return DueUsec + Params.StalenessDeadlineUsec;
+    }
+    if (!SentAny) {
+        return 0;
+    }
+
+    // Next refresh, assuming the value does not change before then
+    const bool startup = (uint64_t)(localUsec - FirstSentUsec) < Params.StartupDurationUsec;
+    const uint64_t refreshUsec = startup ? Params.StartupRefreshIntervalUsec : Params.RefreshIntervalUsec;
+    return LastSentUsec + refreshUsec + Params.StalenessDeadlineUsec;
+}
+
+
+//------------------------------------------------------------------------------
+// MinDeltaPiggybackParser
+
+bool MinDeltaPiggybackParser::OnAttachment(TimeSynchronizer& sync, const uint8_t* data, unsigned bytes)
+{
+    if (bytes < kMinDeltaAttachmentBytes) {
+        return false;
+    }
+
+    sync.OnPeerMinDeltaTS24(HibernatedTimeSync::Read24(data));
+    ++UpdateCount;
+    return true;
+}
@@ -0,0 +1,300 @@
+/** \file
+    \brief TimeSync: NTPv4 Responder
+    \copyright Copyright (c) 2017-2018 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of TimeSync nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <TimeSync/NtpServer.h>
+
+#include <errno.h>
+#include <string.h>
+
+#ifdef __linux__
+    #include <arpa/inet.h>
+    #include <netinet/in.h>
+    #include <poll.h>
+    #include <sys/socket.h>
+    #include <time.h>
+    #include <unistd.h>
+#endif // __linux__
+
+
+//------------------------------------------------------------------------------
+// NtpResponder
+
+/// Convert microseconds to NTP short format (16.16 fixed-point seconds)
+static uint32_t UsecToNtpShort(uint32_t usec)
+{
+    return (uint32_t)(((uint64_t)usec << 16) / 1000000);
+}
+
+static void WriteU32(uint8_t* data, uint32_t x)
+{
+    data[0] = (uint8_t)(x >> 24);
+    data[1] = (uint8_t)(x >> 16);
+    data[2] = (uint8_t)(x >> 8);
+    data[3] = (uint8_t)x;
+}
+
+bool NtpResponder::BuildResponse(
+    const uint8_t* request,
+    unsigned requestBytes,
+    uint64_t recvUnixNsec,
+    uint64_t sendUnixNsec,
+    uint8_t* response) const
+{
+    if (requestBytes < kNtpPacketBytes) {
+        return false;
+    }
+
+    // Only answer client mode (3) requests of versions 1-4
+    const unsigned version = (request[0] >> 3) & 7;
+    const unsigned mode = request[0] & 7;
+    if (mode != 3 || version < 1 || version > 4) {
+        return false;
+    }
+
+    const bool synchronized = Sync.IsSynchronized();
+    const int64_t offsetNsec = Sync.GetSignedRemoteTimeDeltaNsec();
+    const uint32_t minOWDUsec = Sync.GetMinimumOneWayDelayUsec();
+
+    // LI = 3 (alarm) and stratum 16 until synchronized
+    const unsigned leap = synchronized ? 0 : 3;
+    response[0] = (uint8_t)((leap << 6) | (version << 3) | 4);
+    response[1] = synchronized ? Params.Stratum : 16;
+    response[2] = request[2]; // Poll
+    response[3] = (uint8_t)Params.Precision;
+
+    // Root delay is the RTT to the core, and the worst case error from link
+    // asymmetry is +/- the minimum OWD
+    WriteU32(response + 4, UsecToNtpShort(minOWDUsec * 2));
+    WriteU32(response + 8, UsecToNtpShort(minOWDUsec));
+    WriteU32(response + 12, Params.ReferenceId);
+
+    const uint64_t recvNtp = UnixNsecToNtpTimestamp(recvUnixNsec + offsetNsec);
+
+    // Reference time: The estimate is refreshed continuously
+    WriteNtpTimestamp(response + 16, recvNtp);
+
+    // Origin time: Client transmit time copied from the request
+    memcpy(response + 24, request + 40, 8);
+
+    WriteNtpTimestamp(response + 32, recvNtp);
+    WriteNtpTimestamp(response + 40, UnixNsecToNtpTimestamp(sendUnixNsec + offsetNsec));
+
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+// NtpServer
+
+#ifdef __linux__
+
+bool NtpServer::OpenSocket(int family, const void* addr, unsigned addrBytes, bool v6Only, bool reusePort)
+{
+    Close();
+
+    Socket = socket(family, SOCK_DGRAM, 0);
+    if (Socket < 0) {
+        return false;
+    }
+
+    // Kernel receive timestamps
+    int on = 1;
+    int v6OnlyValue = v6Only ? 1 : 0;
+    if (setsockopt(Socket, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) != 0 ||
+        (reusePort && setsockopt(Socket, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != 0) ||
+        (family == AF_INET6 && setsockopt(Socket, IPPROTO_IPV6, IPV6_V6ONLY, &v6OnlyValue, sizeof(v6OnlyValue)) != 0))
+    {
+        Close();
+        return false;
+    }
+
+    sockaddr_storage bound;
+    socklen_t len = sizeof(bound);
+    if (bind(Socket, (const sockaddr*)addr, addrBytes) != 0 ||
+        getsockname(Socket, (sockaddr*)&bound, &len) != 0)
+    {
+        Close();
+        return false;
+    }
+
+    Port = ntohs(bound.ss_family == AF_INET6 ?
+        ((const sockaddr_in6*)&bound)->sin6_port :
+        ((const sockaddr_in*)&bound)->sin_port);
+    return true;
+}
+
+bool NtpServer::Open(uint16_t port, uint32_t bindAddress, bool reusePort)
+{
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(bindAddress);
+
+    return OpenSocket(AF_INET, &addr, sizeof(addr), false, reusePort);
+}
+
+bool NtpServer::OpenIPv6(uint16_t port, const uint8_t* bindAddress, bool v6Only, bool reusePort)
+{
+    sockaddr_in6 addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin6_family = AF_INET6;
+    addr.sin6_port = htons(port);
+    if (bindAddress) {
+        memcpy(&addr.sin6_addr, bindAddress, sizeof(addr.sin6_addr));
+    }
+    else {
+        addr.sin6_addr = in6addr_any;
+    }
+
+    return OpenSocket(AF_INET6, &addr, sizeof(addr), v6Only, reusePort);
+}
+
+void NtpServer::Close()
+{
+    if (Socket >= 0)
+    {
+        close(Socket);
+        Socket = -1;
+    }
+}
+
+int NtpServer::Poll(int timeoutMsec)
+{
+    if (Socket < 0) {
+        return -1;
+    }
+
+    if (timeoutMsec != 0)
+    {
+        pollfd pfd;
+        pfd.fd = Socket;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        const int ready = poll(&pfd, 1, timeoutMsec);
+        if (ready <= 0) {
+            return ready;
+        }
+    }
+
+    // Receive a batch of requests
+    uint8_t requests[kBatchSize][kNtpPacketBytes + 16];
+    uint8_t controls[kBatchSize][CMSG_SPACE(sizeof(timespec))];
+    sockaddr_storage addrs[kBatchSize];
+    iovec iovs[kBatchSize];
+    mmsghdr msgs[kBatchSize];
+
+    for (unsigned i = 0; i < kBatchSize; ++i)
+    {
+        iovs[i].iov_base = requests[i];
+        iovs[i].iov_len = sizeof(requests[i]);
+        memset(&msgs[i], 0, sizeof(msgs[i]));
+        msgs[i].msg_hdr.msg_name = &addrs[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_control = controls[i];
+        msgs[i].msg_hdr.msg_controllen = sizeof(controls[i]);
+    }
+
+    const int received = recvmmsg(Socket, msgs, kBatchSize, MSG_DONTWAIT, nullptr);
+    if (received <= 0) {
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    }
+
+    // One transmit time for the whole batch
+    timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    const uint64_t sendUnixNsec = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+
+    uint8_t responses[kBatchSize][kNtpPacketBytes];
+    iovec outIovs[kBatchSize];
+    mmsghdr outMsgs[kBatchSize];
+    unsigned count = 0;
+
+    for (int i = 0; i < received; ++i)
+    {
+        // Fall back to the batch time if there is no kernel timestamp
+        uint64_t recvUnixNsec = sendUnixNsec;
+        for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr); cmsg;
+            cmsg = CMSG_NXTHDR(&msgs[i].msg_hdr, cmsg))
+        {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_TIMESTAMPNS)
+            {
+                timespec ts;
+                memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+                recvUnixNsec = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+            }
+        }
+
+        if (!Responder.BuildResponse(requests[i], msgs[i].msg_len, recvUnixNsec, sendUnixNsec, responses[count]))
+        {
+            ++InvalidCount;
+            continue;
+        }
+
+        outIovs[count].iov_base = responses[count];
+        outIovs[count].iov_len = kNtpPacketBytes;
+        memset(&outMsgs[count], 0, sizeof(outMsgs[count]));
+        outMsgs[count].msg_hdr.msg_name = &addrs[i];
+        outMsgs[count].msg_hdr.msg_namelen = msgs[i].msg_hdr.msg_namelen;
+        outMsgs[count].msg_hdr.msg_iov = &outIovs[count];
+        outMsgs[count].msg_hdr.msg_iovlen = 1;
+        ++count;
+    }
+
+    if (count == 0) {
+        return 0;
+    }
+
+    // sendmmsg() stops at the first reply that fails and reports the error
+    // on the next call, so keep going past it with the rest of the batch
+    unsigned next = 0, sent = 0;
+    while (next < count)
+    {
+        const int result = sendmmsg(Socket, outMsgs + next, count - next, 0);
+        if (result > 0)
+        {
+            next += (unsigned)result;
+            sent += (unsigned)result;
+            continue;
+        }
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+
+        ++DroppedCount;
+        ++next;
+    }
+
+    ResponseCount += sent;
+    return (int)sent;
+}
+
+#endif // __linux__
@@ -0,0 +1,156 @@
+/** \file
+    \brief TimeSync: One-Way Delay Feedback to the Sender
+    \copyright Copyright (c) 2017-2018 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of TimeSync nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <TimeSync/OWDFeedback.h>
+
+
+//------------------------------------------------------------------------------
+// Tools
+
+static inline uint16_t SaturateTS16(uint32_t usec)
+{
+    const uint32_t ts = usec >> kTime23LostBits;
+    return ts > 0xffff ? (uint16_t)0xffff : (uint16_t)ts;
+}
+
+static inline uint8_t SaturateU8(uint32_t value)
+{
+    return value > 0xff ? (uint8_t)0xff : (uint8_t)value;
+}
+
+static inline int16_t SaturateS16(int32_t value)
+{
+    if (value > 32767) {
+        return 32767;
+    }
+    if (value < -32768) {
+        return -32768;
+    }
+    return (int16_t)value;
+}
+
+static inline void WriteU16LE(uint8_t* data, uint16_t value)
+{
+    data[0] = (uint8_t)value;
+    data[1] = (uint8_t)(value >> 8);
+}
+
+static inline uint16_t ReadU16LE(const uint8_t* data)
+{
+    return (uint16_t)(data[0] | ((uint16_t)data[1] << 8));
+}
+
+
+//------------------------------------------------------------------------------
+// OWDFeedbackCollector
+
+void OWDFeedbackCollector::OnDatagramOWD(unsigned owdUsec, uint32_t minimumOWDUsec)
+{
+    if (owdUsec == 0) {
+        return;
+    }
+
+    if (SampleCount == 0 || MinOWDUsec > owdUsec) {
+        MinOWDUsec = owdUsec;
+    }
+    if (SampleCount == 0 || MaxOWDUsec < owdUsec) {
+        MaxOWDUsec = owdUsec;
+    }
+
+    SumOWDUsec += owdUsec;
+    ++SampleCount;
+
+    LastQueuingDelayUsec = owdUsec > minimumOWDUsec ? owdUsec - minimumOWDUsec : 0;
+}
+
+void OWDFeedbackCollector::Encode(uint8_t* data)
+{
+    // Report zeroes for an empty interval
+    if (SampleCount == 0) {
+        MinOWDUsec = MaxOWDUsec = LastQueuingDelayUsec = 0;
+    }
+
+    int32_t trend = 0;
+    if (SampleCount > 0)
+    {
+        const uint32_t average = (uint32_t)(SumOWDUsec / SampleCount);
+        if (HasLastAverage) {
+            trend = ((int32_t)average - (int32_t)LastAverageOWDUsec) / (1 << kTime23LostBits);
+        }
+        LastAverageOWDUsec = average;
+        HasLastAverage = true;
+    }
+
+    // Saturate rather than truncate: See OWDFeedback.h
+    data[0] = NextSequence.ToUnsigned();
+    data[1] = SaturateU8(SampleCount);
+    WriteU16LE(data + 2, SaturateTS16(MinOWDUsec));
+    WriteU16LE(data + 4, SaturateTS16(MaxOWDUsec - MinOWDUsec));
+    WriteU16LE(data + 6, SaturateTS16(LastQueuingDelayUsec));
+    WriteU16LE(data + 8, (uint16_t)SaturateS16(trend));
+
+    ++NextSequence;
+    SampleCount = 0;
+    SumOWDUsec = 0;
+}
+
+
+//------------------------------------------------------------------------------
+// OWDFeedbackDecoder
+
+bool OWDFeedbackDecoder::Decode(const uint8_t* data, OWDFeedback& feedback)
+{
+    // The first summary received may have any sequence number, e.g. after
+    // joining late or losing the first summaries, so take it as it is.
+    // Expanding it next to zero would wrap for values of 128 and up
+    const uint64_t sequence = !GotFeedback ? data[0] :
+        Counter64::ExpandFromTruncated(
+            LargestSequence,
+            Counter8(data[0])).ToUnsigned();
+
+    // Ignore reordered and duplicate summaries
+    if (GotFeedback && sequence <= LargestSequence) {
+        return false;
+    }
+    LargestSequence = sequence;
+    GotFeedback = true;
+
+    const uint32_t minTS16 = ReadU16LE(data + 2);
+    const uint32_t spreadTS16 = ReadU16LE(data + 4);
+    const uint32_t queuingTS16 = ReadU16LE(data + 6);
+
+    feedback.Sequence = sequence;
+    feedback.SampleCount = data[1];
+    feedback.MinOWDUsec = minTS16 << kTime23LostBits;
+    feedback.MaxOWDUsec = (minTS16 + spreadTS16) << kTime23LostBits;
+    feedback.QueuingDelayUsec = queuingTS16 << kTime23LostBits;
+    feedback.TrendUsec = (int32_t)(int16_t)ReadU16LE(data + 8) * (1 << kTime23LostBits);
+
+    return true;
+}
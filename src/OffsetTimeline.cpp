@@ -0,0 +1,184 @@
+/** \file
+    \brief TimeSync: Offset Timeline for Cross-Host Log Merging
+    \copyright Copyright (c) 2017-2018 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of TimeSync nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <TimeSync/OffsetTimeline.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+
+//------------------------------------------------------------------------------
+// Tools
+
+/// Parse an unsigned decimal number, advancing the cursor.
+/// Returns false if there are no digits or the number does not fit
+static bool ParseUnsigned(const char*& cursor, const char* end, uint64_t& value)
+{
+    const char* start = cursor;
+    value = 0;
+    while (cursor < end && *cursor >= '0' && *cursor <= '9')
+    {
+        const uint64_t digit = (uint64_t)(*cursor - '0');
+        if (value > (UINT64_MAX - digit) / 10) {
+            return false;
+        }
+        value = value * 10 + digit;
+        ++cursor;
+    }
+    return cursor != start;
+}
+
+
+//------------------------------------------------------------------------------
+// OffsetTimeline
+
+/// Check that neighboring offsets are close enough to interpolate between
+static bool IsOffsetStepValid(int64_t fromUsec, int64_t toUsec)
+{
+    const int64_t stepUsec = toUsec - fromUsec;
+    return stepUsec <= kOffsetRecordMaxStepUsec && stepUsec >= -kOffsetRecordMaxStepUsec;
+}
+
+bool OffsetTimeline::AddRecord(uint64_t localUsec, int64_t offsetUsec)
+{
+    Record record;
+    record.LocalUsec = localUsec;
+    record.OffsetUsec = offsetUsec;
+
+    // Common case: Records arrive in order
+    if (Records.empty() || Records.back().LocalUsec <= localUsec)
+    {
+        if (!Records.empty() && !IsOffsetStepValid(Records.back().OffsetUsec, offsetUsec)) {
+            return false;
+        }
+        Records.push_back(record);
+        return true;
+    }
+
+    auto it = std::upper_bound(Records.begin(), Records.end(), localUsec,
+        [](uint64_t usec, const Record& r) { return usec < r.LocalUsec; });
+
+    if (!IsOffsetStepValid(offsetUsec, it->OffsetUsec) ||
+        (it != Records.begin() && !IsOffsetStepValid((it - 1)->OffsetUsec, offsetUsec)))
+    {
+        return false;
+    }
+    Records.insert(it, record);
+    return true;
+}
+
+int64_t OffsetTimeline::GetOffsetUsec(uint64_t localUsec) const
+{
+    if (Records.empty()) {
+        return 0;
+    }
+
+    // Find the first record after localUsec
+    auto next = std::upper_bound(Records.begin(), Records.end(), localUsec,
+        [](uint64_t usec, const Record& r) { return usec < r.LocalUsec; });
+
+    if (next == Records.begin()) {
+        return Records.front().OffsetUsec;
+    }
+    if (next == Records.end()) {
+        return Records.back().OffsetUsec;
+    }
+
+    const Record& prev = *(next - 1);
+    const uint64_t span = next->LocalUsec - prev.LocalUsec;
+    if (span == 0) {
+        return next->OffsetUsec;
+    }
+
+    // Interpolate in floating point to avoid overflow on long spans
+    const double t = (double)(localUsec - prev.LocalUsec) / (double)span;
+    const double slope = (double)(next->OffsetUsec - prev.OffsetUsec);
+    return prev.OffsetUsec + (int64_t)(slope * t);
+}
+
+bool OffsetTimeline::ParseOffsetRecord(
+    const char* line,
+    size_t length,
+    uint64_t& localUsec,
+    int64_t& offsetUsec)
+{
+    static const size_t kPrefixLength = sizeof(TIMESYNC_OFFSET_RECORD_PREFIX) - 1;
+
+    if (length < kPrefixLength ||
+        0 != memcmp(line, TIMESYNC_OFFSET_RECORD_PREFIX, kPrefixLength))
+    {
+        return false;
+    }
+
+    const char* cursor = line + kPrefixLength;
+    const char* end = line + length;
+
+    if (!ParseUnsigned(cursor, end, localUsec)) {
+        return false;
+    }
+
+    while (cursor < end && *cursor == ' ') {
+        ++cursor;
+    }
+
+    bool negative = false;
+    if (cursor < end && *cursor == '-')
+    {
+        negative = true;
+        ++cursor;
+    }
+
+    uint64_t magnitude = 0;
+    if (!ParseUnsigned(cursor, end, magnitude) || magnitude > (uint64_t)INT64_MAX) {
+        return false;
+    }
+
+    offsetUsec = negative ? -(int64_t)magnitude : (int64_t)magnitude;
+    return true;
+}
+
+size_t OffsetTimeline::FormatOffsetRecord(
+    char* buffer,
+    size_t bufferBytes,
+    uint64_t localUsec,
+    int64_t offsetUsec)
+{
+    const int written = snprintf(
+        buffer,
+        bufferBytes,
+        TIMESYNC_OFFSET_RECORD_PREFIX "%llu %lld\n",
+        (unsigned long long)localUsec,
+        (long long)offsetUsec);
+
+    if (written <= 0 || (size_t)written >= bufferBytes) {
+        return 0;
+    }
+    return (size_t)written;
+}
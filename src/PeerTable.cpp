@@ -0,0 +1,109 @@
+/** \file
+    \brief TimeSync: Peer Table with Idle Hibernation
+    \copyright Copyright (c) 2017-2018 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of TimeSync nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <TimeSync/PeerTable.h>
+
+
+//------------------------------------------------------------------------------
+// TimeSyncPeerTable
+
+void TimeSyncPeerTable::SetCreateCallback(CreateCallback callback, void* context)
+{
+    OnCreate = callback;
+    CreateContext = context;
+}
+
+TimeSynchronizer* TimeSyncPeerTable::OnDatagram(uint64_t peerId, uint64_t localUsec)
+{
+    auto active = Active.find(peerId);
+    if (active != Active.end())
+    {
+        active->second.LastActivityUsec = localUsec;
+        return active->second.Sync.get();
+    }
+
+    ActivePeer& peer = Active[peerId];
+    // Configure before rehydrating, since the drift window decides whether
+    // the hibernated sample is still valid
+    peer.Sync.reset(OnCreate ? OnCreate(CreateContext, peerId) : new TimeSynchronizer);
+    peer.LastActivityUsec = localUsec;
+
+    auto hibernated = Hibernated.find(peerId);
+    if (hibernated != Hibernated.end())
+    {
+        peer.Sync->Rehydrate(hibernated->second, localUsec);
+        Hibernated.erase(hibernated);
+    }
+
+    return peer.Sync.get();
+}
+
+TimeSynchronizer* TimeSyncPeerTable::FindActive(uint64_t peerId) const
+{
+    auto active = Active.find(peerId);
+    if (active == Active.end()) {
+        return nullptr;
+    }
+    return active->second.Sync.get();
+}
+
+const HibernatedTimeSync* TimeSyncPeerTable::FindHibernated(uint64_t peerId) const
+{
+    auto hibernated = Hibernated.find(peerId);
+    if (hibernated == Hibernated.end()) {
+        return nullptr;
+    }
+    return &hibernated->second;
+}
+
+unsigned TimeSyncPeerTable::HibernateIdle(uint64_t localUsec, uint64_t idleUsec)
+{
+    unsigned count = 0;
+
+    for (auto it = Active.begin(); it != Active.end();)
+    {
+        if ((uint64_t)(localUsec - it->second.LastActivityUsec) <= idleUsec)
+        {
+            ++it;
+            continue;
+        }
+
+        it->second.Sync->Hibernate(localUsec, Hibernated[it->first]);
+        it = Active.erase(it);
+        ++count;
+    }
+
+    return count;
+}
+
+void TimeSyncPeerTable::Remove(uint64_t peerId)
+{
+    Active.erase(peerId);
+    Hibernated.erase(peerId);
+}
@@ -0,0 +1,206 @@
+/** \file
+    \brief TimeSync: Slewed Remote Clock
+    \copyright Copyright (c) 2017-2018 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of TimeSync nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <TimeSync/RemoteClock.h>
+
+#include <cmath>
+
+
+//------------------------------------------------------------------------------
+// RemoteClock
+
+RemoteClock::RemoteClock()
+{
+    Current.AnchorLocalNsec = 0;
+    Current.AnchorOffsetNsec = 0;
+    Current.TargetOffsetNsec = 0;
+    Current.SlewEndNsec = 0;
+    Current.SlewRatePPB = 0;
+}
+
+void RemoteClock::SetMaxSlewPPM(uint32_t ppm)
+{
+    if (ppm < 1) {
+        ppm = 1;
+    }
+    else if (ppm > kMaxSlewPPMLimit) {
+        ppm = kMaxSlewPPMLimit;
+    }
+    MaxSlewPPM = ppm;
+}
+
+void RemoteClock::Update(const TimeSynchronizer& sync, uint64_t localNsec)
+{
+    if (!sync.IsSynchronized()) {
+        return;
+    }
+
+    const int64_t offsetNsec = sync.GetSignedRemoteTimeDeltaNsec();
+    if (IsInitialized() && offsetNsec == Current.TargetOffsetNsec) {
+        return;
+    }
+
+    SetTargetOffsetNsec(offsetNsec, localNsec);
+}
+
+void RemoteClock::SetTargetOffsetNsec(int64_t offsetNsec, uint64_t localNsec)
+{
+    // Step to the first offset
+    if (!IsInitialized())
+    {
+        Current.AnchorLocalNsec = localNsec;
+        Current.AnchorOffsetNsec = offsetNsec;
+        Current.TargetOffsetNsec = offsetNsec;
+        Current.SlewEndNsec = localNsec;
+        Current.SlewRatePPB = 0;
+        PublishSegment();
+        return;
+    }
+
+    // Segments must not start before the previous one
+    if (localNsec < Current.AnchorLocalNsec) {
+        localNsec = Current.AnchorLocalNsec;
+    }
+
+    // Start the new segment where the current one is now, so the remote
+    // clock stays continuous
+    const int64_t nowOffsetNsec = SegmentOffsetNsec(Current, localNsec);
+    const int64_t errorNsec = offsetNsec - nowOffsetNsec;
+    const uint64_t magnitudeNsec = errorNsec < 0 ? (uint64_t)-errorNsec : (uint64_t)errorNsec;
+
+    // Step to large corrections rather than slewing for a long time
+    if (StepThresholdNsec != 0 && magnitudeNsec > StepThresholdNsec)
+    {
+        Current.AnchorLocalNsec = localNsec;
+        Current.AnchorOffsetNsec = offsetNsec;
+        Current.TargetOffsetNsec = offsetNsec;
+        Current.SlewEndNsec = localNsec;
+        Current.SlewRatePPB = 0;
+        ++StepCount;
+        PublishSegment();
+        return;
+    }
+
+    // Duration: The offset moves by MaxSlewPPM / 1000 nsec per usec
+    const uint64_t slewNsec = (uint64_t)std::ceil((double)magnitudeNsec * 1000000.0 / MaxSlewPPM);
+    const int64_t ratePPB = (int64_t)MaxSlewPPM * 1000;
+
+    Current.AnchorLocalNsec = localNsec;
+    Current.AnchorOffsetNsec = nowOffsetNsec;
+    Current.TargetOffsetNsec = offsetNsec;
+    Current.SlewEndNsec = localNsec + slewNsec;
+    Current.SlewRatePPB = errorNsec < 0 ? -ratePPB : ratePPB;
+    PublishSegment();
+}
+
+uint64_t RemoteClock::ToRemoteNsec(uint64_t localNsec) const
+{
+    Segment segment;
+    ReadSegment(segment);
+    return localNsec + SegmentOffsetNsec(segment, localNsec);
+}
+
+int64_t RemoteClock::GetOffsetNsec(uint64_t localNsec) const
+{
+    Segment segment;
+    ReadSegment(segment);
+    return SegmentOffsetNsec(segment, localNsec);
+}
+
+int64_t RemoteClock::GetSlewErrorNsec(uint64_t localNsec) const
+{
+    Segment segment;
+    ReadSegment(segment);
+    return segment.TargetOffsetNsec - SegmentOffsetNsec(segment, localNsec);
+}
+
+void RemoteClock::ReadSegment(Segment& segment) const
+{
+    for (;;)
+    {
+        const uint64_t seq = Latest.load(std::memory_order_acquire);
+        const Snapshot& snapshot = Snapshots[seq % kSnapshotCount];
+
+        segment.AnchorLocalNsec = snapshot.AnchorLocalNsec.load(std::memory_order_relaxed);
+        segment.AnchorOffsetNsec = snapshot.AnchorOffsetNsec.load(std::memory_order_relaxed);
+        segment.TargetOffsetNsec = snapshot.TargetOffsetNsec.load(std::memory_order_relaxed);
+        segment.SlewEndNsec = snapshot.SlewEndNsec.load(std::memory_order_relaxed);
+        segment.SlewRatePPB = snapshot.SlewRatePPB.load(std::memory_order_relaxed);
+
+        // The copy is good if the slot was not reused while reading it
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (snapshot.Seq.load(std::memory_order_relaxed) == seq) {
+            return;
+        }
+    }
+}
+
+void RemoteClock::PublishSegment()
+{
+    const uint64_t seq = Latest.load(std::memory_order_relaxed) + 1;
+    Snapshot& snapshot = Snapshots[seq % kSnapshotCount];
+
+    // Invalidate the slot before overwriting it
+    snapshot.Seq.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    snapshot.AnchorLocalNsec.store(Current.AnchorLocalNsec, std::memory_order_relaxed);
+    snapshot.AnchorOffsetNsec.store(Current.AnchorOffsetNsec, std::memory_order_relaxed);
+    snapshot.TargetOffsetNsec.store(Current.TargetOffsetNsec, std::memory_order_relaxed);
+    snapshot.SlewEndNsec.store(Current.SlewEndNsec, std::memory_order_relaxed);
+    snapshot.SlewRatePPB.store(Current.SlewRatePPB, std::memory_order_relaxed);
+
+    snapshot.Seq.store(seq, std::memory_order_release);
+    Latest.store(seq, std::memory_order_release);
+}
+
+int64_t RemoteClock::SegmentOffsetNsec(const Segment& segment, uint64_t localNsec)
+{
+    if (localNsec >= segment.SlewEndNsec) {
+        return segment.TargetOffsetNsec;
+    }
+    if (localNsec <= segment.AnchorLocalNsec) {
+        return segment.AnchorOffsetNsec;
+    }
+
+    // Round the applied slew up so that it never lags a whole nanosecond
+    // behind, which keeps the remote clock monotonic at nanosecond
+    // resolution, and clamp it so it never overshoots the target
+    const double elapsedNsec = (double)(localNsec - segment.AnchorLocalNsec);
+    const double rate = (double)(segment.SlewRatePPB < 0 ? -segment.SlewRatePPB : segment.SlewRatePPB);
+    int64_t slewNsec = (int64_t)std::ceil(elapsedNsec * rate / 1000000000.0);
+
+    const int64_t errorNsec = segment.TargetOffsetNsec - segment.AnchorOffsetNsec;
+    const int64_t limitNsec = errorNsec < 0 ? -errorNsec : errorNsec;
+    if (slewNsec > limitNsec) {
+        slewNsec = limitNsec;
+    }
+
+    return segment.AnchorOffsetNsec + (errorNsec < 0 ? -slewNsec : slewNsec);
+}
@@ -0,0 +1,252 @@
+/** \file
+    \brief TimeSync: Same-Host Clock Domain Detection
+    \copyright Copyright (c) 2017-2018 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of TimeSync nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <TimeSync/SameHost.h>
+
+#ifdef __linux__
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <time.h>
+    #include <unistd.h>
+#endif // __linux__
+
+#ifdef __linux__
+
+
+//------------------------------------------------------------------------------
+// Tools
+
+static uint64_t ReadClockNsec(clockid_t clockId)
+{
+    struct timespec ts;
+    clock_gettime(clockId, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static int HexDigitValue(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+
+//------------------------------------------------------------------------------
+// Clock Domain Checks
+
+bool ReadKernelBootId(uint8_t bootId[16])
+{
+    const int fd = open("/proc/sys/kernel/random/boot_id", O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    // Formatted as a UUID, e.g. "2c5e9c2b-8f0e-4f6a-9d0e-2f1c3b4a5d6e\n"
+    char text[64];
+    const ssize_t bytes = read(fd, text, sizeof(text) - 1);
+    close(fd);
+    if (bytes <= 0) {
+        return false;
+    }
+
+    unsigned digits = 0;
+    for (ssize_t i = 0; i < bytes && digits < 32; ++i)
+    {
+        if (text[i] == '-') {
+            continue;
+        }
+        const int value = HexDigitValue(text[i]);
+        if (value < 0) {
+            break;
+        }
+        if (digits % 2 == 0) {
+            bootId[digits / 2] = (uint8_t)(value << 4);
+        } else {
+            bootId[digits / 2] |= (uint8_t)value;
+        }
+        ++digits;
+    }
+
+    return digits == 32;
+}
+
+bool CheckSameClockDomain(const ClockDomainToken& peerToken)
+{
+    uint8_t bootId[16];
+    if (!ReadKernelBootId(bootId) ||
+        memcmp(bootId, peerToken.BootId, sizeof(bootId)) != 0)
+    {
+        return false;
+    }
+
+    // The beacon is only visible if /dev/shm is shared, which rules out
+    // peers in separate containers that happen to share a kernel
+    char name[32];
+    ClockDomainBeacon::GetBeaconName(peerToken, name);
+
+    const int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(ClockDomainBeaconPage))
+    {
+        close(fd);
+        return false;
+    }
+
+    void* mapped = mmap(nullptr, sizeof(ClockDomainBeaconPage), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        return false;
+    }
+
+    const ClockDomainBeaconPage page = *static_cast<const ClockDomainBeaconPage*>(mapped);
+    munmap(mapped, sizeof(ClockDomainBeaconPage));
+
+    if (page.Magic != kClockDomainMagic ||
+        memcmp(page.Nonce, peerToken.Nonce, sizeof(page.Nonce)) != 0)
+    {
+        return false;
+    }
+
+    // Time namespaces offset CLOCK_MONOTONIC but not CLOCK_REALTIME, so
+    // compare how far apart the two clocks were for the peer and are now
+    const uint64_t monotonicNsec = ReadClockNsec(CLOCK_MONOTONIC);
+    const uint64_t realtimeNsec = ReadClockNsec(CLOCK_REALTIME);
+
+    if (page.MonotonicNsec > monotonicNsec + kClockDomainToleranceNsec) {
+        return false; // Beacon from the future
+    }
+    const uint64_t ageNsec = monotonicNsec > page.MonotonicNsec ?
+        monotonicNsec - page.MonotonicNsec : 0;
+
+    const int64_t peerOffsetNsec = (int64_t)(page.RealtimeNsec - page.MonotonicNsec);
+    const int64_t offsetNsec = (int64_t)(realtimeNsec - monotonicNsec);
+    const int64_t errorNsec = offsetNsec - peerOffsetNsec;
+    const uint64_t absErrorNsec = errorNsec < 0 ? (uint64_t)-errorNsec : (uint64_t)errorNsec;
+
+    return absErrorNsec <= kClockDomainToleranceNsec + ageNsec / 1000000 * kClockDomainSlewPPM;
+}
+
+
+//------------------------------------------------------------------------------
+// ClockDomainBeacon
+
+void ClockDomainBeacon::GetBeaconName(const ClockDomainToken& token, char name[32])
+{
+    static const char* kHex = "0123456789abcdef";
+
+    static const char kPrefix[] = "/timesync_cd_";
+    memcpy(name, kPrefix, sizeof(kPrefix) - 1);
+
+    char* digits = name + sizeof(kPrefix) - 1;
+    for (unsigned i = 0; i < sizeof(token.Nonce); ++i)
+    {
+        digits[i * 2] = kHex[token.Nonce[i] >> 4];
+        digits[i * 2 + 1] = kHex[token.Nonce[i] & 15];
+    }
+    digits[sizeof(token.Nonce) * 2] = '\0';
+}
+
+bool ClockDomainBeacon::Open()
+{
+    Close();
+
+    if (!ReadKernelBootId(Token.BootId)) {
+        return false;
+    }
+
+    const int randomFd = open("/dev/urandom", O_RDONLY);
+    if (randomFd < 0) {
+        return false;
+    }
+    const ssize_t bytes = read(randomFd, Token.Nonce, sizeof(Token.Nonce));
+    close(randomFd);
+    if (bytes != (ssize_t)sizeof(Token.Nonce)) {
+        return false;
+    }
+
+    char name[32];
+    GetBeaconName(Token, name);
+
+    // Exclusive create, so a stale object with a colliding name is never reused
+    const int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0) {
+        return false;
+    }
+
+    if (ftruncate(fd, sizeof(ClockDomainBeaconPage)) != 0)
+    {
+        close(fd);
+        shm_unlink(name);
+        return false;
+    }
+
+    void* mapped = mmap(nullptr, sizeof(ClockDomainBeaconPage), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+    {
+        shm_unlink(name);
+        return false;
+    }
+
+    Page = static_cast<ClockDomainBeaconPage*>(mapped);
+    memcpy(Page->Nonce, Token.Nonce, sizeof(Token.Nonce));
+    Page->MonotonicNsec = ReadClockNsec(CLOCK_MONOTONIC);
+    Page->RealtimeNsec = ReadClockNsec(CLOCK_REALTIME);
+    Page->Magic = kClockDomainMagic;
+
+    return true;
+}
+
+void ClockDomainBeacon::Close()
+{
+    if (!Page) {
+        return;
+    }
+
+    munmap(Page, sizeof(ClockDomainBeaconPage));
+    Page = nullptr;
+
+    char name[32];
+    GetBeaconName(Token, name);
+    shm_unlink(name);
+}
+
+#endif // __linux__
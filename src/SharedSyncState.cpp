@@ -0,0 +1,205 @@
+/** \file
+    \brief TimeSync: Cross-Process Shared Sync State
+    \copyright Copyright (c) 2017-2018 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of TimeSync nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <TimeSync/SharedSyncState.h>
+
+#ifdef __linux__
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif // __linux__
+
+
+//------------------------------------------------------------------------------
+// SyncStatePublisher
+
+#ifdef __linux__
+
+bool SyncStatePublisher::Open(const char* name)
+{
+    Close();
+
+    const int fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+    if (fd < 0) {
+        return false;
+    }
+
+    if (ftruncate(fd, sizeof(SharedSyncPage)) != 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    void* mapped = mmap(nullptr, sizeof(SharedSyncPage), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        return false;
+    }
+
+    Page = static_cast<SharedSyncPage*>(mapped);
+
+    // Invalidate any stale contents and bump the sequence past them, so
+    // readers of a previous publisher's page retry
+    Page->Magic = 0;
+    const uint32_t seq = Page->Sequence.load(std::memory_order_relaxed);
+    Page->Sequence.store((seq | 1) + 1, std::memory_order_release);
+    Page->Version = kSharedSyncVersion;
+    Page->Magic = kSharedSyncMagic;
+
+    Publish(SyncStateSnapshot());
+    return true;
+}
+
+void SyncStatePublisher::Close()
+{
+    if (Page)
+    {
+        munmap(Page, sizeof(SharedSyncPage));
+        Page = nullptr;
+    }
+}
+
+void SyncStatePublisher::Unlink(const char* name)
+{
+    shm_unlink(name);
+}
+
+void SyncStatePublisher::Publish(const TimeSynchronizer& sync, uint64_t localUsec)
+{
+    SyncStateSnapshot snapshot;
+    snapshot.Synchronized = sync.IsSynchronized();
+    snapshot.RemoteTimeDeltaUsec = (uint32_t)sync.GetSignedRemoteTimeDeltaUsec();
+    snapshot.RemoteTimeDeltaNsec = sync.GetSignedRemoteTimeDeltaNsec();
+    snapshot.MinimumOneWayDelayUsec = sync.GetMinimumOneWayDelayUsec();
+    snapshot.PublishLocalUsec = localUsec;
+    Publish(snapshot);
+}
+
+void SyncStatePublisher::Publish(const SyncStateSnapshot& snapshot)
+{
+    if (!Page) {
+        return;
+    }
+
+    const uint32_t seq = Page->Sequence.load(std::memory_order_relaxed);
+    const uint64_t count = Page->PublishCount.load(std::memory_order_relaxed);
+
+    // Odd sequence: Write in progress
+    Page->Sequence.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    Page->Synchronized.store(snapshot.Synchronized ? 1 : 0, std::memory_order_relaxed);
+    Page->RemoteTimeDeltaUsec.store(snapshot.RemoteTimeDeltaUsec, std::memory_order_relaxed);
+    Page->MinimumOneWayDelayUsec.store(snapshot.MinimumOneWayDelayUsec, std::memory_order_relaxed);
+    Page->RemoteTimeDeltaNsec.store(snapshot.RemoteTimeDeltaNsec, std::memory_order_relaxed);
+    Page->PublishLocalUsec.store(snapshot.PublishLocalUsec, std::memory_order_relaxed);
+    Page->PublishCount.store(count + 1, std::memory_order_relaxed);
+
+    Page->Sequence.store(seq + 2, std::memory_order_release);
+}
+
+
+//------------------------------------------------------------------------------
+// SyncStateReader
+
+bool SyncStateReader::Open(const char* name)
+{
+    Close();
+
+    const int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(SharedSyncPage))
+    {
+        close(fd);
+        return false;
+    }
+
+    void* mapped = mmap(nullptr, sizeof(SharedSyncPage), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        return false;
+    }
+
+    const SharedSyncPage* page = static_cast<const SharedSyncPage*>(mapped);
+    if (page->Magic != kSharedSyncMagic || page->Version != kSharedSyncVersion)
+    {
+        munmap(mapped, sizeof(SharedSyncPage));
+        return false;
+    }
+
+    Page = page;
+    return true;
+}
+
+void SyncStateReader::Close()
+{
+    if (Page)
+    {
+        munmap(const_cast<SharedSyncPage*>(Page), sizeof(SharedSyncPage));
+        Page = nullptr;
+    }
+}
+
+bool SyncStateReader::Read(SyncStateSnapshot& snapshot) const
+{
+    if (!Page) {
+        return false;
+    }
+
+    for (unsigned attempt = 0; attempt < kSharedSyncReadAttempts; ++attempt)
+    {
+        const uint32_t seq = Page->Sequence.load(std::memory_order_acquire);
+        if (seq & 1) {
+            continue; // Write in progress
+        }
+
+        snapshot.Synchronized = Page->Synchronized.load(std::memory_order_relaxed) != 0;
+        snapshot.RemoteTimeDeltaUsec = Page->RemoteTimeDeltaUsec.load(std::memory_order_relaxed);
+        snapshot.MinimumOneWayDelayUsec = Page->MinimumOneWayDelayUsec.load(std::memory_order_relaxed);
+        snapshot.RemoteTimeDeltaNsec = Page->RemoteTimeDeltaNsec.load(std::memory_order_relaxed);
+        snapshot.PublishLocalUsec = Page->PublishLocalUsec.load(std::memory_order_relaxed);
+        snapshot.PublishCount = Page->PublishCount.load(std::memory_order_relaxed);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (Page->Sequence.load(std::memory_order_relaxed) == seq) {
+            return true;
+        }
+    }
+
+    // The publisher died while writing: Do not hand out a torn copy
+    snapshot = SyncStateSnapshot();
+    return false;
+}
+
+#endif // __linux__
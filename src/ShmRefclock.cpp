@@ -0,0 +1,113 @@
+/** \file
+    \brief TimeSync: NTP SHM Refclock Exporter
+    \copyright Copyright (c) 2017-2018 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of TimeSync nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <TimeSync/ShmRefclock.h>
+
+#ifdef __linux__
+    #include <sys/ipc.h>
+    #include <sys/shm.h>
+#endif // __linux__
+
+
+//------------------------------------------------------------------------------
+// ShmRefclockExporter
+
+#ifdef __linux__
+
+bool ShmRefclockExporter::Open(int unit)
+{
+    Close();
+
+    const int perms = unit <= 1 ? 0600 : 0666;
+    const int id = shmget(kNtpShmKeyBase + unit, sizeof(NtpShmTime), IPC_CREAT | perms);
+    if (id == -1) {
+        return false;
+    }
+
+    void* segment = shmat(id, nullptr, 0);
+    if (segment == (void*)-1) {
+        return false;
+    }
+
+    Segment = static_cast<NtpShmTime*>(segment);
+    Segment->Mode = 1;
+    Segment->NSamples = 3;
+    return true;
+}
+
+void ShmRefclockExporter::Close()
+{
+    if (Segment)
+    {
+        shmdt(Segment);
+        Segment = nullptr;
+    }
+}
+
+void ShmRefclockExporter::Publish(uint64_t localUnixNsec, uint64_t clockUnixNsec, int precision)
+{
+    if (!Segment) {
+        return;
+    }
+
+    NtpShmTime* shm = Segment;
+
+    // Invalidate and bump the count before writing
+    shm->Valid = 0;
+    shm->Count = shm->Count + 1;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    shm->ClockTimeStampSec = (time_t)(clockUnixNsec / 1000000000);
+    shm->ClockTimeStampNSec = (unsigned)(clockUnixNsec % 1000000000);
+    shm->ClockTimeStampUSec = (int)(shm->ClockTimeStampNSec / 1000);
+    shm->ReceiveTimeStampSec = (time_t)(localUnixNsec / 1000000000);
+    shm->ReceiveTimeStampNSec = (unsigned)(localUnixNsec % 1000000000);
+    shm->ReceiveTimeStampUSec = (int)(shm->ReceiveTimeStampNSec / 1000);
+    shm->Leap = 0;
+    shm->Precision = precision;
+
+    // Bump the count again and validate after writing
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    shm->Count = shm->Count + 1;
+    shm->Valid = 1;
+
+    ++PublishCount;
+}
+
+bool ShmRefclockExporter::PublishFromSynchronizer(const TimeSynchronizer& sync, uint64_t localUnixNsec)
+{
+    if (!sync.IsSynchronized()) {
+        return false;
+    }
+
+    Publish(localUnixNsec, localUnixNsec + sync.GetSignedRemoteTimeDeltaNsec());
+    return true;
+}
+
+#endif // __linux__
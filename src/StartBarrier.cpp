@@ -0,0 +1,94 @@
+/** \file
+    \brief TimeSync: Distributed Start Barrier
+    \copyright Copyright (c) 2017-2018 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of TimeSync nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <TimeSync/StartBarrier.h>
+
+
+//------------------------------------------------------------------------------
+// StartBarrierCoordinator
+
+void StartBarrierCoordinator::Reset()
+{
+    ParticipantCount = 0;
+    WorstMinOWDUsec = 0;
+}
+
+bool StartBarrierCoordinator::AddParticipant(const TimeSynchronizer& sync)
+{
+    if (!sync.IsSynchronized()) {
+        return false;
+    }
+
+    const uint32_t minOWDUsec = sync.GetMinimumOneWayDelayUsec();
+    if (WorstMinOWDUsec < minOWDUsec) {
+        WorstMinOWDUsec = minOWDUsec;
+    }
+
+    ++ParticipantCount;
+    return true;
+}
+
+uint32_t StartBarrierCoordinator::GetLeadUsec() const
+{
+    uint64_t leadUsec = (uint64_t)WorstMinOWDUsec * Params.OWDMultiplier;
+    leadUsec += GetWorstErrorBoundUsec() + Params.MarginUsec;
+
+    if (leadUsec < Params.MinLeadUsec) {
+        leadUsec = Params.MinLeadUsec;
+    }
+    if (leadUsec > kMaxLeadUsec) {
+        leadUsec = kMaxLeadUsec;
+    }
+
+    return (uint32_t)leadUsec;
+}
+
+Counter23 StartBarrierCoordinator::PickStartTS23(uint64_t localUsec) const
+{
+    // Round up so the start is never earlier than the lead time
+    const uint64_t startUsec = localUsec + GetLeadUsec() + (1 << kTime23LostBits) - 1;
+
+    return (uint32_t)(startUsec >> kTime23LostBits);
+}
+
+
+//------------------------------------------------------------------------------
+// Participant
+
+uint64_t GetBarrierStartLocalUsec(
+    TimeSynchronizer& sync,
+    uint64_t localUsec,
+    Counter23 startTS23)
+{
+    if (!sync.IsSynchronized()) {
+        return 0;
+    }
+
+    return sync.FromRemoteTime23(localUsec, startTS23);
+}
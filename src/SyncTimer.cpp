@@ -0,0 +1,210 @@
+/** \file
+    \brief TimeSync: High-Precision Synchronized Timer
+    \copyright Copyright (c) 2017-2018 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of TimeSync nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <TimeSync/SyncTimer.h>
+
+#include <chrono>
+
+#ifdef __linux__
+    #include <poll.h>
+    #include <sys/eventfd.h>
+    #include <sys/timerfd.h>
+    #include <time.h>
+    #include <unistd.h>
+#endif // __linux__
+
+
+//------------------------------------------------------------------------------
+// SyncTimer
+
+uint64_t SyncTimer::GetMonotonicUsec()
+{
+#ifdef __linux__
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+#else // __linux__
+    return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif // __linux__
+}
+
+SyncTimer::SyncTimer()
+{
+#ifdef __linux__
+    TimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    WakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (TimerFd < 0 || WakeFd < 0)
+    {
+        if (TimerFd >= 0) {
+            close(TimerFd);
+        }
+        if (WakeFd >= 0) {
+            close(WakeFd);
+        }
+        TimerFd = -1;
+        WakeFd = -1;
+    }
+#endif // __linux__
+}
+
+SyncTimer::~SyncTimer()
+{
+#ifdef __linux__
+    if (TimerFd >= 0) {
+        close(TimerFd);
+    }
+    if (WakeFd >= 0) {
+        close(WakeFd);
+    }
+#endif // __linux__
+}
+
+void SyncTimer::Attach(TimeSynchronizer& sync)
+{
+    sync.SetConversionChangeCallback(&SyncTimer::OnConversionChange, this);
+}
+
+void SyncTimer::OnConversionChange(void* context)
+{
+    static_cast<SyncTimer*>(context)->Notify();
+}
+
+void SyncTimer::Notify()
+{
+#ifdef __linux__
+    if (WakeFd >= 0)
+    {
+        const uint64_t one = 1;
+        ssize_t written = write(WakeFd, &one, sizeof(one));
+        (void)written; // EAGAIN means a wake-up is already pending
+        return;
+    }
+#endif // __linux__
+
+    std::lock_guard<std::mutex> locker(WakeLock);
+    WakePending = true;
+    WakeCondition.notify_all();
+}
+
+void SyncTimer::SleepUsec(uint64_t usec)
+{
+#ifdef __linux__
+    if (TimerFd >= 0)
+    {
+        struct itimerspec spec = {};
+        spec.it_value.tv_sec = (time_t)(usec / 1000000);
+        spec.it_value.tv_nsec = (long)(usec % 1000000) * 1000;
+
+        if (usec > 0 && timerfd_settime(TimerFd, 0, &spec, nullptr) == 0)
+        {
+            struct pollfd fds[2] = {};
+            fds[0].fd = TimerFd;
+            fds[0].events = POLLIN;
+            fds[1].fd = WakeFd;
+            fds[1].events = POLLIN;
+
+            if (poll(fds, 2, -1) > 0)
+            {
+                uint64_t count = 0;
+                if (fds[1].revents & POLLIN) {
+                    ssize_t bytes = read(WakeFd, &count, sizeof(count));
+                    (void)bytes;
+                }
+
+                // Disarming also clears any expiration, so the next sleep
+                // starts clean
+                const struct itimerspec disarm = {};
+                timerfd_settime(TimerFd, 0, &disarm, nullptr);
+                return;
+            }
+        }
+    }
+#endif // __linux__
+
+    std::unique_lock<std::mutex> locker(WakeLock);
+    WakeCondition.wait_for(locker, std::chrono::microseconds(usec), [this]() {
+        return WakePending;
+    });
+    WakePending = false;
+}
+
+bool SyncTimer::WaitForRemoteTime23(
+    TimeSynchronizer& sync,
+    Counter23 remoteTS23,
+    SyncTimerResult& result)
+{
+    result = SyncTimerResult();
+
+    if (!sync.IsSynchronized()) {
+        return false;
+    }
+
+    uint64_t nowUsec = Clock();
+    result.TargetLocalUsec = sync.FromRemoteTime23(nowUsec, remoteTS23);
+
+    for (;;)
+    {
+        if (nowUsec >= result.TargetLocalUsec) {
+            break;
+        }
+
+        const uint64_t remainingUsec = result.TargetLocalUsec - nowUsec;
+
+        // Busy-spin the tail for precision
+        if (remainingUsec <= SpinUsec)
+        {
+            do {
+                nowUsec = Clock();
+            } while (nowUsec < result.TargetLocalUsec);
+            break;
+        }
+
+        // Sleep until the tail or until the offset changes
+        SleepUsec(remainingUsec - SpinUsec);
+
+        if (!sync.IsSynchronized()) {
+            return false;
+        }
+
+        nowUsec = Clock();
+
+        const uint64_t targetUsec = sync.FromRemoteTime23(nowUsec, remoteTS23);
+        if (targetUsec != result.TargetLocalUsec)
+        {
+            result.TargetLocalUsec = targetUsec;
+            ++result.RearmCount;
+        }
+    }
+
+    result.FiredLocalUsec = nowUsec;
+    result.ErrorUsec = (int64_t)(nowUsec - result.TargetLocalUsec);
+
+    return true;
+}
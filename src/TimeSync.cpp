@@ -31,10 +31,11 @@
 
 
 //------------------------------------------------------------------------------
-// WindowedMinTS24
+// WindowedMinT
 
-void WindowedMinTS24::Update(
-    Counter24 value,
+template<class CounterT>
+void WindowedMinT<CounterT>::Update(
+    CounterT value,
     uint64_t timestamp,
     const uint64_t windowLengthTime)
 {
@@ -89,92 +90,779 @@ void WindowedMinTS24::Update(
     }
 }
 
+template class WindowedMinT<Counter24>;
+template class WindowedMinT<Counter64>;
+
 
 //------------------------------------------------------------------------------
 // TimeSynchronizer
 
 void TimeSynchronizer::OnPeerMinDeltaTS24(Counter24 minDeltaTS24)
 {
-    LastFC_MinDeltaTS24 = minDeltaTS24;
+    // The peer truncated its minimum to TS24, so assume the middle of the range
+    static const uint64_t kHalfTS24 = (uint64_t)1 << (kDeltaFracBits - 1);
+
+    OnPeerMinDeltaTS37(((uint64_t)minDeltaTS24.ToUnsigned() << kDeltaFracBits) + kHalfTS24);
+}
+
+void TimeSynchronizer::OnPeerMinDeltaTS32(Counter32 minDeltaTS32)
+{
+    // The peer truncated its minimum to microseconds, so assume the middle
+    OnPeerMinDeltaTS37(LocalUsecToTS37(minDeltaTS32.ToUnsigned()) + kTS37UnitsPerUsec / 2);
+}
+
+void TimeSynchronizer::OnPeerMinDeltaTS37(Counter37 minDeltaTS37)
+{
+    // Route change detection compares against the first peer report
+    if (!GotPeerUpdate) {
+        BaselinePeerMinDeltaTS37 = minDeltaTS37;
+    }
+
+    LastFC_MinDeltaTS37 = minDeltaTS37;
     GotPeerUpdate = true;
 
     Recalculate();
 }
 
+uint32_t TimeSynchronizer::OnFourTimestampExchange(
+    uint64_t t1,
+    uint64_t t2,
+    uint64_t t3,
+    uint64_t t4)
+{
+    // min(OWD_j) + ClockDelta(R-L)_j = Remote Receive Time - Local Send Time
+    const Counter37 outgoingTS37 = LocalUsecToTS37(t2) - LocalUsecToTS37(t1);
+
+    const Counter64 outgoingX64 = LastOutgoingDeltaX64 == 0 ?
+        Counter64(kExpandedDeltaBase + outgoingTS37.ToUnsigned()) :
+        Counter64::ExpandFromTruncated(LastOutgoingDeltaX64, outgoingTS37);
+
+    OutgoingMinDeltas.Update(outgoingX64, t4, DriftWindowUsec);
+    LastOutgoingDeltaX64 = outgoingX64;
+
+    // OWD_i + ClockDelta(L-R)_i = Local Receive Time - Remote Send Time
+    const Counter37 incomingTS37 = LocalUsecToTS37(t4) - LocalUsecToTS37(t3);
+
+    OnDatagramDeltaTS37(incomingTS37, t4);
+
+    const uint64_t rttUsec = (t4 - t1) - (t3 - t2);
+    return rttUsec > 0xffffffff ? 0xffffffff : (uint32_t)rttUsec;
+}
+
 unsigned TimeSynchronizer::OnAuthenticatedDatagramTimestamp(
     Counter24 remoteSendTS24,
     uint64_t localRecvUsec)
 {
-    const Counter24 localTS24 = (uint32_t)(localRecvUsec >> kTime23LostBits);
-
     // OWD_i + ClockDelta(L-R)_i = Local Receive Time - Remote Send Time
-    const Counter24 deltaTS24 = localTS24 - remoteSendTS24;
+    const Counter37 deltaTS37 = LocalUsecToTS37(localRecvUsec) -
+        ((uint64_t)remoteSendTS24.ToUnsigned() << kDeltaFracBits);
+
+    return (unsigned)(OnDatagramDeltaTS37(deltaTS37, localRecvUsec) / 1000);
+}
+
+unsigned TimeSynchronizer::OnAuthenticatedDatagramTimestamp32(
+    Counter32 remoteSendTS32,
+    uint64_t localRecvUsec)
+{
+    const Counter37 deltaTS37 = LocalUsecToTS37(localRecvUsec) -
+        LocalUsecToTS37(remoteSendTS32.ToUnsigned());
+
+    return (unsigned)(OnDatagramDeltaTS37(deltaTS37, localRecvUsec) / 1000);
+}
 
-    WindowedMinTS24Deltas.Update(deltaTS24, localRecvUsec, kDriftWindowUsec);
+uint64_t TimeSynchronizer::OnAuthenticatedDatagramTimestampNs(
+    Counter24 remoteSendTS24,
+    uint64_t localRecvNsec)
+{
+    const Counter37 deltaTS37 = LocalNsecToTS37(localRecvNsec) -
+        ((uint64_t)remoteSendTS24.ToUnsigned() << kDeltaFracBits);
+
+    return OnDatagramDeltaTS37(deltaTS37, localRecvNsec / 1000);
+}
+
+uint64_t TimeSynchronizer::OnDatagramDeltaTS37(
+    Counter37 deltaTS37,
+    uint64_t localRecvUsec,
+    bool checkRouteChange)
+{
+    LastRecvUsec = localRecvUsec;
+
+    const Counter64 deltaX64 = UpdateMinDeltas(deltaTS37, localRecvUsec);
+
+    if (SameClockDomain)
+    {
+        // With no clock offset the delta is the loopback latency itself.
+        // Sign-extend: the sender may read its clock after the receiver
+        const int64_t signedTS37 = (int64_t)(deltaTS37.ToUnsigned() << 27) >> 27;
+        const uint64_t owdNsec = signedTS37 <= 0 ? 0 :
+            (uint64_t)signedTS37 * 1000 / kTS37UnitsPerUsec;
+        OnSameHostOWD(owdNsec);
+        return owdNsec;
+    }
+
+    if (checkRouteChange) {
+        CheckRouteChange(deltaX64, localRecvUsec);
+    }
 
     Recalculate();
 
-    // Estimated one-way-delay (OWD) for this datagram in microseconds.
+    // Estimated one-way-delay (OWD) for this datagram in nanoseconds.
     // This does not include processing time only network delay and perhaps
     // some delays from the Operating System when it is heavily loaded.
     // Set to 0 if trip time is not available
-    unsigned networkTripUsec = 0;
+    uint64_t networkTripNsec = 0;
 
     if (IsSynchronized())
     {
         // This is equivalent to the shortest RTT/2 seen so far by any pair of packets,
         // meaning that it is the average of the upstream and downstream OWD.
-        networkTripUsec = GetMinimumOneWayDelayUsec();
+        networkTripNsec = GetMinimumOneWayDelayNsec();
 
         // While the OWD is an estimate, the relative delay between that
         // smallest packet pair and the current datagram is actually precise:
-        const Counter24 minDeltaTS24 = GetMinDeltaTS24();
-        if (deltaTS24 > minDeltaTS24)
+        const Counter64 minDeltaX64 = WindowedMinDeltas.GetBest();
+        if (deltaX64 > minDeltaX64)
         {
-            const Counter24 relativeTS24 = deltaTS24 - minDeltaTS24;
-            networkTripUsec += relativeTS24.ToUnsigned() << kTime23LostBits;
+            const Counter64 relativeX64 = deltaX64 - minDeltaX64;
+            networkTripNsec += relativeX64.ToUnsigned() * 1000 / kTS37UnitsPerUsec;
         }
 
         // What should happen here is if the delay of each packet varies a lot, then we should
         // get pretty accurate OWD for each packet.  But if the variance is low and the delays
         // for upstream and downstream are asymmetric, then it will underestimate the OWD by
         // half of that asymmetry.  Hopefully this inaccuracy won't cause problems..
+
+        // The asymmetry cancels out in the RTT, which adds the return trip
+        UpdateRTT((uint32_t)(networkTripNsec / 1000) + GetOutgoingBaseDelayUsec() + PeerQueuingDelayUsec);
+
+        CheckOWDSpike(networkTripNsec);
     }
 
-    return networkTripUsec;
+    return networkTripNsec;
+}
+
+Counter64 TimeSynchronizer::UpdateMinDeltas(
+    Counter37 deltaTS37,
+    uint64_t localRecvUsec)
+{
+    // Expand to 64 bits next to the previous delta, so that comparisons are
+    // never ambiguous however long the window is or however large the offset
+    const Counter64 deltaX64 = LastDeltaX64 == 0 ?
+        Counter64(kExpandedDeltaBase + deltaTS37.ToUnsigned()) :
+        Counter64::ExpandFromTruncated(LastDeltaX64, deltaTS37);
+
+    WindowedMinDeltas.Update(deltaX64, localRecvUsec, DriftWindowUsec);
+    LastDeltaX64 = deltaX64;
+
+    return deltaX64;
+}
+
+void TimeSynchronizer::SetSameClockDomain(bool sameDomain)
+{
+    ResetState();
+
+    if (sameDomain)
+    {
+        SameClockDomain = true;
+        Synchronized = true;
+    }
+
+    PublishConversionState();
+
+    if (sameDomain) {
+        PushEvent(kEventSynchronized, 0);
+    }
+}
+
+uint64_t TimeSynchronizer::OnSameHostDatagramNs(
+    uint64_t sendNsec,
+    uint64_t localRecvNsec)
+{
+    if (!SameClockDomain)
+        return 0;
+
+    LastRecvUsec = localRecvNsec / 1000;
+
+    const Counter37 deltaTS37 = LocalNsecToTS37(localRecvNsec) - LocalNsecToTS37(sendNsec);
+    UpdateMinDeltas(deltaTS37, LastRecvUsec);
+
+    const uint64_t owdNsec = localRecvNsec > sendNsec ? localRecvNsec - sendNsec : 0;
+    OnSameHostOWD(owdNsec);
+    return owdNsec;
+}
+
+void TimeSynchronizer::OnSameHostOWD(uint64_t owdNsec)
+{
+    if (!GotSameHostOWD || owdNsec < MinimumOneWayDelayNsec)
+    {
+        MinimumOneWayDelayNsec = owdNsec;
+        MinimumOneWayDelayUsec = (uint32_t)(owdNsec / 1000);
+        GotSameHostOWD = true;
+    }
+
+    // Loopback is symmetric, so the round trip is twice the one-way delay
+    const uint64_t rttUsec = owdNsec * 2 / 1000;
+    UpdateRTT(rttUsec > 0xffffffff ? 0xffffffff : (uint32_t)rttUsec);
+
+    CheckOWDSpike(owdNsec);
 }
 
 void TimeSynchronizer::Recalculate()
 {
-    if (!WindowedMinTS24Deltas.IsValid() || !GotPeerUpdate)
+    // Offsets stay exactly 0 for a peer sharing this clock
+    if (SameClockDomain)
         return;
 
-    // min(OWD_i) + ClockDelta(L-R)_i
-    const Counter24 minRecvDeltaTS24 = WindowedMinTS24Deltas.GetBest();
-
     // min(OWD_j) + ClockDelta(R-L)_j
-    const Counter24 minSendDeltaTS24 = LastFC_MinDeltaTS24;
+    Counter37 minSendDeltaTS37;
+    if (!WindowedMinDeltas.IsValid() || !GetPeerMinDeltaTS37(minSendDeltaTS37))
+        return;
+
+    const bool wasSynchronized = Synchronized;
+    const int64_t prevDeltaNsec = RemoteTimeDeltaNsec;
+
+    // min(OWD_i) + ClockDelta(L-R)_i
+    const Counter37 minRecvDeltaTS37 = WindowedMinDeltas.GetBest().ToUnsigned();
 
     // Assume min(OWD_i) = min(OWD_j):
     // min(OWD) ~= (min(OWD_j) + min(OWD_i)) / 2
-    const Counter23 minOWD_TS23 = (minSendDeltaTS24 + minRecvDeltaTS24).ToUnsigned() >> 1;
+    const uint64_t minOWD_TS36 = (minSendDeltaTS37 + minRecvDeltaTS37).ToUnsigned() >> 1;
 
     // Assume ClockDelta(R-L)_j = -ClockDelta(L-R)_i:
     // ClockDelta(R-L) ~= (ClockDelta(R-L)_j - ClockDelta(L-R)_i) / 2
-    const Counter23 clockDelta_TS23 = (minSendDeltaTS24 - minRecvDeltaTS24).ToUnsigned() >> 1;
+    const uint64_t clockDelta_TS36 = (minSendDeltaTS37 - minRecvDeltaTS37).ToUnsigned() >> 1;
+
+    // Calculate the time delta in microseconds, known modulo 2^26
+    RemoteTimeDeltaUsec = (uint32_t)(clockDelta_TS36 / kTS37UnitsPerUsec);
 
-    // Calculate the time delta in microseconds
-    RemoteTimeDeltaUsec = clockDelta_TS23.ToUnsigned() << kTime23LostBits;
+    // Sign-extend from 36 bits for the nanosecond delta
+    const int64_t signedDelta_TS36 = (int64_t)(clockDelta_TS36 << 28) >> 28;
+    RemoteTimeDeltaNsec = signedDelta_TS36 * 1000 / kTS37UnitsPerUsec;
 
     // Calculate the minimum OWD, which may go negative and blow up..
-    uint32_t min_owd_usec = minOWD_TS23.ToUnsigned() << kTime23LostBits;
+    uint64_t min_owd_ts36 = minOWD_TS36;
 
     // If the implied subtraction went negative, correct to zero:
-    static const uint32_t kSignRolloverThreshold = (1 << 22) << kTime23LostBits;
-    if (min_owd_usec >= kSignRolloverThreshold) {
-        min_owd_usec = 0;
+    static const uint64_t kSignRolloverThreshold = (uint64_t)1 << 35;
+    if (min_owd_ts36 >= kSignRolloverThreshold) {
+        min_owd_ts36 = 0;
     }
-    MinimumOneWayDelayUsec = min_owd_usec;
+    MinimumOneWayDelayUsec = (uint32_t)(min_owd_ts36 / kTS37UnitsPerUsec);
+    MinimumOneWayDelayNsec = min_owd_ts36 * 1000 / kTS37UnitsPerUsec;
 
     Synchronized = true;
+    PublishConversionState();
+
+    if (EventQueue) {
+        CheckOffsetEvents(wasSynchronized, prevDeltaNsec);
+    }
+}
+
+void TimeSynchronizer::ResetState()
+{
+    if (Synchronized) {
+        PushEvent(kEventSyncLost, 0);
+    }
+
+    WindowedMinDeltas.Reset();
+    LastFC_MinDeltaTS37 = 0;
+    GotPeerUpdate = false;
+    Synchronized = false;
+    RemoteTimeDeltaUsec = 0;
+    MinimumOneWayDelayUsec = kDefaultOWDUsec;
+    RemoteTimeDeltaNsec = 0;
+    MinimumOneWayDelayNsec = kDefaultOWDUsec * 1000ULL;
+    LastDeltaX64 = 0;
+    PeerQueuingDelayUsec = 0;
+    SmoothedRTTUsec = 0;
+    RTTVarianceUsec = 0;
+    LastRTTSampleUsec = 0;
+    RecentMinDeltas.Reset();
+    BaselineMinDeltaX64 = 0;
+    BaselinePeerMinDeltaTS37 = 0;
+    OutgoingMinDeltas.Reset();
+    LastOutgoingDeltaX64 = 0;
+    SameClockDomain = false;
+    GotSameHostOWD = false;
+    ReportedDeltaNsec = 0;
+    InOWDSpike = false;
+}
+
+void TimeSynchronizer::PublishConversionState()
+{
+    const TimeConversionParams prev = TimeConversionParams::Unpack(
+        ConversionState.load(std::memory_order_relaxed));
+
+    const bool synchronized = Synchronized;
+    const uint32_t deltaUsec = RemoteTimeDeltaUsec;
+
+    // Leave the generation alone for stable offsets so caches stay valid
+    if (prev.Synchronized == synchronized && prev.RemoteTimeDeltaUsec == deltaUsec) {
+        return;
+    }
+
+    ConversionState.store(
+        TimeConversionParams::Pack(prev.Generation + 1, synchronized, deltaUsec),
+        std::memory_order_release);
+
+    // Every path to synchronized publishes the new state here
+    if (synchronized && !prev.Synchronized && OnSynchronized) {
+        OnSynchronized(SynchronizedContext);
+    }
+    if (OnConversionChange) {
+        OnConversionChange(ConversionChangeContext);
+    }
+}
+
+bool TimeSynchronizer::GetPeerMinDeltaTS37(Counter37& minDeltaTS37) const
+{
+    if (!OutgoingMinDeltas.IsValid())
+    {
+        minDeltaTS37 = LastFC_MinDeltaTS37;
+        return GotPeerUpdate;
+    }
+
+    const Counter37 probeMinDeltaTS37 = OutgoingMinDeltas.GetBest().ToUnsigned();
+    minDeltaTS37 = GotPeerUpdate && LastFC_MinDeltaTS37 < probeMinDeltaTS37 ?
+        LastFC_MinDeltaTS37 : probeMinDeltaTS37;
+    return true;
+}
+
+void TimeSynchronizer::SetRouteChangeCallback(RouteChangeCallback callback, void* context)
+{
+    OnRouteChange = callback;
+    RouteChangeContext = context;
+}
+
+void TimeSynchronizer::SetSynchronizedCallback(SynchronizedCallback callback, void* context)
+{
+    OnSynchronized = callback;
+    SynchronizedContext = context;
+}
+
+void TimeSynchronizer::SetConversionChangeCallback(ConversionChangeCallback callback, void* context)
+{
+    OnConversionChange = callback;
+    ConversionChangeContext = context;
+}
+
+void TimeSynchronizer::SetRouteChangeParams(uint64_t windowUsec, uint32_t thresholdUsec)
+{
+    RouteChangeWindowUsec = windowUsec;
+    RouteChangeThresholdUsec = thresholdUsec;
+    RecentMinDeltas.Reset();
+}
+
+void TimeSynchronizer::CheckRouteChange(Counter64 deltaX64, uint64_t localRecvUsec)
+{
+    // Restart the clock if the recent window is about to start over
+    if (!RecentMinDeltas.IsValid() ||
+        RecentMinDeltas.Samples[2].TimeoutExpired(localRecvUsec, RouteChangeWindowUsec))
+    {
+        RecentStartUsec = localRecvUsec;
+    }
+    RecentMinDeltas.Update(deltaX64, localRecvUsec, RouteChangeWindowUsec);
+
+    // The peer minimum comes from its reports or from four-timestamp
+    // exchanges, so that probe-only peers can detect route changes too
+    Counter37 peerMinDeltaTS37;
+    const bool gotPeerMinDelta = GetPeerMinDeltaTS37(peerMinDeltaTS37);
+
+    // Remember the peer minimum when a new long-term minimum is found.
+    // When an old minimum ages out instead, the replacement is an older
+    // sample, so keep the older peer baseline to avoid missing any drift
+    const Counter64 minDeltaX64 = WindowedMinDeltas.GetBest();
+    if (minDeltaX64 != BaselineMinDeltaX64)
+    {
+        if (minDeltaX64 < BaselineMinDeltaX64) {
+            BaselinePeerMinDeltaTS37 = peerMinDeltaTS37;
+        }
+        BaselineMinDeltaX64 = minDeltaX64;
+    }
+
+    // The peer minimum only rises when the peer resets or ages its window
+    if (gotPeerMinDelta && peerMinDeltaTS37 > BaselinePeerMinDeltaTS37) {
+        BaselinePeerMinDeltaTS37 = peerMinDeltaTS37;
+    }
+
+    // The shift must be sustained for the whole recent window
+    if (!gotPeerMinDelta ||
+        (uint64_t)(localRecvUsec - RecentStartUsec) < RouteChangeWindowUsec)
+    {
+        return;
+    }
+
+    const Counter64 recentDeltaX64 = RecentMinDeltas.GetBest();
+    if (recentDeltaX64 <= minDeltaX64) {
+        return;
+    }
+    uint64_t riseTS37 = (recentDeltaX64 - minDeltaX64).ToUnsigned();
+
+    // Clock drift raises our deltas while lowering the peer's deltas by the
+    // same amount, so only the part not matched by the peer counts
+    if (BaselinePeerMinDeltaTS37 > peerMinDeltaTS37)
+    {
+        const uint64_t fallTS37 = (BaselinePeerMinDeltaTS37 - peerMinDeltaTS37).ToUnsigned();
+        if (fallTS37 >= riseTS37) {
+            return;
+        }
+        riseTS37 -= fallTS37;
+    }
+    const uint32_t riseUsec = (uint32_t)(riseTS37 / kTS37UnitsPerUsec);
+
+    // Allow for drift the peer has not reported yet
+    const uint64_t ageUsec = localRecvUsec - WindowedMinDeltas.Samples[0].Timestamp;
+    const uint32_t driftUsec = (uint32_t)(ageUsec * kRouteChangeMaxDriftPPM / 1000000);
+
+    if (riseUsec <= RouteChangeThresholdUsec + driftUsec) {
+        return;
+    }
+
+    // Start over from the recent samples
+    for (unsigned i = 0; i < WindowedMinX64::kSampleCount; ++i) {
+        WindowedMinDeltas.Samples[i] = RecentMinDeltas.Samples[i];
+    }
+    BaselineMinDeltaX64 = recentDeltaX64;
+    BaselinePeerMinDeltaTS37 = peerMinDeltaTS37;
+    ++RouteChangeCount;
+
+    Recalculate();
+
+    if (OnRouteChange) {
+        OnRouteChange(RouteChangeContext, riseUsec);
+    }
+    PushEvent(kEventWindowReset, riseUsec);
+}
+
+void TimeSynchronizer::SetEventQueue(
+    TimeSyncEventQueue* queue,
+    uint32_t peerId,
+    const TimeSyncEventParams& params)
+{
+    EventQueue = queue;
+    EventPeerId = peerId;
+    EventParams = params;
+
+    // Report the current state so the consumer does not need to poll once
+    ReportedDeltaNsec = RemoteTimeDeltaNsec;
+    InOWDSpike = false;
+    if (Synchronized) {
+        PushEvent(kEventSynchronized, ReportedDeltaNsec);
+    }
+}
+
+void TimeSynchronizer::PushEvent(TimeSyncEventType type, int64_t value)
+{
+    if (!EventQueue) {
+        return;
+    }
+
+    TimeSyncEvent event;
+    event.PeerId = EventPeerId;
+    event.Type = type;
+    event.LocalUsec = LastRecvUsec;
+    event.Value = value;
+    EventQueue->Push(event);
+}
+
+void TimeSynchronizer::CheckOffsetEvents(bool wasSynchronized, int64_t prevDeltaNsec)
+{
+    const int64_t deltaNsec = RemoteTimeDeltaNsec;
+
+    if (!wasSynchronized)
+    {
+        ReportedDeltaNsec = deltaNsec;
+        PushEvent(kEventSynchronized, deltaNsec);
+        return;
+    }
+
+    const int64_t jumpNsec = deltaNsec - prevDeltaNsec;
+    const int64_t absJumpNsec = jumpNsec < 0 ? -jumpNsec : jumpNsec;
+    if (absJumpNsec > (int64_t)EventParams.StepUsec * 1000)
+    {
+        ReportedDeltaNsec = deltaNsec;
+        PushEvent(kEventStep, jumpNsec);
+        return;
+    }
+
+    // Report gradual drift once it adds up since the last report
+    const int64_t changeNsec = deltaNsec - ReportedDeltaNsec;
+    const int64_t absChangeNsec = changeNsec < 0 ? -changeNsec : changeNsec;
+    if (absChangeNsec > (int64_t)EventParams.OffsetChangeUsec * 1000)
+    {
+        ReportedDeltaNsec = deltaNsec;
+        PushEvent(kEventOffsetChanged, changeNsec);
+    }
+}
+
+void TimeSynchronizer::CheckOWDSpike(uint64_t owdNsec)
+{
+    if (!EventQueue) {
+        return;
+    }
+
+    const uint64_t minNsec = MinimumOneWayDelayNsec;
+    const uint64_t excessNsec = owdNsec > minNsec ? owdNsec - minNsec : 0;
+    const uint64_t thresholdNsec = EventParams.OWDSpikeUsec * 1000ULL;
+
+    // Hysteresis so a spike is reported once rather than per datagram
+    if (!InOWDSpike)
+    {
+        if (excessNsec > thresholdNsec)
+        {
+            InOWDSpike = true;
+            PushEvent(kEventOWDSpike, (int64_t)(owdNsec / 1000));
+        }
+    }
+    else if (excessNsec < thresholdNsec / 2) {
+        InOWDSpike = false;
+    }
+}
+
+void TimeSynchronizer::UpdateRTT(uint32_t rttUsec)
+{
+    const uint32_t srtt = SmoothedRTTUsec;
+
+    // First sample
+    if (srtt == 0)
+    {
+        SmoothedRTTUsec = rttUsec > 0 ? rttUsec : 1;
+        RTTVarianceUsec = rttUsec / 2;
+        LastRTTSampleUsec = LastRecvUsec;
+        return;
+    }
+
+    // The RFC 6298 gains assume one sample per round trip, like TCP timing
+    // one segment at a time.  With a sample per datagram they would decay
+    // within a fraction of an RTT, so skip samples until SRTT has elapsed
+    if ((uint64_t)(LastRecvUsec - LastRTTSampleUsec) < srtt) {
+        return;
+    }
+    LastRTTSampleUsec = LastRecvUsec;
+
+    // RTTVAR = 3/4 RTTVAR + 1/4 |SRTT - R|
+    const uint32_t error = srtt > rttUsec ? srtt - rttUsec : rttUsec - srtt;
+    RTTVarianceUsec = (uint32_t)(((uint64_t)RTTVarianceUsec * 3 + error) / 4);
+
+    // SRTT = 7/8 SRTT + 1/8 R
+    SmoothedRTTUsec = (uint32_t)(((uint64_t)srtt * 7 + rttUsec) / 8);
+}
+
+void TimeSynchronizer::Hibernate(uint64_t localUsec, HibernatedTimeSync& state) const
+{
+    state.HibernateMsec = (uint32_t)(localUsec / 1000);
+
+    // Saturate the age rather than letting it roll over
+    const uint64_t bestAgeMsec = (localUsec - WindowedMinDeltas.Samples[0].Timestamp) / 1000;
+    state.BestAgeMsec = bestAgeMsec > 0xffff ? (uint16_t)0xffff : (uint16_t)bestAgeMsec;
+
+    state.Flags = 0;
+    if (Synchronized) {
+        state.Flags |= HibernatedTimeSync::kFlagSynchronized;
+    }
+    if (SameClockDomain) {
+        state.Flags |= HibernatedTimeSync::kFlagSameClockDomain;
+    }
+    Counter37 peerMinDeltaTS37;
+    if (GetPeerMinDeltaTS37(peerMinDeltaTS37)) {
+        state.Flags |= HibernatedTimeSync::kFlagGotPeerUpdate;
+    }
+
+    HibernatedTimeSync::Write24(state.BestDeltaTS24, GetMinDeltaTS24().ToUnsigned());
+    HibernatedTimeSync::Write24(state.PeerMinDeltaTS24, (uint32_t)(peerMinDeltaTS37.ToUnsigned() >> kDeltaFracBits));
+    HibernatedTimeSync::Write24(state.RemoteTimeDeltaTS23, RemoteTimeDeltaUsec >> kTime23LostBits);
+}
+
+bool TimeSynchronizer::Rehydrate(const HibernatedTimeSync& state, uint64_t localUsec)
+{
+    // Recover the full hibernation time from the truncated millisecond counter
+    const uint64_t hibernateMsec = Counter64::ExpandFromTruncated(
+        localUsec / 1000,
+        state.HibernateMsec).ToUnsigned();
+    const uint64_t bestTimestamp = (hibernateMsec - state.BestAgeMsec) * 1000;
+
+    const Counter24 bestDeltaTS24 = HibernatedTimeSync::Read24(state.BestDeltaTS24);
+
+    // A peer sharing this clock needs no estimate
+    if (state.Flags & HibernatedTimeSync::kFlagSameClockDomain)
+    {
+        SetSameClockDomain(true);
+        return true;
+    }
+
+    ResetState();
+    PublishConversionState();
+
+    // If the best sample is too old to be trusted, leave it that way:
+    if (bestDeltaTS24 == 0 ||
+        state.BestAgeMsec == 0xffff ||
+        (uint64_t)(localUsec - bestTimestamp) > DriftWindowUsec)
+    {
+        return false;
+    }
+
+    // The summary is truncated to TS24, so assume the middle of the range
+    static const uint64_t kHalfTS24 = (uint64_t)1 << (kDeltaFracBits - 1);
+    const Counter64 bestDeltaX64 = kExpandedDeltaBase +
+        ((uint64_t)bestDeltaTS24.ToUnsigned() << kDeltaFracBits) + kHalfTS24;
+    const Counter24 peerMinDeltaTS24 = HibernatedTimeSync::Read24(state.PeerMinDeltaTS24);
+
+    WindowedMinDeltas.Reset(WindowedMinX64::Sample(bestDeltaX64, bestTimestamp));
+    LastDeltaX64 = bestDeltaX64;
+    LastFC_MinDeltaTS37 = ((uint64_t)peerMinDeltaTS24.ToUnsigned() << kDeltaFracBits) + kHalfTS24;
+    GotPeerUpdate = (state.Flags & HibernatedTimeSync::kFlagGotPeerUpdate) != 0;
+    BaselineMinDeltaX64 = bestDeltaX64;
+    BaselinePeerMinDeltaTS37 = LastFC_MinDeltaTS37;
+
+    Recalculate();
+
+    return IsSynchronized();
+}
+
+
+//------------------------------------------------------------------------------
+// MultipathTimeSynchronizer
+
+unsigned MultipathTimeSynchronizer::OnAuthenticatedDatagramTimestamp(
+    Counter24 remoteSendTS24,
+    uint64_t localRecvUsec,
+    unsigned pathId)
+{
+    if (pathId >= kMaxPaths) {
+        return 0;
+    }
+
+    const Counter37 deltaTS37 = LocalUsecToTS37(localRecvUsec) -
+        ((uint64_t)remoteSendTS24.ToUnsigned() << kDeltaFracBits);
+
+    return (unsigned)(OnPathDeltaTS37(deltaTS37, localRecvUsec, pathId) / 1000);
+}
+
+uint64_t MultipathTimeSynchronizer::OnDatagramDeltaTS37(
+    Counter37 deltaTS37,
+    uint64_t localRecvUsec,
+    bool checkRouteChange)
+{
+    (void)checkRouteChange; // Decided per path
+    return OnPathDeltaTS37(deltaTS37, localRecvUsec, 0);
+}
+
+uint64_t MultipathTimeSynchronizer::OnPathDeltaTS37(
+    Counter37 deltaTS37,
+    uint64_t localRecvUsec,
+    unsigned pathId)
+{
+    // Only the path with the lowest base delay checks for route changes.
+    // Otherwise a slower path would look like a route change whenever the
+    // faster path goes idle for a while
+    const unsigned lowestPath = GetLowestBasePath();
+    const bool checkRouteChange = lowestPath == kMaxPaths || lowestPath == pathId;
+    const unsigned routeChangeCount = GetRouteChangeCount();
+
+    // The shared clock offset comes from the minimum over all paths
+    const uint64_t owdNsec = TimeSynchronizer::OnDatagramDeltaTS37(
+        deltaTS37, localRecvUsec, checkRouteChange);
+
+    if (GetRouteChangeCount() != routeChangeCount)
+    {
+        // The shared window started over from this path's recent samples
+        for (unsigned i = 0; i < WindowedMinX64::kSampleCount; ++i) {
+            PathMinDeltas[pathId].Samples[i] = RecentMinDeltas.Samples[i];
+        }
+    }
+    else {
+        PathMinDeltas[pathId].Update(LastDeltaX64, localRecvUsec, DriftWindowUsec);
+    }
+    PathLastDeltas[pathId] = LastDeltaX64;
+
+    return owdNsec;
+}
+
+void MultipathTimeSynchronizer::ResetState()
+{
+    TimeSynchronizer::ResetState();
+
+    for (unsigned pathId = 0; pathId < kMaxPaths; ++pathId)
+    {
+        PathMinDeltas[pathId].Reset();
+        PathLastDeltas[pathId] = 0;
+    }
+}
+
+uint32_t MultipathTimeSynchronizer::GetPathBaseDelayUsec(unsigned pathId) const
+{
+    if (!IsSynchronized() || !IsPathValid(pathId)) {
+        return 0;
+    }
+
+    // Path base delay = Shared base delay + extra delay of this path
+    uint32_t baseUsec = GetMinimumOneWayDelayUsec();
+
+    const Counter64 minDeltaX64 = WindowedMinDeltas.GetBest();
+    const Counter64 pathMinDeltaX64 = PathMinDeltas[pathId].GetBest();
+    if (pathMinDeltaX64 > minDeltaX64) {
+        baseUsec += (uint32_t)((pathMinDeltaX64 - minDeltaX64).ToUnsigned() / kTS37UnitsPerUsec);
+    }
+
+    return baseUsec;
+}
+
+uint32_t MultipathTimeSynchronizer::GetPathQueuingDelayUsec(unsigned pathId) const
+{
+    if (!IsPathValid(pathId)) {
+        return 0;
+    }
+
+    const Counter64 pathMinDeltaX64 = PathMinDeltas[pathId].GetBest();
+    if (PathLastDeltas[pathId] <= pathMinDeltaX64) {
+        return 0;
+    }
+    return (uint32_t)((PathLastDeltas[pathId] - pathMinDeltaX64).ToUnsigned() / kTS37UnitsPerUsec);
+}
+
+uint32_t MultipathTimeSynchronizer::GetPathOneWayDelayUsec(unsigned pathId) const
+{
+    const uint32_t baseUsec = GetPathBaseDelayUsec(pathId);
+    if (baseUsec == 0) {
+        return 0;
+    }
+    return baseUsec + GetPathQueuingDelayUsec(pathId);
+}
+
+unsigned MultipathTimeSynchronizer::GetLowestBasePath() const
+{
+    unsigned bestPath = kMaxPaths;
+
+    for (unsigned pathId = 0; pathId < kMaxPaths; ++pathId)
+    {
+        if (IsPathValid(pathId) && (bestPath == kMaxPaths ||
+            PathMinDeltas[pathId].GetBest() < PathMinDeltas[bestPath].GetBest()))
+        {
+            bestPath = pathId;
+        }
+    }
+
+    return bestPath;
+}
+
+unsigned MultipathTimeSynchronizer::GetLowestDelayPath() const
+{
+    unsigned bestPath = kMaxPaths;
+    uint32_t bestUsec = 0;
+
+    for (unsigned pathId = 0; pathId < kMaxPaths; ++pathId)
+    {
+        if (!IsPathValid(pathId)) {
+            continue;
+        }
+
+        const uint32_t owdUsec = GetPathOneWayDelayUsec(pathId);
+        if (bestPath == kMaxPaths || owdUsec < bestUsec)
+        {
+            bestPath = pathId;
+            bestUsec = owdUsec;
+        }
+    }
+
+    return bestPath;
 }
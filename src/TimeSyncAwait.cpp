@@ -0,0 +1,203 @@
+/** \file
+    \brief TimeSync: Awaiting Synchronization and Synchronized Instants
+    \copyright Copyright (c) 2017-2018 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of TimeSync nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <TimeSync/TimeSyncAwait.h>
+
+
+//------------------------------------------------------------------------------
+// AwaitableTimeSynchronizer
+
+/// Remove a wait from a list.  Returns false if it is not in the list
+static bool RemoveWait(std::vector<TimeSyncWait*>& waits, TimeSyncWait* wait)
+{
+    for (size_t i = 0; i < waits.size(); ++i)
+    {
+        if (waits[i] == wait)
+        {
+            waits.erase(waits.begin() + i);
+            return true;
+        }
+    }
+    return false;
+}
+
+AwaitableTimeSynchronizer::AwaitableTimeSynchronizer(TimeSynchronizer& sync, TimeSyncEventLoop& loop)
+    : Sync(sync)
+    , Loop(loop)
+{
+    Sync.SetSynchronizedCallback(&AwaitableTimeSynchronizer::OnSynchronized, this);
+}
+
+AwaitableTimeSynchronizer::~AwaitableTimeSynchronizer()
+{
+    Sync.SetSynchronizedCallback(nullptr, nullptr);
+}
+
+void AwaitableTimeSynchronizer::OnSynchronized(void* context)
+{
+    AwaitableTimeSynchronizer* owner = (AwaitableTimeSynchronizer*)context;
+
+    // Callbacks run later on the loop, so releasing cannot add waiters here
+    std::vector<TimeSyncWait*> waiters;
+    waiters.swap(owner->Waiters);
+    for (TimeSyncWait* wait : waiters) {
+        owner->Release(wait);
+    }
+}
+
+void AwaitableTimeSynchronizer::Wait(TimeSyncWait* wait)
+{
+    wait->Pending = true;
+
+    if (Sync.IsSynchronized()) {
+        Release(wait);
+    }
+    else {
+        Waiters.push_back(wait);
+    }
+}
+
+bool AwaitableTimeSynchronizer::Cancel(TimeSyncWait* wait)
+{
+    if (!wait->Pending) {
+        return false;
+    }
+    wait->Pending = false;
+
+    if (RemoveWait(Waiters, wait) || RemoveWait(Timed, wait)) {
+        return true;
+    }
+
+    // The Ready list may be running, so leave its indices alone
+    for (TimeSyncWait*& ready : Ready)
+    {
+        if (ready == wait)
+        {
+            ready = nullptr;
+            return true;
+        }
+    }
+    return false;
+}
+
+void AwaitableTimeSynchronizer::Release(TimeSyncWait* wait)
+{
+    if (!wait->HasRemoteTime)
+    {
+        Ready.push_back(wait);
+        PostReady();
+        return;
+    }
+
+    Timed.push_back(wait);
+    ScheduleTimer(Sync.FromRemoteTime23(Loop.GetLocalUsec(), wait->RemoteTS23));
+}
+
+void AwaitableTimeSynchronizer::PostReady()
+{
+    if (!ReadyPosted)
+    {
+        ReadyPosted = true;
+        Loop.Post(&AwaitableTimeSynchronizer::OnReadyPosted, this);
+    }
+}
+
+void AwaitableTimeSynchronizer::OnReadyPosted(void* context)
+{
+    AwaitableTimeSynchronizer* owner = (AwaitableTimeSynchronizer*)context;
+    owner->ReadyPosted = false;
+    owner->RunReady();
+}
+
+void AwaitableTimeSynchronizer::RunReady()
+{
+    // Waiters added by the callbacks run on the next post, so a callback
+    // that waits again cannot keep this loop going
+    const size_t count = Ready.size();
+    for (size_t i = 0; i < count; ++i)
+    {
+        TimeSyncWait* wait = Ready[i];
+        if (!wait) {
+            continue;
+        }
+        Ready[i] = nullptr;
+        wait->Pending = false;
+        wait->Func(wait->Context);
+    }
+
+    Ready.erase(Ready.begin(), Ready.begin() + count);
+    if (!Ready.empty()) {
+        PostReady();
+    }
+}
+
+void AwaitableTimeSynchronizer::ScheduleTimer(uint64_t localUsec)
+{
+    if (TimerScheduled && TimerUsec <= localUsec) {
+        return;
+    }
+    TimerScheduled = true;
+    TimerUsec = localUsec;
+    Loop.ScheduleAt(localUsec, &AwaitableTimeSynchronizer::OnTimer, this);
+}
+
+void AwaitableTimeSynchronizer::OnTimer(void* context)
+{
+    AwaitableTimeSynchronizer* owner = (AwaitableTimeSynchronizer*)context;
+    owner->TimerScheduled = false;
+
+    // The offset may have moved since the timer was set, so check each
+    // remote time again and set the timer for the soonest one left
+    const uint64_t nowUsec = owner->Loop.GetLocalUsec();
+    uint64_t nextUsec = 0;
+    bool hasNext = false;
+
+    std::vector<TimeSyncWait*>& timed = owner->Timed;
+    for (size_t i = 0; i < timed.size();)
+    {
+        const uint64_t localUsec = owner->Sync.FromRemoteTime23(nowUsec, timed[i]->RemoteTS23);
+        if (localUsec <= nowUsec)
+        {
+            owner->Ready.push_back(timed[i]);
+            timed.erase(timed.begin() + i);
+            continue;
+        }
+        if (!hasNext || localUsec < nextUsec)
+        {
+            nextUsec = localUsec;
+            hasNext = true;
+        }
+        ++i;
+    }
+
+    if (hasNext) {
+        owner->ScheduleTimer(nextUsec);
+    }
+    owner->RunReady();
+}
@@ -0,0 +1,229 @@
+/** \file
+    \brief TimeSync: Timer Wheel and Event Loop Interface
+    \copyright Copyright (c) 2017-2018 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of TimeSync nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <TimeSync/TimerWheel.h>
+
+
+//------------------------------------------------------------------------------
+// TimerWheel
+
+static const unsigned kTimerSlotBits = 16;
+static const uint64_t kTimerSlotMask = ((uint64_t)1 << kTimerSlotBits) - 1;
+
+TimerWheel::TimerWheel(uint64_t tickUsec, unsigned slotCount)
+    : TickUsec(tickUsec > 0 ? tickUsec : 1)
+{
+    if (slotCount < 1) {
+        slotCount = 1;
+    }
+    else if (slotCount > kTimerSlotMask + 1) {
+        slotCount = (unsigned)(kTimerSlotMask + 1);
+    }
+
+    Slots.resize(slotCount);
+}
+
+uint64_t TimerWheel::Schedule(uint64_t expireUsec, Callback callback, void* context)
+{
+    uint64_t tick = expireUsec / TickUsec;
+
+    // If the wheel has already passed this tick, fire on the next Advance()
+    if (Started && tick < LastTick) {
+        tick = LastTick;
+    }
+
+    const unsigned slot = (unsigned)(tick % Slots.size());
+
+    Entry entry;
+    entry.ExpireUsec = expireUsec;
+    entry.TimerId = (NextTimerId++ << kTimerSlotBits) | slot;
+    entry.Func = callback;
+    entry.Context = context;
+
+    Slots[slot].push_back(entry);
+    ++PendingCount;
+
+    return entry.TimerId;
+}
+
+bool TimerWheel::Cancel(uint64_t timerId)
+{
+    const unsigned slot = (unsigned)(timerId & kTimerSlotMask);
+    if (slot >= Slots.size()) {
+        return false;
+    }
+
+    std::vector<Entry>& entries = Slots[slot];
+    for (size_t i = 0, count = entries.size(); i < count; ++i)
+    {
+        if (entries[i].TimerId == timerId)
+        {
+            entries[i] = entries.back();
+            entries.pop_back();
+            --PendingCount;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+unsigned TimerWheel::Advance(uint64_t nowUsec)
+{
+    const uint64_t nowTick = nowUsec / TickUsec;
+    const uint64_t slotCount = Slots.size();
+
+    // Visit each slot at most once per call.  The slot for the last tick is
+    // visited again because it may contain timers later in that same tick
+    uint64_t tickCount = slotCount;
+    if (Started && nowTick - LastTick < slotCount) {
+        tickCount = nowTick - LastTick + 1;
+    }
+
+    for (uint64_t i = 0; i < tickCount; ++i)
+    {
+        std::vector<Entry>& entries = Slots[(nowTick - i) % slotCount];
+
+        for (size_t j = 0; j < entries.size();)
+        {
+            if (entries[j].ExpireUsec > nowUsec)
+            {
+                ++j;
+                continue;
+            }
+
+            Expired.push_back(entries[j]);
+            entries[j] = entries.back();
+            entries.pop_back();
+        }
+    }
+
+    LastTick = nowTick;
+    Started = true;
+
+    // Callbacks may schedule more timers, so detach the expired list first
+    std::vector<Entry> fired;
+    fired.swap(Expired);
+
+    const unsigned count = (unsigned)fired.size();
+    PendingCount -= count;
+
+    for (unsigned i = 0; i < count; ++i) {
+        fired[i].Func(fired[i].Context);
+    }
+
+    // Keep the allocation for next time
+    fired.clear();
+    Expired.swap(fired);
+
+    return count;
+}
+
+uint64_t TimerWheel::GetNextExpireUsec() const
+{
+    if (PendingCount == 0) {
+        return 0;
+    }
+
+    const uint64_t slotCount = Slots.size();
+
+    // Before the first Advance() entries may be anywhere, so check them all
+    if (!Started)
+    {
+        uint64_t earliest = ~(uint64_t)0;
+        for (const std::vector<Entry>& entries : Slots) {
+            for (const Entry& entry : entries) {
+                if (earliest > entry.ExpireUsec) {
+                    earliest = entry.ExpireUsec;
+                }
+            }
+        }
+        return earliest;
+    }
+
+    // Find the first slot with a timer expiring in the current revolution
+    for (uint64_t tick = LastTick; tick < LastTick + slotCount; ++tick)
+    {
+        const uint64_t tickEndUsec = (tick + 1) * TickUsec;
+        uint64_t earliest = tickEndUsec;
+
+        for (const Entry& entry : Slots[tick % slotCount]) {
+            if (earliest > entry.ExpireUsec) {
+                earliest = entry.ExpireUsec;
+            }
+        }
+
+        if (earliest < tickEndUsec) {
+            return earliest;
+        }
+    }
+
+    // All timers are at least one revolution away
+    return (LastTick + slotCount) * TickUsec;
+}
+
+
+//------------------------------------------------------------------------------
+// TimerWheelEventLoop
+
+void TimerWheelEventLoop::Post(TimerWheel::Callback callback, void* context)
+{
+    Posted posted;
+    posted.Func = callback;
+    posted.Context = context;
+    PostedCallbacks.push_back(posted);
+}
+
+void TimerWheelEventLoop::ScheduleAt(uint64_t localUsec, TimerWheel::Callback callback, void* context)
+{
+    Wheel.Schedule(localUsec, callback, context);
+}
+
+unsigned TimerWheelEventLoop::Poll(uint64_t nowUsec)
+{
+    NowUsec = nowUsec;
+
+    // Callbacks may post more callbacks, which run on the next Poll()
+    std::vector<Posted> posted;
+    posted.swap(PostedCallbacks);
+
+    for (const Posted& callback : posted) {
+        callback.Func(callback.Context);
+    }
+
+    return (unsigned)posted.size() + Wheel.Advance(nowUsec);
+}
+
+uint64_t TimerWheelEventLoop::GetNextWakeUsec() const
+{
+    if (!PostedCallbacks.empty()) {
+        return NowUsec;
+    }
+    return Wheel.GetNextExpireUsec();
+}
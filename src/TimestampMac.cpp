@@ -0,0 +1,471 @@
+/** \file
+    \brief TimeSync: Timestamp Authentication
+    \copyright Copyright (c) 2017-2018 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of TimeSync nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <TimeSync/TimestampMac.h>
+
+
+//------------------------------------------------------------------------------
+// Tools
+
+static inline uint32_t ReadU32LE(const uint8_t* data)
+{
+    return data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+static inline void WriteU32LE(uint8_t* data, uint32_t value)
+{
+    data[0] = (uint8_t)value;
+    data[1] = (uint8_t)(value >> 8);
+    data[2] = (uint8_t)(value >> 16);
+    data[3] = (uint8_t)(value >> 24);
+}
+
+static inline void WriteU64LE(uint8_t* data, uint64_t value)
+{
+    WriteU32LE(data, (uint32_t)value);
+    WriteU32LE(data + 4, (uint32_t)(value >> 32));
+}
+
+static inline uint32_t RotL32(uint32_t x, unsigned bits)
+{
+    return (x << bits) | (x >> (32 - bits));
+}
+
+#define TIMESYNC_HSIP_ROUND(v0, v1, v2, v3) \
+    v0 += v1; v1 = RotL32(v1, 5); v1 ^= v0; v0 = RotL32(v0, 16); \
+    v2 += v3; v3 = RotL32(v3, 8); v3 ^= v2; \
+    v0 += v3; v3 = RotL32(v3, 7); v3 ^= v0; \
+    v2 += v1; v1 = RotL32(v1, 13); v1 ^= v2; v2 = RotL32(v2, 16);
+
+
+//------------------------------------------------------------------------------
+// HalfSipHash
+
+uint32_t HalfSipHash24(uint32_t k0, uint32_t k1, const uint8_t* data, unsigned bytes)
+{
+    uint32_t v0 = k0;
+    uint32_t v1 = k1;
+    uint32_t v2 = 0x6c796765 ^ k0;
+    uint32_t v3 = 0x74656462 ^ k1;
+
+    const uint8_t* end = data + (bytes & ~3u);
+    for (; data != end; data += 4)
+    {
+        const uint32_t m = ReadU32LE(data);
+        v3 ^= m;
+        TIMESYNC_HSIP_ROUND(v0, v1, v2, v3);
+        TIMESYNC_HSIP_ROUND(v0, v1, v2, v3);
+        v0 ^= m;
+    }
+
+    uint32_t b = (uint32_t)bytes << 24;
+    switch (bytes & 3)
+    {
+    case 3: b |= (uint32_t)data[2] << 16; // Fall-thru
+    case 2: b |= (uint32_t)data[1] << 8; // Fall-thru
+    case 1: b |= data[0];
+    default: break;
+    }
+
+    v3 ^= b;
+    TIMESYNC_HSIP_ROUND(v0, v1, v2, v3);
+    TIMESYNC_HSIP_ROUND(v0, v1, v2, v3);
+    v0 ^= b;
+
+    v2 ^= 0xff;
+    TIMESYNC_HSIP_ROUND(v0, v1, v2, v3);
+    TIMESYNC_HSIP_ROUND(v0, v1, v2, v3);
+    TIMESYNC_HSIP_ROUND(v0, v1, v2, v3);
+    TIMESYNC_HSIP_ROUND(v0, v1, v2, v3);
+
+    return v1 ^ v3;
+}
+
+
+//------------------------------------------------------------------------------
+// Tag Input
+
+/// Derive the key for records sent by the given node from the shared key,
+/// so the two directions are authenticated under different keys
+static void DeriveDirectionKey(
+    uint32_t k0,
+    uint32_t k1,
+    uint32_t senderId,
+    uint32_t& d0,
+    uint32_t& d1)
+{
+    uint8_t message[5];
+    WriteU32LE(message, senderId);
+    message[4] = 0;
+    d0 = HalfSipHash24(k0, k1, message, 5);
+    message[4] = 1;
+    d1 = HalfSipHash24(k0, k1, message, 5);
+}
+
+/// The tag covers the full sequence number, which is not sent, followed by
+/// the timestamp fields
+static const unsigned kMessageHeaderBytes = 8;
+
+static inline unsigned BuildMessage(
+    uint64_t sequence,
+    const uint8_t* payload,
+    unsigned payloadBytes,
+    uint8_t* message)
+{
+    WriteU64LE(message, sequence);
+    for (unsigned i = 0; i < payloadBytes; ++i) {
+        message[kMessageHeaderBytes + i] = payload[i];
+    }
+    return kMessageHeaderBytes + payloadBytes;
+}
+
+
+//------------------------------------------------------------------------------
+// Batch Kernel
+
+/// Records hashed together, so the rounds of independent records overlap
+static const unsigned kBatchLanes = 8;
+
+/// Absorb one message word per lane with two rounds
+static inline void CompressLanes(
+    uint32_t* v0,
+    uint32_t* v1,
+    uint32_t* v2,
+    uint32_t* v3,
+    const uint32_t* m)
+{
+    for (unsigned i = 0; i < kBatchLanes; ++i) {
+        v3[i] ^= m[i];
+    }
+    for (unsigned r = 0; r < 2; ++r) {
+        for (unsigned i = 0; i < kBatchLanes; ++i) {
+            TIMESYNC_HSIP_ROUND(v0[i], v1[i], v2[i], v3[i]);
+        }
+    }
+    for (unsigned i = 0; i < kBatchLanes; ++i) {
+        v0[i] ^= m[i];
+    }
+}
+
+/// Compute tags for kBatchLanes records of the same payload length.
+/// The lanes are kept in arrays so the compiler can vectorize the rounds
+template<unsigned kPayloadBytes>
+static void HashLanes(
+    uint32_t k0,
+    uint32_t k1,
+    const uint64_t* sequences,
+    const uint8_t* const* payloads,
+    uint32_t* tags)
+{
+    static_assert(kPayloadBytes == 3 || kPayloadBytes == 6, "Unsupported payload length");
+    static const unsigned kMessageBytes = kMessageHeaderBytes + kPayloadBytes;
+
+    uint32_t v0[kBatchLanes], v1[kBatchLanes], v2[kBatchLanes], v3[kBatchLanes];
+    uint32_t m[kBatchLanes];
+
+    for (unsigned i = 0; i < kBatchLanes; ++i)
+    {
+        v0[i] = k0;
+        v1[i] = k1;
+        v2[i] = 0x6c796765 ^ k0;
+        v3[i] = 0x74656462 ^ k1;
+    }
+
+    // Full words: The sequence number, then for 6 byte payloads the first
+    // 4 payload bytes
+    for (unsigned i = 0; i < kBatchLanes; ++i) {
+        m[i] = (uint32_t)sequences[i];
+    }
+    CompressLanes(v0, v1, v2, v3, m);
+    for (unsigned i = 0; i < kBatchLanes; ++i) {
+        m[i] = (uint32_t)(sequences[i] >> 32);
+    }
+    CompressLanes(v0, v1, v2, v3, m);
+    if (kPayloadBytes >= 4)
+    {
+        for (unsigned i = 0; i < kBatchLanes; ++i) {
+            m[i] = ReadU32LE(payloads[i]);
+        }
+        CompressLanes(v0, v1, v2, v3, m);
+    }
+
+    // Final block with the remaining payload bytes and the length
+    static const unsigned kTailOffset = kPayloadBytes & ~3u;
+    for (unsigned i = 0; i < kBatchLanes; ++i)
+    {
+        const uint8_t* tail = payloads[i] + kTailOffset;
+        uint32_t b = (uint32_t)kMessageBytes << 24;
+        if (kPayloadBytes == 3) {
+            b |= tail[0] | ((uint32_t)tail[1] << 8) | ((uint32_t)tail[2] << 16);
+        }
+        else {
+            b |= tail[0] | ((uint32_t)tail[1] << 8);
+        }
+        m[i] = b;
+    }
+    CompressLanes(v0, v1, v2, v3, m);
+    for (unsigned i = 0; i < kBatchLanes; ++i) {
+        v2[i] ^= 0xff;
+    }
+    for (unsigned r = 0; r < 4; ++r) {
+        for (unsigned i = 0; i < kBatchLanes; ++i) {
+            TIMESYNC_HSIP_ROUND(v0[i], v1[i], v2[i], v3[i]);
+        }
+    }
+
+    for (unsigned i = 0; i < kBatchLanes; ++i) {
+        tags[i] = v1[i] ^ v3[i];
+    }
+}
+
+/// Expand the truncated sequence number of a record next to the largest
+static inline uint64_t ExpandRecordSequence(uint64_t largestSequence, const uint8_t* record)
+{
+    return Counter64::ExpandFromTruncated(
+        largestSequence,
+        Counter32(ReadU32LE(record))).ToUnsigned();
+}
+
+/// Returns true if the sequence number has not been accepted yet and is not
+/// older than the replay window
+static inline bool IsNewSequence(uint64_t largestSequence, uint64_t replayWindow, uint64_t sequence)
+{
+    if (sequence > largestSequence) {
+        return true;
+    }
+    const uint64_t age = largestSequence - sequence;
+    return age < kTimestampReplayWindow && (replayWindow & ((uint64_t)1 << age)) == 0;
+}
+
+/// Mark a sequence number as accepted, sliding the window if it is newest
+static inline void AcceptSequence(uint64_t& largestSequence, uint64_t& replayWindow, uint64_t sequence)
+{
+    if (sequence > largestSequence)
+    {
+        const uint64_t shift = sequence - largestSequence;
+        replayWindow = (shift < kTimestampReplayWindow) ? ((replayWindow << shift) | 1) : 1;
+        largestSequence = sequence;
+    }
+    else {
+        replayWindow |= (uint64_t)1 << (largestSequence - sequence);
+    }
+}
+
+template<unsigned kPayloadBytes>
+static unsigned VerifyBatchT(
+    uint32_t k0,
+    uint32_t k1,
+    uint64_t& largestSequence,
+    uint64_t& replayWindow,
+    const uint8_t* const* records,
+    unsigned count,
+    bool* validOut)
+{
+    static const unsigned kFieldBytes = kTimestampSequenceBytes + kPayloadBytes;
+
+    unsigned validCount = 0;
+    uint64_t sequences[kBatchLanes];
+    const uint8_t* payloads[kBatchLanes];
+    uint32_t tags[kBatchLanes];
+
+    for (unsigned i = 0; i < count; i += kBatchLanes)
+    {
+        unsigned lanes = count - i;
+        if (lanes > kBatchLanes) {
+            lanes = kBatchLanes;
+        }
+
+        // Sequence numbers in a batch are close together, so expanding
+        // them all next to the largest accepted before the batch is fine
+        for (unsigned j = 0; j < kBatchLanes; ++j)
+        {
+            const uint8_t* record = records[i + (j < lanes ? j : 0)];
+            sequences[j] = ExpandRecordSequence(largestSequence, record);
+            payloads[j] = record + kTimestampSequenceBytes;
+        }
+
+        HashLanes<kPayloadBytes>(k0, k1, sequences, payloads, tags);
+
+        // Accept in arrival order so replays within the batch are caught
+        for (unsigned j = 0; j < lanes; ++j)
+        {
+            const bool valid = tags[j] == ReadU32LE(records[i + j] + kFieldBytes) &&
+                IsNewSequence(largestSequence, replayWindow, sequences[j]);
+            if (valid) {
+                AcceptSequence(largestSequence, replayWindow, sequences[j]);
+                ++validCount;
+            }
+            validOut[i + j] = valid;
+        }
+    }
+
+    return validCount;
+}
+
+
+//------------------------------------------------------------------------------
+// TimestampAuthenticator
+
+TimestampAuthenticator::TimestampAuthenticator(
+    const uint8_t key[kTimestampMacKeyBytes],
+    uint32_t localId,
+    uint32_t peerId)
+{
+    const uint32_t k0 = ReadU32LE(key);
+    const uint32_t k1 = ReadU32LE(key + 4);
+    DeriveDirectionKey(k0, k1, localId, SendK0, SendK1);
+    DeriveDirectionKey(k0, k1, peerId, RecvK0, RecvK1);
+}
+
+unsigned TimestampAuthenticator::Stamp(uint8_t* data, unsigned fieldBytes)
+{
+    const uint64_t sequence = NextSequence++;
+    WriteU32LE(data, (uint32_t)sequence);
+
+    const unsigned payloadBytes = fieldBytes - kTimestampSequenceBytes;
+    uint8_t message[kMessageHeaderBytes + 6];
+    const unsigned messageBytes = BuildMessage(sequence, data + kTimestampSequenceBytes, payloadBytes, message);
+
+    WriteU32LE(data + fieldBytes, HalfSipHash24(SendK0, SendK1, message, messageBytes));
+    return fieldBytes + kTimestampTagBytes;
+}
+
+unsigned TimestampAuthenticator::StampTimestamp(uint64_t localUsec, uint8_t* data)
+{
+    HibernatedTimeSync::Write24(data + kTimestampSequenceBytes, TimeSynchronizer::LocalTimeToDatagramTS24(localUsec));
+    return Stamp(data, kTimestampFieldBytes);
+}
+
+unsigned TimestampAuthenticator::StampTimestampAndMinDelta(
+    uint64_t localUsec,
+    Counter24 minDeltaTS24,
+    uint8_t* data)
+{
+    HibernatedTimeSync::Write24(data + kTimestampSequenceBytes, TimeSynchronizer::LocalTimeToDatagramTS24(localUsec));
+    HibernatedTimeSync::Write24(data + kTimestampSequenceBytes + 3, minDeltaTS24.ToUnsigned());
+    return Stamp(data, kTimestampAndMinDeltaFieldBytes);
+}
+
+uint64_t TimestampAuthenticator::ExpandSequence(const uint8_t* data) const
+{
+    return ExpandRecordSequence(LargestSequence, data);
+}
+
+bool TimestampAuthenticator::Verify(const uint8_t* data, unsigned fieldBytes)
+{
+    // Reject replays before hashing
+    const uint64_t sequence = ExpandSequence(data);
+    if (!IsNewSequence(LargestSequence, ReplayWindow, sequence)) {
+        return false;
+    }
+
+    const unsigned payloadBytes = fieldBytes - kTimestampSequenceBytes;
+    uint8_t message[kMessageHeaderBytes + 6];
+    const unsigned messageBytes = BuildMessage(sequence, data + kTimestampSequenceBytes, payloadBytes, message);
+
+    if (HalfSipHash24(RecvK0, RecvK1, message, messageBytes) != ReadU32LE(data + fieldBytes)) {
+        return false;
+    }
+
+    AcceptSequence(LargestSequence, ReplayWindow, sequence);
+    return true;
+}
+
+bool TimestampAuthenticator::VerifyTimestamp(const uint8_t* data, Counter24& timestamp)
+{
+    if (!Verify(data, kTimestampFieldBytes)) {
+        return false;
+    }
+    timestamp = HibernatedTimeSync::Read24(data + kTimestampSequenceBytes);
+    return true;
+}
+
+bool TimestampAuthenticator::VerifyTimestampAndMinDelta(
+    const uint8_t* data,
+    Counter24& timestamp,
+    Counter24& minDeltaTS24)
+{
+    if (!Verify(data, kTimestampAndMinDeltaFieldBytes)) {
+        return false;
+    }
+    timestamp = HibernatedTimeSync::Read24(data + kTimestampSequenceBytes);
+    minDeltaTS24 = HibernatedTimeSync::Read24(data + kTimestampSequenceBytes + 3);
+    return true;
+}
+
+unsigned TimestampAuthenticator::VerifyBatch(
+    const uint8_t* const* records,
+    unsigned count,
+    unsigned fieldBytes,
+    bool* validOut)
+{
+    if (fieldBytes == kTimestampFieldBytes) {
+        return VerifyBatchT<3>(RecvK0, RecvK1, LargestSequence, ReplayWindow, records, count, validOut);
+    }
+    if (fieldBytes == kTimestampAndMinDeltaFieldBytes) {
+        return VerifyBatchT<6>(RecvK0, RecvK1, LargestSequence, ReplayWindow, records, count, validOut);
+    }
+
+    for (unsigned i = 0; i < count; ++i) {
+        validOut[i] = false;
+    }
+    return 0;
+}
+
+unsigned TimestampAuthenticator::OnStampedBatch(
+    TimeSynchronizer& sync,
+    const uint8_t* const* records,
+    const uint64_t* recvUsec,
+    unsigned count)
+{
+    unsigned validCount = 0;
+    bool valid[kBatchLanes * 8];
+
+    // Verify in chunks so the validity flags fit on the stack
+    for (unsigned offset = 0; offset < count; offset += kBatchLanes * 8)
+    {
+        unsigned chunk = count - offset;
+        if (chunk > kBatchLanes * 8) {
+            chunk = kBatchLanes * 8;
+        }
+
+        validCount += VerifyBatchT<3>(RecvK0, RecvK1, LargestSequence, ReplayWindow, records + offset, chunk, valid);
+
+        for (unsigned i = 0; i < chunk; ++i)
+        {
+            if (valid[i]) {
+                sync.OnAuthenticatedDatagramTimestamp(
+                    HibernatedTimeSync::Read24(records[offset + i] + kTimestampSequenceBytes),
+                    recvUsec[offset + i]);
+            }
+        }
+    }
+
+    return validCount;
+}
@@ -0,0 +1,211 @@
+/** \file
+    \brief TimeSync: C API for FFI Consumers
+    \copyright Copyright (c) 2017-2018 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of TimeSync nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <TimeSync/timesync_c.h>
+#include <TimeSync/TimeSync.h>
+
+#include <new>
+
+/// The opaque handle is the synchronizer itself
+struct timesync_sync_t : TimeSynchronizer
+{
+};
+
+
+//------------------------------------------------------------------------------
+// Handles
+
+uint32_t timesync_c_version(void)
+{
+    return TIMESYNC_C_VERSION;
+}
+
+timesync_sync_t* timesync_create(void)
+{
+    return new (std::nothrow) timesync_sync_t;
+}
+
+void timesync_destroy(timesync_sync_t* sync)
+{
+    delete sync;
+}
+
+
+//------------------------------------------------------------------------------
+// State
+
+int timesync_is_synchronized(const timesync_sync_t* sync)
+{
+    return sync->IsSynchronized() ? 1 : 0;
+}
+
+int32_t timesync_get_remote_delta_usec(const timesync_sync_t* sync)
+{
+    return sync->GetSignedRemoteTimeDeltaUsec();
+}
+
+uint32_t timesync_get_min_owd_usec(const timesync_sync_t* sync)
+{
+    return sync->GetMinimumOneWayDelayUsec();
+}
+
+uint32_t timesync_get_min_delta_ts24(const timesync_sync_t* sync)
+{
+    return sync->GetMinDeltaTS24().ToUnsigned();
+}
+
+void timesync_on_peer_min_delta_ts24(
+    timesync_sync_t* sync,
+    uint32_t minDeltaTS24)
+{
+    sync->OnPeerMinDeltaTS24(minDeltaTS24);
+}
+
+
+//------------------------------------------------------------------------------
+// Batch Ingest
+
+void timesync_ingest_ts24(
+    timesync_sync_t* sync,
+    const uint32_t* remoteSendTS24,
+    const uint64_t* localRecvUsec,
+    uint32_t* owdUsecOut,
+    size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        const unsigned owdUsec = sync->OnAuthenticatedDatagramTimestamp(
+            remoteSendTS24[i],
+            localRecvUsec[i]);
+        if (owdUsecOut) {
+            owdUsecOut[i] = owdUsec;
+        }
+    }
+}
+
+void timesync_ingest_ts24_ns(
+    timesync_sync_t* sync,
+    const uint32_t* remoteSendTS24,
+    const uint64_t* localRecvNsec,
+    uint64_t* owdNsecOut,
+    size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        const uint64_t owdNsec = sync->OnAuthenticatedDatagramTimestampNs(
+            remoteSendTS24[i],
+            localRecvNsec[i]);
+        if (owdNsecOut) {
+            owdNsecOut[i] = owdNsec;
+        }
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// Batch Conversions
+
+void timesync_to_datagram_ts24(
+    const uint64_t* localUsec,
+    uint32_t* ts24Out,
+    size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        ts24Out[i] = TimeSynchronizer::LocalTimeToDatagramTS24(localUsec[i]);
+    }
+}
+
+void timesync_to_remote_ts23(
+    const timesync_sync_t* sync,
+    const uint64_t* localUsec,
+    uint32_t* remoteTS23Out,
+    size_t count)
+{
+    const TimeConversionParams params = sync->GetConversionParams();
+
+    for (size_t i = 0; i < count; ++i) {
+        remoteTS23Out[i] = params.ToRemoteTime23(localUsec[i]);
+    }
+}
+
+void timesync_from_remote_ts23(
+    const timesync_sync_t* sync,
+    const uint64_t* localUsec,
+    const uint32_t* remoteTS23,
+    uint64_t* localUsecOut,
+    size_t count)
+{
+    const TimeConversionParams params = sync->GetConversionParams();
+
+    for (size_t i = 0; i < count; ++i) {
+        localUsecOut[i] = params.FromRemoteTime23(localUsec[i], remoteTS23[i]);
+    }
+}
+
+void timesync_from_local_ts23(
+    const uint64_t* localUsec,
+    const uint32_t* localTS23,
+    uint64_t* localUsecOut,
+    size_t count)
+{
+    // As in TimeSynchronizer::FromLocalTime23(), which needs no state
+    for (size_t i = 0; i < count; ++i)
+    {
+        localUsecOut[i] = Counter64::ExpandFromTruncatedWithBias(
+            localUsec[i] >> kTime23LostBits,
+            Counter23(localTS23[i]),
+            kTime23Bias).ToUnsigned() << kTime23LostBits;
+    }
+}
+
+size_t timesync_expand_counters(
+    unsigned bits,
+    uint64_t recent,
+    const uint32_t* truncated,
+    uint64_t* expandedOut,
+    size_t count)
+{
+    if (bits < 1 || bits > 32) {
+        return 0;
+    }
+
+    // Same as Counter64::ExpandFromTruncated() with a run-time field width:
+    // Add the signed gap between the truncated value and the previous one
+    const uint64_t mask = ((uint64_t)1 << bits) - 1;
+    const uint64_t msb = (uint64_t)1 << (bits - 1);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        const uint64_t gap = (truncated[i] - recent) & mask;
+        recent += gap - ((gap & msb) << 1);
+        expandedOut[i] = recent;
+    }
+
+    return count;
+}
@@ -0,0 +1,824 @@
+/** \file
+    \brief TimeSync: Benchmarks
+    \copyright Copyright (c) 2017 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of TimeSync nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <TimeSync/TimeSync.h>
+#include <TimeSync/NtpServer.h>
+#include <TimeSync/SharedSyncState.h>
+#include <TimeSync/MinDeltaPiggyback.h>
+#include <TimeSync/TimestampMac.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+    #include <arpa/inet.h>
+    #include <netinet/in.h>
+    #include <poll.h>
+    #include <sys/socket.h>
+    #include <unistd.h>
+#endif // __linux__
+using namespace std;
+
+
+//------------------------------------------------------------------------------
+// PCG PRNG
+
+/// From http://www.pcg-random.org/
+class PCGRandom
+{
+public:
+    void Seed(uint64_t y, uint64_t x = 0)
+    {
+        State = 0;
+        Inc = (y << 1u) | 1u;
+        Next();
+        State += x;
+        Next();
+    }
+
+    uint32_t Next()
+    {
+        const uint64_t oldstate = State;
+        State = oldstate * UINT64_C(6364136223846793005) + Inc;
+        const uint32_t xorshifted = (uint32_t)(((oldstate >> 18) ^ oldstate) >> 27);
+        const uint32_t rot = oldstate >> 59;
+        return (xorshifted >> rot) | (xorshifted << ((uint32_t)(-(int32_t)rot) & 31));
+    }
+
+    uint64_t State = 0, Inc = 0;
+};
+
+
+//------------------------------------------------------------------------------
+// Tools
+
+static uint64_t get_nsec()
+{
+    return (uint64_t)chrono::duration_cast<chrono::nanoseconds>(
+        chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/// Adapters so that both profiles can share the simulator
+struct Profile24
+{
+    typedef TimeSynchronizer Sync;
+    static const char* Name() { return "TS24 (8 usec)"; }
+
+    static void Send(Sync& from, Sync& to, uint64_t sendUsec, uint64_t recvUsec)
+    {
+        to.OnAuthenticatedDatagramTimestamp(from.LocalTimeToDatagramTS24(sendUsec), recvUsec);
+    }
+    static void Exchange(Sync& a, Sync& b)
+    {
+        a.OnPeerMinDeltaTS24(b.GetMinDeltaTS24());
+        b.OnPeerMinDeltaTS24(a.GetMinDeltaTS24());
+    }
+    static int32_t GetDelta(const Sync& sync)
+    {
+        return sync.GetSignedRemoteTimeDeltaUsec();
+    }
+    static int32_t ExpectedDelta(uint64_t clock_delta)
+    {
+        return (int32_t)((uint32_t)clock_delta << 6) >> 6;
+    }
+};
+
+struct Profile32
+{
+    typedef TimeSynchronizer Sync;
+    static const char* Name() { return "TS32 (1 usec)"; }
+
+    static void Send(Sync& from, Sync& to, uint64_t sendUsec, uint64_t recvUsec)
+    {
+        to.OnAuthenticatedDatagramTimestamp32(from.LocalTimeToDatagramTS32(sendUsec), recvUsec);
+    }
+    static void Exchange(Sync& a, Sync& b)
+    {
+        a.OnPeerMinDeltaTS32(b.GetMinDeltaTS32());
+        b.OnPeerMinDeltaTS32(a.GetMinDeltaTS32());
+    }
+    static int32_t GetDelta(const Sync& sync)
+    {
+        return sync.GetSignedRemoteTimeDeltaUsec();
+    }
+    static int32_t ExpectedDelta(uint64_t clock_delta)
+    {
+        return (int32_t)((uint32_t)clock_delta << 6) >> 6;
+    }
+};
+
+
+//------------------------------------------------------------------------------
+// Offset Error Simulation
+
+/// Returns the largest absolute offset error over several trials
+template<class Profile>
+static unsigned simulate_offset_error(unsigned owdUsec, unsigned jitterUsec)
+{
+    static const unsigned kTrials = 20;
+    static const unsigned kRounds = 1000;
+
+    unsigned worstError = 0;
+
+    for (unsigned trial = 0; trial < kTrials; ++trial)
+    {
+        PCGRandom prng;
+        prng.Seed(trial);
+
+        // Offset that is not a multiple of the timestamp resolution
+        const uint64_t clock_delta = 1000000007ULL * (trial + 1) + prng.Next() % 1000;
+
+        typename Profile::Sync sync_a, sync_b;
+        uint64_t globalUsec = 1000000;
+
+        for (unsigned i = 0; i < kRounds; ++i)
+        {
+            uint64_t sendUsec = globalUsec;
+            globalUsec += owdUsec + prng.Next() % (jitterUsec + 1);
+            Profile::Send(sync_a, sync_b, sendUsec, globalUsec + clock_delta);
+
+            sendUsec = globalUsec;
+            globalUsec += owdUsec + prng.Next() % (jitterUsec + 1);
+            Profile::Send(sync_b, sync_a, sendUsec + clock_delta, globalUsec);
+
+            if (i % 10 == 9) {
+                Profile::Exchange(sync_a, sync_b);
+            }
+
+            globalUsec += 100;
+        }
+
+        const int32_t error = Profile::GetDelta(sync_a) - Profile::ExpectedDelta(clock_delta);
+        const unsigned absError = (unsigned)abs(error);
+        if (absError > worstError) {
+            worstError = absError;
+        }
+    }
+
+    return worstError;
+}
+
+template<class Profile>
+static void BenchmarkOffsetError()
+{
+    static const unsigned kOWDs[] = { 20, 50 };
+    static const unsigned kJitters[] = { 0, 2, 5 };
+
+    for (unsigned owdUsec : kOWDs)
+    {
+        for (unsigned jitterUsec : kJitters)
+        {
+            cout << Profile::Name() << ": OWD = " << owdUsec << " usec, jitter = " << jitterUsec
+                << " usec -> worst offset error = " << simulate_offset_error<Profile>(owdUsec, jitterUsec)
+                << " usec" << endl;
+        }
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// Per-Datagram Cost
+
+template<class Profile>
+static void BenchmarkDatagramCost()
+{
+    static const unsigned kDatagrams = 10 * 1000 * 1000;
+
+    typename Profile::Sync sync_a, sync_b;
+    uint64_t globalUsec = 1000000;
+
+    // Synchronize first so that the full OWD path is measured
+    for (unsigned i = 0; i < 10; ++i)
+    {
+        Profile::Send(sync_a, sync_b, globalUsec, globalUsec + 30);
+        Profile::Send(sync_b, sync_a, globalUsec, globalUsec + 30);
+        Profile::Exchange(sync_a, sync_b);
+        globalUsec += 100;
+    }
+
+    PCGRandom prng;
+    prng.Seed(0);
+
+    const uint64_t t0 = get_nsec();
+    for (unsigned i = 0; i < kDatagrams; ++i)
+    {
+        Profile::Send(sync_b, sync_a, globalUsec, globalUsec + 30 + (prng.Next() & 7));
+        globalUsec += 10;
+    }
+    const uint64_t t1 = get_nsec();
+
+    cout << Profile::Name() << ": OnAuthenticatedDatagramTimestamp() = "
+        << (double)(t1 - t0) / kDatagrams << " nsec/datagram (" << sync_a.GetMinimumOneWayDelayUsec()
+        << " usec OWD)" << endl;
+}
+
+
+//------------------------------------------------------------------------------
+// NTP Response Rate
+
+static void BenchmarkNtpResponses()
+{
+    static const unsigned kRequests = 10 * 1000 * 1000;
+
+    TimeSynchronizer sync;
+    NtpResponder responder(sync);
+
+    uint8_t request[kNtpPacketBytes] = { 0x23 };
+    uint8_t response[kNtpPacketBytes];
+    uint64_t unixNsec = 1700000000000000000ULL;
+    unsigned valid = 0;
+
+    const uint64_t t0 = get_nsec();
+    for (unsigned i = 0; i < kRequests; ++i)
+    {
+        request[40] = (uint8_t)i;
+        valid += responder.BuildResponse(request, sizeof(request), unixNsec, unixNsec + 1000, response) ? 1 : 0;
+        unixNsec += 1000;
+    }
+    const uint64_t t1 = get_nsec();
+
+    cout << "NtpResponder::BuildResponse() = " << (double)(t1 - t0) / kRequests << " nsec/request ("
+        << (uint64_t)(valid * 1000000000.0 / (t1 - t0)) << " requests/sec)" << endl;
+}
+
+
+//------------------------------------------------------------------------------
+// NTP Server Loopback Rate
+
+#ifdef __linux__
+
+static void BenchmarkNtpServer()
+{
+    static const unsigned kRounds = 5000;
+    static const unsigned kBurst = NtpServer::kBatchSize;
+
+    TimeSynchronizer sync;
+    NtpServer server(sync);
+    const int client = socket(AF_INET, SOCK_DGRAM, 0);
+    if (client < 0 || !server.Open(0, INADDR_LOOPBACK))
+    {
+        cout << "NtpServer: Unable to open sockets" << endl;
+        if (client >= 0) {
+            close(client);
+        }
+        return;
+    }
+
+    sockaddr_in to;
+    memset(&to, 0, sizeof(to));
+    to.sin_family = AF_INET;
+    to.sin_port = htons(server.GetPort());
+    to.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(client, (const sockaddr*)&to, sizeof(to)) != 0)
+    {
+        cout << "NtpServer: Unable to connect" << endl;
+        close(client);
+        return;
+    }
+
+    uint8_t requests[kBurst][kNtpPacketBytes];
+    uint8_t responses[kBurst][kNtpPacketBytes];
+    iovec iovs[kBurst];
+    mmsghdr msgs[kBurst];
+    memset(requests, 0x23, sizeof(requests));
+    memset(msgs, 0, sizeof(msgs));
+
+    uint64_t replies = 0;
+    const uint64_t t0 = get_nsec();
+    for (unsigned round = 0; round < kRounds; ++round)
+    {
+        for (unsigned i = 0; i < kBurst; ++i)
+        {
+            iovs[i].iov_base = requests[i];
+            iovs[i].iov_len = kNtpPacketBytes;
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        sendmmsg(client, msgs, kBurst, 0);
+
+        server.Poll(100);
+
+        for (unsigned i = 0; i < kBurst; ++i) {
+            iovs[i].iov_base = responses[i];
+        }
+        const int received = recvmmsg(client, msgs, kBurst, MSG_DONTWAIT, nullptr);
+        if (received > 0) {
+            replies += (unsigned)received;
+        }
+    }
+    const uint64_t t1 = get_nsec();
+
+    cout << "NtpServer over loopback = " << (double)(t1 - t0) / ((uint64_t)kRounds * kBurst)
+        << " nsec/request (client included, " << replies << " replies, "
+        << server.GetDroppedCount() << " dropped)" << endl;
+
+    close(client);
+}
+
+/// Client thread for BenchmarkNtpServerScaling(): Keeps up to one burst of
+/// requests outstanding on each of several sockets
+static void ntp_scaling_client(uint16_t port, std::atomic<bool>& stop, std::atomic<uint64_t>& replies)
+{
+    static const unsigned kSockets = 4;
+    static const unsigned kBurst = 16;
+
+    sockaddr_in to;
+    memset(&to, 0, sizeof(to));
+    to.sin_family = AF_INET;
+    to.sin_port = htons(port);
+    to.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    // Each socket has its own source port, so the kernel hash spreads them
+    pollfd pfds[kSockets];
+    unsigned outstanding[kSockets];
+    for (unsigned i = 0; i < kSockets; ++i)
+    {
+        pfds[i].fd = socket(AF_INET, SOCK_DGRAM, 0);
+        pfds[i].events = POLLIN;
+        outstanding[i] = 0;
+        if (pfds[i].fd >= 0) {
+            connect(pfds[i].fd, (const sockaddr*)&to, sizeof(to));
+        }
+    }
+
+    uint8_t requests[kBurst][kNtpPacketBytes];
+    uint8_t responses[kBurst][kNtpPacketBytes];
+    iovec iovs[kBurst];
+    mmsghdr msgs[kBurst];
+    memset(requests, 0x23, sizeof(requests));
+    memset(msgs, 0, sizeof(msgs));
+    for (unsigned i = 0; i < kBurst; ++i)
+    {
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        iovs[i].iov_len = kNtpPacketBytes;
+    }
+
+    uint64_t received = 0;
+    while (!stop)
+    {
+        for (unsigned s = 0; s < kSockets; ++s)
+        {
+            if (pfds[s].fd < 0 || outstanding[s] > 0) {
+                continue;
+            }
+            for (unsigned i = 0; i < kBurst; ++i) {
+                iovs[i].iov_base = requests[i];
+            }
+            const int sent = sendmmsg(pfds[s].fd, msgs, kBurst, 0);
+            if (sent > 0) {
+                outstanding[s] = (unsigned)sent;
+            }
+        }
+
+        // Lost replies would stall a socket, so start over after a timeout
+        if (poll(pfds, kSockets, 10) <= 0)
+        {
+            for (unsigned s = 0; s < kSockets; ++s) {
+                outstanding[s] = 0;
+            }
+            continue;
+        }
+
+        for (unsigned s = 0; s < kSockets; ++s)
+        {
+            if (!(pfds[s].revents & POLLIN)) {
+                continue;
+            }
+            for (unsigned i = 0; i < kBurst; ++i) {
+                iovs[i].iov_base = responses[i];
+            }
+            const int got = recvmmsg(pfds[s].fd, msgs, kBurst, MSG_DONTWAIT, nullptr);
+            if (got > 0)
+            {
+                received += (unsigned)got;
+                outstanding[s] = (unsigned)got >= outstanding[s] ? 0 : outstanding[s] - (unsigned)got;
+            }
+        }
+    }
+
+    replies += received;
+    for (unsigned i = 0; i < kSockets; ++i)
+    {
+        if (pfds[i].fd >= 0) {
+            close(pfds[i].fd);
+        }
+    }
+}
+
+/// Requests per second answered by several servers sharing one port with
+/// SO_REUSEPORT, each polled by its own thread with its own client thread
+static void BenchmarkNtpServerScaling()
+{
+    static const unsigned kDurationMsec = 500;
+
+    for (unsigned serverCount = 1; serverCount <= 4; serverCount *= 2)
+    {
+        TimeSynchronizer sync;
+        std::vector< std::unique_ptr<NtpServer> > servers;
+        bool opened = true;
+        for (unsigned i = 0; i < serverCount && opened; ++i)
+        {
+            servers.emplace_back(new NtpServer(sync));
+            opened = servers[i]->Open(i == 0 ? 0 : servers[0]->GetPort(), INADDR_LOOPBACK, true);
+        }
+        if (!opened)
+        {
+            cout << "NtpServer: Unable to open SO_REUSEPORT sockets" << endl;
+            return;
+        }
+
+        std::atomic<bool> stop(false);
+        std::atomic<uint64_t> replies(0);
+        std::vector<std::thread> threads;
+        for (auto& server : servers)
+        {
+            NtpServer* polled = server.get();
+            threads.emplace_back([&stop, polled]() {
+                while (!stop) {
+                    polled->Poll(10);
+                }
+            });
+        }
+        const uint16_t port = servers[0]->GetPort();
+        for (unsigned i = 0; i < serverCount; ++i) {
+            threads.emplace_back(ntp_scaling_client, port, std::ref(stop), std::ref(replies));
+        }
+
+        const uint64_t t0 = get_nsec();
+        std::this_thread::sleep_for(std::chrono::milliseconds(kDurationMsec));
+        stop = true;
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+        const uint64_t t1 = get_nsec();
+
+        cout << "NtpServer x" << serverCount << " with SO_REUSEPORT = "
+            << (uint64_t)((double)replies * 1000000000.0 / (double)(t1 - t0))
+            << " requests/sec (" << std::thread::hardware_concurrency() << " cores, clients included)" << endl;
+    }
+}
+
+#endif // __linux__
+
+
+//------------------------------------------------------------------------------
+// Shared State Read Cost
+
+#ifdef __linux__
+
+static void BenchmarkSharedStateReads()
+{
+    static const unsigned kReads = 20 * 1000 * 1000;
+
+    char name[64];
+    snprintf(name, sizeof(name), "/timesync_bench_%d", (int)getpid());
+
+    SyncStatePublisher publisher;
+    SyncStateReader reader;
+    if (!publisher.Open(name) || !reader.Open(name))
+    {
+        cout << "SyncStateReader: Unable to open shared memory" << endl;
+        return;
+    }
+
+    SyncStateSnapshot published;
+    published.Synchronized = true;
+    published.RemoteTimeDeltaUsec = 1234567;
+    publisher.Publish(published);
+
+    uint32_t sum = 0;
+    uint64_t t0 = get_nsec();
+    for (unsigned i = 0; i < kReads; ++i) {
+        sum += reader.ToRemoteTime23(i);
+    }
+    uint64_t t1 = get_nsec();
+    const double readNsec = (double)(t1 - t0) / kReads;
+
+    // Baseline: A clock read through the vDSO
+    t0 = get_nsec();
+    for (unsigned i = 0; i < kReads; ++i) {
+        sum += (uint32_t)get_nsec();
+    }
+    t1 = get_nsec();
+    const double clockNsec = (double)(t1 - t0) / kReads;
+
+    cout << "SyncStateReader::ToRemoteTime23() = " << readNsec << " nsec/read (clock read = "
+        << clockNsec << " nsec) [" << (sum & 1) << "]" << endl;
+
+    reader.Close();
+    publisher.Close();
+    SyncStatePublisher::Unlink(name);
+}
+
+#endif // __linux__
+
+
+//------------------------------------------------------------------------------
+// Concurrent Conversion Cost
+
+/// How reader threads convert timestamps
+enum class ConversionMode
+{
+    SeparateLoads, ///< Separate Synchronized and delta loads
+    PackedLoad,    ///< TimeSynchronizer::ToRemoteTime23()
+    CachedParams   ///< TimeConversionCache refreshed every 64 conversions
+};
+
+static void BenchmarkConcurrentConversions(ConversionMode mode, const char* name)
+{
+    static const unsigned kReaders = 32;
+    static const unsigned kConversionsPerReader = 2 * 1000 * 1000;
+
+    TimeSynchronizer sync_a, sync_b;
+    uint64_t globalUsec = 1000000;
+    for (unsigned i = 0; i < 10; ++i)
+    {
+        Profile24::Send(sync_a, sync_b, globalUsec, globalUsec + 30);
+        Profile24::Send(sync_b, sync_a, globalUsec, globalUsec + 30);
+        Profile24::Exchange(sync_a, sync_b);
+        globalUsec += 100;
+    }
+
+    // Writer keeps feeding datagrams, occasionally moving the offset
+    std::atomic<bool> stop(false);
+    std::thread writer([&]() {
+        PCGRandom prng;
+        prng.Seed(1);
+        uint64_t usec = globalUsec;
+        while (!stop)
+        {
+            Profile24::Send(sync_b, sync_a, usec, usec + 30 + (prng.Next() & 7));
+            usec += 10;
+        }
+    });
+
+    std::atomic<uint32_t> sink(0);
+    std::vector<std::thread> readers;
+
+    const uint64_t t0 = get_nsec();
+    for (unsigned r = 0; r < kReaders; ++r)
+    {
+        readers.emplace_back([&, r]() {
+            TimeConversionCache cache;
+            uint32_t sum = 0;
+            uint64_t localUsec = 1000000 + r;
+
+            for (unsigned i = 0; i < kConversionsPerReader; ++i, localUsec += 3)
+            {
+                switch (mode)
+                {
+                case ConversionMode::SeparateLoads:
+                    if (sync_a.IsSynchronized()) {
+                        sum += (uint32_t)((localUsec + sync_a.GetSignedRemoteTimeDeltaUsec()) >> kTime23LostBits);
+                    }
+                    break;
+                case ConversionMode::PackedLoad:
+                    sum += sync_a.ToRemoteTime23(localUsec);
+                    break;
+                case ConversionMode::CachedParams:
+                    if ((i & 63) == 0) {
+                        cache.Refresh(sync_a);
+                    }
+                    sum += cache.ToRemoteTime23(localUsec);
+                    break;
+                }
+            }
+
+            sink += sum;
+        });
+    }
+    for (auto& reader : readers) {
+        reader.join();
+    }
+    const uint64_t t1 = get_nsec();
+
+    stop = true;
+    writer.join();
+
+    cout << name << ": " << kReaders << " readers, 1 writer -> "
+        << (double)(t1 - t0) / ((uint64_t)kReaders * kConversionsPerReader)
+        << " nsec/conversion (wall clock, " << thread::hardware_concurrency() << " cores) [" << (sink & 1) << "]" << endl;
+}
+
+
+//------------------------------------------------------------------------------
+// Piggyback Radio Wakeups
+
+/// Uplink radio: A transmission after this much idle time is a wakeup
+static const uint64_t kRadioTailUsec = 200000;
+
+struct RadioModel
+{
+    uint64_t LastTxUsec = 0;
+    bool EverSent = false;
+
+    /// Returns true if this transmission woke the radio
+    bool Transmit(uint64_t usec)
+    {
+        const bool wakeup = !EverSent || usec - LastTxUsec > kRadioTailUsec;
+        EverSent = true;
+        LastTxUsec = usec;
+        return wakeup;
+    }
+};
+
+/// Simulate 10 minutes of uplink data with the given mean packet interval.
+/// Compares radio wakeups caused by MinDelta updates when sending them as
+/// separate messages on the README schedule, against piggybacking
+static void simulate_piggyback_wakeups(unsigned meanIntervalMsec)
+{
+    static const uint64_t kDurationUsec = 10 * 60 * 1000000ULL;
+    static const uint64_t kTickUsec = 10000;
+
+    PCGRandom prng;
+    prng.Seed(meanIntervalMsec);
+
+    TimeSynchronizer sync;
+    MinDeltaPiggybacker piggybacker(sync);
+
+    RadioModel baseline, piggyback;
+    unsigned baselineUpdateWakeups = 0, piggybackUpdateWakeups = 0;
+    uint64_t nextBaselineUsec = 0;
+    const uint64_t startUsec = 1000000;
+    uint8_t packet[kMinDeltaAttachmentBytes];
+
+    for (uint64_t usec = startUsec; usec < startUsec + kDurationUsec; usec += kTickUsec)
+    {
+        // Downlink datagrams every 50 msec with jitter move the min delta
+        if ((usec / kTickUsec) % 5 == 0) {
+            const uint64_t sendUsec = usec - 20000 - prng.Next() % 5000;
+            sync.OnAuthenticatedDatagramTimestamp(sync.LocalTimeToDatagramTS24(sendUsec), usec);
+        }
+
+        // Uplink data packet
+        if (prng.Next() % meanIntervalMsec < kTickUsec / 1000)
+        {
+            baseline.Transmit(usec);
+            piggyback.Transmit(usec);
+            piggybacker.OnDataPacket(usec, packet, sizeof(packet));
+        }
+
+        // Baseline: Separate message every 500 msec for 20 seconds, then every 2 seconds
+        if (sync.HasMinDelta() && usec >= nextBaselineUsec)
+        {
+            baselineUpdateWakeups += baseline.Transmit(usec) ? 1 : 0;
+            nextBaselineUsec = usec + ((usec - startUsec < 20000000) ? 500000 : 2000000);
+        }
+
+        // Piggyback: Separate message only after the staleness deadline
+        if (piggybacker.NeedsStandaloneUpdate(usec))
+        {
+            piggybacker.WriteStandaloneUpdate(usec, packet);
+            piggybackUpdateWakeups += piggyback.Transmit(usec) ? 1 : 0;
+        }
+    }
+
+    cout << "Data every ~" << meanIntervalMsec << " msec: MinDelta wakeups " << baselineUpdateWakeups
+        << " separate -> " << piggybackUpdateWakeups << " piggybacked (" << piggybacker.GetAttachmentCount()
+        << " attachments, " << piggybacker.GetStandaloneCount() << " standalone)" << endl;
+}
+
+static void BenchmarkPiggybackWakeups()
+{
+    static const unsigned kIntervalsMsec[] = { 50, 250, 1000, 5000 };
+
+    for (unsigned intervalMsec : kIntervalsMsec) {
+        simulate_piggyback_wakeups(intervalMsec);
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// Timestamp MAC Cost
+
+static void BenchmarkTimestampMac()
+{
+    static const unsigned kBatch = 64;
+    static const unsigned kRounds = 200 * 1000;
+
+    const uint8_t key[kTimestampMacKeyBytes] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+    TimestampAuthenticator mac(key, 1, 2);
+
+    uint8_t storage[kBatch][kStampedTimestampAndMinDeltaBytes];
+    const uint8_t* records[kBatch];
+    bool valid[kBatch];
+
+    for (unsigned fieldBytes = kTimestampFieldBytes; fieldBytes <= kTimestampAndMinDeltaFieldBytes; fieldBytes += 3)
+    {
+        for (unsigned i = 0; i < kBatch; ++i)
+        {
+            if (fieldBytes == kTimestampFieldBytes) {
+                mac.StampTimestamp(1000000 + i * 10, storage[i]);
+            }
+            else {
+                mac.StampTimestampAndMinDelta(1000000 + i * 10, i, storage[i]);
+            }
+            records[i] = storage[i];
+        }
+
+        unsigned validCount = 0;
+        Counter24 ts, minDelta;
+
+        uint64_t t0 = get_nsec();
+        for (unsigned r = 0; r < kRounds; ++r)
+        {
+            // A fresh receiver each round, so the records are not replays
+            TimestampAuthenticator receiver(key, 2, 1);
+            for (unsigned i = 0; i < kBatch; ++i)
+            {
+                validCount += (fieldBytes == kTimestampFieldBytes ?
+                    receiver.VerifyTimestamp(records[i], ts) :
+                    receiver.VerifyTimestampAndMinDelta(records[i], ts, minDelta)) ? 1 : 0;
+            }
+        }
+        uint64_t t1 = get_nsec();
+        const double singleNsec = (double)(t1 - t0) / ((uint64_t)kRounds * kBatch);
+
+        t0 = get_nsec();
+        for (unsigned r = 0; r < kRounds; ++r)
+        {
+            TimestampAuthenticator receiver(key, 2, 1);
+            validCount += receiver.VerifyBatch(records, kBatch, fieldBytes, valid);
+        }
+        t1 = get_nsec();
+        const double batchNsec = (double)(t1 - t0) / ((uint64_t)kRounds * kBatch);
+
+        cout << "HalfSipHash-2-4 for " << fieldBytes << " byte records: " << singleNsec << " nsec/datagram one at a time, "
+            << batchNsec << " nsec/datagram in batches of " << kBatch << " [" << (validCount & 1) << "]" << endl;
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// Entrypoint
+
+int main()
+{
+    cout << "Benchmarks for TimeSync" << endl << endl;
+
+    BenchmarkOffsetError<Profile24>();
+    BenchmarkOffsetError<Profile32>();
+    cout << endl;
+
+    BenchmarkDatagramCost<Profile24>();
+    BenchmarkDatagramCost<Profile32>();
+    cout << endl;
+
+    BenchmarkNtpResponses();
+#ifdef __linux__
+    BenchmarkNtpServer();
+    BenchmarkNtpServerScaling();
+#endif // __linux__
+    cout << endl;
+
+    BenchmarkConcurrentConversions(ConversionMode::SeparateLoads, "Separate atomic loads");
+    BenchmarkConcurrentConversions(ConversionMode::PackedLoad, "Packed atomic load");
+    BenchmarkConcurrentConversions(ConversionMode::CachedParams, "TimeConversionCache");
+    cout << endl;
+
+    BenchmarkPiggybackWakeups();
+    cout << endl;
+
+    BenchmarkTimestampMac();
+
+#ifdef __linux__
+    cout << endl;
+    BenchmarkSharedStateReads();
+#endif // __linux__
+
+    return 0;
+}
@@ -28,8 +28,40 @@
 */
 
 #include <TimeSync/TimeSync.h>
-
+#include <TimeSync/PeerTable.h>
+#include <TimeSync/TimeSyncAwait.h>
+#include <TimeSync/SyncTimer.h>
+#include <TimeSync/StartBarrier.h>
+#include <TimeSync/OffsetTimeline.h>
+#include <TimeSync/OWDFeedback.h>
+#include <TimeSync/NtpServer.h>
+#include <TimeSync/ShmRefclock.h>
+#include <TimeSync/RemoteClock.h>
+#include <TimeSync/SharedSyncState.h>
+#include <TimeSync/MinDeltaPiggyback.h>
+#include <TimeSync/MinDeltaCodec.h>
+#include <TimeSync/TimestampMac.h>
+#include <TimeSync/SameHost.h>
+#include <TimeSync/timesync_c.h>
+
+#include <cstring>
 #include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+    #include <arpa/inet.h>
+    #include <fcntl.h>
+    #include <netinet/in.h>
+    #include <sys/ipc.h>
+    #include <sys/mman.h>
+    #include <sys/shm.h>
+    #include <sys/socket.h>
+    #include <sys/wait.h>
+    #include <time.h>
+    #include <unistd.h>
+#endif
 using namespace std;
 
 
@@ -758,22 +790,3765 @@ bool TestWindowedMinTS24()
 
 
 //------------------------------------------------------------------------------
-// Entrypoint
+// Test: Idle peer hibernation
+
+// Exchange timestamps between two synchronizers until both are synchronized.
+// Peer B clock = Peer A clock + clock_delta
+static void sync_pair(
+    TimeSynchronizer& sync_a,
+    TimeSynchronizer& sync_b,
+    uint64_t& globalUsec,
+    uint64_t clock_delta,
+    unsigned owdUsec)
+{
+    for (unsigned i = 0; i < 4; ++i)
+    {
+        Counter24 ts = sync_a.LocalTimeToDatagramTS24(globalUsec);
+        Counter24 minDelta = sync_a.GetMinDeltaTS24();
+        globalUsec += owdUsec;
+        sync_b.OnAuthenticatedDatagramTimestamp(ts, globalUsec + clock_delta);
+        if (i > 0) {
+            sync_b.OnPeerMinDeltaTS24(minDelta);
+        }
 
-int main()
+        ts = sync_b.LocalTimeToDatagramTS24(globalUsec + clock_delta);
+        minDelta = sync_b.GetMinDeltaTS24();
+        globalUsec += owdUsec;
+        sync_a.OnAuthenticatedDatagramTimestamp(ts, globalUsec);
+        if (i > 0) {
+            sync_a.OnPeerMinDeltaTS24(minDelta);
+        }
+    }
+}
+
+/// Peer table create callback: Configuration that must survive hibernation
+static TimeSynchronizer* create_configured_peer(void* context, uint64_t peerId)
 {
-    cout << "Unit tester for TimeSync.  Exits with -1 on failure, 0 on success" << endl;
-    cout << endl;
+    TimeSynchronizer* sync = new TimeSynchronizer;
+    sync->SetDriftWindowUsec(kDriftWindowUsec * 4);
+    sync->SetEventQueue((TimeSyncEventQueue*)context, (uint32_t)peerId);
+    return sync;
+}
 
-    int result = TIMESYNC_RET_SUCCESS;
+bool TestHibernation()
+{
+    cout << "TestHibernation...";
 
-    if (!TestSimpleUsage()) {
-        result = TIMESYNC_RET_FAIL;
+    const uint64_t clock_delta = 123456789;
+    const unsigned owdUsec = 20000;
+
+    TimeSynchronizer sync_a, sync_b;
+    uint64_t globalUsec = 1000000;
+    sync_pair(sync_a, sync_b, globalUsec, clock_delta, owdUsec);
+
+    if (!sync_a.IsSynchronized() || !sync_b.IsSynchronized())
+    {
+        cout << "Failed: Peers did not synchronize" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
     }
-    if (!TestTwoRounds()) {
-        result = TIMESYNC_RET_FAIL;
+
+    HibernatedTimeSync state;
+    sync_a.Hibernate(globalUsec, state);
+
+    // Conversions should still work while hibernated
+    if (state.ToRemoteTime23(globalUsec) != sync_a.ToRemoteTime23(globalUsec))
+    {
+        cout << "Failed: Hibernated conversion does not match" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
     }
-    if (!TestWindowedMinTS24()) {
+
+    // Rehydrate within the drift window
+    TimeSynchronizer rehydrated;
+    const uint64_t wakeUsec = globalUsec + kDriftWindowUsec / 2;
+    // The summary keeps deltas at TS24 resolution, so the sub-8 usec part of
+    // the minimum OWD is lost
+    unsigned delta = 0;
+    if (!rehydrated.Rehydrate(state, wakeUsec) ||
+        rehydrated.ToRemoteTime23(wakeUsec) != sync_a.ToRemoteTime23(wakeUsec) ||
+        !is_near(rehydrated.GetMinimumOneWayDelayUsec(), sync_a.GetMinimumOneWayDelayUsec(), kTime23ErrorBound, delta) ||
+        rehydrated.GetMinDeltaTS24() != sync_a.GetMinDeltaTS24())
+    {
+        cout << "Failed: Rehydrated state does not match" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    // Rehydrate after the drift window has expired
+    TimeSynchronizer expired;
+    if (expired.Rehydrate(state, globalUsec + kDriftWindowUsec * 2) ||
+        expired.IsSynchronized())
+    {
+        cout << "Failed: Expired state was restored" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    // Peer table should keep only active peers resident
+    TimeSyncPeerTable table;
+    static const unsigned kPeers = 1000;
+    for (unsigned i = 0; i < kPeers; ++i) {
+        table.OnDatagram(i, globalUsec + i);
+    }
+    const unsigned hibernated = table.HibernateIdle(globalUsec + kPeers + kPeers / 2, kPeers);
+    if (hibernated != kPeers / 2 ||
+        table.GetActiveCount() != kPeers / 2 ||
+        table.GetHibernatedCount() != kPeers / 2)
+    {
+        cout << "Failed: Unexpected hibernation count " << hibernated << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    table.OnDatagram(0, globalUsec + kPeers + 2000);
+    if (!table.FindActive(0) || table.FindHibernated(0) ||
+        table.GetHibernatedCount() != kPeers / 2 - 1)
+    {
+        cout << "Failed: Peer was not rehydrated" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    // Per-peer configuration survives hibernation
+    TimeSyncEventQueue events;
+    TimeSyncPeerTable configured;
+    configured.SetCreateCallback(create_configured_peer, &events);
+    TimeSynchronizer sync_c;
+    sync_pair(*configured.OnDatagram(3, globalUsec), sync_c, globalUsec, clock_delta, owdUsec);
+    configured.OnDatagram(7, globalUsec)->SetSameClockDomain(true);
+    configured.HibernateIdle(globalUsec + 2, 1);
+
+    TimeSyncEvent event;
+    while (events.Pop(event)) {
+    }
+
+    // Past the default drift window, but within the configured one
+    const uint64_t lateUsec = globalUsec + kDriftWindowUsec * 2;
+    TimeSynchronizer* peer3 = configured.OnDatagram(3, lateUsec);
+    TimeSynchronizer* peer7 = configured.OnDatagram(7, lateUsec);
+    if (configured.GetHibernatedCount() != 0 ||
+        peer3->GetDriftWindowUsec() != kDriftWindowUsec * 4 ||
+        !peer3->IsSynchronized() ||
+        !events.Pop(event) || event.PeerId != 3 || event.Type != kEventSynchronized ||
+        !peer7->IsSameClockDomain() || !peer7->IsSynchronized())
+    {
+        cout << "Failed: Configuration lost in hibernation" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    cout << "Success!" << endl;
+
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+// Test: Timer wheel
+
+static void count_callback(void* context)
+{
+    ++*(unsigned*)context;
+}
+
+bool TestTimerWheel()
+{
+    cout << "TestTimerWheel...";
+
+    TimerWheel wheel(1000, 64);
+    PCGRandom prng;
+    prng.Seed(1);
+
+    static const unsigned kTimers = 10000;
+    static const uint64_t kMaxDelayUsec = 1000 * 1000; // Many revolutions
+    std::vector<uint64_t> expires(kTimers);
+    std::vector<unsigned> fired(kTimers, 0);
+
+    uint64_t nowUsec = 5000000;
+    wheel.Advance(nowUsec);
+
+    for (unsigned i = 0; i < kTimers; ++i)
+    {
+        expires[i] = nowUsec + prng.Next() % kMaxDelayUsec;
+        wheel.Schedule(expires[i], count_callback, &fired[i]);
+    }
+
+    // Cancel timers in a separate wheel
+    TimerWheel cancelWheel(1000, 64);
+    for (unsigned i = 0; i < kTimers; i += 8)
+    {
+        const uint64_t timerId = cancelWheel.Schedule(expires[i], count_callback, &fired[i]);
+        if (!cancelWheel.Cancel(timerId) || cancelWheel.Cancel(timerId))
+        {
+            cout << "Failed: Cancel" << endl;
+            TIMESYNC_DEBUG_BREAK();
+            return false;
+        }
+    }
+    if (cancelWheel.GetPendingCount() != 0)
+    {
+        cout << "Failed: Cancel left timers pending" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    while (wheel.GetPendingCount() > 0)
+    {
+        const uint64_t nextUsec = wheel.GetNextExpireUsec();
+        if (nextUsec < nowUsec)
+        {
+            cout << "Failed: Next expiration is in the past" << endl;
+            TIMESYNC_DEBUG_BREAK();
+            return false;
+        }
+
+        // Step in odd increments to hit the middle of ticks
+        nowUsec += 777;
+        wheel.Advance(nowUsec);
+
+        for (unsigned i = 0; i < kTimers; ++i)
+        {
+            if (fired[i] > 1 ||
+                (fired[i] == 1) != (expires[i] <= nowUsec))
+            {
+                cout << "Failed: Timer " << i << " fired " << fired[i] << " times at " << nowUsec << " for " << expires[i] << endl;
+                TIMESYNC_DEBUG_BREAK();
+                return false;
+            }
+        }
+    }
+
+    cout << "Success!" << endl;
+
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+// Test: Awaiting synchronization
+
+struct TestWaiter
+{
+    TimeSyncWait Wait;
+    TimerWheelEventLoop* Loop = nullptr;
+    uint64_t FiredUsec = 0;
+
+    static void OnFired(void* context)
+    {
+        TestWaiter* waiter = (TestWaiter*)context;
+        waiter->FiredUsec = waiter->Loop->GetLocalUsec();
+    }
+};
+
+#ifdef TIMESYNC_COROUTINES
+
+struct TestTask
+{
+    struct promise_type
+    {
+        TestTask get_return_object() { return TestTask(); }
+        std::suspend_never initial_suspend() { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() {}
+    };
+};
+
+static TestTask test_await_task(AwaitableTimeSynchronizer& awaitable, Counter23 remoteTS23, int& stage)
+{
+    co_await awaitable.Synchronized();
+    stage = 1;
+    co_await awaitable.UntilRemoteTime(remoteTS23);
+    stage = 2;
+}
+
+/// Task whose frame is destroyed by the caller
+struct TestOwnedTask
+{
+    struct promise_type
+    {
+        TestOwnedTask get_return_object()
+        {
+            TestOwnedTask task;
+            task.Handle = std::coroutine_handle<promise_type>::from_promise(*this);
+            return task;
+        }
+        std::suspend_never initial_suspend() { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() {}
+    };
+
+    std::coroutine_handle<promise_type> Handle;
+};
+
+static TestOwnedTask test_owned_task(AwaitableTimeSynchronizer& awaitable, int& stage)
+{
+    co_await awaitable.Synchronized();
+    stage = 1;
+}
+
+#endif // TIMESYNC_COROUTINES
+
+bool TestAwaitSynchronized()
+{
+    cout << "TestAwaitSynchronized...";
+
+    const uint64_t clock_delta = 987654321;
+    const unsigned owdUsec = 10000;
+
+    TimeSynchronizer sync_a, sync_b;
+    TimerWheelEventLoop loop(100, 1024);
+    AwaitableTimeSynchronizer awaitable(sync_b, loop);
+
+    uint64_t globalUsec = 1000000;
+    loop.Poll(globalUsec + clock_delta);
+
+    // Peer B waits for sync, and then for 1 second from now on peer A's clock
+    const uint64_t targetUsec_a = globalUsec + 1000000;
+    static const unsigned kWaiters = 100;
+    TestWaiter waiters[kWaiters];
+    for (unsigned i = 0; i < kWaiters; ++i)
+    {
+        waiters[i].Loop = &loop;
+        waiters[i].Wait.Func = &TestWaiter::OnFired;
+        waiters[i].Wait.Context = &waiters[i];
+        waiters[i].Wait.HasRemoteTime = (i % 2) != 0;
+        waiters[i].Wait.RemoteTS23 = (uint32_t)(targetUsec_a >> kTime23LostBits);
+        awaitable.Wait(&waiters[i].Wait);
+    }
+
+    size_t expectedWaiters = kWaiters;
+#ifdef TIMESYNC_COROUTINES
+    int stage = 0;
+    test_await_task(awaitable, (uint32_t)(targetUsec_a >> kTime23LostBits), stage);
+    ++expectedWaiters;
+#endif
+
+    if (awaitable.GetWaiterCount() != expectedWaiters)
+    {
+        cout << "Failed: Waiters were released early" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    // Synchronize through the wrapper
+    for (unsigned i = 0; i < 4; ++i)
+    {
+        Counter24 ts = sync_a.LocalTimeToDatagramTS24(globalUsec);
+        Counter24 minDelta = sync_a.GetMinDeltaTS24();
+        globalUsec += owdUsec;
+        awaitable.OnAuthenticatedDatagramTimestamp(ts, globalUsec + clock_delta);
+        if (i > 0) {
+            awaitable.OnPeerMinDeltaTS24(minDelta);
+        }
+
+        ts = sync_b.LocalTimeToDatagramTS24(globalUsec + clock_delta);
+        minDelta = sync_b.GetMinDeltaTS24();
+        globalUsec += owdUsec;
+        sync_a.OnAuthenticatedDatagramTimestamp(ts, globalUsec);
+        if (i > 0) {
+            sync_a.OnPeerMinDeltaTS24(minDelta);
+        }
+    }
+
+    if (!awaitable.IsSynchronized() || awaitable.GetWaiterCount() != 0)
+    {
+        cout << "Failed: Waiters were not released" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    // Run the loop forward past the target time
+    for (uint64_t t = globalUsec; t < targetUsec_a + 10000; t += 50) {
+        loop.Poll(t + clock_delta);
+    }
+
+    const uint64_t expectedUsec_b = targetUsec_a + clock_delta;
+    const unsigned errorBound = kTime23ErrorBound * 2 + 100;
+
+    for (unsigned i = 0; i < kWaiters; ++i)
+    {
+        unsigned delta = 0;
+        if (waiters[i].FiredUsec == 0 ||
+            (waiters[i].Wait.HasRemoteTime &&
+             !is_near((unsigned)(waiters[i].FiredUsec - expectedUsec_b + errorBound), errorBound, errorBound, delta)))
+        {
+            cout << "Failed: Waiter " << i << " fired at the wrong time" << endl;
+            TIMESYNC_DEBUG_BREAK();
+            return false;
+        }
+    }
+
+#ifdef TIMESYNC_COROUTINES
+    if (stage != 2)
+    {
+        cout << "Failed: Coroutine did not complete" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+#endif
+
+    // The offset moves after a remote time waiter was scheduled: The B -> A
+    // direction starts out with a standing queue, which shifts B's offset
+    // estimate by half of it until a faster datagram arrives
+    const unsigned queueUsec = 4000;
+    TimeSynchronizer sync_c, sync_d;
+    TimerWheelEventLoop loop_d(100, 1024);
+    AwaitableTimeSynchronizer awaitable_d(sync_d, loop_d);
+    uint64_t targetUsec_c = 0;
+
+    for (unsigned i = 0; i < 8; ++i)
+    {
+        // The queue drains after the waiter is scheduled
+        const unsigned extraUsec = i < 4 ? queueUsec : 0;
+        if (i == 4)
+        {
+            loop_d.Poll(globalUsec + clock_delta);
+            targetUsec_c = globalUsec + 1000000;
+            waiters[0].FiredUsec = 0;
+            waiters[0].Loop = &loop_d;
+            waiters[0].Wait.HasRemoteTime = true;
+            waiters[0].Wait.RemoteTS23 = (uint32_t)(targetUsec_c >> kTime23LostBits);
+            awaitable_d.Wait(&waiters[0].Wait);
+        }
+
+        Counter24 ts = sync_c.LocalTimeToDatagramTS24(globalUsec);
+        sync_d.OnAuthenticatedDatagramTimestamp(ts, globalUsec + owdUsec + clock_delta);
+        ts = sync_d.LocalTimeToDatagramTS24(globalUsec + clock_delta);
+        sync_c.OnAuthenticatedDatagramTimestamp(ts, globalUsec + owdUsec + extraUsec);
+
+        sync_c.OnPeerMinDeltaTS24(sync_d.GetMinDeltaTS24());
+        sync_d.OnPeerMinDeltaTS24(sync_c.GetMinDeltaTS24());
+        globalUsec += 1000;
+    }
+
+    for (uint64_t t = globalUsec; t < targetUsec_c + 10000 && waiters[0].FiredUsec == 0; t += 50) {
+        loop_d.Poll(t + clock_delta);
+    }
+
+    unsigned firedDelta = 0;
+    if (waiters[0].FiredUsec == 0 ||
+        !is_near((unsigned)(waiters[0].FiredUsec - (targetUsec_c + clock_delta) + errorBound), errorBound, errorBound, firedDelta))
+    {
+        cout << "Failed: Waiter fired early after the offset moved " << (int64_t)(waiters[0].FiredUsec - (targetUsec_c + clock_delta)) << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    // Waiters are released however the synchronizer gets synchronized, here
+    // by a four-timestamp exchange fed to it directly, and can be cancelled
+    TimeSynchronizer sync_e;
+    TimerWheelEventLoop loop_e(100, 1024);
+    AwaitableTimeSynchronizer awaitable_e(sync_e, loop_e);
+    loop_e.Poll(globalUsec);
+
+    TestWaiter kept, cancelled, cancelledReady, cancelledTimed;
+    TestWaiter* testWaiters[4] = { &kept, &cancelled, &cancelledReady, &cancelledTimed };
+    for (TestWaiter* waiter : testWaiters)
+    {
+        waiter->Loop = &loop_e;
+        waiter->Wait.Func = &TestWaiter::OnFired;
+        waiter->Wait.Context = waiter;
+    }
+    awaitable_e.Wait(&kept.Wait);
+    awaitable_e.Wait(&cancelled.Wait);
+    bool ok = awaitable_e.Cancel(&cancelled.Wait) &&
+        !awaitable_e.Cancel(&cancelled.Wait);
+
+#ifdef TIMESYNC_COROUTINES
+    // Destroying a suspended coroutine withdraws its wait
+    int ownedStage = 0;
+    TestOwnedTask owned = test_owned_task(awaitable_e, ownedStage);
+    ok = ok && awaitable_e.GetWaiterCount() == 2;
+    owned.Handle.destroy();
+#endif
+
+    ok = ok && awaitable_e.GetWaiterCount() == 1;
+
+    const uint64_t t1 = globalUsec;
+    const uint64_t t2 = t1 + owdUsec + clock_delta;
+    const uint64_t t3 = t2 + 100;
+    const uint64_t t4 = t3 - clock_delta + owdUsec;
+    sync_e.OnFourTimestampExchange(t1, t2, t3, t4);
+    ok = ok && sync_e.IsSynchronized() && awaitable_e.GetWaiterCount() == 0;
+
+    // Waits already handed to the loop can be cancelled too
+    awaitable_e.Wait(&cancelledReady.Wait);
+    cancelledTimed.Wait.HasRemoteTime = true;
+    cancelledTimed.Wait.RemoteTS23 = sync_e.ToRemoteTime23(t4 + 1000);
+    awaitable_e.Wait(&cancelledTimed.Wait);
+    ok = ok && awaitable_e.Cancel(&cancelledReady.Wait) &&
+        awaitable_e.Cancel(&cancelledTimed.Wait);
+
+    for (uint64_t t = t4; t < t4 + 10000; t += 50) {
+        loop_e.Poll(t);
+    }
+
+    // Same clock domain mode also releases waiters
+    TimeSynchronizer sync_f;
+    TimerWheelEventLoop loop_f(100, 1024);
+    AwaitableTimeSynchronizer awaitable_f(sync_f, loop_f);
+    TestWaiter sameHost;
+    sameHost.Loop = &loop_f;
+    sameHost.Wait.Func = &TestWaiter::OnFired;
+    sameHost.Wait.Context = &sameHost;
+    awaitable_f.Wait(&sameHost.Wait);
+    sync_f.SetSameClockDomain(true);
+    loop_f.Poll(globalUsec);
+
+    ok = ok && kept.FiredUsec != 0 && cancelled.FiredUsec == 0 &&
+        cancelledReady.FiredUsec == 0 && cancelledTimed.FiredUsec == 0 &&
+        sameHost.FiredUsec == globalUsec &&
+        !awaitable_e.Cancel(&kept.Wait);
+#ifdef TIMESYNC_COROUTINES
+    ok = ok && ownedStage == 0;
+#endif
+
+    if (!ok)
+    {
+        cout << "Failed: Release on direct feeds or cancellation" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    cout << "Success!" << endl;
+
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+// Test: Synchronized timer
+
+static uint64_t sim_timer_usec = 0;
+
+static uint64_t sim_timer_clock()
+{
+    return sim_timer_usec;
+}
+
+// SyncTimer on a simulated clock: Sleeping advances the clock to the end of
+// the sleep, or to a scheduled offset change if that comes first.  The sleep
+// then ends early only if the change notified the timer
+class SimSyncTimer : public SyncTimer
+{
+public:
+    typedef void (*ChangeFunction)(TimeSynchronizer& sync);
+
+    TimeSynchronizer* Sync = nullptr;
+    uint64_t ChangeUsec = 0;
+    ChangeFunction Change = nullptr;
+    unsigned SleepCount = 0;
+
+    SimSyncTimer()
+    {
+        SetLocalClock(&sim_timer_clock);
+        SetSpinUsec(0);
+    }
+
+protected:
+    void SleepUsec(uint64_t usec) override
+    {
+        ++SleepCount;
+        const uint64_t endUsec = sim_timer_usec + usec;
+
+        if (Change && ChangeUsec < endUsec)
+        {
+            sim_timer_usec = ChangeUsec;
+            Change(*Sync);
+            Change = nullptr;
+            if (TakeWake()) {
+                return;
+            }
+        }
+
+        sim_timer_usec = endUsec;
+    }
+
+    bool TakeWake()
+    {
+#ifdef __linux__
+        if (WakeFd >= 0)
+        {
+            uint64_t count = 0;
+            return read(WakeFd, &count, sizeof(count)) == (ssize_t)sizeof(count);
+        }
+#endif // __linux__
+        std::lock_guard<std::mutex> locker(WakeLock);
+        const bool pending = WakePending;
+        WakePending = false;
+        return pending;
+    }
+};
+
+// Peer B reports a min delta 100 TS24 units (800 usec) larger, which moves
+// the offset estimate by 400 usec
+static Counter24 sim_timer_shifted_min_delta;
+
+static void sim_timer_shift_offset(TimeSynchronizer& sync)
+{
+    sync.OnPeerMinDeltaTS24(sim_timer_shifted_min_delta);
+}
+
+static void sim_timer_lose_sync(TimeSynchronizer& sync)
+{
+    sync.SetSameClockDomain(false);
+}
+
+bool TestSyncTimer()
+{
+    cout << "TestSyncTimer...";
+
+    // Peer B is ahead of peer A by clock_delta
+    const uint64_t clock_delta = 5555555;
+    const unsigned owdUsec = 1000;
+
+    {
+        TimeSynchronizer sync_a, sync_b;
+        uint64_t globalUsec = 1000000;
+        sync_pair(sync_a, sync_b, globalUsec, clock_delta, owdUsec);
+        sim_timer_shifted_min_delta = sync_b.GetMinDeltaTS24() + 100;
+
+        SimSyncTimer timer;
+        timer.Sync = &sync_a;
+        timer.Attach(sync_a);
+
+        // Fire at 20 ms from now on peer B's clock: One sleep, no polling
+        sim_timer_usec = globalUsec;
+        uint64_t startUsec = sim_timer_usec;
+        Counter23 remoteTS23 = (uint32_t)((startUsec + clock_delta + 20000) >> kTime23LostBits);
+
+        SyncTimerResult result;
+        unsigned delta = 0;
+        if (!timer.WaitForRemoteTime23(sync_a, remoteTS23, result) ||
+            timer.SleepCount != 1 ||
+            result.ErrorUsec != 0 ||
+            result.FiredLocalUsec != sim_timer_usec ||
+            result.RearmCount != 0 ||
+            !is_near((unsigned)(result.TargetLocalUsec - startUsec), 20000, kTime23ErrorBound * 2, delta))
+        {
+            cout << "Failed: Timer fired at the wrong time, error = " << result.ErrorUsec << " usec" << endl;
+            TIMESYNC_DEBUG_BREAK();
+            return false;
+        }
+
+        // Shift the offset by about 400 usec 5 ms into the wait: The change
+        // wakes the timer, which re-arms and sleeps once more
+        timer.SleepCount = 0;
+        startUsec = sim_timer_usec;
+        remoteTS23 = (uint32_t)((startUsec + clock_delta + 20000) >> kTime23LostBits);
+        timer.ChangeUsec = startUsec + 5000;
+        timer.Change = &sim_timer_shift_offset;
+
+        if (!timer.WaitForRemoteTime23(sync_a, remoteTS23, result) ||
+            timer.SleepCount != 2 ||
+            result.ErrorUsec != 0 ||
+            result.RearmCount != 1 ||
+            !is_near((unsigned)(result.TargetLocalUsec - startUsec), 20000 - 400, kTime23ErrorBound * 2, delta))
+        {
+            cout << "Failed: Timer was not re-armed" << endl;
+            TIMESYNC_DEBUG_BREAK();
+            return false;
+        }
+
+        // Losing synchronization ends the wait at the change
+        startUsec = sim_timer_usec;
+        remoteTS23 = (uint32_t)((startUsec + clock_delta + 20000) >> kTime23LostBits);
+        timer.ChangeUsec = startUsec + 5000;
+        timer.Change = &sim_timer_lose_sync;
+
+        if (timer.WaitForRemoteTime23(sync_a, remoteTS23, result) ||
+            sim_timer_usec != startUsec + 5000)
+        {
+            cout << "Failed: Timer did not stop when synchronization was lost" << endl;
+            TIMESYNC_DEBUG_BREAK();
+            return false;
+        }
+    }
+
+    // Real clock: A change from another thread wakes a wait that would
+    // otherwise last 10 seconds
+    {
+        TimeSynchronizer sync_a, sync_b;
+        uint64_t globalUsec = SyncTimer::GetMonotonicUsec();
+        sync_pair(sync_a, sync_b, globalUsec, clock_delta, owdUsec);
+
+        SyncTimer timer;
+        timer.Attach(sync_a);
+
+        const uint64_t startUsec = SyncTimer::GetMonotonicUsec();
+        const Counter23 remoteTS23 = (uint32_t)((startUsec + clock_delta + 10000000) >> kTime23LostBits);
+
+        std::thread updater([&]() {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            sync_a.SetSameClockDomain(false);
+        });
+
+        SyncTimerResult result;
+        const bool fired = timer.WaitForRemoteTime23(sync_a, remoteTS23, result);
+        const uint64_t elapsedUsec = SyncTimer::GetMonotonicUsec() - startUsec;
+        updater.join();
+
+        if (fired || elapsedUsec >= 5000000)
+        {
+            cout << "Failed: Notification did not wake the timer" << endl;
+            TIMESYNC_DEBUG_BREAK();
+            return false;
+        }
+
+        // Short real wait fires, and never early
+        sync_pair(sync_a, sync_b, globalUsec, clock_delta, owdUsec);
+        const uint64_t fireStartUsec = SyncTimer::GetMonotonicUsec();
+        const Counter23 fireTS23 = (uint32_t)((fireStartUsec + clock_delta + 2000) >> kTime23LostBits);
+
+        if (!timer.WaitForRemoteTime23(sync_a, fireTS23, result) ||
+            result.ErrorUsec < 0)
+        {
+            cout << "Failed: Timer did not fire on the real clock" << endl;
+            TIMESYNC_DEBUG_BREAK();
+            return false;
+        }
+    }
+
+    cout << "Success!" << endl;
+
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+// Test: Distributed start barrier
+
+// Simulate a link with jitter between A and B for a number of rounds.
+// Peer B clock = Peer A clock + clock_delta
+static void simulate_link(
+    TimeSynchronizer& sync_a,
+    TimeSynchronizer& sync_b,
+    PCGRandom& prng,
+    uint64_t& globalUsec,
+    uint64_t clock_delta,
+    unsigned owdUsec,
+    unsigned rounds)
+{
+    for (unsigned i = 0; i < rounds; ++i)
+    {
+        // A -> B
+        Counter24 ts = sync_a.LocalTimeToDatagramTS24(globalUsec);
+        Counter24 minDelta = sync_a.GetMinDeltaTS24();
+        globalUsec += owdUsec + prng.Next() % (owdUsec / 5 + 1);
+        sync_b.OnAuthenticatedDatagramTimestamp(ts, globalUsec + clock_delta);
+        if (i % 10 == 9) {
+            sync_b.OnPeerMinDeltaTS24(minDelta);
+        }
+
+        // B -> A
+        ts = sync_b.LocalTimeToDatagramTS24(globalUsec + clock_delta);
+        minDelta = sync_b.GetMinDeltaTS24();
+        globalUsec += owdUsec + prng.Next() % (owdUsec / 5 + 1);
+        sync_a.OnAuthenticatedDatagramTimestamp(ts, globalUsec);
+        if (i % 10 == 9) {
+            sync_a.OnPeerMinDeltaTS24(minDelta);
+        }
+    }
+}
+
+bool TestStartBarrier()
+{
+    cout << "TestStartBarrier...";
+
+    static const unsigned kParticipants = 16;
+
+    PCGRandom prng;
+    prng.Seed(54);
+
+    // Coordinator clock = global clock
+    TimeSynchronizer coordinator[kParticipants];
+    TimeSynchronizer participant[kParticipants];
+    uint64_t clock_delta[kParticipants];
+    unsigned owd[kParticipants];
+
+    const uint64_t startGlobalUsec = 1000000;
+    uint64_t latestUsec = startGlobalUsec;
+
+    StartBarrierCoordinator barrier;
+
+    for (unsigned i = 0; i < kParticipants; ++i)
+    {
+        clock_delta[i] = prng.Next();
+        owd[i] = 5000 + prng.Next() % 95000; // 5..100 ms
+
+        uint64_t globalUsec = startGlobalUsec;
+        simulate_link(coordinator[i], participant[i], prng, globalUsec, clock_delta[i], owd[i], 30);
+        if (latestUsec < globalUsec) {
+            latestUsec = globalUsec;
+        }
+
+        if (!barrier.AddParticipant(coordinator[i]))
+        {
+            cout << "Failed: Participant " << i << " did not synchronize" << endl;
+            TIMESYNC_DEBUG_BREAK();
+            return false;
+        }
+    }
+
+    // Coordinator picks a start time and broadcasts it
+    const Counter23 startTS23 = barrier.PickStartTS23(latestUsec);
+    const uint64_t coordinatorStartUsec = barrier.GetLocalStartUsec(latestUsec);
+
+    uint64_t earliestUsec = ~(uint64_t)0, lastUsec = 0;
+
+    for (unsigned i = 0; i < kParticipants; ++i)
+    {
+        // Broadcast arrives with up to 1.2x OWD
+        const uint64_t arrivalUsec = latestUsec + owd[i] + prng.Next() % (owd[i] / 5 + 1);
+
+        const uint64_t localStartUsec = GetBarrierStartLocalUsec(
+            participant[i],
+            arrivalUsec + clock_delta[i],
+            startTS23);
+
+        // Map back to the global clock
+        const uint64_t globalStartUsec = localStartUsec - clock_delta[i];
+
+        if (globalStartUsec <= arrivalUsec)
+        {
+            cout << "Failed: Start time arrived too late at participant " << i << endl;
+            TIMESYNC_DEBUG_BREAK();
+            return false;
+        }
+
+        if (earliestUsec > globalStartUsec) {
+            earliestUsec = globalStartUsec;
+        }
+        if (lastUsec < globalStartUsec) {
+            lastUsec = globalStartUsec;
+        }
+    }
+
+    const uint64_t skewUsec = lastUsec - earliestUsec;
+
+    unsigned delta = 0;
+    if (skewUsec > barrier.GetWorstErrorBoundUsec() * 2 ||
+        !is_near((unsigned)earliestUsec, (unsigned)coordinatorStartUsec, barrier.GetWorstErrorBoundUsec(), delta))
+    {
+        cout << "Failed: Skew too high " << skewUsec << " usec" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    cout << "(" << kParticipants << " participants, lead " << barrier.GetLeadUsec()
+        << " usec, skew " << skewUsec << " usec) ";
+
+    cout << "Success!" << endl;
+
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+// Test: Offset timeline for log merging
+
+bool TestOffsetTimeline()
+{
+    cout << "TestOffsetTimeline...";
+
+    OffsetTimeline timeline;
+
+    // Records out of order, with the offset drifting by 1 ms per 10 seconds
+    timeline.AddRecord(20000000, -1002000);
+    timeline.AddRecord(10000000, -1001000);
+    timeline.AddRecord(30000000, -1003000);
+
+    if (timeline.GetOffsetUsec(0) != -1001000 ||
+        timeline.GetOffsetUsec(15000000) != -1001500 ||
+        timeline.GetOffsetUsec(25000000) != -1002500 ||
+        timeline.GetOffsetUsec(99000000) != -1003000 ||
+        timeline.ToReferenceUsec(15000000) != 15000000 - 1001500)
+    {
+        cout << "Failed: Interpolation" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    // Offset records round-trip through the log format
+    char line[64];
+    const size_t length = OffsetTimeline::FormatOffsetRecord(line, sizeof(line), 123456789012, -33554431);
+    uint64_t localUsec = 0;
+    int64_t offsetUsec = 0;
+    if (length == 0 ||
+        !OffsetTimeline::ParseOffsetRecord(line, length, localUsec, offsetUsec) ||
+        localUsec != 123456789012 ||
+        offsetUsec != -33554431 ||
+        OffsetTimeline::ParseOffsetRecord("123 hello", 9, localUsec, offsetUsec))
+    {
+        cout << "Failed: Offset record format" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    // Numbers that do not fit are rejected rather than wrapped
+    const char* maxLocal = "#TIMESYNC 18446744073709551615 -9223372036854775807";
+    const char* bigLocal = "#TIMESYNC 18446744073709551616 0";
+    const char* bigOffset = "#TIMESYNC 0 -9223372036854775808";
+    if (!OffsetTimeline::ParseOffsetRecord(maxLocal, strlen(maxLocal), localUsec, offsetUsec) ||
+        localUsec != UINT64_MAX ||
+        offsetUsec != -INT64_MAX ||
+        OffsetTimeline::ParseOffsetRecord(bigLocal, strlen(bigLocal), localUsec, offsetUsec) ||
+        OffsetTimeline::ParseOffsetRecord(bigOffset, strlen(bigOffset), localUsec, offsetUsec))
+    {
+        cout << "Failed: Offset record overflow" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    // Offsets from a synchronizer map local times to the peer's clock
+    const uint64_t clock_delta = 10000000; // Peer B is 10 seconds ahead
+    TimeSynchronizer sync_a, sync_b;
+    uint64_t globalUsec = 1000000;
+    sync_pair(sync_a, sync_b, globalUsec, clock_delta, 20000);
+
+    unsigned delta = 0;
+    if (!is_near((unsigned)sync_a.GetSignedRemoteTimeDeltaUsec(), (unsigned)clock_delta, kTime23ErrorBound, delta) ||
+        !is_near((unsigned)-sync_b.GetSignedRemoteTimeDeltaUsec(), (unsigned)clock_delta, kTime23ErrorBound, delta))
+    {
+        cout << "Failed: Signed remote time delta" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    // An offset drifting past +33.5 seconds wraps around to -33.5 seconds.
+    // Those records are rejected instead of being interpolated across
+    OffsetTimeline wrapped;
+    if (!wrapped.AddRecord(10000000, 33554000) ||
+        wrapped.AddRecord(20000000, -33554400) ||
+        wrapped.AddRecord(5000000, -33554300) ||
+        !wrapped.AddRecord(30000000, 33554200) ||
+        wrapped.GetRecordCount() != 2 ||
+        wrapped.GetOffsetUsec(20000000) != 33554100)
+    {
+        cout << "Failed: Wrapped offset record accepted" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    cout << "Success!" << endl;
+
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+// Test: Log merge tool
+
+#ifdef TIMESYNC_LOGMERGE_PATH
+
+static bool write_log_file(const char* path, const char* text)
+{
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        return false;
+    }
+    const size_t length = strlen(text);
+    const bool success = fwrite(text, 1, length, file) == length;
+    return fclose(file) == 0 && success;
+}
+
+bool TestLogMerge()
+{
+    cout << "TestLogMerge...";
+
+    char pathA[64], pathB[64];
+    snprintf(pathA, sizeof(pathA), "/tmp/timesync_test_%d_a.log", (int)getpid());
+    snprintf(pathB, sizeof(pathB), "/tmp/timesync_test_%d_b.log", (int)getpid());
+
+    // Host A is 1 second ahead of the reference, and host B is 0.5 seconds
+    // behind.  Host B's last offset record wrapped around and is ignored.
+    // Lines with timestamps too large for 64 bits are skipped
+    const bool wrote =
+        write_log_file(pathA,
+            "#TIMESYNC 0 -1000000\n"
+            "2000000 a0\n"
+            "no timestamp\n"
+            "18446744073709551616 overflow\n"
+            "4000000 a1\n") &&
+        write_log_file(pathB,
+            "#TIMESYNC 0 500000\n"
+            "1000000 b0\n"
+            "3000000 b1\n"
+            "#TIMESYNC 5000000 -66000000\n");
+
+    std::string merged;
+    if (wrote)
+    {
+        const std::string command = std::string(TIMESYNC_LOGMERGE_PATH) + " " +
+            pathA + " " + pathB + " 2>/dev/null";
+        FILE* pipe = popen(command.c_str(), "r");
+        if (pipe)
+        {
+            char buffer[256];
+            size_t bytes;
+            while ((bytes = fread(buffer, 1, sizeof(buffer), pipe)) > 0) {
+                merged.append(buffer, bytes);
+            }
+            if (pclose(pipe) != 0) {
+                merged.clear();
+            }
+        }
+    }
+
+    unlink(pathA);
+    unlink(pathB);
+
+    const char* expected =
+        "1000000 0 a0\n"
+        "1500000 1 b0\n"
+        "3000000 0 a1\n"
+        "3500000 1 b1\n";
+    if (merged != expected)
+    {
+        cout << "Failed: Merged log:" << endl << merged << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    cout << "Success!" << endl;
+
+    return true;
+}
+
+#endif // TIMESYNC_LOGMERGE_PATH
+
+
+//------------------------------------------------------------------------------
+// Test: OWD feedback channel
+
+bool TestOWDFeedback()
+{
+    cout << "TestOWDFeedback...";
+
+    OWDFeedbackCollector collector;
+    OWDFeedbackDecoder decoder;
+    OWDFeedback feedback;
+
+    uint8_t first[kOWDFeedbackBytes];
+    uint8_t second[kOWDFeedbackBytes];
+
+    // First interval: 20..30 ms with 10 ms base delay
+    for (unsigned owd = 20000; owd <= 30000; owd += 1000) {
+        collector.OnDatagramOWD(owd, 10000);
+    }
+    collector.Encode(first);
+
+    // Second interval: Delay rising by about 5 ms
+    for (unsigned owd = 25000; owd <= 35000; owd += 1000) {
+        collector.OnDatagramOWD(owd, 10000);
+    }
+    collector.Encode(second);
+
+    unsigned delta = 0;
+    if (!decoder.Decode(first, feedback) ||
+        feedback.SampleCount != 11 ||
+        feedback.MinOWDUsec != 20000 ||
+        feedback.MaxOWDUsec != 30000 ||
+        feedback.QueuingDelayUsec != 20000 ||
+        feedback.TrendUsec != 0)
+    {
+        cout << "Failed: First summary" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    if (!decoder.Decode(second, feedback) ||
+        feedback.Sequence != 1 ||
+        feedback.MinOWDUsec != 25000 ||
+        feedback.QueuingDelayUsec != 25000 ||
+        !is_near((unsigned)feedback.TrendUsec, 5000, 1 << kTime23LostBits, delta))
+    {
+        cout << "Failed: Second summary" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    // Delays past the 16-bit range saturate rather than wrapping to a
+    // small delay, which would tell the sender the queue has drained
+    OWDFeedbackCollector bigCollector;
+    OWDFeedbackDecoder bigDecoder;
+    bigCollector.OnDatagramOWD(600000, 10000);
+    bigCollector.OnDatagramOWD(1200000, 10000);
+    bigCollector.Encode(second);
+    static const uint32_t kSaturatedUsec = 0xffff << kTime23LostBits;
+    if (!bigDecoder.Decode(second, feedback) ||
+        feedback.MinOWDUsec != kSaturatedUsec ||
+        feedback.MaxOWDUsec < kSaturatedUsec ||
+        feedback.QueuingDelayUsec != kSaturatedUsec)
+    {
+        cout << "Failed: Large delays did not saturate" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    // Reordered summary is ignored
+    if (decoder.Decode(first, feedback))
+    {
+        cout << "Failed: Reordered summary was accepted" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    // Sequence numbers keep expanding past 8 bits
+    for (unsigned i = 0; i < 1000; ++i)
+    {
+        collector.OnDatagramOWD(20000, 10000);
+        collector.Encode(first);
+        if (!decoder.Decode(first, feedback) || feedback.Sequence != i + 2)
+        {
+            cout << "Failed: Sequence expansion" << endl;
+            TIMESYNC_DEBUG_BREAK();
+            return false;
+        }
+    }
+
+    // A decoder that misses the first 200 summaries accepts all the rest
+    OWDFeedbackCollector lateCollector;
+    OWDFeedbackDecoder lateDecoder;
+    unsigned accepted = 0;
+    for (unsigned i = 0; i < 1200; ++i)
+    {
+        lateCollector.OnDatagramOWD(20000, 10000);
+        lateCollector.Encode(first);
+        if (i >= 200 && lateDecoder.Decode(first, feedback) && feedback.Sequence == i) {
+            ++accepted;
+        }
+    }
+    if (accepted != 1000)
+    {
+        cout << "Failed: Late start accepted " << accepted << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    cout << "Success!" << endl;
+
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+// Test: Per-direction queuing delay
+
+bool TestDirectionalQueuing()
+{
+    cout << "TestDirectionalQueuing...";
+
+    const uint64_t clock_delta = 31415926;
+    const unsigned owdUsec = 20000;
+
+    PCGRandom prng;
+    prng.Seed(57);
+
+    TimeSynchronizer sync_a, sync_b;
+    uint64_t globalUsec = 1000000;
+    simulate_link(sync_a, sync_b, prng, globalUsec, clock_delta, owdUsec, 100);
+
+    // Congest only the A -> B path with 30 ms of queuing
+    const unsigned queuingUsec = 30000;
+    const Counter24 ts = sync_a.LocalTimeToDatagramTS24(globalUsec);
+    globalUsec += owdUsec + queuingUsec;
+    sync_b.OnAuthenticatedDatagramTimestamp(ts, globalUsec + clock_delta);
+
+    // The B -> A path is not congested
+    const Counter24 ts_b = sync_b.LocalTimeToDatagramTS24(globalUsec + clock_delta);
+    globalUsec += owdUsec;
+    sync_a.OnAuthenticatedDatagramTimestamp(ts_b, globalUsec);
+
+    // B reports its incoming queuing delay back to A, e.g. via OWDFeedback
+    sync_a.OnPeerIncomingQueuingDelayUsec(sync_b.GetIncomingQueuingDelayUsec());
+
+    // Jitter in the simulation is up to 20% of OWD
+    const unsigned jitterBound = owdUsec / 5 + kTime23ErrorBound;
+
+    unsigned delta = 0;
+    if (!is_near(sync_b.GetIncomingQueuingDelayUsec(), queuingUsec, jitterBound, delta) ||
+        sync_a.GetIncomingQueuingDelayUsec() > jitterBound ||
+        !is_near(sync_a.GetOutgoingQueuingDelayUsec(), queuingUsec, jitterBound, delta) ||
+        sync_b.GetOutgoingQueuingDelayUsec() != 0)
+    {
+        cout << "Failed: Queuing delay was not attributed to the right direction" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    if (!is_near(sync_a.GetIncomingBaseDelayUsec(), owdUsec, jitterBound, delta) ||
+        sync_a.GetOutgoingBaseDelayUsec() != sync_a.GetIncomingBaseDelayUsec())
+    {
+        cout << "Failed: Base delay" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    cout << "Success!" << endl;
+
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+// Test: Smoothed RTT without echo packets
+
+bool TestSmoothedRTT()
+{
+    cout << "TestSmoothedRTT...";
+
+    const uint64_t clock_delta = 2718281828;
+    const unsigned owdUsec = 20000;
+
+    PCGRandom prng;
+    prng.Seed(58);
+
+    TimeSynchronizer sync_a, sync_b;
+    if (sync_a.GetSmoothedRTTUsec() != 0 ||
+        sync_a.GetRetransmitTimeoutUsec() != kDefaultOWDUsec * 2)
+    {
+        cout << "Failed: Initial state" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    uint64_t globalUsec = 1000000;
+    simulate_link(sync_a, sync_b, prng, globalUsec, clock_delta, owdUsec, 200);
+
+    // Jitter in the simulation is up to 20% of OWD on the incoming path
+    const unsigned rttUsec = owdUsec * 2;
+    const unsigned jitterBound = owdUsec / 5 + kTime23ErrorBound * 2;
+
+    unsigned delta = 0;
+    if (!is_near(sync_a.GetSmoothedRTTUsec(), rttUsec + jitterBound / 2, jitterBound, delta) ||
+        !is_near(sync_b.GetSmoothedRTTUsec(), rttUsec + jitterBound / 2, jitterBound, delta) ||
+        sync_a.GetRTTVarianceUsec() > jitterBound ||
+        sync_a.GetRetransmitTimeoutUsec() <= sync_a.GetSmoothedRTTUsec() ||
+        sync_a.GetRetransmitTimeoutUsec(1000000) != 1000000)
+    {
+        cout << "Failed: SRTT " << sync_a.GetSmoothedRTTUsec() << " RTTVAR " << sync_a.GetRTTVarianceUsec() << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    // A burst of many datagrams within one RTT takes a single RTT sample,
+    // so a short queuing spike moves SRTT by at most 1/8 of the spike
+    const unsigned srttBefore = sync_a.GetSmoothedRTTUsec();
+    const unsigned spikeUsec = 40000;
+    for (unsigned i = 0; i < 1000; ++i)
+    {
+        const Counter24 ts = sync_b.LocalTimeToDatagramTS24(globalUsec + clock_delta);
+        sync_a.OnAuthenticatedDatagramTimestamp(ts, globalUsec + owdUsec + spikeUsec);
+        globalUsec += 10;
+    }
+    if (sync_a.GetSmoothedRTTUsec() > srttBefore + spikeUsec / 8 + jitterBound)
+    {
+        cout << "Failed: SRTT followed a burst within one RTT " << sync_a.GetSmoothedRTTUsec() << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+    globalUsec += rttUsec * 4;
+
+    // Queuing on the outgoing path reported by the peer raises the RTT
+    const unsigned queuingUsec = 50000;
+    sync_a.OnPeerIncomingQueuingDelayUsec(queuingUsec);
+    for (unsigned i = 0; i < 100; ++i)
+    {
+        const Counter24 ts = sync_b.LocalTimeToDatagramTS24(globalUsec + clock_delta);
+        globalUsec += owdUsec;
+        sync_a.OnAuthenticatedDatagramTimestamp(ts, globalUsec);
+    }
+
+    if (!is_near(sync_a.GetSmoothedRTTUsec(), rttUsec + queuingUsec, jitterBound, delta))
+    {
+        cout << "Failed: SRTT did not include outgoing queuing " << sync_a.GetSmoothedRTTUsec() << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    cout << "Success!" << endl;
+
+    return true;
+}
+
+
+bool TestMultipath()
+{
+    cout << "TestMultipath...";
+
+    const uint64_t clock_delta = 1618033988;
+    const unsigned fastOwdUsec = 10000;
+    const unsigned slowOwdUsec = 50000;
+    const unsigned slowQueuingUsec = 8000;
+
+    MultipathTimeSynchronizer sync_a;
+    TimeSynchronizer sync_b;
+
+    uint64_t globalUsec = 1000000;
+
+    for (unsigned i = 0; i < 20; ++i)
+    {
+        // B -> A over both paths
+        const Counter24 ts = sync_b.LocalTimeToDatagramTS24(globalUsec + clock_delta);
+        sync_a.OnAuthenticatedDatagramTimestamp(ts, globalUsec + fastOwdUsec, 0);
+        sync_a.OnAuthenticatedDatagramTimestamp(ts, globalUsec + slowOwdUsec, 1);
+
+        // A -> B over the fast path
+        const Counter24 tsA = sync_a.LocalTimeToDatagramTS24(globalUsec);
+        sync_b.OnAuthenticatedDatagramTimestamp(tsA, globalUsec + clock_delta + fastOwdUsec);
+
+        sync_a.OnPeerMinDeltaTS24(sync_b.GetMinDeltaTS24());
+        sync_b.OnPeerMinDeltaTS24(sync_a.GetMinDeltaTS24());
+
+        globalUsec += 100000;
+    }
+
+    // Slow path now has a standing queue
+    const Counter24 ts = sync_b.LocalTimeToDatagramTS24(globalUsec + clock_delta);
+    sync_a.OnAuthenticatedDatagramTimestamp(ts, globalUsec + fastOwdUsec, 0);
+    sync_a.OnAuthenticatedDatagramTimestamp(ts, globalUsec + slowOwdUsec + slowQueuingUsec, 1);
+
+    const unsigned bound = kTime23ErrorBound * 2;
+    unsigned delta = 0;
+    if (!sync_a.IsSynchronized() ||
+        !is_near(sync_a.GetMinimumOneWayDelayUsec(), fastOwdUsec, bound, delta) ||
+        !is_near(sync_a.GetPathBaseDelayUsec(0), fastOwdUsec, bound, delta) ||
+        !is_near(sync_a.GetPathBaseDelayUsec(1), slowOwdUsec, bound, delta))
+    {
+        cout << "Failed: Path base delays " << sync_a.GetPathBaseDelayUsec(0) << " " << sync_a.GetPathBaseDelayUsec(1) << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    // The slow path base delay must not be reported as queuing
+    if (sync_a.GetPathQueuingDelayUsec(0) > bound ||
+        !is_near(sync_a.GetPathQueuingDelayUsec(1), slowQueuingUsec, bound, delta) ||
+        !is_near(sync_a.GetPathOneWayDelayUsec(1), slowOwdUsec + slowQueuingUsec, bound, delta) ||
+        sync_a.GetLowestDelayPath() != 0 ||
+        sync_a.IsPathValid(2) ||
+        sync_a.GetPathBaseDelayUsec(2) != 0)
+    {
+        cout << "Failed: Path queuing delays " << sync_a.GetPathQueuingDelayUsec(0) << " " << sync_a.GetPathQueuingDelayUsec(1) << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    // The shared clock offset comes from the fast path
+    const Counter23 remoteTS23 = sync_a.ToRemoteTime23(globalUsec);
+    const Counter23 expectedTS23 = (uint32_t)((globalUsec + clock_delta) >> kTime23LostBits);
+    const int32_t errorTS23 = (int32_t)((remoteTS23 - expectedTS23).ToUnsigned() << 9) >> 9;
+    if (errorTS23 > 1 || errorTS23 < -1)
+    {
+        cout << "Failed: Clock offset error " << errorTS23 << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    // Invalid path identifiers are ignored
+    if (sync_a.OnAuthenticatedDatagramTimestamp(ts, globalUsec + fastOwdUsec, MultipathTimeSynchronizer::kMaxPaths) != 0 ||
+        sync_a.IsPathValid(MultipathTimeSynchronizer::kMaxPaths))
+    {
+        cout << "Failed: Invalid path accepted" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    // The fast path goes idle while the slow path keeps sending.
+    // This is not a route change
+    for (unsigned i = 0; i < 50; ++i)
+    {
+        globalUsec += 100000;
+
+        const Counter24 tsB = sync_b.LocalTimeToDatagramTS24(globalUsec + clock_delta);
+        sync_a.OnAuthenticatedDatagramTimestamp(tsB, globalUsec + slowOwdUsec, 1);
+
+        const Counter24 tsA = sync_a.LocalTimeToDatagramTS24(globalUsec);
+        sync_b.OnAuthenticatedDatagramTimestamp(tsA, globalUsec + clock_delta + fastOwdUsec);
+
+        sync_a.OnPeerMinDeltaTS24(sync_b.GetMinDeltaTS24());
+        sync_b.OnPeerMinDeltaTS24(sync_a.GetMinDeltaTS24());
+    }
+    if (sync_a.GetRouteChangeCount() != 0 ||
+        !is_near(sync_a.GetMinimumOneWayDelayUsec(), fastOwdUsec, bound, delta) ||
+        !is_near(sync_a.GetPathBaseDelayUsec(1), slowOwdUsec, bound, delta))
+    {
+        cout << "Failed: Idle fast path seen as route change " << sync_a.GetRouteChangeCount() << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    // Rehydrate starts the per-path windows over, in the restored units,
+    // also when called through a TimeSynchronizer reference
+    TimeSynchronizer& base_a = sync_a;
+    HibernatedTimeSync state;
+    base_a.Hibernate(globalUsec, state);
+    globalUsec += 1000000;
+    if (!base_a.Rehydrate(state, globalUsec) || sync_a.IsPathValid(0) || sync_a.IsPathValid(1))
+    {
+        cout << "Failed: Rehydrate kept path windows" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+    // Datagrams without a path identifier count as path 0
+    const Counter24 tsR = sync_b.LocalTimeToDatagramTS24(globalUsec + clock_delta);
+    base_a.OnAuthenticatedDatagramTimestampNs(tsR, (globalUsec + fastOwdUsec) * 1000);
+    sync_a.OnAuthenticatedDatagramTimestamp(tsR, globalUsec + slowOwdUsec, 1);
+    if (!is_near(sync_a.GetPathBaseDelayUsec(0), fastOwdUsec, bound, delta) ||
+        !is_near(sync_a.GetPathBaseDelayUsec(1), slowOwdUsec, bound, delta) ||
+        sync_a.GetPathQueuingDelayUsec(0) > bound ||
+        sync_a.GetPathQueuingDelayUsec(1) > bound)
+    {
+        cout << "Failed: Path delays after rehydrate " << sync_a.GetPathBaseDelayUsec(0) << " " << sync_a.GetPathBaseDelayUsec(1) << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    // Same clock domain mode through the base class also resets the paths
+    base_a.SetSameClockDomain(true);
+    if (sync_a.IsPathValid(0) || sync_a.IsPathValid(1))
+    {
+        cout << "Failed: SetSameClockDomain kept path windows" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    cout << "Success!" << endl;
+
+    return true;
+}
+
+
+static void count_route_change(void* context, uint32_t increaseUsec)
+{
+    *(uint32_t*)context = increaseUsec;
+}
+
+bool TestRouteChange()
+{
+    cout << "TestRouteChange...";
+
+    const uint64_t clock_delta = 3141592653;
+    const unsigned owdUsec = 10000;
+    const unsigned newOwdUsec = 30000;
+
+    PCGRandom prng;
+    prng.Seed(60);
+
+    TimeSynchronizer sync_a, sync_b;
+    uint32_t increaseUsec = 0;
+    sync_a.SetRouteChangeCallback(count_route_change, &increaseUsec);
+
+    uint64_t globalUsec = 1000000;
+    simulate_link(sync_a, sync_b, prng, globalUsec, clock_delta, owdUsec, 200);
+
+    // A short burst of queuing is not a route change
+    simulate_link(sync_a, sync_b, prng, globalUsec, clock_delta, newOwdUsec, 10);
+    simulate_link(sync_a, sync_b, prng, globalUsec, clock_delta, owdUsec, 100);
+
+    if (sync_a.GetRouteChangeCount() != 0 || sync_b.GetRouteChangeCount() != 0)
+    {
+        cout << "Failed: Queuing burst detected as route change" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    // Base delay rises in both directions.  Each round is about 2 * OWD,
+    // so 50 rounds is about 3 seconds, well before the drift window expires
+    simulate_link(sync_a, sync_b, prng, globalUsec, clock_delta, newOwdUsec, 50);
+
+    const unsigned jitterBound = newOwdUsec / 5 + kTime23ErrorBound * 2;
+    unsigned delta = 0;
+    if (sync_a.GetRouteChangeCount() != 1 ||
+        sync_b.GetRouteChangeCount() != 1 ||
+        !is_near(increaseUsec, newOwdUsec - owdUsec, jitterBound, delta) ||
+        !is_near(sync_a.GetMinimumOneWayDelayUsec(), newOwdUsec, jitterBound, delta))
+    {
+        cout << "Failed: Route change not detected " << sync_a.GetRouteChangeCount() << " " << increaseUsec << " " << sync_a.GetMinimumOneWayDelayUsec() << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    // Clock drift of 2000 ppm raises A's deltas as much as a route change
+    // would over the drift window, but lowers B's deltas by the same amount
+    TimeSynchronizer sync_c, sync_d;
+    uint64_t drifting_delta = clock_delta;
+    for (unsigned i = 0; i < 1000; ++i)
+    {
+        const uint64_t startUsec = globalUsec;
+        simulate_link(sync_c, sync_d, prng, globalUsec, drifting_delta, owdUsec, 1);
+        drifting_delta -= (globalUsec - startUsec) / 500;
+
+        if (i % 10 == 9)
+        {
+            sync_c.OnPeerMinDeltaTS24(sync_d.GetMinDeltaTS24());
+            sync_d.OnPeerMinDeltaTS24(sync_c.GetMinDeltaTS24());
+        }
+    }
+
+    if (sync_c.GetRouteChangeCount() != 0 || sync_d.GetRouteChangeCount() != 0)
+    {
+        cout << "Failed: Clock drift detected as route change " << sync_c.GetRouteChangeCount() << " " << sync_d.GetRouteChangeCount() << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    cout << "Success!" << endl;
+
+    return true;
+}
+
+
+bool TestPrecisionProfile32()
+{
+    cout << "TestPrecisionProfile32...";
+
+    // Datacenter link with 30 usec OWD and up to 2 usec of jitter
+    const uint64_t clock_delta = 12345678;
+    const unsigned owdUsec = 30;
+    const unsigned jitterUsec = 2;
+
+    PCGRandom prng;
+    prng.Seed(61);
+
+    TimeSynchronizer sync_a, sync_b;
+
+    // The profile only changes the field sizes, so later features apply
+    TimeSyncEventQueue events;
+    sync_a.SetEventQueue(&events, 61);
+    uint64_t globalUsec = 1000000;
+
+    for (unsigned i = 0; i < 1000; ++i)
+    {
+        // A -> B
+        Counter32 ts = sync_a.LocalTimeToDatagramTS32(globalUsec);
+        globalUsec += owdUsec + prng.Next() % (jitterUsec + 1);
+        sync_b.OnAuthenticatedDatagramTimestamp32(ts, globalUsec + clock_delta);
+
+        // B -> A
+        ts = sync_b.LocalTimeToDatagramTS32(globalUsec + clock_delta);
+        globalUsec += owdUsec + prng.Next() % (jitterUsec + 1);
+        sync_a.OnAuthenticatedDatagramTimestamp32(ts, globalUsec);
+
+        if (i % 10 == 9)
+        {
+            sync_a.OnPeerMinDeltaTS32(sync_b.GetMinDeltaTS32());
+            sync_b.OnPeerMinDeltaTS32(sync_a.GetMinDeltaTS32());
+        }
+
+        globalUsec += 100;
+    }
+
+    // The clock delta is known modulo 2^26 usec
+    const int32_t expectedDelta = (int32_t)((uint32_t)clock_delta << 6) >> 6;
+    const int32_t errorA = sync_a.GetSignedRemoteTimeDeltaUsec() - expectedDelta;
+    const int32_t errorB = sync_b.GetSignedRemoteTimeDeltaUsec() + expectedDelta;
+
+    unsigned delta = 0;
+    if (!sync_a.IsSynchronized() ||
+        errorA > 5 || errorA < -5 ||
+        errorB > 5 || errorB < -5 ||
+        !is_near(sync_a.GetMinimumOneWayDelayUsec(), owdUsec, kTime32ErrorBound + 1, delta))
+    {
+        cout << "Failed: Offset error " << errorA << " " << errorB << " OWD " << sync_a.GetMinimumOneWayDelayUsec() << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    // Conversions round-trip exactly at 1 usec resolution
+    const uint64_t localUsec = globalUsec + 12345;
+    const uint32_t remoteTS32 = sync_a.ToRemoteTime32(localUsec);
+    if (sync_a.FromRemoteTime32(globalUsec, remoteTS32) != localUsec ||
+        sync_a.FromRemoteUsec(sync_a.ToRemoteUsec(localUsec)) != localUsec ||
+        TimeSynchronizer::FromLocalTime32(globalUsec, (uint32_t)localUsec) != localUsec)
+    {
+        cout << "Failed: Conversions" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    TimeSyncEvent event;
+    if (!events.Pop(event) || event.Type != kEventSynchronized || event.PeerId != 61)
+    {
+        cout << "Failed: Synchronized event" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    cout << "Success!" << endl;
+
+    return true;
+}
+
+
+#ifdef __linux__
+
+/// UDP socket bound to an ephemeral loopback port with SO_TIMESTAMPNS
+struct LoopbackSocket
+{
+    int Fd = -1;
+    sockaddr_in Addr;
+
+    bool Open()
+    {
+        Fd = socket(AF_INET, SOCK_DGRAM, 0);
+        if (Fd < 0) {
+            return false;
+        }
+        int on = 1;
+        setsockopt(Fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+
+        memset(&Addr, 0, sizeof(Addr));
+        Addr.sin_family = AF_INET;
+        Addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len = sizeof(Addr);
+        return bind(Fd, (sockaddr*)&Addr, sizeof(Addr)) == 0 &&
+            getsockname(Fd, (sockaddr*)&Addr, &len) == 0;
+    }
+
+    ~LoopbackSocket()
+    {
+        if (Fd >= 0) {
+            close(Fd);
+        }
+    }
+
+    /// Send a TS24 timestamp taken from the given clock offset
+    bool Send(const LoopbackSocket& to, int64_t clockOffsetNsec)
+    {
+        timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        const uint64_t nowNsec = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec + clockOffsetNsec;
+        const uint32_t ts24 = TimeSynchronizer::LocalTimeToDatagramTS24(nowNsec / 1000);
+
+        uint8_t buffer[3];
+        HibernatedTimeSync::Write24(buffer, ts24);
+        return sendto(Fd, buffer, 3, 0, (const sockaddr*)&to.Addr, sizeof(to.Addr)) == 3;
+    }
+
+    /// Receive a TS24 timestamp and its kernel receive time on the given clock
+    bool Receive(Counter24& ts24, uint64_t& recvNsec, int64_t clockOffsetNsec)
+    {
+        uint8_t buffer[16];
+        uint8_t control[256];
+        iovec iov = { buffer, sizeof(buffer) };
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        if (recvmsg(Fd, &msg, 0) != 3) {
+            return false;
+        }
+        ts24 = HibernatedTimeSync::Read24(buffer);
+
+        for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_TIMESTAMPNS)
+            {
+                timespec ts;
+                memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+                recvNsec = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec + clockOffsetNsec;
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+#endif // __linux__
+
+static int64_t abs_int64(int64_t x)
+{
+    return x < 0 ? -x : x;
+}
+
+bool TestNanosecondPipeline()
+{
+    cout << "TestNanosecondPipeline...";
+
+    // Remote clock offset with a sub-microsecond part
+    const int64_t offsetNsec = 123456789437;
+    const int64_t expectedDeltaNsec = offsetNsec - ((int64_t)1 << 26) * 2000;
+    const unsigned owdNsec = 20250;
+
+    PCGRandom prng;
+    prng.Seed(62);
+
+    // Simulated link: Compare the microsecond and nanosecond input paths
+    TimeSynchronizer usec_a, usec_b, nsec_a, nsec_b;
+    uint64_t globalNsec = 1000000000;
+
+    for (unsigned i = 0; i < 2000; ++i)
+    {
+        // A -> B
+        uint64_t sendNsec = globalNsec;
+        globalNsec += owdNsec + prng.Next() % 2000;
+        Counter24 ts = TimeSynchronizer::LocalTimeToDatagramTS24(sendNsec / 1000);
+        usec_b.OnAuthenticatedDatagramTimestamp(ts, (globalNsec + offsetNsec) / 1000);
+        nsec_b.OnAuthenticatedDatagramTimestampNs(ts, globalNsec + offsetNsec);
+
+        // B -> A
+        sendNsec = globalNsec + offsetNsec;
+        globalNsec += owdNsec + prng.Next() % 2000;
+        ts = TimeSynchronizer::LocalTimeToDatagramTS24(sendNsec / 1000);
+        usec_a.OnAuthenticatedDatagramTimestamp(ts, globalNsec / 1000);
+        nsec_a.OnAuthenticatedDatagramTimestampNs(ts, globalNsec);
+
+        if (i % 10 == 9)
+        {
+            usec_a.OnPeerMinDeltaTS24(usec_b.GetMinDeltaTS24());
+            usec_b.OnPeerMinDeltaTS24(usec_a.GetMinDeltaTS24());
+            nsec_a.OnPeerMinDeltaTS37(nsec_b.GetMinDeltaTS37());
+            nsec_b.OnPeerMinDeltaTS37(nsec_a.GetMinDeltaTS37());
+        }
+
+        globalNsec += 100000 + prng.Next() % 10000;
+    }
+
+    const int64_t usecError = abs_int64(usec_a.GetSignedRemoteTimeDeltaNsec() - expectedDeltaNsec);
+    const int64_t nsecError = abs_int64(nsec_a.GetSignedRemoteTimeDeltaNsec() - expectedDeltaNsec);
+    const int64_t owdError = abs_int64((int64_t)nsec_a.GetMinimumOneWayDelayNsec() - owdNsec);
+
+    if (nsecError > 250 || owdError > 250 || nsecError > usecError)
+    {
+        cout << "Failed: Simulated offset error usec path = " << usecError << " nsec, nsec path = " << nsecError << " nsec, OWD error = " << owdError << " nsec" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+#ifdef __linux__
+    // Loopback: Both ends share a clock, so the only error is measurement.
+    // This reports how much precision is recovered in practice
+    LoopbackSocket sock_a, sock_b;
+    if (!sock_a.Open() || !sock_b.Open())
+    {
+        cout << "Failed: Loopback sockets" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    TimeSynchronizer loop_a, loop_b, loop_usec_a, loop_usec_b;
+    for (unsigned i = 0; i < 2000; ++i)
+    {
+        Counter24 ts;
+        uint64_t recvNsec = 0;
+
+        if (!sock_a.Send(sock_b, 0) || !sock_b.Receive(ts, recvNsec, offsetNsec))
+        {
+            cout << "Failed: Loopback A -> B" << endl;
+            TIMESYNC_DEBUG_BREAK();
+            return false;
+        }
+        loop_b.OnAuthenticatedDatagramTimestampNs(ts, recvNsec);
+        loop_usec_b.OnAuthenticatedDatagramTimestamp(ts, recvNsec / 1000);
+
+        if (!sock_b.Send(sock_a, offsetNsec) || !sock_a.Receive(ts, recvNsec, 0))
+        {
+            cout << "Failed: Loopback B -> A" << endl;
+            TIMESYNC_DEBUG_BREAK();
+            return false;
+        }
+        loop_a.OnAuthenticatedDatagramTimestampNs(ts, recvNsec);
+        loop_usec_a.OnAuthenticatedDatagramTimestamp(ts, recvNsec / 1000);
+
+        if (i % 10 == 9)
+        {
+            loop_a.OnPeerMinDeltaTS37(loop_b.GetMinDeltaTS37());
+            loop_b.OnPeerMinDeltaTS37(loop_a.GetMinDeltaTS37());
+            loop_usec_a.OnPeerMinDeltaTS24(loop_usec_b.GetMinDeltaTS24());
+            loop_usec_b.OnPeerMinDeltaTS24(loop_usec_a.GetMinDeltaTS24());
+        }
+    }
+
+    const int64_t loopNsecError = abs_int64(loop_a.GetSignedRemoteTimeDeltaNsec() - expectedDeltaNsec);
+    const int64_t loopUsecError = abs_int64(loop_usec_a.GetSignedRemoteTimeDeltaNsec() - expectedDeltaNsec);
+
+    cout << "(loopback offset error: nsec path " << loopNsecError << " nsec, usec path " << loopUsecError
+        << " nsec, min OWD " << loop_a.GetMinimumOneWayDelayNsec() << " nsec) ";
+
+    if (loopNsecError > kTime23ErrorBound * 1000)
+    {
+        cout << "Failed: Loopback offset error" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+#endif // __linux__
+
+    cout << "Success!" << endl;
+
+    return true;
+}
+
+
+bool TestExtendedRange()
+{
+    cout << "TestExtendedRange...";
+
+    const unsigned owdUsec = 8000;
+
+    // B's clock is behind by exactly the OWD, so A -> B deltas are zero.
+    // A zero delta must still count as a valid minimum
+    {
+        TimeSynchronizer sync_a, sync_b;
+        uint64_t globalUsec = 1000000;
+        const uint64_t clock_delta = (uint64_t)0 - owdUsec;
+        sync_pair(sync_a, sync_b, globalUsec, clock_delta, owdUsec);
+
+        unsigned delta = 0;
+        if (sync_b.GetMinDeltaTS24() != 0 ||
+            !sync_a.IsSynchronized() || !sync_b.IsSynchronized() ||
+            !is_near(sync_b.GetMinimumOneWayDelayUsec(), owdUsec, kTime23ErrorBound, delta))
+        {
+            cout << "Failed: Zero delta" << endl;
+            TIMESYNC_DEBUG_BREAK();
+            return false;
+        }
+    }
+
+    // A five minute window keeps one good sample for longer than the
+    // 134 second TS24 datagram timestamp period
+    {
+        const uint64_t clock_delta = 9876543210;
+        const uint64_t windowUsec = 5 * 60 * 1000 * 1000ULL;
+
+        PCGRandom prng;
+        prng.Seed(63);
+
+        TimeSynchronizer sync_a, sync_b;
+        sync_a.SetDriftWindowUsec(windowUsec);
+        sync_b.SetDriftWindowUsec(windowUsec);
+
+        uint64_t globalUsec = 1000000;
+        sync_pair(sync_a, sync_b, globalUsec, clock_delta, owdUsec);
+        const uint32_t bestOwdUsec = sync_a.GetMinimumOneWayDelayUsec();
+
+        // Three minutes of datagrams that are all at least 1 ms slower
+        for (unsigned i = 0; i < 1800; ++i)
+        {
+            Counter24 ts = sync_a.LocalTimeToDatagramTS24(globalUsec);
+            globalUsec += owdUsec + 1000 + prng.Next() % 1000;
+            sync_b.OnAuthenticatedDatagramTimestamp(ts, globalUsec + clock_delta);
+
+            ts = sync_b.LocalTimeToDatagramTS24(globalUsec + clock_delta);
+            globalUsec += owdUsec + 1000 + prng.Next() % 1000;
+            sync_a.OnAuthenticatedDatagramTimestamp(ts, globalUsec);
+
+            if (i % 10 == 9)
+            {
+                sync_a.OnPeerMinDeltaTS24(sync_b.GetMinDeltaTS24());
+                sync_b.OnPeerMinDeltaTS24(sync_a.GetMinDeltaTS24());
+            }
+
+            globalUsec += 100000 - 2 * owdUsec;
+        }
+
+        if (sync_a.GetDriftWindowUsec() != windowUsec ||
+            sync_a.GetMinimumOneWayDelayUsec() != bestOwdUsec ||
+            sync_a.GetRouteChangeCount() != 0 ||
+            sync_a.GetIncomingQueuingDelayUsec() < 1000)
+        {
+            cout << "Failed: Long window lost the best sample " << sync_a.GetMinimumOneWayDelayUsec() << " != " << bestOwdUsec << endl;
+            TIMESYNC_DEBUG_BREAK();
+            return false;
+        }
+    }
+
+    cout << "Success!" << endl;
+
+    return true;
+}
+
+
+bool TestFourTimestampExchange()
+{
+    cout << "TestFourTimestampExchange...";
+
+    const uint64_t clock_delta = 5555555555;
+    const unsigned owdUsec = 15000;
+    const int32_t expectedDelta = (int32_t)((uint32_t)clock_delta << 6) >> 6;
+
+    PCGRandom prng;
+    prng.Seed(64);
+
+    // Probe-only peer: No MinDelta reports at all
+    TimeSynchronizer sync_a;
+    uint64_t globalUsec = 1000000;
+    uint32_t rttUsec = 0;
+
+    for (unsigned i = 0; i < 100; ++i)
+    {
+        const uint64_t t1 = globalUsec;
+        globalUsec += owdUsec + prng.Next() % 300;
+        const uint64_t t2 = globalUsec + clock_delta;
+        globalUsec += 50; // Remote processing time
+        const uint64_t t3 = globalUsec + clock_delta;
+        globalUsec += owdUsec + prng.Next() % 300;
+        const uint64_t t4 = globalUsec;
+
+        rttUsec = sync_a.OnFourTimestampExchange(t1, t2, t3, t4);
+        globalUsec += 100000;
+    }
+
+    int32_t error = sync_a.GetSignedRemoteTimeDeltaUsec() - expectedDelta;
+    unsigned delta = 0;
+    if (!sync_a.IsSynchronized() ||
+        error > (int32_t)kTime23ErrorBound || error < -(int32_t)kTime23ErrorBound ||
+        !is_near(sync_a.GetMinimumOneWayDelayUsec(), owdUsec, kTime23ErrorBound, delta) ||
+        !is_near(rttUsec, owdUsec * 2 + 300, 300, delta))
+    {
+        cout << "Failed: Probe-only sync error " << error << " OWD " << sync_a.GetMinimumOneWayDelayUsec() << " RTT " << rttUsec << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    // Probe-only route change: The path from the peer becomes slower
+    const unsigned newOwdUsec = owdUsec + 20000;
+    for (unsigned i = 0; i < 50; ++i)
+    {
+        const uint64_t t1 = globalUsec;
+        globalUsec += owdUsec + prng.Next() % 300;
+        const uint64_t t2 = globalUsec + clock_delta;
+        globalUsec += 50;
+        const uint64_t t3 = globalUsec + clock_delta;
+        globalUsec += newOwdUsec + prng.Next() % 300;
+        sync_a.OnFourTimestampExchange(t1, t2, t3, globalUsec);
+        globalUsec += 100000;
+    }
+    if (sync_a.GetRouteChangeCount() != 1 ||
+        !is_near(sync_a.GetMinimumOneWayDelayUsec(), (owdUsec + newOwdUsec) / 2, kTime23ErrorBound, delta))
+    {
+        cout << "Failed: Probe-only route change " << sync_a.GetRouteChangeCount() << " OWD " << sync_a.GetMinimumOneWayDelayUsec() << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    // Mixed: Datagram timestamps from the peer plus occasional probes
+    TimeSynchronizer sync_b, sync_peer;
+    for (unsigned i = 0; i < 200; ++i)
+    {
+        const Counter24 ts = sync_peer.LocalTimeToDatagramTS24(globalUsec + clock_delta);
+        globalUsec += owdUsec + prng.Next() % 300;
+        sync_b.OnAuthenticatedDatagramTimestamp(ts, globalUsec);
+
+        if (i % 20 == 19)
+        {
+            const uint64_t t1 = globalUsec;
+            globalUsec += owdUsec + prng.Next() % 300;
+            const uint64_t t2 = globalUsec + clock_delta;
+            globalUsec += owdUsec + prng.Next() % 300;
+            sync_b.OnFourTimestampExchange(t1, t2, t2, globalUsec);
+        }
+
+        globalUsec += 10000;
+    }
+
+    error = sync_b.GetSignedRemoteTimeDeltaUsec() - expectedDelta;
+    if (!sync_b.IsSynchronized() ||
+        error > (int32_t)kTime23ErrorBound * 2 || error < -(int32_t)kTime23ErrorBound * 2)
+    {
+        cout << "Failed: Mixed sync error " << error << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    // A MinDelta report from the peer that is better than the probes is used
+    const uint32_t owdBefore = sync_b.GetMinimumOneWayDelayUsec();
+    sync_b.OnPeerMinDeltaTS37(TimeSynchronizer::LocalUsecToTS37(clock_delta + owdUsec - 1000));
+    if (sync_b.GetMinimumOneWayDelayUsec() >= owdBefore)
+    {
+        cout << "Failed: Peer report not used" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    cout << "Success!" << endl;
+
+    return true;
+}
+
+
+#ifdef __linux__
+
+/// Minimal SNTP client: Returns false on timeout
+static bool ntp_client_query(
+    uint16_t port,
+    int64_t& offsetNsec,
+    uint8_t& leap,
+    uint8_t& stratum)
+{
+    LoopbackSocket client;
+    if (!client.Open()) {
+        return false;
+    }
+
+    timeval tv;
+    tv.tv_sec = 1;
+    tv.tv_usec = 0;
+    setsockopt(client.Fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    sockaddr_in server;
+    memset(&server, 0, sizeof(server));
+    server.sin_family = AF_INET;
+    server.sin_port = htons(port);
+    server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    const uint64_t t1 = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+
+    // LI = 0, VN = 4, Mode = 3 (client)
+    uint8_t request[kNtpPacketBytes] = { 0x23 };
+    WriteNtpTimestamp(request + 40, UnixNsecToNtpTimestamp(t1));
+    if (sendto(client.Fd, request, sizeof(request), 0, (const sockaddr*)&server, sizeof(server)) != (ssize_t)sizeof(request)) {
+        return false;
+    }
+
+    uint8_t response[kNtpPacketBytes];
+    if (recv(client.Fd, response, sizeof(response), 0) != (ssize_t)sizeof(response)) {
+        return false;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    const uint64_t t4 = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+
+    // Origin timestamp must echo our transmit timestamp
+    if (memcmp(response + 24, request + 40, 8) != 0 || (response[0] & 7) != 4) {
+        return false;
+    }
+
+    leap = response[0] >> 6;
+    stratum = response[1];
+
+    const int64_t t2 = (int64_t)NtpTimestampToUnixNsec(ReadNtpTimestamp(response + 32));
+    const int64_t t3 = (int64_t)NtpTimestampToUnixNsec(ReadNtpTimestamp(response + 40));
+    offsetNsec = ((t2 - (int64_t)t1) + (t3 - (int64_t)t4)) / 2;
+    return true;
+}
+
+/// Send one request over loopback in the given address family, and check
+/// that the server answers it
+static bool ntp_ping(NtpServer& server, int family)
+{
+    const int fd = socket(family, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        return false;
+    }
+
+    timeval tv;
+    tv.tv_sec = 1;
+    tv.tv_usec = 0;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    sockaddr_in to4;
+    sockaddr_in6 to6;
+    memset(&to4, 0, sizeof(to4));
+    memset(&to6, 0, sizeof(to6));
+    to4.sin_family = AF_INET;
+    to4.sin_port = htons(server.GetPort());
+    to4.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    to6.sin6_family = AF_INET6;
+    to6.sin6_port = htons(server.GetPort());
+    to6.sin6_addr = in6addr_loopback;
+    const sockaddr* to = family == AF_INET6 ? (const sockaddr*)&to6 : (const sockaddr*)&to4;
+    const socklen_t toLen = family == AF_INET6 ? sizeof(to6) : sizeof(to4);
+
+    uint8_t request[kNtpPacketBytes] = { 0x23 };
+    uint8_t response[kNtpPacketBytes];
+    const bool ok = sendto(fd, request, sizeof(request), 0, to, toLen) == (ssize_t)sizeof(request) &&
+        server.Poll(1000) == 1 &&
+        recv(fd, response, sizeof(response), 0) == (ssize_t)sizeof(response) &&
+        (response[0] & 7) == 4;
+
+    close(fd);
+    return ok;
+}
+
+#endif // __linux__
+
+bool TestNtpServer()
+{
+    cout << "TestNtpServer...";
+
+    // Timestamp conversion round trip
+    const uint64_t unixNsec = 1700000000123456789ULL;
+    const uint64_t roundTrip = NtpTimestampToUnixNsec(UnixNsecToNtpTimestamp(unixNsec));
+    if (roundTrip > unixNsec || unixNsec - roundTrip > 1)
+    {
+        cout << "Failed: NTP timestamp conversion" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    TimeSynchronizer sync_a, sync_b;
+
+    // Invalid requests are rejected
+    NtpResponder responder(sync_a);
+    uint8_t request[kNtpPacketBytes] = { 0x24 }; // Mode 4 (server)
+    uint8_t response[kNtpPacketBytes];
+    if (responder.BuildResponse(request, sizeof(request), unixNsec, unixNsec, response) ||
+        responder.BuildResponse(request, 47, unixNsec, unixNsec, response))
+    {
+        cout << "Failed: Invalid request accepted" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+#ifdef __linux__
+    NtpServer server(sync_a);
+    if (!server.Open(0, INADDR_LOOPBACK))
+    {
+        cout << "Failed: NtpServer::Open" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    std::atomic<bool> stop(false);
+    std::thread serverThread([&]() {
+        while (!stop) {
+            server.Poll(10);
+        }
+    });
+
+    // Unsynchronized responses carry the alarm condition
+    int64_t offsetNsec = 0;
+    uint8_t leap = 0, stratum = 0;
+    const bool unsyncOk = ntp_client_query(server.GetPort(), offsetNsec, leap, stratum) &&
+        leap == 3 && stratum == 16;
+
+    // Synchronize with a core whose clock is 1.234567 seconds ahead
+    const uint64_t clock_delta = 1234567;
+    uint64_t globalUsec = 1000000;
+    sync_pair(sync_a, sync_b, globalUsec, clock_delta, 500);
+
+    bool syncOk = true;
+    int64_t worstErrorNsec = 0;
+    for (unsigned i = 0; i < 10; ++i)
+    {
+        if (!ntp_client_query(server.GetPort(), offsetNsec, leap, stratum) ||
+            leap != 0 || stratum != 2)
+        {
+            syncOk = false;
+            break;
+        }
+        const int64_t errorNsec = abs_int64(offsetNsec - sync_a.GetSignedRemoteTimeDeltaNsec());
+        if (errorNsec > worstErrorNsec) {
+            worstErrorNsec = errorNsec;
+        }
+    }
+
+    // A burst larger than one batch is answered in full
+    static const unsigned kBurst = 100;
+    unsigned burstReplies = 0;
+    LoopbackSocket burstClient;
+    if (burstClient.Open())
+    {
+        timeval tv;
+        tv.tv_sec = 1;
+        tv.tv_usec = 0;
+        setsockopt(burstClient.Fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+        sockaddr_in to;
+        memset(&to, 0, sizeof(to));
+        to.sin_family = AF_INET;
+        to.sin_port = htons(server.GetPort());
+        to.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        uint8_t burstRequest[kNtpPacketBytes] = { 0x23 };
+        for (unsigned i = 0; i < kBurst; ++i) {
+            sendto(burstClient.Fd, burstRequest, sizeof(burstRequest), 0, (const sockaddr*)&to, sizeof(to));
+        }
+        uint8_t burstResponse[kNtpPacketBytes];
+        while (burstReplies < kBurst &&
+            recv(burstClient.Fd, burstResponse, sizeof(burstResponse), 0) == (ssize_t)sizeof(burstResponse))
+        {
+            ++burstReplies;
+        }
+    }
+
+    stop = true;
+    serverThread.join();
+
+    // Loopback RTT is well under a millisecond
+    if (!unsyncOk || !syncOk || worstErrorNsec > 1000000 ||
+        burstReplies != kBurst ||
+        server.GetResponseCount() != 11 + kBurst ||
+        server.GetDroppedCount() != 0)
+    {
+        cout << "Failed: NTP client query, worst error " << worstErrorNsec << " nsec" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    // A dual-stack IPv6 socket serves IPv6 and IPv4 clients.
+    // Skipped if the host has no IPv6 support
+    NtpServer server6(sync_a);
+    if (server6.OpenIPv6(0) &&
+        (!ntp_ping(server6, AF_INET6) || !ntp_ping(server6, AF_INET)))
+    {
+        cout << "Failed: NTP over IPv6" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    // Servers opened with reusePort share a port, and others cannot bind it
+    NtpServer shared1(sync_a), shared2(sync_a), other(sync_a);
+    if (!shared1.Open(0, INADDR_LOOPBACK, true) ||
+        !shared2.Open(shared1.GetPort(), INADDR_LOOPBACK, true) ||
+        other.Open(shared1.GetPort(), INADDR_LOOPBACK))
+    {
+        cout << "Failed: SO_REUSEPORT" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+#endif // __linux__
+
+    cout << "Success!" << endl;
+
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+// SHM Refclock Test
+
+#ifdef __linux__
+
+/// Read one sample the way chronyd's SHM driver does.
+/// Returns false if no valid sample was available or the read was torn.
+static bool shm_refclock_read(
+    NtpShmTime* shm,
+    uint64_t& localUnixNsec,
+    uint64_t& clockUnixNsec)
+{
+    if (shm->Mode != 1 || !shm->Valid) {
+        return false;
+    }
+
+    const int count = shm->Count;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    clockUnixNsec = (uint64_t)shm->ClockTimeStampSec * 1000000000 + shm->ClockTimeStampNSec;
+    localUnixNsec = (uint64_t)shm->ReceiveTimeStampSec * 1000000000 + shm->ReceiveTimeStampNSec;
+
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const bool consistent = (count == shm->Count) && shm->Valid;
+    shm->Valid = 0;
+    return consistent;
+}
+
+#endif // __linux__
+
+bool TestShmRefclock()
+{
+    cout << "TestShmRefclock...";
+
+#ifdef __linux__
+    // Use a unit well above the ones chronyd is normally configured with
+    const int unit = 1000 + (int)(getpid() % 10000);
+
+    ShmRefclockExporter exporter;
+    if (!exporter.Open(unit))
+    {
+        cout << "Failed: ShmRefclockExporter::Open" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    // Attach separately as the reader
+    const int shmId = shmget(kNtpShmKeyBase + unit, sizeof(NtpShmTime), 0);
+    void* attached = shmId == -1 ? (void*)-1 : shmat(shmId, nullptr, 0);
+    if (attached == (void*)-1)
+    {
+        cout << "Failed: Reader attach" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+    NtpShmTime* shm = static_cast<NtpShmTime*>(attached);
+
+    TimeSynchronizer sync_a, sync_b;
+    uint64_t localUnixNsec = 0, clockUnixNsec = 0;
+    const uint64_t nowNsec = 1500000000ULL * 1000000000ULL + 123456789;
+
+    // Nothing is published before synchronization
+    bool ok = !exporter.PublishFromSynchronizer(sync_a, nowNsec) &&
+        !shm_refclock_read(shm, localUnixNsec, clockUnixNsec);
+
+    // Synchronize with a core whose clock is 1.234567 seconds ahead
+    uint64_t globalUsec = 1000000;
+    sync_pair(sync_a, sync_b, globalUsec, 1234567, 500);
+
+    ok = ok && exporter.PublishFromSynchronizer(sync_a, nowNsec) &&
+        shm_refclock_read(shm, localUnixNsec, clockUnixNsec) &&
+        localUnixNsec == nowNsec &&
+        (int64_t)(clockUnixNsec - localUnixNsec) == sync_a.GetSignedRemoteTimeDeltaNsec() &&
+        shm->ReceiveTimeStampUSec == 123456 &&
+        abs_int64((int64_t)(clockUnixNsec - localUnixNsec) - 1234567000) < 20000;
+
+    // The sample is consumed by the read
+    ok = ok && !shm_refclock_read(shm, localUnixNsec, clockUnixNsec);
+
+    // Concurrent writer: Every sample the reader accepts must be whole
+    const uint64_t offsetNsec = 987654321;
+    std::atomic<bool> stop(false);
+    std::thread writer([&]() {
+        uint64_t t = nowNsec;
+        while (!stop)
+        {
+            exporter.Publish(t, t + offsetNsec);
+            t += 1000000007;
+            std::this_thread::yield();
+        }
+    });
+
+    unsigned accepted = 0, torn = 0;
+    for (unsigned i = 0; i < 10000000 && accepted < 1000; ++i)
+    {
+        if (shm_refclock_read(shm, localUnixNsec, clockUnixNsec))
+        {
+            ++accepted;
+            if (clockUnixNsec - localUnixNsec != offsetNsec) {
+                ++torn;
+            }
+        }
+    }
+
+    stop = true;
+    writer.join();
+
+    shmdt(attached);
+    exporter.Close();
+    shmctl(shmId, IPC_RMID, nullptr);
+
+    if (!ok || torn != 0 || accepted == 0)
+    {
+        cout << "Failed: SHM refclock readback, " << torn << " torn of " << accepted << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+#endif // __linux__
+
+    cout << "Success!" << endl;
+
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+// Remote Clock Test
+
+/// Walk the remote clock from startNsec to endNsec in steps, checking that
+/// it never goes backwards and never slews faster than maxPPM.
+/// Returns false on violation
+static bool walk_remote_clock(
+    const RemoteClock& clock,
+    uint64_t startNsec,
+    uint64_t endNsec,
+    uint64_t stepNsec,
+    uint32_t maxPPM)
+{
+    uint64_t lastRemote = clock.ToRemoteNsec(startNsec);
+    int64_t lastOffset = clock.GetOffsetNsec(startNsec);
+
+    for (uint64_t t = startNsec + stepNsec; t <= endNsec; t += stepNsec)
+    {
+        const uint64_t remote = clock.ToRemoteNsec(t);
+        const int64_t offset = clock.GetOffsetNsec(t);
+        const int64_t slew = abs_int64(offset - lastOffset);
+
+        if (remote < lastRemote ||
+            slew > (int64_t)(stepNsec * maxPPM / 1000000) + 1)
+        {
+            return false;
+        }
+
+        lastRemote = remote;
+        lastOffset = offset;
+    }
+
+    return true;
+}
+
+bool TestRemoteClock()
+{
+    cout << "TestRemoteClock...";
+
+    RemoteClock clock;
+    const uint64_t t0 = 1000000000;
+
+    // Local time passes through until the first offset, which is stepped to
+    bool ok = !clock.IsInitialized() && clock.ToRemoteNsec(t0) == t0;
+    clock.SetTargetOffsetNsec(1000000000, t0);
+    ok = ok && clock.IsInitialized() &&
+        clock.ToRemoteNsec(t0) == t0 + 1000000000 &&
+        !clock.IsSlewing(t0);
+
+    // Step the target back 50 usec: Slews over 100 msec at 500 ppm
+    const uint64_t t1 = t0 + 1000000;
+    clock.SetTargetOffsetNsec(1000000000 - 50000, t1);
+    ok = ok && clock.GetSlewErrorNsec(t1) == -50000 &&
+        abs_int64(clock.GetSlewErrorNsec(t1 + 50000000) + 25000) <= 1 &&
+        clock.IsSlewing(t1 + 99990000) &&
+        !clock.IsSlewing(t1 + 100000000) &&
+        walk_remote_clock(clock, t1 - 1000, t1 + 200000000, 997, kDefaultMaxSlewPPM) &&
+        walk_remote_clock(clock, t1 + 99990000, t1 + 100010000, 1, kDefaultMaxSlewPPM);
+
+    // Retarget forwards mid-slew: The remote clock stays continuous
+    clock.SetMaxSlewPPM(100);
+    const uint64_t t2 = t1 + 200000000;
+    clock.SetTargetOffsetNsec(1000000000 - 60000, t2);
+    const uint64_t t3 = t2 + 30000000;
+    const int64_t beforeOffset = clock.GetOffsetNsec(t3);
+    clock.SetTargetOffsetNsec(1000000000 + 30000, t3);
+    ok = ok && clock.GetOffsetNsec(t3) == beforeOffset &&
+        clock.GetSlewErrorNsec(t3) == 1000000000 + 30000 - beforeOffset &&
+        walk_remote_clock(clock, t2, t3 + 2000000000, 1009, 100) &&
+        clock.GetOffsetNsec(t3 + 2000000000) == 1000000000 + 30000;
+
+    if (!ok)
+    {
+        cout << "Failed: Slew" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    // Corrections larger than the step threshold are stepped to like ntpd
+    // does, rather than slewed for 20 minutes, unless stepping is disabled
+    RemoteClock stepped, slewOnly;
+    slewOnly.SetStepThresholdNsec(0);
+    for (RemoteClock* c : { &stepped, &slewOnly })
+    {
+        c->SetTargetOffsetNsec(0, t0);
+        c->SetTargetOffsetNsec(600000000, t1);
+    }
+    ok = stepped.GetOffsetNsec(t1) == 600000000 && !stepped.IsSlewing(t1) &&
+        stepped.GetStepCount() == 1 &&
+        slewOnly.GetSlewErrorNsec(t1) == 600000000 && slewOnly.GetStepCount() == 0 &&
+        walk_remote_clock(slewOnly, t1, t1 + 1000000000, 1000003, kDefaultMaxSlewPPM);
+
+    // Smaller corrections are still slewed
+    stepped.SetTargetOffsetNsec(600000000 + kDefaultStepThresholdNsec, t2);
+    ok = ok && stepped.IsSlewing(t2) && stepped.GetStepCount() == 1;
+
+    if (!ok)
+    {
+        cout << "Failed: Step threshold" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    // Follow a synchronizer
+    TimeSynchronizer sync_a, sync_b;
+    RemoteClock synced;
+    synced.Update(sync_a, t0);
+    uint64_t globalUsec = 1000000;
+    sync_pair(sync_a, sync_b, globalUsec, 1234567, 500);
+    synced.Update(sync_a, t0);
+    if (synced.GetOffsetNsec(t0) != sync_a.GetSignedRemoteTimeDeltaNsec())
+    {
+        cout << "Failed: Update" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    // Readers never see a torn segment while the writer retargets between
+    // two offsets: Every offset read lies between them
+    RemoteClock shared;
+    shared.SetTargetOffsetNsec(0, t0);
+    std::atomic<uint64_t> writerNsec(t0);
+    std::atomic<bool> stop(false);
+    std::atomic<unsigned> outOfRange(0);
+
+    std::thread readers[2];
+    for (auto& reader : readers)
+    {
+        reader = std::thread([&]() {
+            while (!stop)
+            {
+                const int64_t offset = shared.GetOffsetNsec(writerNsec.load());
+                if (offset < 0 || offset > 100000) {
+                    ++outOfRange;
+                }
+            }
+        });
+    }
+
+    uint64_t t = t0;
+    for (unsigned i = 0; i < 200000; ++i)
+    {
+        t += 7919;
+        writerNsec = t;
+        shared.SetTargetOffsetNsec((i % 2) ? 0 : 100000, t);
+    }
+
+    stop = true;
+    for (auto& reader : readers) {
+        reader.join();
+    }
+
+    if (outOfRange != 0)
+    {
+        cout << "Failed: Torn read " << outOfRange << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    cout << "Success!" << endl;
+
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+// Shared Sync State Test
+
+bool TestSharedSyncState()
+{
+    cout << "TestSharedSyncState...";
+
+#ifdef __linux__
+    char name[64];
+    snprintf(name, sizeof(name), "/timesync_test_%d", (int)getpid());
+    SyncStatePublisher::Unlink(name);
+
+    // Readers cannot open a page that has not been published
+    SyncStateReader reader;
+    if (reader.Open(name))
+    {
+        cout << "Failed: Opened missing page" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    SyncStatePublisher publisher;
+    if (!publisher.Open(name) || !reader.Open(name))
+    {
+        cout << "Failed: Open" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    TimeSynchronizer sync_a, sync_b;
+    uint64_t globalUsec = 1000000;
+    publisher.Publish(sync_a, globalUsec);
+    bool ok = !reader.IsSynchronized() && reader.ToRemoteTime23(globalUsec) == 0;
+
+    // Conversions through the page match the synchronizer
+    sync_pair(sync_a, sync_b, globalUsec, 1234567, 500);
+    publisher.Publish(sync_a, globalUsec);
+
+    SyncStateSnapshot snapshot;
+    ok = ok && reader.IsSynchronized() && reader.Read(snapshot) &&
+        snapshot.PublishLocalUsec == globalUsec &&
+        snapshot.RemoteTimeDeltaNsec == sync_a.GetSignedRemoteTimeDeltaNsec() &&
+        snapshot.MinimumOneWayDelayUsec == sync_a.GetMinimumOneWayDelayUsec();
+
+    for (uint64_t localUsec = globalUsec; localUsec < globalUsec + 100000000; localUsec += 999983)
+    {
+        const uint32_t remoteTS23 = sync_a.ToRemoteTime23(localUsec);
+        if (reader.ToRemoteTime23(localUsec) != remoteTS23 ||
+            reader.FromRemoteTime23(localUsec, remoteTS23) != sync_a.FromRemoteTime23(localUsec, remoteTS23) ||
+            SyncStateReader::FromLocalTime23(localUsec, remoteTS23) != sync_a.FromLocalTime23(localUsec, remoteTS23))
+        {
+            ok = false;
+        }
+    }
+
+    // Another process sees the same conversions
+    const uint32_t expectedTS23 = sync_a.ToRemoteTime23(globalUsec);
+    const pid_t child = fork();
+    if (child == 0)
+    {
+        SyncStateReader childReader;
+        const bool childOk = childReader.Open(name) &&
+            childReader.ToRemoteTime23(globalUsec) == expectedTS23;
+        _exit(childOk ? 0 : 1);
+    }
+    int status = -1;
+    ok = ok && child > 0 && waitpid(child, &status, 0) == child &&
+        WIFEXITED(status) && WEXITSTATUS(status) == 0;
+
+    if (!ok)
+    {
+        cout << "Failed: Shared conversions" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    // Readers never see a torn snapshot while the publisher is writing
+    reader.Read(snapshot);
+    const uint64_t baseCount = snapshot.PublishCount;
+    std::atomic<bool> stop(false);
+    std::thread writer([&]() {
+        SyncStateSnapshot published;
+        published.Synchronized = true;
+        for (uint64_t i = 1; !stop; ++i)
+        {
+            published.RemoteTimeDeltaUsec = (uint32_t)i;
+            published.RemoteTimeDeltaNsec = (int64_t)i * 1000;
+            published.MinimumOneWayDelayUsec = (uint32_t)(i * 3);
+            published.PublishLocalUsec = i * 7;
+            publisher.Publish(published);
+        }
+    });
+
+    unsigned torn = 0;
+    for (unsigned i = 0; i < 1000000; ++i)
+    {
+        reader.Read(snapshot);
+        if (snapshot.PublishCount <= baseCount) {
+            continue;
+        }
+        const uint64_t v = snapshot.RemoteTimeDeltaUsec;
+        if (snapshot.RemoteTimeDeltaNsec != (int64_t)v * 1000 ||
+            snapshot.MinimumOneWayDelayUsec != (uint32_t)(v * 3) ||
+            snapshot.PublishLocalUsec != v * 7)
+        {
+            ++torn;
+        }
+    }
+
+    stop = true;
+    writer.join();
+
+    if (torn != 0)
+    {
+        cout << "Failed: " << torn << " torn snapshots" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    // A publisher that dies in the middle of a write leaves the sequence
+    // odd.  Readers give up, and the next publisher recovers the page
+    publisher.Close();
+    const int fd = shm_open(name, O_RDWR, 0);
+    void* mapped = fd < 0 ? MAP_FAILED :
+        mmap(nullptr, sizeof(SharedSyncPage), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (mapped != MAP_FAILED)
+    {
+        SharedSyncPage* page = static_cast<SharedSyncPage*>(mapped);
+        page->Sequence.store(page->Sequence.load() | 1);
+        munmap(mapped, sizeof(SharedSyncPage));
+    }
+    ok = mapped != MAP_FAILED &&
+        !reader.Read(snapshot) && !snapshot.Synchronized && !reader.IsSynchronized();
+
+    ok = ok && publisher.Open(name);
+    publisher.Publish(sync_a, globalUsec);
+    ok = ok && reader.Read(snapshot) && reader.IsSynchronized();
+
+    reader.Close();
+    publisher.Close();
+    SyncStatePublisher::Unlink(name);
+
+    if (!ok)
+    {
+        cout << "Failed: Recovery from a dead publisher" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+#endif // __linux__
+
+    cout << "Success!" << endl;
+
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+// Conversion Cache Test
+
+bool TestConversionCache()
+{
+    cout << "TestConversionCache...";
+
+    TimeSynchronizer sync_a, sync_b;
+    TimeConversionCache cache;
+
+    // Nothing to refresh before synchronization
+    bool ok = sync_a.GetConversionGeneration() == 0 &&
+        !cache.Refresh(sync_a) &&
+        cache.ToRemoteTime23(1000000) == 0;
+
+    uint64_t globalUsec = 1000000;
+    sync_pair(sync_a, sync_b, globalUsec, 1234567, 500);
+    ok = ok && cache.Refresh(sync_a) && cache.GetParams().Synchronized;
+
+    // Cached conversions match the synchronizer
+    for (uint64_t localUsec = globalUsec; localUsec < globalUsec + 100000000; localUsec += 999983)
+    {
+        const uint32_t remoteTS23 = sync_a.ToRemoteTime23(localUsec);
+        if (cache.ToRemoteTime23(localUsec) != remoteTS23 ||
+            cache.ToRemoteTime16(localUsec) != sync_a.ToRemoteTime16(localUsec) ||
+            cache.FromRemoteTime23(localUsec, remoteTS23) != sync_a.FromRemoteTime23(localUsec, remoteTS23))
+        {
+            ok = false;
+        }
+    }
+
+    // The generation only changes when the offset does
+    const uint32_t generation = sync_a.GetConversionGeneration();
+    for (unsigned i = 0; i < 10; ++i) {
+        sync_pair(sync_a, sync_b, globalUsec, 1234567, 500);
+    }
+    ok = ok && sync_a.GetConversionGeneration() == generation && !cache.Refresh(sync_a);
+
+    sync_pair(sync_a, sync_b, globalUsec, 1234567 + 100, 400);
+    ok = ok && sync_a.GetConversionGeneration() != generation && cache.Refresh(sync_a) &&
+        cache.GetParams().RemoteTimeDeltaUsec == (uint32_t)sync_a.GetSignedRemoteTimeDeltaUsec();
+
+    if (!ok)
+    {
+        cout << "Failed: Cached conversions" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    cout << "Success!" << endl;
+
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+// MinDelta Piggyback Test
+
+bool TestMinDeltaPiggyback()
+{
+    cout << "TestMinDeltaPiggyback...";
+
+    const uint64_t clock_delta = 1234567;
+    TimeSynchronizer sync_a, sync_b;
+    PiggybackParams params;
+    MinDeltaPiggybacker piggy_a(sync_a, params), piggy_b(sync_b, params);
+    MinDeltaPiggybackParser parser_a, parser_b;
+
+    // Nothing to attach before any datagram was received
+    uint8_t packet[8];
+    uint64_t globalUsec = 1000000;
+    bool ok = piggy_a.OnDataPacket(globalUsec, packet, sizeof(packet)) == 0 &&
+        !piggy_a.NeedsStandaloneUpdate(globalUsec) &&
+        piggy_a.GetStandaloneDeadlineUsec(globalUsec) == 0 &&
+        !parser_a.OnAttachment(sync_a, packet, kMinDeltaAttachmentBytes - 1);
+
+    // Data flows both ways every 20 msec for 60 seconds
+    const uint64_t startUsec = globalUsec;
+    unsigned standalone = 0;
+    for (unsigned i = 0; i < 3000; ++i)
+    {
+        Counter24 ts = sync_a.LocalTimeToDatagramTS24(globalUsec);
+        unsigned bytes = piggy_a.OnDataPacket(globalUsec, packet, sizeof(packet));
+        globalUsec += 500 + (i * 7919) % 100;
+        sync_b.OnAuthenticatedDatagramTimestamp(ts, globalUsec + clock_delta);
+        if (bytes > 0) {
+            parser_b.OnAttachment(sync_b, packet, bytes);
+        }
+
+        ts = sync_b.LocalTimeToDatagramTS24(globalUsec + clock_delta);
+        bytes = piggy_b.OnDataPacket(globalUsec + clock_delta, packet, sizeof(packet));
+        globalUsec += 500 + (i * 104729) % 100;
+        sync_a.OnAuthenticatedDatagramTimestamp(ts, globalUsec);
+        if (bytes > 0) {
+            parser_a.OnAttachment(sync_a, packet, bytes);
+        }
+
+        if (piggy_a.NeedsStandaloneUpdate(globalUsec) ||
+            piggy_b.NeedsStandaloneUpdate(globalUsec + clock_delta))
+        {
+            ++standalone;
+        }
+
+        globalUsec += 19000;
+    }
+
+    // Attachments stay within the byte budget
+    const uint64_t elapsedSec = (globalUsec - startUsec) / 1000000 + 1;
+    const uint64_t budgetBytes = params.BudgetBytesPerSecond * elapsedSec +
+        params.BurstAttachments * kMinDeltaAttachmentBytes;
+    ok = ok && sync_a.IsSynchronized() && sync_b.IsSynchronized() &&
+        standalone == 0 &&
+        parser_a.GetUpdateCount() == piggy_b.GetAttachmentCount() &&
+        piggy_a.GetAttachmentCount() > 0 &&
+        piggy_a.GetAttachmentCount() * kMinDeltaAttachmentBytes <= budgetBytes &&
+        abs_int64(sync_a.GetSignedRemoteTimeDeltaUsec() - (int64_t)clock_delta) <= 16;
+
+    // Without data, a due value is sent standalone after the deadline
+    const uint64_t deadlineUsec = piggy_a.GetStandaloneDeadlineUsec(globalUsec);
+    ok = ok && deadlineUsec > globalUsec &&
+        !piggy_a.NeedsStandaloneUpdate(deadlineUsec - 1) &&
+        piggy_a.NeedsStandaloneUpdate(deadlineUsec) &&
+        piggy_a.WriteStandaloneUpdate(deadlineUsec, packet) == kMinDeltaAttachmentBytes &&
+        HibernatedTimeSync::Read24(packet) == sync_a.GetMinDeltaTS24().ToUnsigned() &&
+        !piggy_a.NeedsStandaloneUpdate(deadlineUsec) &&
+        piggy_a.GetStandaloneCount() == 1;
+
+    // No room in the packet: Not attached
+    ok = ok && piggy_a.OnDataPacket(deadlineUsec + 10000000, packet, 2) == 0;
+
+    if (!ok)
+    {
+        cout << "Failed: Piggybacking" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    cout << "Success!" << endl;
+
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+// MinDelta Codec Test
+
+/// Exposes the last MinDelta value the peer provided
+class PeerMinDeltaProbe : public TimeSynchronizer
+{
+public:
+    inline uint32_t GetLastPeerMinDeltaTS24() const
+    {
+        return (uint32_t)(LastFC_MinDeltaTS37.ToUnsigned() >> kDeltaFracBits);
+    }
+};
+
+/// Lossy channel that reorders messages among the oldest few in flight
+struct LossyChannel
+{
+    struct Message
+    {
+        uint8_t Data[kMinDeltaUpdateMaxBytes];
+        unsigned Bytes;
+        uint32_t Value; ///< Value the message encodes
+    };
+
+    std::vector<Message> InFlight;
+
+    void Send(PCGRandom& prng, const uint8_t* data, unsigned bytes, uint32_t value = 0)
+    {
+        if (prng.Next() % 100 < 20) {
+            return; // Lost
+        }
+        Message message;
+        memcpy(message.Data, data, bytes);
+        message.Bytes = bytes;
+        message.Value = value;
+        InFlight.push_back(message);
+    }
+
+    /// Deliver a random in-flight message.  Returns false if none
+    bool Receive(PCGRandom& prng, Message& message)
+    {
+        if (InFlight.empty()) {
+            return false;
+        }
+        const size_t window = InFlight.size() < 4 ? InFlight.size() : 4;
+        const size_t i = prng.Next() % window;
+        message = InFlight[i];
+        InFlight.erase(InFlight.begin() + i);
+        return true;
+    }
+};
+
+bool TestMinDeltaCodec()
+{
+    cout << "TestMinDeltaCodec...";
+
+    PCGRandom prng;
+    prng.Seed(71);
+
+    MinDeltaEncoder encoder;
+    encoder.SetFullRefreshUsec(10000000);
+    MinDeltaDecoder decoder;
+    PeerMinDeltaProbe sync;
+    LossyChannel updates, acks;
+
+    // Deltas cannot be decoded before a base was received
+    uint8_t message[kMinDeltaUpdateMaxBytes] = { 0x05 };
+    bool ok = decoder.Decode(sync, message, 1) == 0 &&
+        !encoder.OnAck(0x05);
+
+    // Slowly wandering value with occasional jumps.  Every message must
+    // decode to the value it was sent with, and the byte cost should
+    // approach 1 byte
+    uint32_t value = 0xfffff0; // Wraps around during the test
+    uint64_t localUsec = 1000000;
+    uint64_t totalBytes = 0;
+    unsigned updates_sent = 0, corrupted = 0;
+
+    for (unsigned i = 0; i < 20000; ++i)
+    {
+        if (i % 1000 == 999) {
+            value += 200;
+        }
+        else {
+            value += (prng.Next() % 5) - 2;
+        }
+        value &= 0xffffff;
+
+        const unsigned bytes = encoder.Encode(value, localUsec, message);
+        totalBytes += bytes;
+        ++updates_sent;
+        updates.Send(prng, message, bytes, value);
+
+        // Deliver about one message per update, out of order
+        LossyChannel::Message received;
+        while (prng.Next() % 4 != 0 && updates.Receive(prng, received))
+        {
+            if (decoder.Decode(sync, received.Data, received.Bytes) != 0 &&
+                sync.GetLastPeerMinDeltaTS24() != received.Value)
+            {
+                ++corrupted;
+            }
+            if (decoder.HasAck())
+            {
+                const uint8_t ack = decoder.WriteAck();
+                acks.Send(prng, &ack, kMinDeltaAckBytes);
+            }
+        }
+        while (prng.Next() % 4 != 0 && acks.Receive(prng, received)) {
+            encoder.OnAck(received.Data[0]);
+        }
+
+        localUsec += 100000;
+    }
+
+    // Once the channel drains, the latest value gets through
+    updates.InFlight.clear();
+    LossyChannel::Message received;
+    while (acks.Receive(prng, received)) {
+        encoder.OnAck(received.Data[0]);
+    }
+    for (unsigned i = 0; i < 3; ++i)
+    {
+        const unsigned bytes = encoder.Encode(value, localUsec, message);
+        decoder.Decode(sync, message, bytes);
+        if (decoder.HasAck()) {
+            encoder.OnAck(decoder.WriteAck());
+        }
+    }
+
+    const double bytesPerUpdate = (double)totalBytes / updates_sent;
+    ok = ok && corrupted == 0 &&
+        sync.GetLastPeerMinDeltaTS24() == value &&
+        bytesPerUpdate < 1.5 &&
+        encoder.GetDeltaCount() > encoder.GetFullCount();
+
+    if (!ok)
+    {
+        cout << "Failed: " << corrupted << " corrupted, " << bytesPerUpdate << " bytes/update" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    cout << "(" << bytesPerUpdate << " bytes/update) Success!" << endl;
+
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+// Timestamp MAC Test
+
+// Exposes the replay state of a TimestampAuthenticator
+class TimestampMacProbe : public TimestampAuthenticator
+{
+public:
+    TimestampMacProbe(const uint8_t key[kTimestampMacKeyBytes], uint32_t localId, uint32_t peerId)
+        : TimestampAuthenticator(key, localId, peerId)
+    {
+    }
+
+    void SetLargestSequence(uint64_t sequence)
+    {
+        LargestSequence = sequence;
+    }
+};
+
+bool TestTimestampMac()
+{
+    cout << "TestTimestampMac...";
+
+    // HalfSipHash-2-4 reference vectors: key 00..07, message 00..(n-1)
+    uint8_t key[kTimestampMacKeyBytes];
+    for (unsigned i = 0; i < kTimestampMacKeyBytes; ++i) {
+        key[i] = (uint8_t)i;
+    }
+    const uint32_t k0 = 0x03020100, k1 = 0x07060504;
+    const uint8_t message[1] = { 0 };
+    if (HalfSipHash24(k0, k1, message, 0) != 0x5b9f35a9 ||
+        HalfSipHash24(k0, k1, message, 1) != 0xb85a4727)
+    {
+        cout << "Failed: HalfSipHash test vectors" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    // Node 1 sends to node 2 under a key shared by both directions
+    TimestampAuthenticator mac(key, 1, 2);
+    TimestampAuthenticator peer(key, 2, 1);
+
+    // Every single bit flip is detected, then the record round trips once
+    uint8_t stamped[kStampedTimestampAndMinDeltaBytes];
+    Counter24 ts, minDelta;
+    bool ok = mac.StampTimestampAndMinDelta(123456789, 0xabcdef, stamped) == kStampedTimestampAndMinDeltaBytes;
+    for (unsigned bit = 0; bit < kStampedTimestampAndMinDeltaBytes * 8; ++bit)
+    {
+        stamped[bit / 8] ^= (uint8_t)(1 << (bit % 8));
+        ok = ok && !peer.VerifyTimestampAndMinDelta(stamped, ts, minDelta);
+        stamped[bit / 8] ^= (uint8_t)(1 << (bit % 8));
+    }
+    ok = ok && peer.VerifyTimestampAndMinDelta(stamped, ts, minDelta) &&
+        ts == TimeSynchronizer::LocalTimeToDatagramTS24(123456789) &&
+        minDelta == 0xabcdef && peer.GetLargestSequence() == 1;
+
+    // A different key does not verify, nor does a record reflected back to
+    // its sender
+    uint8_t otherKey[kTimestampMacKeyBytes] = { 1 };
+    TimestampAuthenticator otherMac(otherKey, 1, 2);
+    TimestampAuthenticator otherPeer(otherKey, 2, 1);
+    TimestampAuthenticator reflected(key, 1, 2);
+    ok = ok && mac.StampTimestamp(987654321, stamped) == kStampedTimestampBytes &&
+        !otherPeer.VerifyTimestamp(stamped, ts) &&
+        !reflected.VerifyTimestamp(stamped, ts) &&
+        peer.VerifyTimestamp(stamped, ts);
+
+    if (!ok)
+    {
+        cout << "Failed: Stamp/verify" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    // Batch verification matches one-at-a-time verification
+    static const unsigned kBatch = 77;
+    PCGRandom prng;
+    prng.Seed(72);
+    for (unsigned fieldBytes = kTimestampFieldBytes; fieldBytes <= kTimestampAndMinDeltaFieldBytes; fieldBytes += 3)
+    {
+        TimestampAuthenticator sender(key, 1, 2);
+        TimestampAuthenticator batchReceiver(key, 2, 1);
+        TimestampAuthenticator singleReceiver(key, 2, 1);
+
+        uint8_t storage[kBatch][kStampedTimestampAndMinDeltaBytes];
+        const uint8_t* records[kBatch];
+        bool valid[kBatch];
+        unsigned expected = 0;
+
+        for (unsigned i = 0; i < kBatch; ++i)
+        {
+            if (fieldBytes == kTimestampFieldBytes) {
+                sender.StampTimestamp(prng.Next(), storage[i]);
+            }
+            else {
+                sender.StampTimestampAndMinDelta(prng.Next(), prng.Next(), storage[i]);
+            }
+            if (i % 5 == 2) {
+                storage[i][prng.Next() % (fieldBytes + kTimestampTagBytes)] ^= 0x10;
+            }
+            else {
+                ++expected;
+            }
+            records[i] = storage[i];
+        }
+
+        if (batchReceiver.VerifyBatch(records, kBatch, fieldBytes, valid) != expected)
+        {
+            cout << "Failed: VerifyBatch count" << endl;
+            TIMESYNC_DEBUG_BREAK();
+            return false;
+        }
+        for (unsigned i = 0; i < kBatch; ++i)
+        {
+            const bool single = fieldBytes == kTimestampFieldBytes ?
+                singleReceiver.VerifyTimestamp(records[i], ts) :
+                singleReceiver.VerifyTimestampAndMinDelta(records[i], ts, minDelta);
+            if (valid[i] != single || valid[i] != (i % 5 != 2))
+            {
+                cout << "Failed: VerifyBatch record " << i << endl;
+                TIMESYNC_DEBUG_BREAK();
+                return false;
+            }
+        }
+
+        // The whole batch again is a replay
+        if (batchReceiver.VerifyBatch(records, kBatch, fieldBytes, valid) != 0)
+        {
+            cout << "Failed: VerifyBatch replay" << endl;
+            TIMESYNC_DEBUG_BREAK();
+            return false;
+        }
+    }
+
+    // Forged timestamps claiming a fast path do not lower the minimum
+    TimeSynchronizer sync;
+    TimestampAuthenticator sender(key, 1, 2);
+    TimestampAuthenticator receiver(key, 2, 1);
+    uint8_t genuine[kStampedTimestampBytes], forged[kStampedTimestampBytes];
+    uint64_t localUsec = 1000000;
+    sender.StampTimestamp(localUsec, genuine);
+    otherMac.StampTimestamp(localUsec + 20000, forged);
+    const uint8_t* batch[2] = { genuine, forged };
+    uint64_t recvUsec[2] = { localUsec + 30000, localUsec + 30000 };
+    if (receiver.OnStampedBatch(sync, batch, recvUsec, 2) != 1 ||
+        sync.GetMinDeltaTS24() != Counter24(30000 / 8))
+    {
+        cout << "Failed: OnStampedBatch" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    // Neither do replays: TS24 wraps every 2^27 usec, so a record replayed
+    // 20 ms short of one wrap later would look 20 ms faster than the original
+    uint8_t later[kStampedTimestampBytes];
+    sender.StampTimestamp(localUsec + 1000000, later);
+    batch[0] = later;
+    recvUsec[0] = localUsec + 1030000;
+    ok = receiver.OnStampedBatch(sync, batch, recvUsec, 1) == 1;
+    batch[0] = genuine;
+    recvUsec[0] = localUsec + ((uint64_t)1 << 27) - 20000 + 30000;
+    ok = ok && receiver.OnStampedBatch(sync, batch, recvUsec, 1) == 0 &&
+        sync.GetMinDeltaTS24() == Counter24(30000 / 8);
+
+    // Replayed MinDelta values do not restore a stale peer minimum
+    uint8_t oldMinDelta[kStampedTimestampAndMinDeltaBytes], newMinDelta[kStampedTimestampAndMinDeltaBytes];
+    sender.StampTimestampAndMinDelta(localUsec, 1000, oldMinDelta);
+    sender.StampTimestampAndMinDelta(localUsec, 2000, newMinDelta);
+    ok = ok && receiver.VerifyTimestampAndMinDelta(oldMinDelta, ts, minDelta) &&
+        receiver.VerifyTimestampAndMinDelta(newMinDelta, ts, minDelta) &&
+        !receiver.VerifyTimestampAndMinDelta(oldMinDelta, ts, minDelta);
+
+    // Reordered genuine records are accepted once within the replay window,
+    // whether verified one at a time or in a batch
+    static const unsigned kReordered = kTimestampReplayWindow + 8;
+    uint8_t reordered[kReordered][kStampedTimestampBytes];
+    const uint8_t* reorderedRecords[kReordered];
+    bool reorderedValid[kReordered];
+    TimestampAuthenticator reorderSender(key, 1, 2);
+    TimestampAuthenticator reorderSingle(key, 2, 1);
+    TimestampAuthenticator reorderBatch(key, 2, 1);
+    for (unsigned i = 0; i < kReordered; ++i) {
+        reorderSender.StampTimestamp(localUsec + i * 100, reordered[i]);
+    }
+    // Arrival order: 1 0 3 2 5 4 ... 69 68 71, where record 2 arrives twice
+    // in place of record 4, and record 70 is still in flight
+    const unsigned arrivalCount = kReordered - 1;
+    for (unsigned i = 0; i < arrivalCount; ++i) {
+        reorderedRecords[i] = reordered[i ^ 1];
+    }
+    reorderedRecords[arrivalCount - 1] = reordered[kReordered - 1];
+    reorderedRecords[5] = reordered[2];
+    ok = ok && reorderBatch.VerifyBatch(reorderedRecords, arrivalCount, kTimestampFieldBytes, reorderedValid) == arrivalCount - 1;
+    for (unsigned i = 0; i < arrivalCount; ++i)
+    {
+        const bool single = reorderSingle.VerifyTimestamp(reorderedRecords[i], ts);
+        ok = ok && single == reorderedValid[i] && single == (i != 5);
+    }
+    // Record 4 is now older than the window, and record 70 is accepted once
+    ok = ok && !reorderSingle.VerifyTimestamp(reordered[4], ts) &&
+        reorderSingle.VerifyTimestamp(reordered[kReordered - 2], ts) &&
+        !reorderSingle.VerifyTimestamp(reordered[kReordered - 2], ts);
+    {
+        TimestampAuthenticator lateReceiver(key, 2, 1);
+        ok = ok && lateReceiver.VerifyTimestamp(reordered[kReordered - 1], ts) &&
+            !lateReceiver.VerifyTimestamp(reordered[kReordered - 1 - kTimestampReplayWindow], ts) &&
+            lateReceiver.VerifyTimestamp(reordered[kReordered - kTimestampReplayWindow], ts) &&
+            !lateReceiver.VerifyTimestamp(reordered[kReordered - kTimestampReplayWindow], ts);
+    }
+
+    // A record replayed 2^32 records later expands to a new sequence number
+    // but does not verify, because the tag covers all 64 bits
+    TimestampMacProbe probe(key, 2, 1);
+    uint8_t first[kStampedTimestampBytes];
+    TimestampAuthenticator wrapSender(key, 1, 2);
+    wrapSender.StampTimestamp(localUsec, first);
+    probe.SetLargestSequence(((uint64_t)1 << 32) - 5);
+    ok = ok && !probe.VerifyTimestamp(first, ts) &&
+        probe.GetLargestSequence() == ((uint64_t)1 << 32) - 5;
+
+    if (!ok)
+    {
+        cout << "Failed: Replay accepted" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    cout << "Success!" << endl;
+
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+// Same Host Test
+
+bool TestSameHost()
+{
+    cout << "TestSameHost...";
+
+    // Same clock domain mode converts with no offset and measures OWD directly
+    TimeSynchronizer sync;
+    sync.SetSameClockDomain(true);
+
+    bool ok = sync.IsSameClockDomain() && sync.IsSynchronized() &&
+        sync.GetSignedRemoteTimeDeltaNsec() == 0;
+
+    for (uint64_t localUsec = 1000000; localUsec < 200000000; localUsec += 999983)
+    {
+        const uint32_t remoteTS23 = sync.ToRemoteTime23(localUsec);
+        if (remoteTS23 != (uint32_t)((localUsec >> kTime23LostBits) & 0x7fffff) ||
+            sync.FromRemoteTime23(localUsec + 1000, remoteTS23) != (localUsec & ~(uint64_t)7))
+        {
+            ok = false;
+        }
+    }
+
+    const uint64_t sendNsec = 8000000;
+    const Counter24 sendTS24 = TimeSynchronizer::LocalTimeToDatagramTS24(sendNsec / 1000);
+    uint64_t owdNsec = sync.OnAuthenticatedDatagramTimestampNs(sendTS24, sendNsec + 12345);
+    ok = ok && owdNsec >= 12343 && owdNsec <= 12345 &&
+        sync.GetMinimumOneWayDelayNsec() == owdNsec;
+
+    // The peer's min delta reports do not move the offset
+    sync.OnPeerMinDeltaTS24(1000);
+    owdNsec = sync.OnSameHostDatagramNs(sendNsec, sendNsec + 5000);
+    ok = ok && owdNsec == 5000 && sync.GetMinimumOneWayDelayNsec() == 5000 &&
+        sync.GetSignedRemoteTimeDeltaNsec() == 0 && sync.GetSmoothedRTTUsec() != 0;
+
+    sync.SetSameClockDomain(false);
+    ok = ok && !sync.IsSameClockDomain() && !sync.IsSynchronized() &&
+        sync.OnSameHostDatagramNs(sendNsec, sendNsec + 5000) == 0;
+
+    // Only one side switches: The other still synchronizes from the
+    // MinDeltaTS24 values the switched side keeps reporting
+    TimeSynchronizer switched, unswitched;
+    switched.SetSameClockDomain(true);
+    PCGRandom prng;
+    prng.Seed(73);
+    uint64_t globalUsec = 1000000;
+    simulate_link(switched, unswitched, prng, globalUsec, 0, 50, 100);
+    int64_t signedDelta = unswitched.GetSignedRemoteTimeDeltaUsec();
+    ok = ok && switched.HasMinDelta() && unswitched.IsSynchronized() &&
+        signedDelta > -(int64_t)kTime23ErrorBound * 2 && signedDelta < (int64_t)kTime23ErrorBound * 2 &&
+        switched.GetSignedRemoteTimeDeltaNsec() == 0;
+
+    if (!ok)
+    {
+        cout << "Failed: Same clock domain mode" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+#ifdef __linux__
+    ClockDomainBeacon beacon;
+    if (!beacon.Open())
+    {
+        cout << "Failed: Beacon open" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    uint8_t handshake[kClockDomainTokenBytes];
+    beacon.GetToken().Write(handshake);
+    ClockDomainToken token;
+    ok = token.Read(handshake) && CheckSameClockDomain(token);
+
+    // Another process on this host shares the clock
+    const pid_t child = fork();
+    if (child == 0) {
+        _exit(CheckSameClockDomain(token) ? 0 : 1);
+    }
+    int status = -1;
+    ok = ok && child > 0 && waitpid(child, &status, 0) == child &&
+        WIFEXITED(status) && WEXITSTATUS(status) == 0;
+
+    // Another boot or an unknown beacon does not
+    ClockDomainToken otherBoot = token;
+    otherBoot.BootId[5] ^= 1;
+    ClockDomainToken otherBeacon = token;
+    otherBeacon.Nonce[3] ^= 1;
+    ok = ok && !CheckSameClockDomain(otherBoot) && !CheckSameClockDomain(otherBeacon);
+
+    if (!ok)
+    {
+        cout << "Failed: Clock domain check" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    // A peer in a time namespace sees a different CLOCK_MONOTONIC
+    char name[32];
+    ClockDomainBeacon::GetBeaconName(token, name);
+    const int fd = shm_open(name, O_RDWR, 0);
+    void* mapped = fd < 0 ? MAP_FAILED :
+        mmap(nullptr, sizeof(ClockDomainBeaconPage), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (mapped == MAP_FAILED)
+    {
+        cout << "Failed: Beacon map" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+    ClockDomainBeaconPage* page = static_cast<ClockDomainBeaconPage*>(mapped);
+    page->MonotonicNsec -= 10ULL * 1000000000ULL;
+    ok = !CheckSameClockDomain(token);
+    page->MonotonicNsec += 10ULL * 1000000000ULL;
+    ok = ok && CheckSameClockDomain(token);
+    munmap(mapped, sizeof(ClockDomainBeaconPage));
+
+    // The beacon goes away on Close()
+    beacon.Close();
+    ok = ok && !CheckSameClockDomain(token);
+
+    if (!ok)
+    {
+        cout << "Failed: Time namespace check" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+#endif // __linux__
+
+    cout << "Success!" << endl;
+
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+// C API Test
+
+bool TestCApi()
+{
+    cout << "TestCApi...";
+
+    timesync_sync_t* sync = timesync_create();
+    if (!sync || timesync_c_version() != TIMESYNC_C_VERSION || timesync_is_synchronized(sync))
+    {
+        cout << "Failed: Create" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    // Batches give the same results as the C++ calls one at a time
+    TimeSynchronizer reference;
+    PCGRandom prng;
+    prng.Seed(74);
+
+    static const unsigned kCount = 1000;
+    static const uint64_t kClockDelta = 1234567;
+    std::vector<uint64_t> sendUsec(kCount), recvUsec(kCount), recvNsec(kCount);
+    std::vector<uint32_t> sendTS24(kCount), owdUsec(kCount), expectedOwdUsec(kCount);
+    std::vector<uint64_t> owdNsec(kCount);
+
+    uint64_t localUsec = 1000000;
+    for (unsigned i = 0; i < kCount; ++i)
+    {
+        localUsec += 1000 + prng.Next() % 1000;
+        sendUsec[i] = localUsec + kClockDelta;
+        recvUsec[i] = localUsec + 500 + prng.Next() % 300;
+        recvNsec[i] = recvUsec[i] * 1000 + prng.Next() % 1000;
+    }
+    timesync_to_datagram_ts24(sendUsec.data(), sendTS24.data(), kCount);
+
+    const uint32_t peerMinDeltaTS24 = (uint32_t)(((uint64_t)0 - kClockDelta + 500) / 8) & 0xffffff;
+    timesync_on_peer_min_delta_ts24(sync, peerMinDeltaTS24);
+    reference.OnPeerMinDeltaTS24(peerMinDeltaTS24);
+
+    timesync_ingest_ts24(sync, sendTS24.data(), recvUsec.data(), owdUsec.data(), kCount);
+    for (unsigned i = 0; i < kCount; ++i) {
+        expectedOwdUsec[i] = reference.OnAuthenticatedDatagramTimestamp(sendTS24[i], recvUsec[i]);
+    }
+
+    bool ok = owdUsec == expectedOwdUsec &&
+        timesync_is_synchronized(sync) == 1 &&
+        timesync_get_remote_delta_usec(sync) == reference.GetSignedRemoteTimeDeltaUsec() &&
+        timesync_get_min_owd_usec(sync) == reference.GetMinimumOneWayDelayUsec() &&
+        timesync_get_min_delta_ts24(sync) == reference.GetMinDeltaTS24().ToUnsigned();
+
+    // Nanosecond ingest with optional outputs omitted
+    timesync_sync_t* syncNs = timesync_create();
+    TimeSynchronizer referenceNs;
+    timesync_on_peer_min_delta_ts24(syncNs, peerMinDeltaTS24);
+    referenceNs.OnPeerMinDeltaTS24(peerMinDeltaTS24);
+    timesync_ingest_ts24_ns(syncNs, sendTS24.data(), recvNsec.data(), nullptr, kCount / 2);
+    timesync_ingest_ts24_ns(syncNs, sendTS24.data() + kCount / 2, recvNsec.data() + kCount / 2,
+        owdNsec.data(), kCount - kCount / 2);
+    for (unsigned i = 0; i < kCount; ++i)
+    {
+        const uint64_t expected = referenceNs.OnAuthenticatedDatagramTimestampNs(sendTS24[i], recvNsec[i]);
+        if (i >= kCount / 2 && owdNsec[i - kCount / 2] != expected) {
+            ok = false;
+        }
+    }
+    ok = ok && timesync_get_remote_delta_usec(syncNs) == referenceNs.GetSignedRemoteTimeDeltaUsec();
+    timesync_destroy(syncNs);
+
+    if (!ok)
+    {
+        cout << "Failed: Batch ingest" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    std::vector<uint32_t> remoteTS23(kCount), localTS23(kCount);
+    std::vector<uint64_t> fromRemote(kCount), fromLocal(kCount);
+    timesync_to_remote_ts23(sync, recvUsec.data(), remoteTS23.data(), kCount);
+    timesync_from_remote_ts23(sync, recvUsec.data(), remoteTS23.data(), fromRemote.data(), kCount);
+    for (unsigned i = 0; i < kCount; ++i) {
+        localTS23[i] = (uint32_t)(sendUsec[i] - kClockDelta) >> kTime23LostBits & 0x7fffff;
+    }
+    timesync_from_local_ts23(recvUsec.data(), localTS23.data(), fromLocal.data(), kCount);
+
+    for (unsigned i = 0; i < kCount; ++i)
+    {
+        if (remoteTS23[i] != reference.ToRemoteTime23(recvUsec[i]) ||
+            fromRemote[i] != reference.FromRemoteTime23(recvUsec[i], remoteTS23[i]) ||
+            fromLocal[i] != reference.FromLocalTime23(recvUsec[i], localTS23[i]))
+        {
+            ok = false;
+        }
+    }
+
+    if (!ok)
+    {
+        cout << "Failed: Batch conversions" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    // Counters expand across many wraps, forwards and backwards
+    std::vector<uint64_t> values(kCount), expanded(kCount);
+    std::vector<uint32_t> truncated(kCount);
+    const unsigned kWidths[3] = { 8, 24, 32 };
+    for (unsigned w = 0; w < 3; ++w)
+    {
+        const unsigned bits = kWidths[w];
+        const uint64_t mask = ((uint64_t)1 << bits) - 1;
+        const uint64_t maxStep = ((uint64_t)1 << (bits - 1)) - 1;
+        uint64_t value = (uint64_t)1 << 40;
+        for (unsigned i = 0; i < kCount; ++i)
+        {
+            const uint64_t step = ((uint64_t)prng.Next() << 32 | prng.Next()) % maxStep;
+            value = (i / 100) % 2 == 0 ? value + step : value - step;
+            values[i] = value;
+            truncated[i] = (uint32_t)(value & mask);
+        }
+        const uint64_t recent = ((uint64_t)1 << 40) + 3;
+        if (timesync_expand_counters(bits, recent, truncated.data(), expanded.data(), kCount) != kCount ||
+            expanded != values)
+        {
+            ok = false;
+        }
+    }
+    ok = ok && timesync_expand_counters(0, 0, truncated.data(), expanded.data(), kCount) == 0 &&
+        timesync_expand_counters(33, 0, truncated.data(), expanded.data(), kCount) == 0;
+
+    timesync_destroy(sync);
+    timesync_destroy(nullptr);
+
+    if (!ok)
+    {
+        cout << "Failed: Expand counters" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    cout << "Success!" << endl;
+
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+// Event Queue Test
+
+// Pop all events and count them by type.  Returns false on a wrong peer id
+static bool drain_events(
+    TimeSyncEventQueue& queue,
+    uint32_t peerId,
+    unsigned counts[kEventWindowReset + 1],
+    TimeSyncEvent& last)
+{
+    for (unsigned i = 0; i <= kEventWindowReset; ++i) {
+        counts[i] = 0;
+    }
+
+    bool ok = true;
+    TimeSyncEvent event;
+    while (queue.Pop(event))
+    {
+        ok = ok && event.PeerId == peerId;
+        ++counts[event.Type];
+        last = event;
+    }
+    return ok;
+}
+
+bool TestEventQueue()
+{
+    cout << "TestEventQueue...";
+
+    // Bounded FIFO that drops when full
+    TimeSyncEventQueue small(5);
+    TimeSyncEvent event = TimeSyncEvent();
+    bool ok = small.GetCapacity() == 8 && !small.Pop(event);
+    for (unsigned lap = 0; lap < 100; ++lap)
+    {
+        for (unsigned i = 0; i < 9; ++i)
+        {
+            event.Value = lap * 100 + i;
+            ok = ok && small.Push(event) == (i < 8);
+        }
+        for (unsigned i = 0; i < 8; ++i) {
+            ok = ok && small.Pop(event) && event.Value == lap * 100 + i;
+        }
+        ok = ok && !small.Pop(event);
+    }
+    ok = ok && small.GetDroppedCount() == 100;
+
+    if (!ok)
+    {
+        cout << "Failed: Bounded FIFO" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    // Concurrent producers never lose, duplicate or reorder their events
+    static const unsigned kProducers = 4;
+    static const unsigned kEventsPerProducer = 100000;
+    TimeSyncEventQueue queue(256);
+    std::vector<std::thread> producers;
+    for (unsigned p = 0; p < kProducers; ++p)
+    {
+        producers.emplace_back([&queue, p]() {
+            TimeSyncEvent produced = TimeSyncEvent();
+            produced.PeerId = p;
+            for (unsigned i = 0; i < kEventsPerProducer; ++i)
+            {
+                produced.Value = i;
+                while (!queue.Push(produced)) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+
+    int64_t nextValue[kProducers] = {};
+    unsigned received = 0;
+    TimeSyncEvent batch[64];
+    while (received < kProducers * kEventsPerProducer)
+    {
+        const unsigned count = queue.PopBatch(batch, 64);
+        if (count == 0) {
+            std::this_thread::yield();
+        }
+        for (unsigned i = 0; i < count; ++i)
+        {
+            if (batch[i].PeerId >= kProducers ||
+                batch[i].Value != nextValue[batch[i].PeerId]++)
+            {
+                ok = false;
+            }
+        }
+        received += count;
+    }
+    for (std::thread& producer : producers) {
+        producer.join();
+    }
+
+    if (!ok || queue.Pop(event))
+    {
+        cout << "Failed: Concurrent producers" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    // Synchronizers report state changes
+    static const uint32_t kPeerId = 75;
+    const uint64_t clock_delta = 271828182;
+    const unsigned owdUsec = 10000;
+
+    PCGRandom prng;
+    prng.Seed(75);
+
+    TimeSynchronizer sync_a, sync_b;
+    TimeSyncEventQueue events;
+    sync_a.SetEventQueue(&events, kPeerId);
+
+    uint64_t globalUsec = 1000000;
+    simulate_link(sync_a, sync_b, prng, globalUsec, clock_delta, owdUsec, 200);
+
+    unsigned counts[kEventWindowReset + 1];
+    ok = drain_events(events, kPeerId, counts, event) &&
+        counts[kEventSynchronized] == 1 && counts[kEventSyncLost] == 0 &&
+        counts[kEventOWDSpike] == 0 && counts[kEventWindowReset] == 0;
+
+    if (!ok)
+    {
+        cout << "Failed: Synchronized event" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    // A burst of queuing is one spike, not one per datagram
+    simulate_link(sync_a, sync_b, prng, globalUsec, clock_delta, owdUsec * 4, 5);
+    simulate_link(sync_a, sync_b, prng, globalUsec, clock_delta, owdUsec, 20);
+    ok = drain_events(events, kPeerId, counts, event) &&
+        counts[kEventOWDSpike] == 1 && counts[kEventWindowReset] == 0 &&
+        counts[kEventStep] == 0;
+
+    // The peer's clock is stepped by 5 ms
+    const uint64_t stepUsec = globalUsec;
+    simulate_link(sync_a, sync_b, prng, globalUsec, clock_delta - 5000, owdUsec, 20);
+    ok = ok && drain_events(events, kPeerId, counts, event) &&
+        event.LocalUsec > stepUsec && event.LocalUsec <= globalUsec;
+    const unsigned stepCount = counts[kEventStep];
+
+    if (!ok || stepCount == 0)
+    {
+        cout << "Failed: Spike and step events " << stepCount << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    // Base delay rises and the window resets
+    simulate_link(sync_a, sync_b, prng, globalUsec, clock_delta - 5000, owdUsec * 3, 50);
+    ok = drain_events(events, kPeerId, counts, event) &&
+        counts[kEventWindowReset] == 1 && sync_a.GetRouteChangeCount() == 1;
+
+    // Reset by switching to same clock domain mode
+    sync_a.SetSameClockDomain(true);
+    ok = ok && drain_events(events, kPeerId, counts, event) &&
+        counts[kEventSyncLost] == 1 && counts[kEventSynchronized] == 1 &&
+        event.Type == kEventSynchronized && event.Value == 0;
+
+    // Removing the queue stops events
+    sync_a.SetEventQueue(nullptr, 0);
+    sync_a.SetSameClockDomain(false);
+    ok = ok && !events.Pop(event) && events.GetDroppedCount() == 0;
+
+    if (!ok)
+    {
+        cout << "Failed: Window reset and sync lost events" << endl;
+        TIMESYNC_DEBUG_BREAK();
+        return false;
+    }
+
+    cout << "Success!" << endl;
+
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+// Entrypoint
+
+int main()
+{
+    cout << "Unit tester for TimeSync.  Exits with -1 on failure, 0 on success" << endl;
+    cout << endl;
+
+    int result = TIMESYNC_RET_SUCCESS;
+
+    if (!TestSimpleUsage()) {
+        result = TIMESYNC_RET_FAIL;
+    }
+    if (!TestTwoRounds()) {
+        result = TIMESYNC_RET_FAIL;
+    }
+    if (!TestWindowedMinTS24()) {
+        result = TIMESYNC_RET_FAIL;
+    }
+    if (!TestHibernation()) {
+        result = TIMESYNC_RET_FAIL;
+    }
+    if (!TestTimerWheel()) {
+        result = TIMESYNC_RET_FAIL;
+    }
+    if (!TestAwaitSynchronized()) {
+        result = TIMESYNC_RET_FAIL;
+    }
+    if (!TestSyncTimer()) {
+        result = TIMESYNC_RET_FAIL;
+    }
+    if (!TestStartBarrier()) {
+        result = TIMESYNC_RET_FAIL;
+    }
+    if (!TestOffsetTimeline()) {
+        result = TIMESYNC_RET_FAIL;
+    }
+#ifdef TIMESYNC_LOGMERGE_PATH
+    if (!TestLogMerge()) {
+        result = TIMESYNC_RET_FAIL;
+    }
+#endif // TIMESYNC_LOGMERGE_PATH
+    if (!TestOWDFeedback()) {
+        result = TIMESYNC_RET_FAIL;
+    }
+    if (!TestDirectionalQueuing()) {
+        result = TIMESYNC_RET_FAIL;
+    }
+    if (!TestSmoothedRTT()) {
+        result = TIMESYNC_RET_FAIL;
+    }
+    if (!TestMultipath()) {
+        result = TIMESYNC_RET_FAIL;
+    }
+    if (!TestRouteChange()) {
+        result = TIMESYNC_RET_FAIL;
+    }
+    if (!TestPrecisionProfile32()) {
+        result = TIMESYNC_RET_FAIL;
+    }
+    if (!TestNanosecondPipeline()) {
+        result = TIMESYNC_RET_FAIL;
+    }
+    if (!TestExtendedRange()) {
+        result = TIMESYNC_RET_FAIL;
+    }
+    if (!TestFourTimestampExchange()) {
+        result = TIMESYNC_RET_FAIL;
+    }
+    if (!TestNtpServer()) {
+        result = TIMESYNC_RET_FAIL;
+    }
+    if (!TestShmRefclock()) {
+        result = TIMESYNC_RET_FAIL;
+    }
+    if (!TestRemoteClock()) {
+        result = TIMESYNC_RET_FAIL;
+    }
+    if (!TestSharedSyncState()) {
+        result = TIMESYNC_RET_FAIL;
+    }
+    if (!TestConversionCache()) {
+        result = TIMESYNC_RET_FAIL;
+    }
+    if (!TestMinDeltaPiggyback()) {
+        result = TIMESYNC_RET_FAIL;
+    }
+    if (!TestMinDeltaCodec()) {
+        result = TIMESYNC_RET_FAIL;
+    }
+    if (!TestTimestampMac()) {
+        result = TIMESYNC_RET_FAIL;
+    }
+    if (!TestSameHost()) {
+        result = TIMESYNC_RET_FAIL;
+    }
+    if (!TestCApi()) {
+        result = TIMESYNC_RET_FAIL;
+    }
+    if (!TestEventQueue()) {
         result = TIMESYNC_RET_FAIL;
     }
 
@@ -0,0 +1,442 @@
+/** \file
+    \brief TimeSync: Cross-Host Log Merge Tool
+    \copyright Copyright (c) 2017-2018 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of TimeSync nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+    Cross-Host Log Merge Tool
+
+    Usage: timesync_logmerge <host1.log> [host2.log ...] > merged.log
+
+    Each input file is a per-host log in the TimeSync log format described
+    in OffsetTimeline.h: Lines start with a local timestamp in decimal
+    microseconds, and periodic "#TIMESYNC <localUsec> <offsetUsec>" records
+    give the offset from that host's clock to the common reference clock.
+
+    The output contains every log line from all hosts in reference time
+    order, prefixed by the reference time and the input file index:
+
+        <referenceUsec> <fileIndex> <message>
+
+    Input files are memory-mapped so that tens of GB can be merged without
+    reading them into memory.  The first pass parses each file once, on up
+    to one thread per hardware thread: It collects the offset records and
+    indexes the timestamped lines, at 24 bytes per line.  The second pass
+    is a k-way merge over the indexes, which are each assumed to be in
+    local time order, and only touches the message bytes to copy them out.
+    Pages that have been consumed are released as each pass goes.
+*/
+
+#include <TimeSync/OffsetTimeline.h>
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <queue>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+//------------------------------------------------------------------------------
+// Constants
+
+/// Release consumed pages after this many bytes
+static const size_t kReleaseBytes = 64 * 1024 * 1024;
+
+/// Size of the output buffer
+static const size_t kOutputBufferBytes = 1024 * 1024;
+
+
+//------------------------------------------------------------------------------
+// InputFile
+
+class InputFile
+{
+public:
+    ~InputFile()
+    {
+        if (Data) {
+            munmap((void*)Data, Size);
+        }
+        if (Fd >= 0) {
+            close(Fd);
+        }
+    }
+
+    bool Open(const char* path)
+    {
+        Path = path;
+
+        Fd = open(path, O_RDONLY);
+        if (Fd < 0) {
+            return false;
+        }
+
+        struct stat st;
+        if (fstat(Fd, &st) != 0) {
+            return false;
+        }
+        Size = (size_t)st.st_size;
+        if (Size == 0) {
+            return true;
+        }
+
+        void* data = mmap(nullptr, Size, PROT_READ, MAP_PRIVATE, Fd, 0);
+        if (data == MAP_FAILED) {
+            return false;
+        }
+        Data = (const char*)data;
+
+        madvise(data, Size, MADV_SEQUENTIAL);
+        return true;
+    }
+
+    /// Pass 1: Collect offset records and index the timestamped lines
+    void Scan()
+    {
+        size_t offset = 0, released = 0;
+        const char* line = nullptr;
+        size_t length = 0;
+
+        while (NextLine(offset, line, length))
+        {
+            LineEntry entry;
+            const char* message = nullptr;
+            size_t messageLength = 0;
+
+            if (ParseTimestamp(line, length, entry.LocalUsec, message, messageLength))
+            {
+                entry.MessageOffset = (uint64_t)(message - Data);
+                entry.MessageLength = (uint64_t)messageLength;
+                Lines.push_back(entry);
+            }
+            else
+            {
+                int64_t offsetUsec = 0;
+                if (!OffsetTimeline::ParseOffsetRecord(line, length, entry.LocalUsec, offsetUsec)) {
+                    ++SkippedLines;
+                } else if (!Timeline.AddRecord(entry.LocalUsec, offsetUsec)) {
+                    ++RejectedRecords;
+                }
+            }
+
+            ReleaseConsumed(offset, released);
+        }
+    }
+
+    /**
+        Pass 2: Advance to the next indexed log line.
+        Returns false at the end of the file
+    */
+    bool Advance()
+    {
+        if (NextEntry >= Lines.size()) {
+            return false;
+        }
+
+        const LineEntry& entry = Lines[NextEntry++];
+        ReleaseConsumed((size_t)entry.MessageOffset, Released);
+
+        Message = Data + entry.MessageOffset;
+        MessageLength = (size_t)entry.MessageLength;
+        ReferenceUsec = Timeline.ToReferenceUsec(entry.LocalUsec);
+        return true;
+    }
+
+    /// Path of the file
+    const char* Path = nullptr;
+
+    /// Offset records for this host
+    OffsetTimeline Timeline;
+
+    /// Current line mapped to the reference clock
+    uint64_t ReferenceUsec = 0;
+
+    /// Current line message after the timestamp
+    const char* Message = nullptr;
+    size_t MessageLength = 0;
+
+    /// Number of lines without a timestamp
+    uint64_t SkippedLines = 0;
+
+    /// Number of offset records that wrapped around
+    uint64_t RejectedRecords = 0;
+
+protected:
+    int Fd = -1;
+    const char* Data = nullptr;
+    size_t Size = 0;
+
+    /// Timestamped line found in pass 1
+    struct LineEntry
+    {
+        uint64_t LocalUsec = 0;
+        uint64_t MessageOffset = 0;
+        uint64_t MessageLength = 0;
+    };
+
+    /// Timestamped lines in file order
+    std::vector<LineEntry> Lines;
+
+    /// Pass 2 state
+    size_t NextEntry = 0;
+    size_t Released = 0;
+
+
+    bool NextLine(size_t& offset, const char*& line, size_t& length) const
+    {
+        if (offset >= Size) {
+            return false;
+        }
+
+        line = Data + offset;
+        const char* newline = (const char*)memchr(line, '\n', Size - offset);
+        length = newline ? (size_t)(newline - line) : (Size - offset);
+        offset += length + 1;
+
+        // Strip carriage return
+        if (length > 0 && line[length - 1] == '\r') {
+            --length;
+        }
+        return true;
+    }
+
+    /// Release pages that were already consumed so RSS stays bounded
+    void ReleaseConsumed(size_t offset, size_t& released) const
+    {
+        if (offset - released < kReleaseBytes || offset > Size) {
+            return;
+        }
+
+        const size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+        const size_t end = (offset / pageSize) * pageSize;
+        if (end > released)
+        {
+            madvise((void*)(Data + released), end - released, MADV_DONTNEED);
+            released = end;
+        }
+    }
+
+    static bool ParseTimestamp(
+        const char* line,
+        size_t length,
+        uint64_t& localUsec,
+        const char*& message,
+        size_t& messageLength)
+    {
+        size_t i = 0;
+        localUsec = 0;
+        while (i < length && line[i] >= '0' && line[i] <= '9')
+        {
+            // Reject timestamps that do not fit
+            const uint64_t digit = (uint64_t)(line[i] - '0');
+            if (localUsec > (UINT64_MAX - digit) / 10) {
+                return false;
+            }
+            localUsec = localUsec * 10 + digit;
+            ++i;
+        }
+        if (i == 0) {
+            return false;
+        }
+
+        // Skip one separator
+        if (i < length && (line[i] == ' ' || line[i] == '\t')) {
+            ++i;
+        }
+
+        message = line + i;
+        messageLength = length - i;
+        return true;
+    }
+};
+
+
+//------------------------------------------------------------------------------
+// Output
+
+class OutputBuffer
+{
+public:
+    OutputBuffer()
+    {
+        Buffer.resize(kOutputBufferBytes);
+    }
+    ~OutputBuffer()
+    {
+        Flush();
+    }
+
+    void WriteLine(uint64_t referenceUsec, unsigned fileIndex, const char* message, size_t length)
+    {
+        // Leave room for the prefix and newline
+        if (Used + length + 48 > Buffer.size())
+        {
+            Flush();
+            if (length + 48 > Buffer.size()) {
+                Buffer.resize(length + 48);
+            }
+        }
+
+        Used += (size_t)snprintf(
+            Buffer.data() + Used,
+            Buffer.size() - Used,
+            "%llu %u ",
+            (unsigned long long)referenceUsec,
+            fileIndex);
+
+        memcpy(Buffer.data() + Used, message, length);
+        Used += length;
+        Buffer[Used++] = '\n';
+    }
+
+    void Flush()
+    {
+        if (Used > 0) {
+            fwrite(Buffer.data(), 1, Used, stdout);
+            Used = 0;
+        }
+    }
+
+protected:
+    std::vector<char> Buffer;
+    size_t Used = 0;
+};
+
+
+//------------------------------------------------------------------------------
+// Entrypoint
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: %s <host1.log> [host2.log ...] > merged.log\n", argv[0]);
+        return -1;
+    }
+
+    const unsigned fileCount = (unsigned)(argc - 1);
+    std::vector< std::unique_ptr<InputFile> > files(fileCount);
+
+    for (unsigned i = 0; i < fileCount; ++i)
+    {
+        files[i].reset(new InputFile);
+        if (!files[i]->Open(argv[i + 1]))
+        {
+            fprintf(stderr, "Failed to open %s\n", argv[i + 1]);
+            return -1;
+        }
+        fprintf(stderr, "%u: %s\n", i, argv[i + 1]);
+    }
+
+    // Pass 1: Scan the files in parallel, each worker taking the next
+    // unscanned file until none are left
+    {
+        unsigned threadCount = std::thread::hardware_concurrency();
+        if (threadCount == 0) {
+            threadCount = 1;
+        }
+        if (threadCount > fileCount) {
+            threadCount = fileCount;
+        }
+
+        std::atomic<unsigned> nextFile(0);
+        auto worker = [&]() {
+            for (;;)
+            {
+                const unsigned i = nextFile++;
+                if (i >= fileCount) {
+                    break;
+                }
+                files[i]->Scan();
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for (unsigned i = 1; i < threadCount; ++i) {
+            threads.emplace_back(worker);
+        }
+        worker();
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+    }
+
+    for (unsigned i = 0; i < fileCount; ++i) {
+        if (files[i]->Timeline.GetRecordCount() == 0) {
+            fprintf(stderr, "Warning: %s has no offset records\n", files[i]->Path);
+        }
+        if (files[i]->RejectedRecords > 0) {
+            fprintf(stderr, "Warning: %s has %llu offset records that wrapped around\n",
+                files[i]->Path, (unsigned long long)files[i]->RejectedRecords);
+        }
+    }
+
+    // Pass 2: K-way merge by reference time
+    typedef std::pair<uint64_t, unsigned> HeapEntry; // (reference time, file index)
+    std::priority_queue<HeapEntry, std::vector<HeapEntry>, std::greater<HeapEntry> > heap;
+
+    for (unsigned i = 0; i < fileCount; ++i) {
+        if (files[i]->Advance()) {
+            heap.push(HeapEntry(files[i]->ReferenceUsec, i));
+        }
+    }
+
+    OutputBuffer output;
+    uint64_t lineCount = 0;
+
+    while (!heap.empty())
+    {
+        const unsigned i = heap.top().second;
+        heap.pop();
+
+        InputFile* file = files[i].get();
+        output.WriteLine(file->ReferenceUsec, i, file->Message, file->MessageLength);
+        ++lineCount;
+
+        if (file->Advance()) {
+            heap.push(HeapEntry(file->ReferenceUsec, i));
+        }
+    }
+
+    output.Flush();
+
+    uint64_t skipped = 0;
+    for (unsigned i = 0; i < fileCount; ++i) {
+        skipped += files[i]->SkippedLines;
+    }
+    fprintf(stderr, "Merged %llu lines (%llu lines without timestamps skipped)\n",
+        (unsigned long long)lineCount, (unsigned long long)skipped);
+
+    return 0;
+}